@@ -0,0 +1,156 @@
+#ifndef __itkBoxMinimumImageFilter_h
+#define __itkBoxMinimumImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkImage.h"
+#include "itkMultiThreader.h"
+
+#include <vector>
+
+namespace itk
+{
+/**
+* \class BoxMinimumImageFilter
+* \brief The minimum over a box neighbourhood of every pixel, a grayscale
+* erosion by a box, in a fixed number of comparisons per pixel
+*
+* Every output pixel is the minimum of the input over the box of half
+* widths Radius centred on it. Neighbours outside the input buffer are left
+* out, which gives the same minimum as the zero flux boundary of
+* MinimumImageFunction, so both agree everywhere for the same radius.
+*
+* The box minimum is separable, so the image is filtered one axis at a
+* time. Along a line the running minimum of van Herk [1] and Gil and
+* Werman [2] splits the line into segments of the window width 2r+1 and
+* accumulates the minimum forward and backward within each segment. Any
+* window then covers the end of one segment and the start of the next, so
+* its minimum is the smaller of one backward and one forward value. This
+* costs about three comparisons per pixel and axis whatever the radius,
+* where MinimumImageFunction visits (2r+1)^D neighbours for every pixel.
+*
+* Each pass is multithreaded over the lines of its axis, visited a block of
+* neighbouring lines at a time as in DomainTransformImageFilter. The input
+* requested region is the output one padded by the radius.
+*
+* This is a standalone filter for pipelines that need the minimum image
+* itself or large radii. The MSDE of HighDynamicRangeImageFilter does not
+* use it: its 3x3x3 minimum is taken row by row inside its fused weight
+* kernel, so that no minimum image is stored.
+*
+* [1] Marcel van Herk, A fast algorithm for local minimum and maximum
+*     filters on rectangular and octagonal kernels, Pattern Recognition
+*     Letters, 13(7), 1992
+* [2] Joseph Gil and Michael Werman, Computing 2-D min, median, and max
+*     filters, IEEE Transactions on Pattern Analysis and Machine
+*     Intelligence, 15(5), 1993
+*
+* \sa MinimumImageFunction
+* \sa GrayscaleErodeImageFilter
+*
+* \ingroup ImageEnhancement
+*/
+template <class TInputImage, class TOutputImage >
+class ITK_EXPORT BoxMinimumImageFilter :
+    public ImageToImageFilter< TInputImage, TOutputImage >
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef BoxMinimumImageFilter                             Self;
+  typedef ImageToImageFilter< TInputImage, TOutputImage >   Superclass;
+  typedef SmartPointer<Self>                                Pointer;
+  typedef SmartPointer<const Self>                          ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(BoxMinimumImageFilter, ImageToImageFilter);
+
+  /** Dimensionality of the input image. Dimensionality of the output image
+   *  is assumed to be the same. */
+  itkStaticConstMacro(
+    ImageDimension, unsigned int, TInputImage::ImageDimension);
+
+  /** Image typedefs. */
+  typedef TInputImage                                   InputImageType;
+  typedef typename TInputImage::PixelType               InputPixelType;
+  typedef typename TInputImage::SizeType                InputImageSizeType;
+  typedef TOutputImage                                  OutputImageType;
+  typedef typename TOutputImage::PixelType              OutputPixelType;
+  typedef typename TOutputImage::RegionType             OutputImageRegionType;
+
+  /** Set/Get the half widths of the box in pixels. Default is 1 along every
+   *  axis, the 3x3x3 neighbourhood of MinimumImageFunction. */
+  itkSetMacro(Radius, InputImageSizeType);
+  itkGetConstReferenceMacro(Radius, InputImageSizeType);
+
+  /** Set the same half width along every axis. */
+  void SetRadius(SizeValueType radius)
+    {
+    InputImageSizeType size;
+    size.Fill(radius);
+    this->SetRadius(size);
+    }
+
+protected:
+
+  BoxMinimumImageFilter()
+    {
+    m_Radius.Fill(1);
+    }
+
+  virtual ~BoxMinimumImageFilter() {}
+
+  /** The input requested region is the output one padded by the radius. */
+  virtual void GenerateInputRequestedRegion()
+    throw(InvalidRequestedRegionError);
+
+  /** Filter the input axis by axis into a working buffer, then write it to
+   *  the output. The passes are multithreaded internally. */
+  void GenerateData();
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+  /** Lines are filtered in blocks of up to this many neighbouring lines,
+   *  which are adjacent in memory for every axis but the first. */
+  itkStaticConstMacro(BlockLength, unsigned int, 64);
+
+  /** Data shared by the threads of one pass along one axis, laid out as in
+   *  DomainTransformImageFilter: lines of Length pixels separated by Stride,
+   *  in Outer groups of Stride lines. */
+  struct PassThreadStruct
+    {
+    Self                  *Filter;
+    InputPixelType        *Buffer;
+    SizeValueType         Length;
+    SizeValueType         Stride;
+    SizeValueType         Outer;
+    SizeValueType         Radius;
+    };
+
+  /** Replace the lines of the thread's blocks by their running minimum. */
+  void ThreadedPass(PassThreadStruct *str, ThreadIdType threadId,
+                    ThreadIdType numberOfThreads);
+
+  /** Static function used to dispatch a pass to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE PassThreaderCallback(void *arg);
+
+private:
+
+  BoxMinimumImageFilter(const Self&);   // Not implemented on purpose
+
+  void operator=(const Self&);          // Not implemented on purpose
+
+  InputImageSizeType    m_Radius;
+
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkBoxMinimumImageFilter.txx"
+#endif
+
+#endif // End #ifndef __itkBoxMinimumImageFilter_h
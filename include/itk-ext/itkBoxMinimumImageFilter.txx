@@ -0,0 +1,240 @@
+#ifndef __itkBoxMinimumImageFilter_txx
+#define __itkBoxMinimumImageFilter_txx
+
+#include "itkBoxMinimumImageFilter.h"
+
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageAlgorithm.h"
+
+#include <algorithm>
+
+namespace itk
+{
+
+template <class TInputImage, class TOutputImage>
+void
+BoxMinimumImageFilter<TInputImage,TOutputImage>
+::GenerateInputRequestedRegion() throw(InvalidRequestedRegionError)
+{
+  // call the superclass' implementation of this method. this should
+  // copy the output requested region to the input requested region
+  Superclass::GenerateInputRequestedRegion();
+
+  TInputImage *inputPtr = const_cast< TInputImage *>( this->GetInput() );
+  if ( !inputPtr )
+    {
+    return;
+    }
+
+  // pad the input requested region by the radius of the box and crop it at
+  // the input's largest possible region
+  typename TInputImage::RegionType inputRequestedRegion =
+    inputPtr->GetRequestedRegion();
+  inputRequestedRegion.PadByRadius( m_Radius );
+
+  if ( inputRequestedRegion.Crop(inputPtr->GetLargestPossibleRegion()) )
+    {
+    inputPtr->SetRequestedRegion( inputRequestedRegion );
+    return;
+    }
+  else
+    {
+    // Couldn't crop the region (requested region is outside the largest
+    // possible region).  Throw an exception.
+
+    // store what we tried to request (prior to trying to crop)
+    inputPtr->SetRequestedRegion( inputRequestedRegion );
+
+    // build an exception
+    InvalidRequestedRegionError e(__FILE__, __LINE__);
+    e.SetLocation(ITK_LOCATION);
+    e.SetDescription
+      ("Requested region is outside the largest possible region.");
+    e.SetDataObject(inputPtr);
+    throw e;
+    }
+}
+
+template <class TInputImage, class TOutputImage>
+void
+BoxMinimumImageFilter<TInputImage, TOutputImage>
+::GenerateData()
+{
+  const InputImageType *input = this->GetInput();
+  this->AllocateOutputs();
+  OutputImageType *output = this->GetOutput();
+  const OutputImageRegionType outputRegion = output->GetRequestedRegion();
+  const typename InputImageType::RegionType region = input->GetBufferedRegion();
+
+  if ( !region.IsInside(outputRegion) )
+    {
+    itkExceptionMacro(<< "The input must be buffered over the output region");
+    }
+
+  // The passes run in place on a copy of the buffered input, so that the
+  // minimum near the output boundary still sees the padding of the region
+  typename InputImageType::Pointer buffer = InputImageType::New();
+  buffer->CopyInformation(input);
+  buffer->SetRegions(region);
+  buffer->Allocate();
+  ImageAlgorithm::Copy(input, buffer.GetPointer(), region, region);
+
+  PassThreadStruct str;
+  str.Filter = this;
+  str.Buffer = buffer->GetBufferPointer();
+
+  this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+  this->GetMultiThreader()->SetSingleMethod(this->PassThreaderCallback, &str);
+  SizeValueType stride = 1;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    str.Length = region.GetSize(i);
+    str.Stride = stride;
+    str.Outer = region.GetNumberOfPixels()/(str.Length*stride);
+    stride *= str.Length;
+
+    // Beyond the length of the line every window covers the whole line
+    str.Radius = std::min(m_Radius[i], str.Length - 1);
+    if ( str.Radius == 0 )
+      {
+      continue;
+      }
+
+    this->GetMultiThreader()->SingleMethodExecute();
+    }
+
+  ImageRegionConstIterator<InputImageType> iterBuffer(buffer, outputRegion);
+  ImageRegionIterator<OutputImageType> iterOutput(output, outputRegion);
+  for ( ; !iterOutput.IsAtEnd(); ++iterOutput, ++iterBuffer )
+    {
+    iterOutput.Set(static_cast<OutputPixelType>(iterBuffer.Get()));
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+BoxMinimumImageFilter<TInputImage, TOutputImage>
+::ThreadedPass(PassThreadStruct *str, ThreadIdType threadId,
+               ThreadIdType numberOfThreads)
+{
+  const SizeValueType blockLength = itkGetStaticConstMacro(BlockLength);
+  const SizeValueType blocksPerGroup =
+    (str->Stride + blockLength - 1) / blockLength;
+  const SizeValueType numberOfBlocks = str->Outer*blocksPerGroup;
+  const SizeValueType beginBlock = (numberOfBlocks*threadId)/numberOfThreads;
+  const SizeValueType endBlock = (numberOfBlocks*(threadId+1))/numberOfThreads;
+
+  const SizeValueType length = str->Length;
+  const SizeValueType stride = str->Stride;
+  const SizeValueType radius = str->Radius;
+  const SizeValueType window = 2*radius + 1;
+
+  // The line is padded by radius pixels of the largest value at both ends,
+  // which leaves the pixels outside the buffer out of the minimum. Position
+  // p of the padded line is pixel p - radius.
+  const SizeValueType paddedLength = length + 2*radius;
+  const InputPixelType padding = NumericTraits<InputPixelType>::max();
+
+  // Minimum from the start of its segment up to p, and from p up to the end
+  // of its segment, for every line of the block
+  const SizeValueType maxWidth = std::min(blockLength, stride);
+  std::vector<InputPixelType> forward(paddedLength*maxWidth);
+  std::vector<InputPixelType> backward(paddedLength*maxWidth);
+
+  for (SizeValueType block = beginBlock; block < endBlock; ++block)
+    {
+    const SizeValueType group = block / blocksPerGroup;
+    const SizeValueType first = (block % blocksPerGroup)*blockLength;
+    const SizeValueType width = std::min(blockLength, stride - first);
+    InputPixelType *lines = str->Buffer + group*length*stride + first;
+
+    for (SizeValueType p = 0; p < paddedLength; ++p)
+      {
+      const bool inside = p >= radius && p < radius + length;
+      const InputPixelType *values =
+        inside ? lines + (p - radius)*stride : 0;
+      InputPixelType *current = &forward[p*width];
+      if ( p % window == 0 )
+        {
+        for (SizeValueType j = 0; j < width; ++j)
+          {
+          current[j] = inside ? values[j] : padding;
+          }
+        }
+      else
+        {
+        const InputPixelType *previous = current - width;
+        for (SizeValueType j = 0; j < width; ++j)
+          {
+          current[j] = inside ? std::min(previous[j], values[j]) : previous[j];
+          }
+        }
+      }
+
+    for (SizeValueType p = paddedLength; p > 0; --p)
+      {
+      const SizeValueType q = p - 1;
+      const bool inside = q >= radius && q < radius + length;
+      const InputPixelType *values =
+        inside ? lines + (q - radius)*stride : 0;
+      InputPixelType *current = &backward[q*width];
+      if ( q % window == window - 1 || q == paddedLength - 1 )
+        {
+        for (SizeValueType j = 0; j < width; ++j)
+          {
+          current[j] = inside ? values[j] : padding;
+          }
+        }
+      else
+        {
+        const InputPixelType *next = current + width;
+        for (SizeValueType j = 0; j < width; ++j)
+          {
+          current[j] = inside ? std::min(next[j], values[j]) : next[j];
+          }
+        }
+      }
+
+    // The window of pixel n spans the padded positions [n, n + 2 radius],
+    // which end one segment and start the next
+    for (SizeValueType n = 0; n < length; ++n)
+      {
+      InputPixelType *values = lines + n*stride;
+      const InputPixelType *fromEnd = &backward[n*width];
+      const InputPixelType *fromStart = &forward[(n + 2*radius)*width];
+      for (SizeValueType j = 0; j < width; ++j)
+        {
+        values[j] = std::min(fromEnd[j], fromStart[j]);
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+BoxMinimumImageFilter<TInputImage, TOutputImage>
+::PassThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  PassThreadStruct *str = static_cast<PassThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedPass(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+BoxMinimumImageFilter<TInputImage, TOutputImage>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "Radius: " << m_Radius << std::endl;
+}
+
+} // end namespace itk
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef __itkDomainTransformImageFilter_h
+#define __itkDomainTransformImageFilter_h
+
+#include "itkEdgePreservingSmoothingImageFilter.h"
+#include "itkImage.h"
+#include "itkMultiThreader.h"
+
+#include <vector>
+
+namespace itk
+{
+/**
+* \class DomainTransformImageFilter
+* \brief An edge preserving smoother in linear time, the domain transform
+*
+* This filter smooths an image while preserving its edges with the
+* recursive filter of the domain transform of Gastal and Oliveira [1].
+*
+* Along each axis, the distance between two neighbouring pixels is
+* stretched by the difference of their intensities,
+*   dt = 1 + (DomainSigma/RangeSigma) |I(n) - I(n-1)|
+* with DomainSigma in pixels. A first order recursive filter is then run
+* forward and backward along every line of the axis, with the feedback
+* coefficient a^dt, so that smoothing stops at strong edges. The axes are
+* filtered one after the other, and the whole sequence is repeated
+* NumberOfIterations times with decreasing sigmas so that the artefacts of
+* the separable filtering vanish. The distances are always taken on the
+* input image, which acts as its own edge image.
+*
+* Unlike FastBilateralImageFilter there is no grid: the cost is a fixed
+* number of operations per pixel and the memory is one float per pixel,
+* whatever the sigmas. Each pass is multithreaded over the lines of its
+* axis, which are visited a block of neighbouring lines at a time so that
+* memory is read contiguously along every axis.
+*
+* The recursive filter has an infinite support, so the whole image is
+* always requested and produced.
+*
+* [1] Eduardo S. L. Gastal and Manuel M. Oliveira,
+*     Domain Transform for Edge-Aware Image and Video Processing,
+*     ACM Transactions on Graphics (SIGGRAPH 2011), 30(4), 2011
+*
+* \sa FastBilateralImageFilter
+* \sa EdgePreservingSmoothingImageFilter
+*
+* \ingroup ImageEnhancement
+*/
+template <class TInputImage, class TOutputImage >
+class ITK_EXPORT DomainTransformImageFilter :
+    public EdgePreservingSmoothingImageFilter< TInputImage, TOutputImage >
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef DomainTransformImageFilter                        Self;
+  typedef EdgePreservingSmoothingImageFilter< TInputImage, TOutputImage >
+                                                            Superclass;
+  typedef SmartPointer<Self>                                Pointer;
+  typedef SmartPointer<const Self>                          ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(DomainTransformImageFilter, EdgePreservingSmoothingImageFilter);
+
+  /** Dimensionality of the input image. Dimensionality of the output image
+   *  is assumed to be the same. */
+  itkStaticConstMacro(
+    ImageDimension, unsigned int, TInputImage::ImageDimension);
+
+  /** Image typedefs. */
+  typedef TInputImage                                   InputImageType;
+  typedef typename TInputImage::PixelType               InputPixelType;
+  typedef TOutputImage                                  OutputImageType;
+  typedef typename TOutputImage::PixelType              OutputPixelType;
+  typedef typename TOutputImage::RegionType             OutputImageRegionType;
+  typedef typename Superclass::DomainSigmaArrayType     DomainSigmaArrayType;
+
+  /** Set/Get the number of times the axes are filtered. Default is 3. */
+  itkSetClampMacro(NumberOfIterations, unsigned int, 1,
+                   NumericTraits<unsigned int>::max());
+  itkGetConstMacro(NumberOfIterations, unsigned int);
+
+  /** Predicted cost of an update: one float per pixel and a fixed number of
+   *  operations per pixel and pass, whatever the sigmas. */
+  typedef typename Superclass::InputImageSizeType       InputImageSizeType;
+  typedef typename Superclass::InputImageSpacingType    InputImageSpacingType;
+  typedef typename Superclass::CostEstimateType         CostEstimateType;
+  virtual CostEstimateType EstimateCost(const InputImageSizeType &size,
+                                        const InputImageSpacingType &spacing,
+                                        double intensityRange) const;
+
+protected:
+
+  DomainTransformImageFilter()
+    {
+    m_NumberOfIterations = 3;
+    }
+
+  virtual ~DomainTransformImageFilter() {}
+
+  /** The recursive filter needs the whole input. */
+  virtual void GenerateInputRequestedRegion()
+    throw(InvalidRequestedRegionError);
+
+  /** The recursive filter produces the whole output. */
+  virtual void EnlargeOutputRequestedRegion(DataObject *output);
+
+  /** Filter the input axis by axis into a working buffer, then write it to
+   *  the output. The passes are multithreaded internally. */
+  void GenerateData();
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+  /** Lines are filtered in blocks of up to this many neighbouring lines,
+   *  which are adjacent in memory for every axis but the first. */
+  itkStaticConstMacro(BlockLength, unsigned int, 64);
+
+  /** Data shared by the threads of one pass along one axis. A pass filters
+   *  all lines parallel to Axis. Each line holds Length pixels separated by
+   *  Stride in memory, Stride being the number of pixels of a block. There
+   *  are Outer groups of Stride lines, split into blocks of BlockLength. */
+  struct PassThreadStruct
+    {
+    Self                  *Filter;
+    const InputPixelType  *Guide;
+    float                 *Buffer;
+    unsigned int          Axis;
+    SizeValueType         Length;
+    SizeValueType         Stride;
+    SizeValueType         Outer;
+    /** DomainSigma/RangeSigma along Axis, in pixels per intensity unit */
+    double                Ratio;
+    /** log of the feedback coefficient of this iteration along Axis */
+    double                LogFeedback;
+    };
+
+  /** Run the recursive filter forward then backward along the lines of the
+   *  thread's blocks. */
+  void ThreadedPass(PassThreadStruct *str, ThreadIdType threadId,
+                    ThreadIdType numberOfThreads);
+
+  /** Static function used to dispatch a pass to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE PassThreaderCallback(void *arg);
+
+private:
+
+  DomainTransformImageFilter(const Self&);  // Not implemented on purpose
+
+  void operator=(const Self&);              // Not implemented on purpose
+
+  unsigned int          m_NumberOfIterations;
+
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkDomainTransformImageFilter.txx"
+#endif
+
+#endif // End #ifndef __itkDomainTransformImageFilter_h
@@ -0,0 +1,231 @@
+#ifndef __itkDomainTransformImageFilter_txx
+#define __itkDomainTransformImageFilter_txx
+
+#include "itkDomainTransformImageFilter.h"
+
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+
+#include <algorithm>
+
+namespace itk
+{
+
+template <class TInputImage, class TOutputImage>
+void
+DomainTransformImageFilter<TInputImage,TOutputImage>
+::GenerateInputRequestedRegion() throw(InvalidRequestedRegionError)
+{
+  Superclass::GenerateInputRequestedRegion();
+
+  TInputImage *inputPtr = const_cast< TInputImage *>( this->GetInput() );
+  if ( inputPtr )
+    {
+    inputPtr->SetRequestedRegionToLargestPossibleRegion();
+    }
+}
+
+template <class TInputImage, class TOutputImage>
+void
+DomainTransformImageFilter<TInputImage,TOutputImage>
+::EnlargeOutputRequestedRegion(DataObject *output)
+{
+  Superclass::EnlargeOutputRequestedRegion(output);
+  output->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template <class TInputImage, class TOutputImage>
+void
+DomainTransformImageFilter<TInputImage, TOutputImage>
+::GenerateData()
+{
+  const InputImageType *input = this->GetInput();
+  this->AllocateOutputs();
+  OutputImageType *output = this->GetOutput();
+  const OutputImageRegionType region = output->GetRequestedRegion();
+
+  if ( input->GetBufferedRegion() != region )
+    {
+    itkExceptionMacro(<< "The input must be buffered over the output region");
+    }
+  if ( this->GetRangeSigma() <= 0.0 )
+    {
+    itkExceptionMacro(<< "RangeSigma must be positive, got "
+                      << this->GetRangeSigma());
+    }
+
+  // The working buffer starts as a copy of the input. Every pass filters
+  // it in place while the distances are read from the input itself.
+  std::vector<float> buffer(region.GetNumberOfPixels());
+  {
+  ImageRegionConstIterator<InputImageType> iterInput(input, region);
+  std::vector<float>::iterator value = buffer.begin();
+  for ( iterInput.GoToBegin(); !iterInput.IsAtEnd(); ++iterInput, ++value )
+    {
+    *value = static_cast<float>(iterInput.Get());
+    }
+  }
+
+  PassThreadStruct str;
+  str.Filter = this;
+  str.Guide = input->GetBufferPointer();
+  str.Buffer = &buffer[0];
+
+  // Sigmas of the iterations as in Gastal and Oliveira, eq. 14: the
+  // variances of the iterations add up to that of DomainSigma.
+  const unsigned int iterations = m_NumberOfIterations;
+  const double varianceScale =
+    vcl_sqrt(3.0)/vcl_sqrt(vcl_pow(4.0, static_cast<double>(iterations)) - 1.0);
+
+  this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+  this->GetMultiThreader()->SetSingleMethod(this->PassThreaderCallback, &str);
+  for (unsigned int iteration = 0; iteration < iterations; ++iteration)
+    {
+    const double iterationScale = varianceScale
+      * vcl_pow(2.0, static_cast<double>(iterations - iteration - 1));
+
+    SizeValueType stride = 1;
+    for (str.Axis = 0; str.Axis < itkGetStaticConstMacro(ImageDimension);
+         ++str.Axis)
+      {
+      str.Length = region.GetSize(str.Axis);
+      str.Stride = stride;
+      str.Outer = region.GetNumberOfPixels()/(str.Length*stride);
+      stride *= str.Length;
+
+      // The transform is measured in pixels along the axis
+      const double sigmaInPixels =
+        this->GetDomainSigma()[str.Axis] / input->GetSpacing()[str.Axis];
+      if ( str.Length < 2 || sigmaInPixels <= 0.0 )
+        {
+        continue;
+        }
+      str.Ratio = sigmaInPixels / this->GetRangeSigma();
+      str.LogFeedback = -vcl_sqrt(2.0) / (sigmaInPixels*iterationScale);
+
+      this->GetMultiThreader()->SingleMethodExecute();
+      }
+    }
+
+  ImageRegionIterator<OutputImageType> iterOutput(output, region);
+  std::vector<float>::const_iterator value = buffer.begin();
+  for ( iterOutput.GoToBegin(); !iterOutput.IsAtEnd(); ++iterOutput, ++value )
+    {
+    iterOutput.Set(static_cast<OutputPixelType>(*value));
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+DomainTransformImageFilter<TInputImage, TOutputImage>
+::ThreadedPass(PassThreadStruct *str, ThreadIdType threadId,
+               ThreadIdType numberOfThreads)
+{
+  // Work is split into blocks of up to BlockLength neighbouring lines. The
+  // pixels of a block at the same position along the axis are contiguous,
+  // so the recursion advances the whole block one position at a time.
+  const SizeValueType blockLength = itkGetStaticConstMacro(BlockLength);
+  const SizeValueType blocksPerGroup =
+    (str->Stride + blockLength - 1) / blockLength;
+  const SizeValueType numberOfBlocks = str->Outer*blocksPerGroup;
+  const SizeValueType beginBlock = (numberOfBlocks*threadId)/numberOfThreads;
+  const SizeValueType endBlock = (numberOfBlocks*(threadId+1))/numberOfThreads;
+
+  const SizeValueType length = str->Length;
+  const SizeValueType stride = str->Stride;
+  const float ratio = static_cast<float>(str->Ratio);
+  const float logFeedback = static_cast<float>(str->LogFeedback);
+
+  // Feedback coefficients a^dt of the block, computed by the forward
+  // recursion and reused by the backward one
+  std::vector<float> feedback(length*std::min(blockLength, stride));
+
+  for (SizeValueType block = beginBlock; block < endBlock; ++block)
+    {
+    const SizeValueType group = block / blocksPerGroup;
+    const SizeValueType first = (block % blocksPerGroup)*blockLength;
+    const SizeValueType width = std::min(blockLength, stride - first);
+    const SizeValueType base = group*length*stride + first;
+
+    // Forward: J[n] = J[n] + a^dt (J[n-1] - J[n])
+    for (SizeValueType n = 1; n < length; ++n)
+      {
+      const InputPixelType *guide = str->Guide + base + n*stride;
+      const InputPixelType *previousGuide = guide - stride;
+      float *current = str->Buffer + base + n*stride;
+      const float *previous = current - stride;
+      float *weights = &feedback[n*width];
+      for (SizeValueType j = 0; j < width; ++j)
+        {
+        const float distance = 1.0f + ratio*vcl_abs(
+          static_cast<float>(guide[j]) - static_cast<float>(previousGuide[j]));
+        const float weight = vcl_exp(distance*logFeedback);
+        weights[j] = weight;
+        current[j] += weight*(previous[j] - current[j]);
+        }
+      }
+
+    // Backward: J[n] = J[n] + a^dt (J[n+1] - J[n]), with dt between n, n+1
+    for (SizeValueType n = length - 1; n > 0; --n)
+      {
+      float *current = str->Buffer + base + (n - 1)*stride;
+      const float *next = current + stride;
+      const float *weights = &feedback[n*width];
+      for (SizeValueType j = 0; j < width; ++j)
+        {
+        current[j] += weights[j]*(next[j] - current[j]);
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+DomainTransformImageFilter<TInputImage, TOutputImage>
+::PassThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  PassThreadStruct *str = static_cast<PassThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedPass(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+typename DomainTransformImageFilter<TInputImage, TOutputImage>::CostEstimateType
+DomainTransformImageFilter<TInputImage, TOutputImage>
+::EstimateCost(const InputImageSizeType &size,
+               const InputImageSpacingType &itkNotUsed(spacing),
+               double itkNotUsed(intensityRange)) const
+{
+  double pixels = 1.0;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    pixels *= size[i];
+    }
+
+  // Per pixel and pass: the distance and its exponential (about 20
+  // operations) in the forward recursion, 3 operations in the backward one
+  CostEstimateType cost;
+  cost.Cells = pixels;
+  cost.Memory = pixels*sizeof(float);
+  cost.Operations = pixels*(2.0 + m_NumberOfIterations
+                            *itkGetStaticConstMacro(ImageDimension)*25.0);
+  return cost;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+DomainTransformImageFilter<TInputImage, TOutputImage>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "NumberOfIterations: " << m_NumberOfIterations << std::endl;
+}
+
+} // end namespace itk
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef __itkEdgePreservingSmoothingImageFilter_h
+#define __itkEdgePreservingSmoothingImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkFixedArray.h"
+
+namespace itk
+{
+/**
+* \class EdgePreservingSmoothingImageFilter
+* \brief Base class of the edge preserving smoothers
+*
+* Edge preserving smoothers average pixels that are close in space and
+* close in intensity. They all take a spatial standard deviation,
+* DomainSigma, and an intensity one, RangeSigma, and differ in how the
+* kernel is approximated and in what it costs. This class holds the two
+* parameters so that code building a pipeline can pick a smoother at run
+* time and set it up through this interface.
+*
+* DomainSigma is specified in the same units as the image spacing, one
+* value per axis. RangeSigma is specified in the units of intensity.
+*
+* Each smoother also predicts what an update would cost for an image of a
+* given size, spacing and intensity range (EstimateCost), so that the
+* cheapest one can be chosen before any of them is run.
+*
+* \sa FastBilateralImageFilter
+* \sa DomainTransformImageFilter
+*
+* \ingroup ImageEnhancement
+*/
+template <class TInputImage, class TOutputImage >
+class ITK_EXPORT EdgePreservingSmoothingImageFilter :
+    public ImageToImageFilter< TInputImage, TOutputImage >
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef EdgePreservingSmoothingImageFilter                Self;
+  typedef ImageToImageFilter< TInputImage, TOutputImage >   Superclass;
+  typedef SmartPointer<Self>                                Pointer;
+  typedef SmartPointer<const Self>                          ConstPointer;
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(EdgePreservingSmoothingImageFilter, ImageToImageFilter);
+
+  /** Dimensionality of the input image. Dimensionality of the output image
+   *  is assumed to be the same. */
+  itkStaticConstMacro(
+    ImageDimension, unsigned int, TInputImage::ImageDimension);
+
+  /** Typedef for an array of doubles that specifies the DomainSigma
+   *  in each spacial dimension. */
+  typedef FixedArray<double, itkGetStaticConstMacro(ImageDimension)>
+    DomainSigmaArrayType;
+
+  /** Geometry of the images a cost is estimated for. */
+  typedef typename TInputImage::SizeType                InputImageSizeType;
+  typedef typename TInputImage::SpacingType             InputImageSpacingType;
+
+  /** Predicted cost of one update. Cells is the number of cells of the
+   *  intermediate representation (grid, lattice, neighbourhood or working
+   *  buffer), Memory the bytes it needs and Operations the number of
+   *  floating point operations of the whole update. */
+  struct CostEstimateType
+    {
+    double  Cells;
+    double  Memory;
+    double  Operations;
+    };
+
+  /** Standard get/set macros for filter parameters.
+   *  DomainSigma is specified in the same units as the Image spacing.
+   *  RangeSigma is specified in the units of intensity. */
+  itkGetConstMacro(DomainSigma, const DomainSigmaArrayType);
+  itkSetMacro(DomainSigma, DomainSigmaArrayType);
+  itkGetConstMacro(RangeSigma, double);
+  itkSetMacro(RangeSigma, double);
+
+  /** Convenience set method for setting all domain standard deviations to the
+   *  same value. */
+  void SetDomainSigma(const double v)
+    {
+    DomainSigmaArrayType sigma;
+    sigma.Fill(v);
+    this->SetDomainSigma(sigma);
+    }
+
+  /** Predict the cost of filtering an image of the given size and spacing
+   *  whose intensities span intensityRange, with the current parameters. */
+  virtual CostEstimateType EstimateCost(const InputImageSizeType &size,
+                                        const InputImageSpacingType &spacing,
+                                        double intensityRange) const = 0;
+
+protected:
+
+  /** Default Constructor. Default value for DomainSigma is 4. Default
+   *  value for RangeSigma is 50. */
+  EdgePreservingSmoothingImageFilter()
+    {
+    m_DomainSigma.Fill(4.0);
+    m_RangeSigma = 50.0;
+    }
+
+  virtual ~EdgePreservingSmoothingImageFilter() {}
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const
+    {
+    Superclass::PrintSelf(os,indent);
+
+    os << indent << "DomainSigma: " << m_DomainSigma << std::endl;
+    os << indent << "RangeSigma: " << m_RangeSigma << std::endl;
+    }
+
+private:
+
+  EdgePreservingSmoothingImageFilter(const Self&);  // Not implemented on purpose
+
+  void operator=(const Self&);                      // Not implemented on purpose
+
+  double                m_RangeSigma;
+  DomainSigmaArrayType  m_DomainSigma;
+
+};
+
+} // end namespace itk
+
+#endif // End #ifndef __itkEdgePreservingSmoothingImageFilter_h
@@ -0,0 +1,132 @@
+#ifndef __itkExactBilateralImageFilter_h
+#define __itkExactBilateralImageFilter_h
+
+#include "itkEdgePreservingSmoothingImageFilter.h"
+#include "itkImage.h"
+
+#include <vector>
+
+namespace itk
+{
+/**
+* \class ExactBilateralImageFilter
+* \brief The bilateral filter computed by brute force, as a reference
+*
+* Every output pixel is the normalised sum over its neighbourhood of
+*   exp(-|x - y|^2/(2 DomainSigma^2)) exp(-(I(x) - I(y))^2/(2 RangeSigma^2)) I(y)
+* evaluated directly, with no downsampling and no lookup table. The
+* neighbourhood extends DomainKernelWidth domain sigmas along each axis and
+* neighbours outside the image are left out of the sums.
+*
+* Its cost grows with the volume of the neighbourhood, so it is meant to
+* validate the fast approximations (FastBilateralImageFilter,
+* PermutohedralBilateralImageFilter, DomainTransformImageFilter) on small
+* volumes rather than for production use. It is multithreaded over the
+* output requested region. The spatial weights and the memory offsets of
+* the neighbourhood are tabulated once per update, and pixels whose
+* neighbourhood lies inside the input skip the bounds checks.
+*
+* \sa BilateralImageFilter
+* \sa FastBilateralImageFilter
+*
+* \ingroup ImageEnhancement
+*/
+template <class TInputImage, class TOutputImage >
+class ITK_EXPORT ExactBilateralImageFilter :
+    public EdgePreservingSmoothingImageFilter< TInputImage, TOutputImage >
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef ExactBilateralImageFilter                         Self;
+  typedef EdgePreservingSmoothingImageFilter< TInputImage, TOutputImage >
+                                                            Superclass;
+  typedef SmartPointer<Self>                                Pointer;
+  typedef SmartPointer<const Self>                          ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ExactBilateralImageFilter, EdgePreservingSmoothingImageFilter);
+
+  /** Dimensionality of the input image. Dimensionality of the output image
+   *  is assumed to be the same. */
+  itkStaticConstMacro(
+    ImageDimension, unsigned int, TInputImage::ImageDimension);
+
+  /** Image typedefs. */
+  typedef TInputImage                                   InputImageType;
+  typedef typename TInputImage::PixelType               InputPixelType;
+  typedef typename TInputImage::IndexType               InputImageIndexType;
+  typedef typename TInputImage::SizeType                InputImageSizeType;
+  typedef typename TInputImage::OffsetType              InputImageOffsetType;
+  typedef TOutputImage                                  OutputImageType;
+  typedef typename TOutputImage::PixelType              OutputPixelType;
+  typedef typename TOutputImage::RegionType             OutputImageRegionType;
+  typedef typename Superclass::DomainSigmaArrayType     DomainSigmaArrayType;
+
+  /** Set/Get the half width of the neighbourhood in domain sigmas.
+   *  Default is 3. */
+  itkSetMacro(DomainKernelWidth, double);
+  itkGetConstMacro(DomainKernelWidth, double);
+
+  /** Predicted cost of an update: the whole neighbourhood is visited for
+   *  every pixel. */
+  typedef typename Superclass::InputImageSpacingType    InputImageSpacingType;
+  typedef typename Superclass::CostEstimateType         CostEstimateType;
+  virtual CostEstimateType EstimateCost(const InputImageSizeType &size,
+                                        const InputImageSpacingType &spacing,
+                                        double intensityRange) const;
+
+protected:
+
+  ExactBilateralImageFilter()
+    {
+    m_DomainKernelWidth = 3.0;
+    }
+
+  virtual ~ExactBilateralImageFilter() {}
+
+  /** The input requested region is the output one padded by the radius of
+   *  the neighbourhood. */
+  virtual void GenerateInputRequestedRegion()
+    throw(InvalidRequestedRegionError);
+
+  /** Tabulate the neighbourhood */
+  void BeforeThreadedGenerateData();
+
+  /** Evaluate the sums for the output region of a thread */
+  void ThreadedGenerateData(const OutputImageRegionType& outputRegionForThread,
+                            ThreadIdType threadId);
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+  /** Radius of the neighbourhood in pixels for the given spacing */
+  InputImageSizeType ComputeRadius(const InputImageSpacingType &spacing) const;
+
+private:
+
+  ExactBilateralImageFilter(const Self&);  // Not implemented on purpose
+
+  void operator=(const Self&);             // Not implemented on purpose
+
+  double                m_DomainKernelWidth;
+
+  /** Neighbourhood of a pixel: index offsets, offsets in the input buffer
+   *  and spatial weights */
+  InputImageSizeType                  m_Radius;
+  std::vector<InputImageOffsetType>   m_NeighbourOffsets;
+  std::vector<OffsetValueType>        m_NeighbourBufferOffsets;
+  std::vector<double>                 m_NeighbourWeights;
+
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkExactBilateralImageFilter.txx"
+#endif
+
+#endif // End #ifndef __itkExactBilateralImageFilter_h
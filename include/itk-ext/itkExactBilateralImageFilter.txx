@@ -0,0 +1,233 @@
+#ifndef __itkExactBilateralImageFilter_txx
+#define __itkExactBilateralImageFilter_txx
+
+#include "itkExactBilateralImageFilter.h"
+
+#include "itkImageRegionIteratorWithIndex.h"
+
+namespace itk
+{
+
+template <class TInputImage, class TOutputImage>
+typename ExactBilateralImageFilter<TInputImage,TOutputImage>::InputImageSizeType
+ExactBilateralImageFilter<TInputImage,TOutputImage>
+::ComputeRadius(const InputImageSpacingType &spacing) const
+{
+  InputImageSizeType radius;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    radius[i] = static_cast<SizeValueType>(vcl_ceil(m_DomainKernelWidth
+      * this->GetDomainSigma()[i] / spacing[i]));
+    }
+  return radius;
+}
+
+template <class TInputImage, class TOutputImage>
+void
+ExactBilateralImageFilter<TInputImage,TOutputImage>
+::GenerateInputRequestedRegion() throw(InvalidRequestedRegionError)
+{
+  // call the superclass' implementation of this method. this should
+  // copy the output requested region to the input requested region
+  Superclass::GenerateInputRequestedRegion();
+
+  TInputImage *inputPtr = const_cast< TInputImage *>( this->GetInput() );
+  if ( !inputPtr )
+    {
+    return;
+    }
+
+  // pad the input requested region by the radius of the neighbourhood and
+  // crop it at the input's largest possible region
+  typename TInputImage::RegionType inputRequestedRegion =
+    inputPtr->GetRequestedRegion();
+  inputRequestedRegion.PadByRadius( this->ComputeRadius(inputPtr->GetSpacing()) );
+
+  if ( inputRequestedRegion.Crop(inputPtr->GetLargestPossibleRegion()) )
+    {
+    inputPtr->SetRequestedRegion( inputRequestedRegion );
+    return;
+    }
+  else
+    {
+    // Couldn't crop the region (requested region is outside the largest
+    // possible region).  Throw an exception.
+
+    // store what we tried to request (prior to trying to crop)
+    inputPtr->SetRequestedRegion( inputRequestedRegion );
+
+    // build an exception
+    InvalidRequestedRegionError e(__FILE__, __LINE__);
+    e.SetLocation(ITK_LOCATION);
+    e.SetDescription
+      ("Requested region is outside the largest possible region.");
+    e.SetDataObject(inputPtr);
+    throw e;
+    }
+}
+
+template <class TInputImage, class TOutputImage>
+void
+ExactBilateralImageFilter<TInputImage, TOutputImage>
+::BeforeThreadedGenerateData()
+{
+  if ( this->GetRangeSigma() <= 0.0 )
+    {
+    itkExceptionMacro(<< "RangeSigma must be positive, got "
+                      << this->GetRangeSigma());
+    }
+
+  const InputImageType *input = this->GetInput();
+  const typename InputImageType::SpacingType & spacing = input->GetSpacing();
+  const OffsetValueType *offsetTable = input->GetOffsetTable();
+  m_Radius = this->ComputeRadius(spacing);
+
+  // Enumerate the box [-radius, radius], first axis fastest, and keep the
+  // offsets and the spatial weight of every neighbour
+  m_NeighbourOffsets.clear();
+  m_NeighbourBufferOffsets.clear();
+  m_NeighbourWeights.clear();
+
+  InputImageOffsetType offset;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    offset[i] = -static_cast<OffsetValueType>(m_Radius[i]);
+    }
+  bool done = false;
+  while ( !done )
+    {
+    double exponent = 0.0;
+    OffsetValueType bufferOffset = 0;
+    for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      if ( this->GetDomainSigma()[i] > 0.0 )
+        {
+        const double distance =
+          offset[i]*spacing[i] / this->GetDomainSigma()[i];
+        exponent += distance*distance;
+        }
+      bufferOffset += offset[i]*offsetTable[i];
+      }
+    m_NeighbourOffsets.push_back(offset);
+    m_NeighbourBufferOffsets.push_back(bufferOffset);
+    m_NeighbourWeights.push_back(vcl_exp(-0.5*exponent));
+
+    done = true;
+    for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      if ( offset[i] < static_cast<OffsetValueType>(m_Radius[i]) )
+        {
+        ++offset[i];
+        done = false;
+        break;
+        }
+      offset[i] = -static_cast<OffsetValueType>(m_Radius[i]);
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+ExactBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedGenerateData(const OutputImageRegionType& outputRegionForThread,
+                       ThreadIdType itkNotUsed(threadId))
+{
+  const InputImageType *input = this->GetInput();
+  const typename InputImageType::RegionType & bufferedRegion =
+    input->GetBufferedRegion();
+  const InputPixelType *buffer = input->GetBufferPointer();
+  const double rangeFactor =
+    -0.5/(this->GetRangeSigma()*this->GetRangeSigma());
+  const SizeValueType neighbours = m_NeighbourWeights.size();
+
+  ImageRegionIteratorWithIndex<OutputImageType>
+    iterOutput(this->GetOutput(), outputRegionForThread);
+  for ( iterOutput.GoToBegin(); !iterOutput.IsAtEnd(); ++iterOutput )
+    {
+    const InputImageIndexType index = iterOutput.GetIndex();
+    const OffsetValueType centerOffset = input->ComputeOffset(index);
+    const double center = static_cast<double>(buffer[centerOffset]);
+
+    // Neighbourhoods inside the buffer are read through the buffer offsets
+    bool inside = true;
+    for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      const OffsetValueType radius = static_cast<OffsetValueType>(m_Radius[i]);
+      if ( index[i] - radius < bufferedRegion.GetIndex(i)
+           || index[i] + radius >= bufferedRegion.GetIndex(i)
+              + static_cast<OffsetValueType>(bufferedRegion.GetSize(i)) )
+        {
+        inside = false;
+        break;
+        }
+      }
+
+    double sum = 0.0;
+    double weight = 0.0;
+    for (SizeValueType k = 0; k < neighbours; ++k)
+      {
+      double value;
+      if ( inside )
+        {
+        value = static_cast<double>(buffer[centerOffset
+                                           + m_NeighbourBufferOffsets[k]]);
+        }
+      else
+        {
+        const InputImageIndexType neighbour = index + m_NeighbourOffsets[k];
+        if ( !bufferedRegion.IsInside(neighbour) )
+          {
+          continue;
+          }
+        value = static_cast<double>(buffer[input->ComputeOffset(neighbour)]);
+        }
+      const double difference = value - center;
+      const double w = m_NeighbourWeights[k]
+        * vcl_exp(difference*difference*rangeFactor);
+      sum += w*value;
+      weight += w;
+      }
+
+    iterOutput.Set(static_cast<OutputPixelType>(sum/weight));
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+typename ExactBilateralImageFilter<TInputImage, TOutputImage>::CostEstimateType
+ExactBilateralImageFilter<TInputImage, TOutputImage>
+::EstimateCost(const InputImageSizeType &size,
+               const InputImageSpacingType &spacing,
+               double itkNotUsed(intensityRange)) const
+{
+  const InputImageSizeType radius = this->ComputeRadius(spacing);
+  double pixels = 1.0;
+  double neighbours = 1.0;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    pixels *= size[i];
+    neighbours *= 2.0*radius[i] + 1.0;
+    }
+
+  // Each neighbour costs a range weight (an exponential, about 15
+  // operations) and the accumulation of the sums
+  CostEstimateType cost;
+  cost.Cells = neighbours;
+  cost.Memory = neighbours*(sizeof(InputImageOffsetType)
+                            + sizeof(OffsetValueType) + sizeof(double));
+  cost.Operations = pixels*neighbours*22.0;
+  return cost;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+ExactBilateralImageFilter<TInputImage, TOutputImage>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "DomainKernelWidth: " << m_DomainKernelWidth << std::endl;
+}
+
+} // end namespace itk
+
+#endif
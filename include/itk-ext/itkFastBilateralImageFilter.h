@@ -1,12 +1,16 @@
 #ifndef __itkFastBilateralImageFilter_h
 #define __itkFastBilateralImageFilter_h
 
-#include "itkImageToImageFilter.h"
+#include "itkEdgePreservingSmoothingImageFilter.h"
 #include "itkImage.h"
-#include "itkDiscreteGaussianImageFilter.h"
+#include "itkVectorImage.h"
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
-#include "itkLinearInterpolateImageFunction.h"
+#include "itkMultiThreader.h"
+#include "itkSparseBilateralGrid.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace itk
 {
@@ -24,13 +28,111 @@ namespace itk
 * Instead of calculating a kernel for every pixel in
 * an image, this filter places the values of each pixel into a higher
 * dimensional image determined by the position and intensity of a pixel.
+* As in Paris and Durand's homogeneous grid, every grid cell stores the
+* pair (sum of intensities, number of pixels) interleaved in a single
+* buffer, so each stage of the filter is one sweep over one memory stream.
 * How many bins are used is determined by the sigma values provided
 * to the filter. Larger sigmas will result in more aggresive downsampling
 * and less running time overall. After the data of an image
-* has been organized into bins, a DiscreteGaussianImageFilter is applied.
+* has been organized into bins, a small separable Gaussian is applied to
+* the grid in place, one multithreaded pass per grid axis.
 * Finally, the output image is constructed by interpolating the
 * values of the output pixels from the blurred higher
-* dimensional image.
+* dimensional image. This last step is multithreaded over the output
+* requested region and uses a dedicated multilinear kernel with tabulated
+* spatial weights, since the spatial grid coordinates are regular.
+*
+* Sorting the input into the grid is multithreaded. The input region is
+* split into slabs along its last axis, one per thread, and each thread
+* accumulates into a private grid that only spans the grid planes its slab
+* can reach. The private grids are then summed into the shared grid with
+* a threaded reduction over grid planes.
+*
+* When the range of intensities is large compared to RangeSigma, most
+* cells of the grid stay empty and a dense grid may not even fit in memory.
+* The grid can then be stored sparsely, as a hash of small bricks of cells
+* (see SparseBilateralGrid). Only bricks reached by the input, and their
+* neighbours, are stored, blurred and sliced. By default the filter picks
+* the dense or the sparse grid from the size of the dense grid and the
+* occupancy of the bricks, estimated on a subsample of the input. The
+* choice can be forced with SetGridMode().
+*
+* Grids too large for memory that the sparse storage would not shrink
+* enough are streamed instead (StreamingGrid). The grid is then swept along
+* the last spatial axis: each plane is splatted from the input rows binned
+* into it and blurred along the other axes into a ring a few planes deep,
+* blurred along the last axis and normalised once its neighbours are in the
+* ring, and the output rows between the last two final planes are sliced
+* right away. Only kernel width + 2 planes per channel are allocated, so the
+* grid memory no longer grows with the extent of the last axis, and the
+* output is that of the dense grid.
+*
+* The cells of the grid are aligned on multiples of DomainSigma from index
+* 0, and the uniform range bins on multiples of their width, so any
+* requested region is filtered as it would be within the whole image. The
+* input requested region is the output one padded by 3.5 domain sigmas,
+* the reach of the blur and of the interpolation, so the filter can also be
+* streamed by the pipeline, e.g. with a StreamingImageFilter, to bound the
+* memory of the images themselves. Adaptive range axes depend on the
+* histogram of the region and do not share this property.
+*
+* An optional edge image turns the filter into a cross (joint) bilateral
+* filter: the intensities of the edge image place the pixels along the range
+* axis of the grid, while the values averaged are those of the input. The
+* range coordinates derived from the edge image are kept between updates,
+* so several inputs can be filtered with the same edge image without
+* scanning it again. They are recomputed when the edge image, its region or
+* the filter parameters change, or on ReleaseGuideCache().
+*
+* The grid can be built faster at some cost in accuracy. With a
+* SplatSubsampling of k, only the pixels on every k-th diagonal plane
+* (sum of the index components a multiple of k) are sorted into the grid;
+* the splat steps from one to the next along the first axis and never
+* visits the others. With a RangeCoarsening of c, the range bins are
+* c*RangeSigma wide instead of RangeSigma and the range axis is blurred with
+* a variance reduced by c^2, so that RangeSigma is kept. The splat costs
+* about 1/k and the grid memory and blur about 1/c of the default; slicing
+* is unchanged. SetQuality() sets both from a single value. The defaults,
+* k = 1 and c = 1, are the exact grid path.
+*
+* Error bounds with respect to the default grid: every output is a
+* weighted mean of input values binned within 3.5 range bins of the
+* output pixel's own value (nearest bin, blur radius 2, interpolation 1),
+* so it lies within 3.5*c*RangeSigma of it, and the default output within
+* 3.5*RangeSigma. The two therefore never differ by more than
+* 3.5*(1+c)*RangeSigma, whatever k. This worst case is only approached
+* at edges of height near RangeSigma. In flat regions subsampling adds the
+* error of a mean over 1/k of the pixels of a cell, about
+* sqrt(k/n) times the local noise for n pixels per cell, and coarsening
+* adds the rounding of intensities to the nearest bin, at most
+* c*RangeSigma/2 before blurring. The itkBilateralAccuracyTest reports
+* the measured PSNR and maximum error of each setting against the exact
+* bilateral filter.
+*
+* By default the range axis is uniform, one bin per RangeSigma between the
+* minimum and the maximum intensity. Skewed histograms, such as those of MR
+* images with a large background peak and a long bright tail, leave most of
+* those bins almost empty. With an AdaptiveRangeAxis the intensities are
+* instead placed on the range axis through a monotone lookup table built
+* from their histogram. Intensities at least as frequent as the median of
+* the occupied histogram keep bins RangeSigma wide; rarer ones, and the
+* gaps between occupied intensities, get bins up to MaximumRangeStretch
+* times wider in proportion to their scarcity. The range distance between
+* two intensities is thus never larger than on the uniform axis and at most
+* MaximumRangeStretch times smaller: the filter behaves as a bilateral
+* filter whose range sigma is RangeSigma over the bulk of the histogram and
+* grows to at most MaximumRangeStretch*RangeSigma in its sparse parts. The
+* grid shrinks accordingly along the range axis. A MaximumRangeStretch of 1
+* gives back the uniform axis.
+*
+* Several co-registered images can be filtered in one pass by setting them
+* as indexed inputs. Every input is filtered on its own, with its own range
+* axis and grid, into the output of the same index. The spatial bins and
+* interpolation weights are shared: each pixel position is visited once,
+* and all the channels are splatted and sliced from that visit.
+* Color and vector pixel types are not supported: the pixels of the input
+* and output images must be scalars, and the channels of a vector image
+* have to be extracted and set as indexed inputs.
 * 
 * [1] Sylvain Paris and Frédo Durand,
 *     A Fast Approximation of the Bilateral Filter using a Signal Processing
@@ -46,20 +148,18 @@ namespace itk
 *
 * \ingroup ImageEnhancement
 * \ingroup ImageFeatureExtraction
-*
-* \todo Support for color images
-* \todo Support for vector images
 */
 
 template <class TInputImage, class TOutputImage >
 class ITK_EXPORT FastBilateralImageFilter :
-    public ImageToImageFilter< TInputImage, TOutputImage >
+    public EdgePreservingSmoothingImageFilter< TInputImage, TOutputImage >
 {
 public:
   
   /** Standard class typedefs. */
   typedef FastBilateralImageFilter                          Self;
-  typedef ImageToImageFilter< TInputImage, TOutputImage >   Superclass;
+  typedef EdgePreservingSmoothingImageFilter< TInputImage, TOutputImage >
+                                                            Superclass;
   typedef SmartPointer<Self>                                Pointer;
   typedef SmartPointer<const Self>                          ConstPointer;
   
@@ -67,7 +167,7 @@ public:
   itkNewMacro(Self);
   
   /** Run-time type information (and related methods). */
-  itkTypeMacro(FastBilateralImageFilter, ImageToImageFilter);
+  itkTypeMacro(FastBilateralImageFilter, EdgePreservingSmoothingImageFilter);
   
   /** Dimensionality of the input image. Dimensionality of the output image
    *  is assumed to be the same. */
@@ -89,6 +189,9 @@ public:
   /** Output image typedefs. */
   typedef TOutputImage                                  OutputImageType;
   typedef typename TOutputImage::Pointer                OutputImagePointer;
+  typedef typename TOutputImage::RegionType             OutputImageRegionType;
+  typedef typename Superclass::DataObjectPointerArraySizeType
+    DataObjectPointerArraySizeType;
   
   /** Output image iterator type. */
   typedef ImageRegionIterator<TOutputImage>
@@ -99,37 +202,131 @@ public:
   typedef typename TInputImage::PixelType               InputPixelType;
   
   /** Typedef for an array of doubles that specifies the DomainSigma
-   *  in each spacial dimension. */
-  typedef FixedArray<double, itkGetStaticConstMacro(ImageDimension)>
-    DomainSigmaArrayType;
-  
-  /** Standard get/set macros for filter parameters.
-   *  DomainSigma is specified in the same units as the Image spacing.
-   *  RangeSigma is specified in the units of intensity. */
-  itkGetConstMacro(DomainSigma, const DomainSigmaArrayType);
-  itkSetMacro(DomainSigma, DomainSigmaArrayType);
-  itkGetConstMacro(RangeSigma, double);
-  itkSetMacro(RangeSigma, double);
-  
-  /** Convenience set method for setting all domain standard deviations to the
-   *  same value. */
-  void SetDomainSigma(const double v)
-    {
-    m_DomainSigma.Fill(v);
+   *  in each spacial dimension. DomainSigma and RangeSigma are set through
+   *  EdgePreservingSmoothingImageFilter. */
+  typedef typename Superclass::DomainSigmaArrayType     DomainSigmaArrayType;
+
+  /** Storage of the grid. AutomaticGrid picks one of the others for every
+   *  update from the estimated occupancy of the grid. StreamingGrid only
+   *  keeps a few planes of a dense grid at a time. */
+  typedef enum { AutomaticGrid = 0, DenseGrid, SparseGrid, StreamingGrid }
+    GridModeType;
+
+  /** Set/Get the storage of the grid. Default is AutomaticGrid. */
+  itkSetMacro(GridMode, GridModeType);
+  itkGetConstMacro(GridMode, GridModeType);
+
+  /** Set/Get the size in bytes up to which a dense grid is always used in
+   *  automatic mode. Default is 64 MB. */
+  itkSetMacro(MaximumDenseGridMemory, SizeValueType);
+  itkGetConstMacro(MaximumDenseGridMemory, SizeValueType);
+
+  /** Storage used by the last update, DenseGrid, SparseGrid or
+   *  StreamingGrid. */
+  itkGetConstMacro(SelectedGridMode, GridModeType);
+
+  /** Layout of the range axis. UniformRangeAxis has one bin per RangeSigma,
+   *  AdaptiveRangeAxis follows the histogram of the intensities. */
+  typedef enum { UniformRangeAxis = 0, AdaptiveRangeAxis } RangeAxisType;
+
+  /** Set/Get the layout of the range axis. Default is UniformRangeAxis. */
+  itkSetMacro(RangeAxis, RangeAxisType);
+  itkGetConstMacro(RangeAxis, RangeAxisType);
+
+  /** Set/Get how many times wider than RangeSigma the bins of rare
+   *  intensities may get on an adaptive range axis. Default is 4. */
+  itkSetClampMacro(MaximumRangeStretch, double, 1.0,
+                   NumericTraits<double>::max());
+  itkGetConstMacro(MaximumRangeStretch, double);
+
+  /** Set/Get the splat subsampling: only one pixel in SplatSubsampling is
+   *  sorted into the grid. Default is 1. */
+  itkSetClampMacro(SplatSubsampling, unsigned int, 1,
+                   NumericTraits<unsigned int>::max());
+  itkGetConstMacro(SplatSubsampling, unsigned int);
+
+  /** Set/Get the width of the range bins in RangeSigma. Default is 1. */
+  itkSetClampMacro(RangeCoarsening, double, 1.0,
+                   NumericTraits<double>::max());
+  itkGetConstMacro(RangeCoarsening, double);
+
+  /** Convenience method setting SplatSubsampling to round(1/quality) and
+   *  RangeCoarsening to 1/sqrt(quality), for a quality in (0, 1]. A quality
+   *  of 1 is the exact grid path, 0.25 sorts a quarter of the pixels into
+   *  bins twice as wide. */
+  void SetQuality(const double quality)
+    {
+    const double q = std::min(1.0, std::max(quality, 1e-3));
+    this->SetSplatSubsampling(static_cast<unsigned int>(1.0/q + 0.5));
+    this->SetRangeCoarsening(1.0/vcl_sqrt(q));
     }
+
+  /** Set/Get the edge image. When set, its intensities drive the range axis
+   *  of the grids instead of those of the inputs. It must have the geometry
+   *  of the inputs. */
+  void SetEdgeImage(const InputImageType *edge)
+    {
+    this->ProcessObject::SetInput("EdgeImage",
+                                  const_cast<InputImageType *>(edge));
+    }
+  const InputImageType * GetEdgeImage() const
+    {
+    return static_cast<const InputImageType *>
+      (this->ProcessObject::GetInput("EdgeImage"));
+    }
+
+  /** Sets first NULL indexed input, appends to the end otherwise. Each
+   *  indexed input is filtered into the output of the same index. */
+  void AddInput(const InputImageType *input)
+    {
+    Superclass::AddInput(const_cast<InputImageType *>(input));
+    }
+
+  /** Number of images filtered together, i.e. of indexed inputs. */
+  unsigned int GetNumberOfChannels() const
+    {
+    return static_cast<unsigned int>(this->GetNumberOfIndexedInputs());
+    }
+
+  /** Free the range coordinates kept from the edge image. */
+  void ReleaseGuideCache();
+
+  /** Predicted cost of an update with the current parameters and number of
+   *  channels. In automatic grid mode the sparse grid is assumed when the
+   *  dense one would exceed MaximumDenseGridMemory, with at most a few
+   *  bricks per pixel of a spatial cell along the range axis, and the
+   *  streamed grid when the sparse one would not save enough. The range
+   *  axis is assumed uniform, which bounds the size of an adaptive one. */
+  typedef typename Superclass::CostEstimateType         CostEstimateType;
+  virtual CostEstimateType EstimateCost(const InputImageSizeType &size,
+                                        const InputImageSpacingType &spacing,
+                                        double intensityRange) const;
   
 protected:
   
-  /** Default Constructor. Default value for DomainSigma is 4. Default
-   *  value for RangeSigma is 50. These values were chosen match those of the
+  /** Default Constructor. The default DomainSigma of 4 and RangeSigma of
+   *  50 come from EdgePreservingSmoothingImageFilter and match those of the
    *  BilateralImageFilter */
   FastBilateralImageFilter()
     {
-    m_DomainSigma.Fill(4.0);
-    m_RangeSigma = 50.0;
+    m_GridPadding = 2;
+    m_GridMode = AutomaticGrid;
+    m_SelectedGridMode = DenseGrid;
+    m_MaximumDenseGridMemory = 64*1024*1024;
+    m_SplatSubsampling = 1;
+    m_RangeCoarsening = 1.0;
+    m_RangeAxis = UniformRangeAxis;
+    m_MaximumRangeStretch = 4.0;
+    m_GuideCacheImage = NULL;
+    m_GuideCacheTime = 0;
+    m_GuideDenseMemory = -1.0;
+    m_GuideSparseMemory = -1.0;
     }
   
   virtual ~FastBilateralImageFilter() {}
+
+  /** Create one output per indexed input. */
+  virtual void GenerateOutputInformation();
   
   /*
    * The FastBilateralImageFilter needs a larger input requested
@@ -140,49 +337,334 @@ protected:
   virtual void GenerateInputRequestedRegion()
     throw(InvalidRequestedRegionError);
 
-  /** Standard pipline method */
-  void GenerateData();
+  /** Build, blur and normalise the grid from the input */
+  void BeforeThreadedGenerateData();
+
+  /** Slice the grid to construct the output region of a thread. Streamed
+   *  grids are sliced while they are built. */
+  void ThreadedGenerateData(const OutputImageRegionType& outputRegionForThread,
+                            ThreadIdType threadId);
+
+  /** Release the grid */
+  void AfterThreadedGenerateData();
   
   /** Method to print member variables to an output stream */
   void PrintSelf(std::ostream& os, Indent indent) const;
   
   /** The type of image to use as the higher dimensional grid.
-   * The blurring is performed on this image type. */
+   * The blurring is performed on this image type. Each pixel holds the
+   * homogeneous pair (sum, weight), stored interleaved. */
   typedef typename
-  itk::Image<float, itkGetStaticConstMacro(ImageDimension)+1>
+  itk::VectorImage<float, itkGetStaticConstMacro(ImageDimension)+1>
     GridType;
   
+  /** Number of interleaved values per grid cell */
+  itkStaticConstMacro(GridComponents, unsigned int, 2);
+
   /** Grid types */
-  typedef typename GridType::PixelType                  GridPixelType;
+  typedef typename GridType::InternalPixelType          GridValueType;
   typedef typename GridType::IndexType                  GridIndexType;
   typedef typename GridType::SizeType                   GridSizeType;
   typedef typename
     Size<itkGetStaticConstMacro(ImageDimension)+1>::SizeValueType
                                                         GridSizeValueType;
   typedef typename GridType::RegionType                 GridRegionType;
-  
-  /** Grid image iterator type. */
-  typedef ImageRegionIterator<GridType>                 GridImageIteratorType;
-  typedef ImageRegionConstIterator<GridType>
-    GridImageConstIteratorType;
 
-  /** The type of blurring to use on the grid. */
-  typedef DiscreteGaussianImageFilter< GridType, GridType > BlurType;
- 
-  /** The type of interpolation done to calculate output pixels. */ 
-  typedef LinearInterpolateImageFunction<GridType, float>
-    InterpolatorType;
-  typedef typename InterpolatorType::ContinuousIndexType
-    InterpolatedIndexType;
+  /** Sparse storage of the grid */
+  typedef SparseBilateralGrid<itkGetStaticConstMacro(ImageDimension)+1,
+                              GridValueType>            SparseGridType;
+  typedef typename SparseGridType::Pointer              SparseGridPointer;
+
+  /** Map from the intensities of a channel to its range axis, in bins and
+   *  without the padding. The intensity is first scaled to
+   *  (value - Minimum)/BinWidth. On a uniform axis BinWidth is the width of
+   *  the range bins and Positions is empty. On an adaptive axis BinWidth is
+   *  that of the histogram buckets and Positions holds the range position
+   *  of every bucket bound, interpolated linearly in between. */
+  struct RangeMapType
+    {
+    InputPixelType        Minimum;
+    double                BinWidth;
+    std::vector<float>    Positions;
+
+    double Map(InputPixelType value) const
+      {
+      const double t = static_cast<double>(value - Minimum) / BinWidth;
+      if ( Positions.empty() )
+        {
+        return t;
+        }
+      const SizeValueType last = Positions.size() - 2;
+      const SizeValueType k = ( t <= 0.0 ) ? 0
+        : std::min(static_cast<SizeValueType>(t), last);
+      return Positions[k] + (t - k)*(Positions[k+1] - Positions[k]);
+      }
+    };
+
+  /** Build the range map of an image over the input requested region,
+   *  uniform or from the histogram of its intensities. */
+  void ComputeRangeMap(const InputImageType *image,
+                       InputPixelType minimum, InputPixelType maximum,
+                       RangeMapType &rangeMap) const;
+
+  /** Estimate the memory of the dense and of the sparse storage of a grid
+   *  of the given size, whose range axis follows the guide image. The
+   *  sparse one is estimated from the number of occupied bricks on a
+   *  subsample of the guide. */
+  void EstimateGridMemory(const GridSizeType &gridSize,
+                          const InputImageType *guide,
+                          const RangeMapType &rangeMap,
+                          double &denseMemory, double &sparseMemory);
+
+  /** Width of a range bin in intensity, RangeSigma*RangeCoarsening */
+  double GetRangeBinWidth() const
+    {
+    return this->GetRangeSigma()*m_RangeCoarsening;
+    }
+
+  /** Kernels of the blur of the spatial axes and of the range axis. */
+  void CreateBlurKernels(std::vector<double> &kernel,
+                         std::vector<double> &rangeKernel) const;
+
+  /** Number of planes of the ring of the streamed grid, those the kernel
+   *  reads around a plane blurred along the last spatial axis. */
+  static unsigned int StreamingRingDepth(const std::vector<double> &kernel)
+    {
+    return 2*static_cast<unsigned int>(kernel.size()/2) + 1;
+    }
+
+  /** Allocate a dense grid of the given size, filled with zeros */
+  typename GridType::Pointer AllocateGrid(const GridSizeType &size) const;
+
+  /** Offsets of the slicing tables in the dense grids m_Grids */
+  void ComputeSliceOffsets();
+
+  /** Build the dense or the sparse grids, one per channel: splat the
+   *  inputs, then blur and normalise. The spatial axes are blurred with
+   *  kernel and the range axis with rangeKernel. */
+  void GenerateDenseGrids(const std::vector<GridSizeType> &gridSizes,
+                          const std::vector<double> &kernel,
+                          const std::vector<double> &rangeKernel);
+  void GenerateSparseGrids(const std::vector<GridSizeType> &gridSizes,
+                           const std::vector<double> &kernel,
+                           const std::vector<double> &rangeKernel);
+
+  /** Sweep the grids plane by plane along the last spatial axis and slice
+   *  the output rows as soon as the planes they interpolate are final. */
+  void GenerateStreamedOutputs(const std::vector<GridSizeType> &gridSizes,
+                               const std::vector<double> &kernel,
+                               const std::vector<double> &rangeKernel);
+
+  /** Compute the range positions of the edge image, unless those kept from
+   *  the previous update are still valid. */
+  void UpdateGuideCache();
+
+  /** Offset of a pixel in the guide positions, i.e. in the input requested
+   *  region. */
+  OffsetValueType ComputeGuideOffset(const InputImageIndexType &index) const
+    {
+    OffsetValueType offset = 0;
+    for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      offset += (index[i] - m_GuideRegionIndex[i])*m_GuideRegionStrides[i];
+      }
+    return offset;
+    }
+
+  /** Slice the dense grids, or the window of the streamed ones. */
+  void ThreadedDenseSlice(const OutputImageRegionType& outputRegionForThread);
+
+  /** Slice the sparse grid, the counterpart of ThreadedDenseSlice. */
+  void ThreadedSparseSlice(const OutputImageRegionType& outputRegionForThread);
   
+  /** Private grid filled by one thread during the splat. It has the size of
+   *  the full grid except along the last spatial axis, where it only spans
+   *  the planes [PlaneBegin, PlaneEnd) reached by the thread's input slab. */
+  struct PrivateGridType
+    {
+    std::vector<GridValueType>  Values;
+    IndexValueType              PlaneBegin;
+    IndexValueType              PlaneEnd;
+    };
+
+  /** Data shared by the threads of the splat and its reduction. Either
+   *  Grids or SparseGrids is filled, with one grid per channel. Private
+   *  grids are indexed by threadId*NumberOfChannels + channel. */
+  struct SplatThreadStruct
+    {
+    Self                               *Filter;
+    std::vector<const InputImageType *> Inputs;
+    std::vector<GridType *>            Grids;
+    std::vector<SparseGridType *>      SparseGrids;
+    unsigned int                       NumberOfChannels;
+    DomainSigmaArrayType               DomainSigmaInPixels;
+    DomainSigmaArrayType               GridShift;
+    std::vector<RangeMapType>          RangeMaps;
+    int                                Padding;
+    unsigned int                       Subsampling;
+    /** Rows splatted into the current plane, when streaming */
+    typename InputImageType::RegionType Slab;
+    std::vector<PrivateGridType>       PrivateGrids;
+    std::vector<SparseGridPointer>     PrivateSparseGrids;
+    };
+
+  /** Sort the thread's slab of the inputs into its private grids. */
+  void ThreadedSplat(SplatThreadStruct *str, ThreadIdType threadId,
+                     ThreadIdType numberOfThreads);
+
+  /** Sum the private grids into the shared grids. Each thread owns a
+   *  disjoint set of grid planes so no locking is required. */
+  void ThreadedSplatReduce(SplatThreadStruct *str, ThreadIdType threadId,
+                           ThreadIdType numberOfThreads);
+
+  /** Sparse counterparts of the splat and its reduction. Every thread sorts
+   *  its slab into a private sparse grid. The shared grid holds the union of
+   *  their bricks and is reduced brick by brick. */
+  void ThreadedSparseSplat(SplatThreadStruct *str, ThreadIdType threadId,
+                           ThreadIdType numberOfThreads);
+  void ThreadedSparseSplatReduce(SplatThreadStruct *str, ThreadIdType threadId,
+                                 ThreadIdType numberOfThreads);
+
+  /** Streaming counterpart of the splat: sort str->Slab, whose rows all
+   *  fall into one plane, into the planes str->Grids. Threads own disjoint
+   *  cells along the axis before the last one. */
+  void ThreadedStreamSplat(SplatThreadStruct *str, ThreadIdType threadId,
+                           ThreadIdType numberOfThreads);
+
+  /** Static functions used to dispatch the splat to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE SplatThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE SplatReduceThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE StreamSplatThreaderCallback(void *arg);
+
+  /** Split [0, length) into numberOfPieces nearly equal parts and return
+   *  the bounds of the given piece. */
+  static void SplitRange(SizeValueType length, ThreadIdType piece,
+                         ThreadIdType numberOfPieces,
+                         SizeValueType &begin, SizeValueType &end)
+    {
+    begin = (length*piece)/numberOfPieces;
+    end   = (length*(piece+1))/numberOfPieces;
+    }
+
+  /** Offset along the first axis, from the start of a line, of the first
+   *  pixel the splat keeps: the first whose index components sum to a
+   *  multiple of subsampling. The next ones follow every subsampling
+   *  pixels. */
+  static IndexValueType FirstSubsample(const InputImageIndexType &lineStart,
+                                       IndexValueType subsampling)
+    {
+    IndexValueType phase = 0;
+    for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      phase += lineStart[i];
+      }
+    phase %= subsampling;
+    return ( phase > 0 ) ? subsampling - phase : -phase;
+    }
+
+  /** Data shared by the threads of one blur pass. The dense grid is blurred
+   *  in place through Buffer, the sparse one out of place when SparseGrid
+   *  is set. */
+  struct BlurThreadStruct
+    {
+    Self                  *Filter;
+    GridValueType         *Buffer;
+    SparseGridType        *SparseGrid;
+    GridSizeType          Size;
+    unsigned int          Axis;
+    bool                  Normalise;
+    std::vector<double>   Kernel;
+    };
+
+  /** Blur the grid along str->Axis in place. When str->Normalise is set,
+   *  each cell is also divided by its weight once it has been filtered. */
+  void ThreadedBlur(BlurThreadStruct *str, ThreadIdType threadId,
+                    ThreadIdType numberOfThreads);
+
+  /** Static function used to dispatch the blur to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE BlurThreaderCallback(void *arg);
+
+  /** Data shared by the threads blurring a streamed plane along the last
+   *  spatial axis. Planes holds the Kernel.size() planes around it in
+   *  order, each PlaneLength values per range bin. The previous plane of
+   *  the Window moves to its first half and the result goes to its second
+   *  half, normalised. */
+  struct StreamBlurThreadStruct
+    {
+    Self                                *Filter;
+    std::vector<const GridValueType *>  Planes;
+    GridValueType                       *Window;
+    SizeValueType                       PlaneLength;
+    SizeValueType                       RangeBins;
+    std::vector<double>                 Kernel;
+    };
+
+  /** Blur and normalise the thread's range bins of a streamed plane. */
+  void ThreadedStreamBlur(StreamBlurThreadStruct *str, ThreadIdType threadId,
+                          ThreadIdType numberOfThreads);
+
+  /** Output rows sliced from the window of the streamed grids */
+  struct SliceThreadStruct
+    {
+    Self                                *Filter;
+    OutputImageRegionType               Region;
+    };
+
+  /** Static functions used to dispatch the streamed blur and slicing to the
+   *  MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE StreamBlurThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE StreamSliceThreaderCallback(void *arg);
+
 private:
   
   FastBilateralImageFilter(const Self&);  // Not implemented on purpose
   
   void operator=(const Self&);            // Not implemented on purpose
   
-  double                m_RangeSigma;
-  DomainSigmaArrayType  m_DomainSigma;
+  GridModeType          m_GridMode;
+  GridModeType          m_SelectedGridMode;
+  SizeValueType         m_MaximumDenseGridMemory;
+  unsigned int          m_SplatSubsampling;
+  double                m_RangeCoarsening;
+  RangeAxisType         m_RangeAxis;
+  double                m_MaximumRangeStretch;
+
+  /** State shared between grid construction and the slicing threads,
+   *  with one grid and one range map per channel */
+  std::vector<typename GridType::Pointer>  m_Grids;
+  std::vector<SparseGridPointer>           m_SparseGrids;
+  std::vector<RangeMapType>                m_RangeMaps;
+  DomainSigmaArrayType          m_DomainSigmaInPixels;
+  /** Grid position of index 0 along each spatial axis, padding included */
+  DomainSigmaArrayType          m_GridShift;
+  int                           m_GridPadding;
+
+  /** Range positions of the edge image over the input requested region,
+   *  padding included, the map they come from and what they depend on */
+  std::vector<float>            m_GuidePositions;
+  InputImageIndexType           m_GuideRegionIndex;
+  OffsetValueType               m_GuideRegionStrides[itkGetStaticConstMacro(ImageDimension)];
+  const InputImageType          *m_GuideCacheImage;
+  ModifiedTimeType              m_GuideCacheTime;
+  typename InputImageType::RegionType m_GuideCacheRegion;
+  double                        m_GuideCacheRangeBinWidth;
+  RangeAxisType                 m_GuideCacheRangeAxis;
+  double                        m_GuideCacheRangeStretch;
+  DomainSigmaArrayType          m_GuideCacheDomainSigma;
+  RangeMapType                  m_GuideRangeMap;
+  InputPixelType                m_GuideIntensityMax;
+  /** Estimated memory of one channel grid, negative until estimated */
+  double                        m_GuideDenseMemory;
+  double                        m_GuideSparseMemory;
+
+  /** Per-axis slicing tables indexed by (index - m_SliceTableStart): the
+   *  index of the lower grid neighbour, its offset in the dense grids and
+   *  the weight of the upper neighbour. The spatial axes of all the
+   *  channel grids are identical, so the tables are shared. */
+  IndexValueType                m_SliceTableStart[itkGetStaticConstMacro(ImageDimension)];
+  std::vector<IndexValueType>   m_SliceIndices[itkGetStaticConstMacro(ImageDimension)];
+  std::vector<OffsetValueType>  m_SliceOffsets[itkGetStaticConstMacro(ImageDimension)];
+  std::vector<float>            m_SliceWeights[itkGetStaticConstMacro(ImageDimension)];
 
 };
 
@@ -4,7 +4,11 @@
 #include "itkFastBilateralImageFilter.h"
 
 #include "itkMinimumMaximumImageCalculator.h"
-#include "itkImageDuplicator.h"
+#include "itkImageLinearConstIteratorWithIndex.h"
+#include "itkGaussianOperator.h"
+#include "itkImageRegionConstIterator.h"
+
+#include <algorithm>
 
 namespace itk
 {
@@ -27,19 +31,19 @@ FastBilateralImageFilter<TInputImage,TOutputImage>
     return;
     }
 
-  // Pad the image by 2*sigma (pixel units)
+  // Pad the image by 3.5*sigma (pixel units)
   // this is done to ensure that nearby pixels are still
   // included in calculations
   // When the filter does the downsampling pixels are placed into
-  // bins based on their position/sigma. Therefore, assuming
-  // that the input region includes a pixel that would be placed into a new bin
-  // on its own, that bin and the bin beside it would need to be populated.
-  // Each bin can contain at most ceil(sigma) pixels
+  // bins based on their position/sigma. An output pixel interpolates the
+  // two cells around it, and the blur, of radius 2, spreads into those the
+  // cells up to 2 further away. Pixels are rounded to the nearest cell, so
+  // every pixel within 3.5 sigmas of the output pixel may contribute.
   InputImageSizeType radius;
   for (int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
     {
-    radius[i] = 
-    2*vcl_ceil(m_DomainSigma[i] / (this->GetInput()->GetSpacing()[i]));
+    radius[i] = static_cast<SizeValueType>(
+      vcl_ceil(3.5*this->GetDomainSigma()[i] / (this->GetInput()->GetSpacing()[i])));
     }
   
   // get a copy of the input requested region (should equal the output
@@ -54,6 +58,23 @@ FastBilateralImageFilter<TInputImage,TOutputImage>
   if ( inputRequestedRegion.Crop(inputPtr->GetLargestPossibleRegion()) )
     {
     inputPtr->SetRequestedRegion( inputRequestedRegion );
+
+    // The other channels and the edge image are read over the same region
+    for (unsigned int c = 1; c < this->GetNumberOfChannels(); ++c)
+      {
+      InputImagePointer channelPtr =
+        const_cast< TInputImage *>( this->GetInput(c) );
+      if ( channelPtr )
+        {
+        channelPtr->SetRequestedRegion( inputRequestedRegion );
+        }
+      }
+    InputImagePointer edgePtr =
+      const_cast< TInputImage *>( this->GetEdgeImage() );
+    if ( edgePtr )
+      {
+      edgePtr->SetRequestedRegion( inputRequestedRegion );
+      }
     return;
     }
   else
@@ -77,229 +98,1928 @@ FastBilateralImageFilter<TInputImage,TOutputImage>
 template< class TInputImage, class TOutputImage >
 void
 FastBilateralImageFilter<TInputImage, TOutputImage>
-::GenerateData()
+::GenerateOutputInformation()
+{
+  // One output per channel
+  const unsigned int channels = this->GetNumberOfChannels();
+  this->SetNumberOfIndexedOutputs(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    if ( !this->GetOutput(c) )
+      {
+      this->SetNthOutput(c, this->MakeOutput(c));
+      }
+    }
+
+  Superclass::GenerateOutputInformation();
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::BeforeThreadedGenerateData()
 {
-  this->AllocateOutputs();
   InputImageConstPointer input = this->GetInput();
-  OutputImagePointer output = this->GetOutput();
+  const unsigned int channels = this->GetNumberOfChannels();
   
   // Array to store domain sigmas, used during down-sampling and reconstruction
   DomainSigmaArrayType  domainSigmaInPixels;
+
+  // Position of index 0 in the grid along each spatial axis, in cells
+  DomainSigmaArrayType  gridShift;
   
-  // Minimum intensity of the input image,
-  //used during down-sampling and reconstruction
-  InputPixelType        intensityMin;
+  // Range map of each channel, from its intensities to its range axis,
+  // used during down-sampling and reconstruction
+  std::vector<RangeMapType> rangeMaps(channels);
   
-  // Define the GridType
-  // These are pointers to the source and destination of the blurring filter
-  // Data from the input will be sorted into the first two images while the
-  // second two images will provide the output data.
+  // Size of the grid of each channel
+  // Data from the inputs will be sorted into the grids, which are then
+  // blurred and normalised. Each cell holds (sum, weight).
   // The parameters are determined by the size of the input image and the
-  // values of m_DomainSigma and m_RangeSigma
-  typename GridType::Pointer gridImage = GridType::New();
-  typename GridType::Pointer gridWeight;
-  typename GridType::Pointer gridImageOut;
-  typename GridType::Pointer gridWeightOut;
+  // values of DomainSigma and RangeSigma. Only the range axis
+  // differs between channels.
+  std::vector<GridSizeType> gridSizes(channels);
 
   // The amount of padding around the grid images, required so that
   // interpolation is not done outside of the grid during reconstruction
   int padding = 2;
   
-  // Setup the higher dimensional grids (gridImage and gridWeight).
+  const typename InputImageType::RegionType & inputRegion =
+    input->GetRequestedRegion();
+
+  // Setup the higher dimensional grids.
   {
-  GridIndexType gridStartPos;
-  GridSizeType  gridSize;
-  
   // Convert domain sigmas from spacing units to pixel units
   // for the blurring in the grid.
-  // The set method for m_DomainSigma uses spacing units to be
+  // The set method for DomainSigma uses spacing units to be
   // consistent with the itkBilateralImageFilter implementation.
   // When the data is placed into bins in the grid the
   // itkDiscreteGaussianImageFilter will be run on the grid using
   // imageSpacingOff.
-  InputImageSizeType inputSize = input->GetRequestedRegion().GetSize();
-//  InputImageSizeType fullSize = input->GetLargestPossibleRegion().GetSize();
- 
+  // The cells are aligned on multiples of the sigmas from index 0 rather
+  // than from the start of the requested region, so that a region is
+  // binned as it would be within the whole image and streamed regions
+  // match. The first cell reached by the region follows the padding.
+  GridSizeType gridSize;
   const InputImageSpacingType& spacing = input->GetSpacing();
   for (int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
     {
-    domainSigmaInPixels[i] = m_DomainSigma[i] / spacing[i];
-    gridSize[i] = vcl_floor( (inputSize[i] - 1) / domainSigmaInPixels[i] )
-                  + 1 + 2*padding;
+    domainSigmaInPixels[i] = this->GetDomainSigma()[i] / spacing[i];
+    const IndexValueType firstIndex = inputRegion.GetIndex(i);
+    const IndexValueType lastIndex  = firstIndex + inputRegion.GetSize(i) - 1;
+    const double origin = vcl_floor(firstIndex / domainSigmaInPixels[i]);
+    gridShift[i] = padding - origin;
+    gridSize[i] = static_cast<GridSizeValueType>(
+      vcl_floor(lastIndex / domainSigmaInPixels[i]) - origin) + 1 + 2*padding;
     }
   
   // Determine min/max intensities to calculate grid size in the intensity axis
+  // These come from the edge image when there is one, and are then kept
+  // with its range positions between updates.
+  std::vector<InputPixelType> intensityMaxs(channels);
+  m_GridPadding = padding;
+  if ( this->GetEdgeImage() )
+    {
+    this->UpdateGuideCache();
+    std::fill(rangeMaps.begin(), rangeMaps.end(), m_GuideRangeMap);
+    std::fill(intensityMaxs.begin(), intensityMaxs.end(), m_GuideIntensityMax);
+    }
+  else
+    {
+    std::vector<float>().swap(m_GuidePositions);
+
+    typedef MinimumMaximumImageCalculator< InputImageType > MinMaxCalculatorType;
+    typename MinMaxCalculatorType::Pointer calculator =
+      MinMaxCalculatorType::New();
+
+    for (unsigned int c = 0; c < channels; ++c)
+      {
+      calculator->SetImage(this->GetInput(c));
+      calculator->SetRegion(input->GetRequestedRegion());
+      calculator->Compute();
+      intensityMaxs[c] = calculator->GetMaximum();
+      this->ComputeRangeMap(this->GetInput(c), calculator->GetMinimum(),
+                            intensityMaxs[c], rangeMaps[c]);
+      }
+    }
+
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    // All channels are read through the offsets of the first one
+    if ( this->GetInput(c)->GetBufferedRegion() != input->GetBufferedRegion() )
+      {
+      itkExceptionMacro(<< "Input " << c << " does not have the region of the first input.");
+      }
+
+    gridSizes[c] = gridSize;
+    gridSizes[c][itkGetStaticConstMacro(ImageDimension)] =
+      static_cast<GridSizeValueType>(rangeMaps[c].Map(intensityMaxs[c]))
+      + 1 + 2*padding;
+    }
+  }
+  
+  // Keep what the splat and the slicing threads need
+  m_DomainSigmaInPixels = domainSigmaInPixels;
+  m_GridShift = gridShift;
+  m_RangeMaps = rangeMaps;
+
+  std::vector<double> kernel;
+  std::vector<double> rangeKernel;
+  this->CreateBlurKernels(kernel, rangeKernel);
+
+  // Pick the storage of the grids. With an edge image all the channel grids
+  // have the same occupancy, which only depends on the edge image, so it is
+  // estimated once and kept with its range positions.
+  m_SelectedGridMode = m_GridMode;
+  if ( m_SelectedGridMode == AutomaticGrid )
+    {
+    double denseMemory = 0.0;
+    double sparseMemory = 0.0;
+    if ( this->GetEdgeImage() )
+      {
+      if ( m_GuideSparseMemory < 0.0 )
+        {
+        this->EstimateGridMemory(gridSizes[0], this->GetEdgeImage(),
+                                 rangeMaps[0],
+                                 m_GuideDenseMemory, m_GuideSparseMemory);
+        }
+      denseMemory = channels*m_GuideDenseMemory;
+      sparseMemory = channels*m_GuideSparseMemory;
+      }
+    else
+      {
+      for (unsigned int c = 0; c < channels; ++c)
+        {
+        double channelDense, channelSparse;
+        this->EstimateGridMemory(gridSizes[c], this->GetInput(c),
+                                 rangeMaps[c], channelDense, channelSparse);
+        denseMemory += channelDense;
+        sparseMemory += channelSparse;
+        }
+      }
+
+    // Small grids are always dense, and the sparse grid is slower per cell
+    // so it is only used when it saves a lot. Large grids that would stay
+    // dense are streamed instead when that keeps few of their planes.
+    const double streamingMemory = denseMemory*(StreamingRingDepth(kernel) + 2)
+      / gridSizes[0][itkGetStaticConstMacro(ImageDimension) - 1];
+    m_SelectedGridMode = DenseGrid;
+    if ( denseMemory > m_MaximumDenseGridMemory )
+      {
+      if ( 4*sparseMemory < denseMemory )
+        {
+        m_SelectedGridMode = SparseGrid;
+        }
+      else if ( 2*streamingMemory < denseMemory )
+        {
+        m_SelectedGridMode = StreamingGrid;
+        }
+      }
+    itkDebugMacro(<< "Grid mode " << m_SelectedGridMode
+                  << ", estimated " << sparseMemory << " bytes sparse, "
+                  << streamingMemory << " bytes streamed and "
+                  << denseMemory << " bytes dense");
+    }
+
+  // Slicing interpolates the grid at
+  // (index/domainSigmaInPixels + padding, range map of the intensity + padding).
+  // The spatial part is regular, so the lower grid index and interpolation
+  // weight along each spatial axis are tabulated once per index, for all
+  // channels.
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    const SizeValueType length = inputRegion.GetSize(i);
+    m_SliceTableStart[i] = inputRegion.GetIndex(i);
+    m_SliceIndices[i].resize(length);
+    m_SliceWeights[i].resize(length);
+    for (SizeValueType j = 0; j < length; ++j)
+      {
+      // The index is signed, regions may start below 0
+      const IndexValueType index =
+        m_SliceTableStart[i] + static_cast<IndexValueType>(j);
+      const double position = index / domainSigmaInPixels[i] + gridShift[i];
+      const IndexValueType lower = static_cast<IndexValueType>(position);
+      m_SliceIndices[i][j] = lower;
+      m_SliceWeights[i][j] = static_cast<float>(position - lower);
+      }
+    }
+
+  if ( m_SelectedGridMode == SparseGrid )
+    {
+    this->GenerateSparseGrids(gridSizes, kernel, rangeKernel);
+    }
+  else if ( m_SelectedGridMode == StreamingGrid )
+    {
+    // The outputs are sliced during the sweep, ThreadedGenerateData has
+    // nothing left to do
+    this->GenerateStreamedOutputs(gridSizes, kernel, rangeKernel);
+    }
+  else
+    {
+    this->GenerateDenseGrids(gridSizes, kernel, rangeKernel);
+    this->ComputeSliceOffsets();
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ComputeSliceOffsets()
+{
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    const OffsetValueType stride = m_Grids[0]->GetOffsetTable()[i];
+    const SizeValueType length = m_SliceIndices[i].size();
+    m_SliceOffsets[i].resize(length);
+    for (SizeValueType j = 0; j < length; ++j)
+      {
+      m_SliceOffsets[i][j] = GridComponents*m_SliceIndices[i][j]*stride;
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::UpdateGuideCache()
+{
+  const double rangeBinWidth = this->GetRangeBinWidth();
+  const InputImageType *edge = this->GetEdgeImage();
+  const typename InputImageType::RegionType & region =
+    this->GetInput()->GetRequestedRegion();
+  if ( edge->GetRequestedRegion() != region )
+    {
+    itkExceptionMacro(<< "The edge image does not cover the region of the input.");
+    }
+
+  const ModifiedTimeType edgeTime =
+    std::max(edge->GetMTime(), edge->GetUpdateMTime());
+  if ( edge == m_GuideCacheImage && edgeTime == m_GuideCacheTime
+       && region == m_GuideCacheRegion
+       && rangeBinWidth == m_GuideCacheRangeBinWidth
+       && m_RangeAxis == m_GuideCacheRangeAxis
+       && m_MaximumRangeStretch == m_GuideCacheRangeStretch
+       && this->GetDomainSigma() == m_GuideCacheDomainSigma
+       && !m_GuidePositions.empty() )
+    {
+    itkDebugMacro(<< "Reusing the range positions of the edge image");
+    return;
+    }
+
   typedef MinimumMaximumImageCalculator< InputImageType > MinMaxCalculatorType;
   typename MinMaxCalculatorType::Pointer calculator =
     MinMaxCalculatorType::New();
-
-  calculator->SetImage(input);
+  calculator->SetImage(edge);
+  calculator->SetRegion(region);
   calculator->Compute();
-  intensityMin = calculator->GetMinimum();
-  InputPixelType intensityMax = calculator->GetMaximum();
-  InputPixelType intensityDelta =
-    static_cast<InputPixelType>(intensityMax - intensityMin);  
-  gridSize[itkGetStaticConstMacro(ImageDimension)] =
-    static_cast<GridSizeValueType>((intensityDelta/m_RangeSigma)+1+2*padding);
-  
+  m_GuideIntensityMax = calculator->GetMaximum();
+  this->ComputeRangeMap(edge, calculator->GetMinimum(), m_GuideIntensityMax,
+                        m_GuideRangeMap);
+
+  // Positions are stored in the order of the region, first axis fastest
+  OffsetValueType stride = 1;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    m_GuideRegionIndex[i] = region.GetIndex(i);
+    m_GuideRegionStrides[i] = stride;
+    stride *= region.GetSize(i);
+    }
+
+  m_GuidePositions.resize(region.GetNumberOfPixels());
+  ImageRegionConstIterator<InputImageType> iterEdge(edge, region);
+  std::vector<float>::iterator position = m_GuidePositions.begin();
+  for ( iterEdge.GoToBegin(); !iterEdge.IsAtEnd(); ++iterEdge, ++position )
+    {
+    *position = static_cast<float>(m_GuideRangeMap.Map(iterEdge.Get()))
+      + m_GridPadding;
+    }
+
+  m_GuideCacheImage = edge;
+  m_GuideCacheTime = edgeTime;
+  m_GuideCacheRegion = region;
+  m_GuideCacheRangeBinWidth = rangeBinWidth;
+  m_GuideCacheRangeAxis = m_RangeAxis;
+  m_GuideCacheRangeStretch = m_MaximumRangeStretch;
+  m_GuideCacheDomainSigma = this->GetDomainSigma();
+  m_GuideDenseMemory = -1.0;
+  m_GuideSparseMemory = -1.0;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ReleaseGuideCache()
+{
+  std::vector<float>().swap(m_GuidePositions);
+  m_GuideCacheImage = NULL;
+  m_GuideCacheTime = 0;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::GenerateStreamedOutputs(const std::vector<GridSizeType> &gridSizes,
+                          const std::vector<double> &kernel,
+                          const std::vector<double> &rangeKernel)
+{
+  const unsigned int channels = this->GetNumberOfChannels();
+  const unsigned int lastAxis  = itkGetStaticConstMacro(ImageDimension) - 1;
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const IndexValueType planes = gridSizes[0][lastAxis];
+  const IndexValueType depth = static_cast<IndexValueType>(StreamingRingDepth(kernel));
+  const IndexValueType radius = depth/2;
+
+  // The grids are swept along the last spatial axis. Each plane is splatted
+  // and blurred along the other axes into a ring of the last depth planes.
+  // Once the planes around it are in the ring, a plane is blurred along the
+  // last axis and normalised into a window holding the two final planes
+  // that the output rows between them interpolate. Only depth + 2 planes
+  // per channel are ever allocated.
+  std::vector<typename GridType::Pointer> ring(depth*channels);
+  std::vector<GridSizeType> planeSizes(gridSizes);
+  m_Grids.resize(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    planeSizes[c][lastAxis] = 1;
+    for (IndexValueType slot = 0; slot < depth; ++slot)
+      {
+      ring[slot*channels + c] = this->AllocateGrid(planeSizes[c]);
+      }
+    GridSizeType windowSize = gridSizes[c];
+    windowSize[lastAxis] = 2;
+    m_Grids[c] = this->AllocateGrid(windowSize);
+    }
+
+  // Output rows are sliced from a window whose first plane is their lower
+  // plane, so their offset along the last axis is always zero
+  this->ComputeSliceOffsets();
+  std::fill(m_SliceOffsets[lastAxis].begin(), m_SliceOffsets[lastAxis].end(),
+            0);
+
+  SplatThreadStruct splat;
+  splat.Filter = this;
+  splat.NumberOfChannels = channels;
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    splat.Inputs.push_back(this->GetInput(c));
+    }
+  splat.Grids.resize(channels);
+  splat.DomainSigmaInPixels = m_DomainSigmaInPixels;
+  splat.RangeMaps = m_RangeMaps;
+  splat.Padding = m_GridPadding;
+  splat.GridShift = m_GridShift;
+  splat.Subsampling = m_SplatSubsampling;
+  splat.Slab = this->GetInput()->GetRequestedRegion();
+
+  BlurThreadStruct blur;
+  blur.Filter = this;
+  blur.SparseGrid = NULL;
+  blur.Normalise = false;
+
+  StreamBlurThreadStruct stream;
+  stream.Filter = this;
+  stream.Kernel = kernel;
+  stream.Planes.resize(depth);
+
+  SliceThreadStruct slice;
+  slice.Filter = this;
+  slice.Region = this->GetOutput()->GetRequestedRegion();
+
+  const double sigmaLast = m_DomainSigmaInPixels[lastAxis];
+  IndexValueType inputRow = splat.Slab.GetIndex(lastAxis);
+  const IndexValueType inputEnd = inputRow + splat.Slab.GetSize(lastAxis);
+  IndexValueType outputRow = slice.Region.GetIndex(lastAxis);
+  const IndexValueType outputEnd = outputRow + slice.Region.GetSize(lastAxis);
+
+  MultiThreader *threader = this->GetMultiThreader();
+  threader->SetNumberOfThreads(this->GetNumberOfThreads());
+  for (IndexValueType plane = 0; plane < planes + radius; ++plane)
+    {
+    // Splat the input rows binned into the plane, then blur it along all
+    // axes but the last spatial one. The plane replaces the oldest one of
+    // the ring, which is no longer needed.
+    if ( plane < planes )
+      {
+      const IndexValueType rowBegin = inputRow;
+      while ( inputRow < inputEnd
+              && static_cast<IndexValueType>(inputRow/sigmaLast + 0.5
+                                             + m_GridShift[lastAxis]) <= plane )
+        {
+        ++inputRow;
+        }
+      for (unsigned int c = 0; c < channels; ++c)
+        {
+        GridType *grid = ring[(plane % depth)*channels + c];
+        splat.Grids[c] = grid;
+        std::fill(grid->GetBufferPointer(), grid->GetBufferPointer() +
+          GridComponents*grid->GetLargestPossibleRegion().GetNumberOfPixels(),
+          0.0);
+        }
+      if ( inputRow > rowBegin )
+        {
+        splat.Slab.SetIndex(lastAxis, rowBegin);
+        splat.Slab.SetSize(lastAxis, inputRow - rowBegin);
+        threader->SetSingleMethod(this->StreamSplatThreaderCallback, &splat);
+        threader->SingleMethodExecute();
+
+        threader->SetSingleMethod(this->BlurThreaderCallback, &blur);
+        for (unsigned int c = 0; c < channels; ++c)
+          {
+          blur.Buffer = splat.Grids[c]->GetBufferPointer();
+          blur.Size = planeSizes[c];
+          for (blur.Axis = 0; blur.Axis <= rangeAxis; ++blur.Axis)
+            {
+            if ( blur.Axis != lastAxis )
+              {
+              blur.Kernel = ( blur.Axis == rangeAxis ) ? rangeKernel : kernel;
+              threader->SingleMethodExecute();
+              }
+            }
+          }
+        }
+      }
+
+    // Blur the plane radius behind along the last axis, with the zero flux
+    // boundary of the dense blur, and move it into the window
+    const IndexValueType current = plane - radius;
+    if ( current < 0 )
+      {
+      continue;
+      }
+    threader->SetSingleMethod(this->StreamBlurThreaderCallback, &stream);
+    for (unsigned int c = 0; c < channels; ++c)
+      {
+      for (IndexValueType t = 0; t < depth; ++t)
+        {
+        const IndexValueType source = std::min(planes - 1,
+          std::max<IndexValueType>(current + t - radius, 0));
+        stream.Planes[t] =
+          ring[(source % depth)*channels + c]->GetBufferPointer();
+        }
+      stream.Window = m_Grids[c]->GetBufferPointer();
+      stream.PlaneLength =
+        GridComponents*ring[c]->GetOffsetTable()[rangeAxis];
+      stream.RangeBins = gridSizes[c][rangeAxis];
+      threader->SingleMethodExecute();
+      }
+
+    // Slice the output rows that lie between the two planes of the window
+    const IndexValueType rowBegin = outputRow;
+    while ( outputRow < outputEnd
+            && m_SliceIndices[lastAxis][outputRow - m_SliceTableStart[lastAxis]]
+               < current )
+      {
+      ++outputRow;
+      }
+    if ( outputRow > rowBegin )
+      {
+      slice.Region.SetIndex(lastAxis, rowBegin);
+      slice.Region.SetSize(lastAxis, outputRow - rowBegin);
+      threader->SetSingleMethod(this->StreamSliceThreaderCallback, &slice);
+      threader->SingleMethodExecute();
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ComputeRangeMap(const InputImageType *image,
+                  InputPixelType minimum, InputPixelType maximum,
+                  RangeMapType &rangeMap) const
+{
+  const double rangeBinWidth = this->GetRangeBinWidth();
+  const double intensityRange = static_cast<double>(maximum - minimum);
+  rangeMap.Minimum = minimum;
+  rangeMap.BinWidth = rangeBinWidth;
+  rangeMap.Positions.clear();
+  if ( m_RangeAxis != AdaptiveRangeAxis || m_MaximumRangeStretch <= 1.0
+       || intensityRange <= rangeBinWidth )
+    {
+    // The uniform bins are aligned on multiples of their width, so that
+    // regions with different minima are binned alike
+    rangeMap.Minimum = static_cast<InputPixelType>(
+      vcl_floor(static_cast<double>(minimum)/rangeBinWidth)*rangeBinWidth);
+    return;
+    }
+
+  // Histogram of the intensities in buckets of a quarter of a range bin,
+  // with at most 2^16 buckets
+  const SizeValueType maximumBuckets = 1u << 16;
+  const SizeValueType buckets = std::min(maximumBuckets,
+    static_cast<SizeValueType>(vcl_ceil(4.0*intensityRange/rangeBinWidth)));
+  const double bucketWidth = intensityRange/buckets;
+  std::vector<double> counts(buckets + 1, 0.0);
+  ImageRegionConstIterator<InputImageType>
+    iterImage(image, this->GetInput()->GetRequestedRegion());
+  for ( iterImage.GoToBegin(); !iterImage.IsAtEnd(); ++iterImage )
+    {
+    const SizeValueType k = static_cast<SizeValueType>
+      (static_cast<double>(iterImage.Get() - minimum)/bucketWidth);
+    counts[std::min(k, buckets - 1) + 1] += 1.0;
+    }
+
+  // Density of each bucket, averaged over one range bin around it
+  for (SizeValueType k = 1; k <= buckets; ++k)
+    {
+    counts[k] += counts[k-1];
+    }
+  const SizeValueType halfWindow = static_cast<SizeValueType>
+    (0.5*rangeBinWidth/bucketWidth);
+  std::vector<double> densities(buckets);
+  for (SizeValueType k = 0; k < buckets; ++k)
+    {
+    const SizeValueType first = ( k > halfWindow ) ? k - halfWindow : 0;
+    const SizeValueType last = std::min(k + halfWindow + 1, buckets);
+    densities[k] = (counts[last] - counts[first])/(last - first);
+    }
+
+  // Buckets at least as dense as the median occupied bucket keep the
+  // resolution of the uniform axis, sparser ones are stretched by the
+  // ratio of the densities up to MaximumRangeStretch
+  std::vector<double> occupied;
+  for (SizeValueType k = 0; k < buckets; ++k)
+    {
+    if ( densities[k] > 0.0 )
+      {
+      occupied.push_back(densities[k]);
+      }
+    }
+  std::nth_element(occupied.begin(), occupied.begin() + occupied.size()/2,
+                   occupied.end());
+  const double reference = occupied[occupied.size()/2];
+
+  const double bucketBins = bucketWidth/rangeBinWidth;
+  rangeMap.BinWidth = bucketWidth;
+  rangeMap.Positions.resize(buckets + 1);
+  rangeMap.Positions[0] = 0.0;
+  double position = 0.0;
+  for (SizeValueType k = 0; k < buckets; ++k)
+    {
+    double stretch = m_MaximumRangeStretch;
+    if ( densities[k]*m_MaximumRangeStretch > reference )
+      {
+      stretch = std::max(1.0, reference/densities[k]);
+      }
+    position += bucketBins/stretch;
+    rangeMap.Positions[k+1] = static_cast<float>(position);
+    }
+  itkDebugMacro(<< "Adaptive range axis of " << position << " bins instead of "
+                << intensityRange/rangeBinWidth);
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::EstimateGridMemory(const GridSizeType &gridSize,
+                     const InputImageType *guide,
+                     const RangeMapType &rangeMap,
+                     double &denseMemory, double &sparseMemory)
+{
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+
+  // Small grids are always dense, there is nothing to gain
+  denseMemory = GridComponents*sizeof(GridValueType);
+  double bricks = 1.0;
+  SizeValueType brickGridSize[itkGetStaticConstMacro(ImageDimension)+1];
+  for (unsigned int i = 0; i <= rangeAxis; ++i)
+    {
+    denseMemory *= gridSize[i];
+    brickGridSize[i] = (gridSize[i] + SparseGridType::BrickEdge - 1)
+                       >> SparseGridType::BrickEdgeShift;
+    bricks *= brickGridSize[i];
+    }
+  if ( denseMemory <= m_MaximumDenseGridMemory )
+    {
+    sparseMemory = denseMemory;
+    return;
+    }
+
+  // Too many bricks to even mark them, the dense grid is hopeless
+  if ( bricks > double(1u << 26) )
+    {
+    sparseMemory = 0.0;
+    return;
+    }
+
+  // Mark the bricks reached by every other pixel along each axis
+  const typename InputImageType::RegionType & region =
+    this->GetInput()->GetRequestedRegion();
+  const SizeValueType numberOfBricks = static_cast<SizeValueType>(bricks);
+  std::vector<unsigned char> occupied(numberOfBricks, 0);
+  SizeValueType brickStrides[itkGetStaticConstMacro(ImageDimension)+1];
+  brickStrides[0] = 1;
+  for (unsigned int i = 1; i <= rangeAxis; ++i)
+    {
+    brickStrides[i] = brickStrides[i-1]*brickGridSize[i-1];
+    }
+
+  typedef ImageLinearConstIteratorWithIndex<TInputImage> LineIteratorType;
+  LineIteratorType iterLine(guide, region);
+  iterLine.SetDirection(0);
+  for ( iterLine.GoToBegin(); !iterLine.IsAtEnd(); iterLine.NextLine() )
+    {
+    InputImageIndexType index = iterLine.GetIndex();
+    SizeValueType lineBrick = 0;
+    bool skip = false;
+    for (unsigned int i = 1; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      if ( (index[i] - region.GetIndex(i)) & 1 )
+        {
+        skip = true;
+        break;
+        }
+      const IndexValueType bin = static_cast<IndexValueType>
+        (index[i]/m_DomainSigmaInPixels[i]+0.5+m_GridShift[i]);
+      lineBrick += (bin >> SparseGridType::BrickEdgeShift)*brickStrides[i];
+      }
+    if ( skip )
+      {
+      continue;
+      }
+    while ( !iterLine.IsAtEndOfLine() )
+      {
+      index = iterLine.GetIndex();
+      const IndexValueType bin = static_cast<IndexValueType>
+        (index[0]/m_DomainSigmaInPixels[0]+0.5+m_GridShift[0]);
+      const IndexValueType rangeBin = static_cast<IndexValueType>
+        (rangeMap.Map(iterLine.Get())+0.5+m_GridPadding);
+      occupied[lineBrick + (bin >> SparseGridType::BrickEdgeShift)
+               + (rangeBin >> SparseGridType::BrickEdgeShift)*brickStrides[rangeAxis]] = 1;
+      ++iterLine;
+      if ( !iterLine.IsAtEndOfLine() )
+        {
+        ++iterLine;
+        }
+      }
+    }
+
+  // The sparse grid also stores the neighbours of every brick reached
+  std::vector<unsigned char> dilated(numberOfBricks);
+  for (unsigned int i = 0; i <= rangeAxis; ++i)
+    {
+    for (SizeValueType b = 0; b < numberOfBricks; ++b)
+      {
+      const SizeValueType position = (b / brickStrides[i]) % brickGridSize[i];
+      unsigned char value = occupied[b];
+      if ( position > 0 )
+        {
+        value |= occupied[b - brickStrides[i]];
+        }
+      if ( position + 1 < brickGridSize[i] )
+        {
+        value |= occupied[b + brickStrides[i]];
+        }
+      dilated[b] = value;
+      }
+    occupied.swap(dilated);
+    }
+  const double storedBricks =
+    static_cast<double>(std::count(occupied.begin(), occupied.end(), 1));
+
+  // Bricks are double buffered during the blur, the hash table is at most
+  // half full
+  sparseMemory = storedBricks*
+    (2*sizeof(typename SparseGridType::BrickType)
+     + 5*sizeof(typename SparseGridType::KeyType));
+  itkDebugMacro(<< "Estimated " << storedBricks << " of " << bricks
+                << " bricks stored");
+}
+
+template< class TInputImage, class TOutputImage >
+typename FastBilateralImageFilter<TInputImage, TOutputImage>::GridType::Pointer
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::AllocateGrid(const GridSizeType &size) const
+{
+  typename GridType::Pointer grid = GridType::New();
+  {
+  GridIndexType gridStartPos;
   for(int i = 0; i < ImageDimension+1; ++i)
     {
     gridStartPos[i] = 0;
     }
-  
+
   GridRegionType region;
-  region.SetSize(gridSize);
+  region.SetSize(size);
   region.SetIndex(gridStartPos);
-  gridImage->SetRegions(region);
-  
+  grid->SetRegions(region);
+  grid->SetNumberOfComponentsPerPixel(GridComponents);
   }
-  
+
   // Allocate the memory for pixel data
-  // We now have an empty grid. Two will be needed total,
-  // one will be a container for the down-sampled data and one
-  // will remember how many pixels were placed into each bin
-  gridImage->Allocate();
+  // The first value of a cell is a container for the down-sampled data and
+  // the second will remember how many pixels were placed into the bin
+  grid->Allocate();
   // Init values of image to 0
-  gridImage->FillBuffer(0.0);
+  std::fill(grid->GetBufferPointer(), grid->GetBufferPointer() +
+    GridComponents*grid->GetLargestPossibleRegion().GetNumberOfPixels(), 0.0);
+  return grid;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::GenerateDenseGrids(const std::vector<GridSizeType> &gridSizes,
+                     const std::vector<double> &kernel,
+                     const std::vector<double> &rangeKernel)
+{
+  const unsigned int channels = this->GetNumberOfChannels();
+
+  m_Grids.resize(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    m_Grids[c] = this->AllocateGrid(gridSizes[c]);
+    }
   
-  // Duplicate our grid image for the weight image
+  // Sort the input images in the grids and keep track of the weights
+  // This is a scatter type operation. To run it on several threads without
+  // locking, every thread sorts a slab of the inputs into private grids,
+  // then the private grids are summed into the grids.
   {
-  typedef ImageDuplicator<GridType> DuplicatorType;
-  typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
-  duplicator->SetInputImage(gridImage);
-  duplicator->Update();
-  gridWeight = duplicator->GetOutput();
+  SplatThreadStruct str;
+  str.Filter = this;
+  str.NumberOfChannels = channels;
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    str.Inputs.push_back(this->GetInput(c));
+    str.Grids.push_back(m_Grids[c]);
+    }
+  str.DomainSigmaInPixels = m_DomainSigmaInPixels;
+  str.RangeMaps = m_RangeMaps;
+  str.Padding = m_GridPadding;
+  str.GridShift = m_GridShift;
+  str.Subsampling = m_SplatSubsampling;
+
+  this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+  str.PrivateGrids.resize(this->GetMultiThreader()->GetNumberOfThreads()*channels);
+
+  this->GetMultiThreader()->SetSingleMethod(this->SplatThreaderCallback, &str);
+  this->GetMultiThreader()->SingleMethodExecute();
+
+  this->GetMultiThreader()->SetSingleMethod(this->SplatReduceThreaderCallback,
+                                            &str);
+  this->GetMultiThreader()->SingleMethodExecute();
   }
   
-  // Sort the input image in gridImage and keep track of weights in gridWeight
-  {
-  InputImageConstIteratorType iterInputImage
-    (input, input->GetRequestedRegion());
-  GridIndexType       gridIndices;
-  int                 i;
-  InputPixelType      current;
-  InputPixelType      intensityDelta;
-  InputImageIndexType index;
-  
-  // For every pixel in the input image, place it into a bin in the grid
-  // This is a scatter type operation and will be inefficient, as far as I
-  // know, there is no way to place the pixels into the grid using iterators
-  for ( iterInputImage.GoToBegin(); !iterInputImage.IsAtEnd();
-        ++iterInputImage)
+  // Perform blurring on the grids, in place
+  for (unsigned int c = 0; c < channels; ++c)
     {
-    index = iterInputImage.GetIndex();
-    current = iterInputImage.Get();
-    // Determine the position in the grid to place the pixel
-    for ( i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    BlurThreadStruct str;
+    str.Filter = this;
+    str.Buffer = m_Grids[c]->GetBufferPointer();
+    str.SparseGrid = NULL;
+    str.Size = gridSizes[c];
+    str.Normalise = false;
+  
+    // One pass per grid axis, each pass filters sums and weights together.
+    // Early division; in Paris and Durand's implementation early division can
+    // be done on the grid image, or interpolation on both the bin and the
+    // weights can be done then the division. Interpolation is an expensive
+    // operation so I've opted for the early division approach. It is done by
+    // the last blur pass as soon as a cell is final.
+    this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+    this->GetMultiThreader()->SetSingleMethod(this->BlurThreaderCallback, &str);
+    for (str.Axis = 0; str.Axis <= itkGetStaticConstMacro(ImageDimension);
+         ++str.Axis)
       {
-      gridIndices[i] = static_cast<GridSizeValueType>
-        (index[i]/domainSigmaInPixels[i]+0.5+padding);
+      str.Normalise = ( str.Axis == itkGetStaticConstMacro(ImageDimension) );
+      str.Kernel = str.Normalise ? rangeKernel : kernel;
+      this->GetMultiThreader()->SingleMethodExecute();
       }
-    intensityDelta = current - intensityMin;
-    gridIndices[itkGetStaticConstMacro(ImageDimension)] =
-      static_cast<GridSizeValueType>(intensityDelta/m_RangeSigma+0.5+padding);
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::GenerateSparseGrids(const std::vector<GridSizeType> &gridSizes,
+                      const std::vector<double> &kernel,
+                      const std::vector<double> &rangeKernel)
+{
+  const unsigned int channels = this->GetNumberOfChannels();
 
-    // Update the bin and the weight
-    (gridImage->GetPixel(gridIndices))    += current;
-    (gridWeight->GetPixel(gridIndices)) += 1.0;
+  m_SparseGrids.resize(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    m_SparseGrids[c] = SparseGridType::New();
+    m_SparseGrids[c]->SetGridSize(gridSizes[c]);
     }
-  }
-  
-  // Perform blurring on gridImage and gridWeight
-  // outputs are pointed to by gridImageOut and gridWeightOut
+
+  // Sort the input images in private sparse grids, one per thread and
+  // channel, then store the union of their bricks and neighbours in the
+  // grids and sum them
   {
-  
-  // This variance approximately corresponds to a 1D filter of [1 2 1] which is
-  // used in Paris and Durands C++ implementation to blur their down-sampled
-  // data. With this variance a kernel width larger than 5 is not necessary.
-  double      variance  = 1.59577;
-  int         maxWidth  = 5;
-  
-  // Setup the Gaussian filter
-  typename BlurType::Pointer gridImageBlurFilter  = BlurType::New();
-  typename BlurType::Pointer gridWeightBlurFilter = BlurType::New();
+  SplatThreadStruct str;
+  str.Filter = this;
+  str.NumberOfChannels = channels;
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    str.Inputs.push_back(this->GetInput(c));
+    str.SparseGrids.push_back(m_SparseGrids[c]);
+    }
+  str.DomainSigmaInPixels = m_DomainSigmaInPixels;
+  str.RangeMaps = m_RangeMaps;
+  str.Padding = m_GridPadding;
+  str.GridShift = m_GridShift;
+  str.Subsampling = m_SplatSubsampling;
 
-  gridImageBlurFilter ->SetVariance(variance);
-  gridWeightBlurFilter->SetVariance(variance);
-  
-  gridImageBlurFilter ->SetUseImageSpacingOff();
-  gridWeightBlurFilter->SetUseImageSpacingOff();
-  
-  gridImageBlurFilter ->SetMaximumKernelWidth(maxWidth);
-  gridWeightBlurFilter->SetMaximumKernelWidth(maxWidth);
-  
-  gridImageBlurFilter ->SetInput(gridImage);
-  gridWeightBlurFilter->SetInput(gridWeight);
-  
-  gridImageOut  = gridImageBlurFilter ->GetOutput();
-  gridWeightOut = gridWeightBlurFilter->GetOutput();
+  this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+  str.PrivateSparseGrids.resize(this->GetMultiThreader()->GetNumberOfThreads()*channels);
 
-  gridImageBlurFilter ->Update();
-  gridWeightBlurFilter->Update();
-  }
-  
-  // Early division; in Paris and Durand's implementation early division can
-  // be done on the grid image, or interpolation on both the bin and the
-  // weights can be done then the division. Interpolation is an expensive
-  // operation so I've opted for the early division approach.
-  {
-  GridImageIteratorType iterGridImage
-    (gridImageOut, gridImageOut->GetLargestPossibleRegion());
-  GridImageConstIteratorType iterGridWeight
-    (gridWeightOut, gridWeightOut->GetLargestPossibleRegion());
-  
-  GridPixelType weight;
-  
-  for ( iterGridImage.GoToBegin(), iterGridWeight.GoToBegin();
-  !iterGridImage.IsAtEnd(); ++iterGridImage, ++iterGridWeight)
+  this->GetMultiThreader()->SetSingleMethod(this->SplatThreaderCallback, &str);
+  this->GetMultiThreader()->SingleMethodExecute();
+
+  for (size_t p = 0; p < str.PrivateSparseGrids.size(); ++p)
     {
-    if ( (weight = iterGridWeight.Get() ) != 0.0 )
+    const SparseGridType *privateGrid = str.PrivateSparseGrids[p];
+    SparseGridType *grid = m_SparseGrids[p % channels];
+    for (SizeValueType slot = 0; slot < privateGrid->GetNumberOfBricks(); ++slot)
       {
-      iterGridImage.Value() /= weight;
+      grid->InsertBrick(privateGrid->GetKey(slot));
       }
     }
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    m_SparseGrids[c]->Dilate();
+    }
+
+  this->GetMultiThreader()->SetSingleMethod(this->SplatReduceThreaderCallback,
+                                            &str);
+  this->GetMultiThreader()->SingleMethodExecute();
   }
-    
+
+  // Blur brick by brick, ping-ponging between the two buffers of each grid
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    SparseGridType *grid = m_SparseGrids[c];
+    BlurThreadStruct str;
+    str.Filter = this;
+    str.Buffer = NULL;
+    str.SparseGrid = grid;
+    str.Size = gridSizes[c];
+    str.Normalise = false;
+
+    grid->AllocateBackBuffer();
+    this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+    this->GetMultiThreader()->SetSingleMethod(this->BlurThreaderCallback, &str);
+    for (str.Axis = 0; str.Axis <= itkGetStaticConstMacro(ImageDimension);
+         ++str.Axis)
+      {
+      str.Normalise = ( str.Axis == itkGetStaticConstMacro(ImageDimension) );
+      str.Kernel = str.Normalise ? rangeKernel : kernel;
+      this->GetMultiThreader()->SingleMethodExecute();
+      grid->SwapBuffers();
+      }
+    grid->ReleaseBackBuffer();
+
+    itkDebugMacro(<< "Sparse grid " << c << " of " << grid->GetNumberOfBricks()
+                  << " bricks, " << grid->GetMemorySize() << " bytes");
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedGenerateData(const OutputImageRegionType& outputRegionForThread,
+                       ThreadIdType itkNotUsed(threadId))
+{
+  if ( !m_SparseGrids.empty() )
+    {
+    this->ThreadedSparseSlice(outputRegionForThread);
+    }
+  else if ( m_SelectedGridMode != StreamingGrid )
+    {
+    this->ThreadedDenseSlice(outputRegionForThread);
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedDenseSlice(const OutputImageRegionType& outputRegionForThread)
+{
   // Perform interpolation in order to construct the output.
   // For every pixel in the input image, determine where in the grid the pixel
   // was placed and interpolate for the output pixel's value.
-  {
+  // The grid has ImageDimension+1 axes, so every output pixel blends
+  // 2^(ImageDimension+1) grid values. Along a line of the fastest image axis
+  // the corners contributed by the other spatial axes do not change, so they
+  // are computed once per line and shared by all channels. The range
+  // coordinates of a line are staged in contiguous arrays first, which keeps
+  // the per-pixel loops short and friendly to the compiler's vectorizer.
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const unsigned int lineCorners =
+    1u << (itkGetStaticConstMacro(ImageDimension) - 1);
+  const unsigned int channels = this->GetNumberOfChannels();
+
+  InputImageConstPointer input = this->GetInput();
 
-  OutputImageIteratorType     iterOutputImage
-    (output, output->GetRequestedRegion());
-  InputImageConstIteratorType iterInputImage
-    (input, output->GetRequestedRegion());
+  // Offsets are in grid values, i.e. pixel offsets times GridComponents.
+  // After the early division the first value of every cell is the result.
+  // The channel grids only differ along the range axis, which is the
+  // slowest, so they share their strides.
+  const OffsetValueType *gridStrides = m_Grids[0]->GetOffsetTable();
+  const OffsetValueType rangeStride = GridComponents*gridStrides[rangeAxis];
+  const OffsetValueType xStride = GridComponents;
+
+  const SizeValueType lineLength = outputRegionForThread.GetSize(0);
+  std::vector<OffsetValueType> rangeOffsets(lineLength);
+  std::vector<float>           rangeWeights(lineLength);
+
+  OffsetValueType lineCornerOffsets[1u << (itkGetStaticConstMacro(ImageDimension) - 1)];
+  float           lineCornerWeights[1u << (itkGetStaticConstMacro(ImageDimension) - 1)];
+
+  typedef ImageLinearConstIteratorWithIndex<TInputImage> LineIteratorType;
+  LineIteratorType iterLine(input, outputRegionForThread);
+  iterLine.SetDirection(0);
+  for ( iterLine.GoToBegin(); !iterLine.IsAtEnd(); iterLine.NextLine() )
+    {
+    const InputImageIndexType lineIndex = iterLine.GetIndex();
+    const OffsetValueType inputOffset = input->ComputeOffset(lineIndex);
+
+    // Corners of the spatial axes other than the fastest one
+    for (unsigned int c = 0; c < lineCorners; ++c)
+      {
+      lineCornerOffsets[c] = 0;
+      lineCornerWeights[c] = 1.0;
+      for (unsigned int i = 1; i < itkGetStaticConstMacro(ImageDimension); ++i)
+        {
+        const SizeValueType j = lineIndex[i] - m_SliceTableStart[i];
+        const float weight = m_SliceWeights[i][j];
+        lineCornerOffsets[c] += m_SliceOffsets[i][j];
+        if ( c & (1u << (i-1)) )
+          {
+          lineCornerOffsets[c] += GridComponents*gridStrides[i];
+          lineCornerWeights[c] *= weight;
+          }
+        else
+          {
+          lineCornerWeights[c] *= 1.0 - weight;
+          }
+        }
+      }
+
+    const SizeValueType first = lineIndex[0] - m_SliceTableStart[0];
+    const OffsetValueType *xOffsets = &m_SliceOffsets[0][first];
+    const float *xWeights = &m_SliceWeights[0][first];
+    const float *guide = m_GuidePositions.empty() ? NULL
+      : &m_GuidePositions[this->ComputeGuideOffset(lineIndex)];
+
+    for (unsigned int channel = 0; channel < channels; ++channel)
+      {
+      const GridValueType *grid = m_Grids[channel]->GetBufferPointer();
+      const InputPixelType *current =
+        this->GetInput(channel)->GetBufferPointer() + inputOffset;
+      OutputImageType *output = this->GetOutput(channel);
+      OutputPixelType *out =
+        output->GetBufferPointer() + output->ComputeOffset(lineIndex);
+      const RangeMapType &rangeMap = m_RangeMaps[channel];
 
-  InterpolatedIndexType gridIndices;
-  int i;
-  InputPixelType current;
-  InputPixelType intensityDelta;
+      // Range coordinates of the whole line, from the input or the edge image
+      for (SizeValueType k = 0; k < lineLength; ++k)
+        {
+        const float position = guide ? guide[k] :
+          static_cast<float>(rangeMap.Map(current[k])) + m_GridPadding;
+        const IndexValueType lower = static_cast<IndexValueType>(position);
+        rangeOffsets[k] = lower*rangeStride;
+        rangeWeights[k] = position - lower;
+        }
+
+      // Blend the corners
+      for (SizeValueType k = 0; k < lineLength; ++k)
+        {
+        const float wx = xWeights[k];
+        const float wr = rangeWeights[k];
+        const OffsetValueType offset = xOffsets[k] + rangeOffsets[k];
+        float value = 0.0;
+        for (unsigned int c = 0; c < lineCorners; ++c)
+          {
+          const GridValueType *g = grid + lineCornerOffsets[c] + offset;
+          const float lo = (1.0f-wx)*g[0] + wx*g[xStride];
+          const float hi = (1.0f-wx)*g[rangeStride] + wx*g[rangeStride+xStride];
+          value += lineCornerWeights[c]*((1.0f-wr)*lo + wr*hi);
+          }
+        out[k] = static_cast<OutputPixelType>(value);
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSparseSlice(const OutputImageRegionType& outputRegionForThread)
+{
+  // Same interpolation as the dense slicing, with every corner looked up
+  // in the sparse grids. Neighbouring pixels mostly read the same bricks, so
+  // the last brick found for each corner of each channel is kept to skip
+  // most hash probes. Cells of missing bricks hold no data and read as zero.
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const unsigned int corners =
+    1u << (itkGetStaticConstMacro(ImageDimension) + 1);
+  const unsigned int channels = this->GetNumberOfChannels();
+
+  typedef typename SparseGridType::KeyType    KeyType;
+  typedef typename SparseGridType::IndexType  CellType;
+  std::vector<KeyType> cachedKeys(channels*corners,
+                                  NumericTraits<KeyType>::max());
+  std::vector<const GridValueType *> cachedBricks(channels*corners,
+                                                  static_cast<const GridValueType *>(NULL));
+
+  InputImageConstPointer input = this->GetInput();
+  std::vector<const InputPixelType *> inputBuffers(channels);
+  std::vector<OutputPixelType *> outputBuffers(channels);
+  for (unsigned int channel = 0; channel < channels; ++channel)
+    {
+    inputBuffers[channel] = this->GetInput(channel)->GetBufferPointer();
+    outputBuffers[channel] = this->GetOutput(channel)->GetBufferPointer();
+    }
+  OutputImagePointer output = this->GetOutput();
+
+  InputImageConstIteratorType iterInput(input, outputRegionForThread);
+  CellType lower;
+  CellType cell;
+  float    weights[itkGetStaticConstMacro(ImageDimension) + 1];
+  for ( iterInput.GoToBegin(); !iterInput.IsAtEnd(); ++iterInput )
+    {
+    const InputImageIndexType index = iterInput.GetIndex();
+    for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+      {
+      const SizeValueType j = index[i] - m_SliceTableStart[i];
+      lower[i] = m_SliceIndices[i][j];
+      weights[i] = m_SliceWeights[i][j];
+      }
+    const OffsetValueType inputOffset = input->ComputeOffset(index);
+    const OffsetValueType outputOffset = output->ComputeOffset(index);
+
+    for (unsigned int channel = 0; channel < channels; ++channel)
+      {
+      const SparseGridType *grid = m_SparseGrids[channel];
+      const float position = m_GuidePositions.empty()
+        ? static_cast<float>(m_RangeMaps[channel].Map(
+                               inputBuffers[channel][inputOffset]))
+          + m_GridPadding
+        : m_GuidePositions[this->ComputeGuideOffset(index)];
+      lower[rangeAxis] = static_cast<IndexValueType>(position);
+      weights[rangeAxis] = position - lower[rangeAxis];
+
+      KeyType *keys = &cachedKeys[channel*corners];
+      const GridValueType **bricks = &cachedBricks[channel*corners];
+      float value = 0.0;
+      for (unsigned int c = 0; c < corners; ++c)
+        {
+        float weight = 1.0;
+        for (unsigned int i = 0; i <= rangeAxis; ++i)
+          {
+          if ( c & (1u << i) )
+            {
+            cell[i] = lower[i] + 1;
+            weight *= weights[i];
+            }
+          else
+            {
+            cell[i] = lower[i];
+            weight *= 1.0f - weights[i];
+            }
+          }
+        const KeyType key = grid->ComputeKey(cell);
+        if ( key != keys[c] )
+          {
+          keys[c] = key;
+          bricks[c] = grid->FindBrick(key);
+          }
+        if ( bricks[c] )
+          {
+          value += weight*bricks[c][SparseGridType::ComputeCellOffset(cell)];
+          }
+        }
+      outputBuffers[channel][outputOffset] = static_cast<OutputPixelType>(value);
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::AfterThreadedGenerateData()
+{
+  // The grids can be large, do not keep them around between updates
+  m_Grids.clear();
+  m_SparseGrids.clear();
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    std::vector<IndexValueType>().swap(m_SliceIndices[i]);
+    std::vector<OffsetValueType>().swap(m_SliceOffsets[i]);
+    std::vector<float>().swap(m_SliceWeights[i]);
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSplat(SplatThreadStruct *str, ThreadIdType threadId,
+                ThreadIdType numberOfThreads)
+{
+  const unsigned int lastAxis  = itkGetStaticConstMacro(ImageDimension) - 1;
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const unsigned int channels  = str->NumberOfChannels;
+  PrivateGridType *privateGrids = &str->PrivateGrids[threadId*channels];
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    privateGrids[c].PlaneBegin = 0;
+    privateGrids[c].PlaneEnd = 0;
+    }
+
+  // Slab of the inputs sorted by this thread
+  const InputImageType *input = str->Inputs[0];
+  typename InputImageType::RegionType slab = input->GetRequestedRegion();
+  SizeValueType begin, end;
+  SplitRange(slab.GetSize(lastAxis), threadId, numberOfThreads, begin, end);
+  if ( begin == end )
+    {
+    return;
+    }
+  slab.SetIndex(lastAxis, slab.GetIndex(lastAxis) + begin);
+  slab.SetSize(lastAxis, end - begin);
+
+  // Grid planes reached by the slab along the last spatial axis
+  const double sigmaLast = str->DomainSigmaInPixels[lastAxis];
+  const IndexValueType firstIndex = slab.GetIndex(lastAxis);
+  const IndexValueType lastIndex  = firstIndex + slab.GetSize(lastAxis) - 1;
+  const IndexValueType planeBegin = static_cast<GridSizeValueType>
+    (firstIndex/sigmaLast+0.5+str->GridShift[lastAxis]);
+  const IndexValueType planeEnd = static_cast<GridSizeValueType>
+    (lastIndex/sigmaLast+0.5+str->GridShift[lastAxis]) + 1;
+
+  // Layout of the private grids, identical to the shared grids except along
+  // the last spatial axis. Strides are in grid values, i.e. GridComponents
+  // per cell, and only the number of range bins differs between channels.
+  GridSizeType privateSize =
+    str->Grids[0]->GetLargestPossibleRegion().GetSize();
+  privateSize[lastAxis] = planeEnd - planeBegin;
+  OffsetValueType strides[itkGetStaticConstMacro(ImageDimension)+1];
+  strides[0] = GridComponents;
+  for (unsigned int i = 1; i <= rangeAxis; ++i)
+    {
+    strides[i] = strides[i-1]*privateSize[i-1];
+    }
+
+  std::vector<GridValueType *>        grids(channels);
+  std::vector<const InputPixelType *> inputBuffers(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    const SizeValueType rangeBins =
+      str->Grids[c]->GetLargestPossibleRegion().GetSize(rangeAxis);
+    privateGrids[c].PlaneBegin = planeBegin;
+    privateGrids[c].PlaneEnd = planeEnd;
+    privateGrids[c].Values.assign(strides[rangeAxis]*rangeBins, 0.0);
+    grids[c] = &privateGrids[c].Values[0];
+    inputBuffers[c] = str->Inputs[c]->GetBufferPointer();
+    }
+
+  // For every pixel in the slab, place it into a bin in the private grid of
+  // every channel. The spatial bin is shared by all channels.
+  const float *guidePositions =
+    m_GuidePositions.empty() ? NULL : &m_GuidePositions[0];
+  // The pixels are visited along the lines of the first axis, stepping
+  // over those left out by the subsampling
+  const IndexValueType subsampling = str->Subsampling;
+  typename InputImageType::RegionType lines = slab;
+  const IndexValueType lineLength = slab.GetSize(0);
+  lines.SetSize(0, 1);
+  InputImageConstIteratorType iterLines(input, lines);
+  InputPixelType      current;
   InputImageIndexType index;
-  typename InterpolatorType::Pointer interpolator = InterpolatorType::New();
-  interpolator->SetInputImage(gridImageOut);
+  OffsetValueType     offset;
+  IndexValueType      bin;
+  for ( iterLines.GoToBegin(); !iterLines.IsAtEnd(); ++iterLines )
+    {
+    index = iterLines.GetIndex();
+    const IndexValueType lineStart = index[0];
+    for (IndexValueType x = FirstSubsample(index, subsampling); x < lineLength;
+         x += subsampling)
+      {
+      index[0] = lineStart + x;
+      // Determine the position in the grid to place the pixel
+      offset = 0;
+      for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+        {
+        bin = static_cast<GridSizeValueType>
+          (index[i]/str->DomainSigmaInPixels[i]+0.5+str->GridShift[i]);
+        offset += bin*strides[i];
+        }
+      offset -= planeBegin*strides[lastAxis];
+      const OffsetValueType inputOffset = input->ComputeOffset(index);
+
+      for (unsigned int c = 0; c < channels; ++c)
+        {
+        current = inputBuffers[c][inputOffset];
+        if ( guidePositions )
+          {
+          bin = static_cast<GridSizeValueType>
+            (guidePositions[this->ComputeGuideOffset(index)]+0.5);
+          }
+        else
+          {
+          bin = static_cast<GridSizeValueType>
+            (str->RangeMaps[c].Map(current)+0.5+str->Padding);
+          }
 
-  for ( iterOutputImage.GoToBegin(), iterInputImage.GoToBegin();
-        !iterOutputImage.IsAtEnd();  ++iterOutputImage, ++iterInputImage)
+        // Update the bin and the weight
+        GridValueType *cellValues = grids[c] + offset + bin*strides[rangeAxis];
+        cellValues[0] += current;
+        cellValues[1] += 1.0;
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSplatReduce(SplatThreadStruct *str, ThreadIdType threadId,
+                      ThreadIdType numberOfThreads)
+{
+  const unsigned int lastAxis  = itkGetStaticConstMacro(ImageDimension) - 1;
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const unsigned int channels  = str->NumberOfChannels;
+
+  for (unsigned int c = 0; c < channels; ++c)
     {
-    index = iterInputImage.GetIndex();
-    current = iterInputImage.Get();
-    // Determine the position in the grid to get the data from
-    for ( i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    const GridSizeType gridSize =
+      str->Grids[c]->GetLargestPossibleRegion().GetSize();
+    const OffsetValueType *gridStrides = str->Grids[c]->GetOffsetTable();
+
+    // A grid plane holds every axis before the last spatial one and is
+    // contiguous in memory. Planes are indexed by (range bin, last axis bin).
+    const SizeValueType planeLength = GridComponents*gridStrides[lastAxis];
+    const SizeValueType planesPerBin = gridSize[lastAxis];
+    SizeValueType begin, end;
+    SplitRange(planesPerBin*gridSize[rangeAxis], threadId, numberOfThreads,
+               begin, end);
+
+    GridValueType *grid = str->Grids[c]->GetBufferPointer();
+    for (SizeValueType plane = begin; plane < end; ++plane)
       {
-      gridIndices[i] = index[i] / domainSigmaInPixels[i] + padding;
+      const IndexValueType rangeBin = plane / planesPerBin;
+      const IndexValueType lastBin  = plane % planesPerBin;
+      GridValueType *dst = grid + plane*planeLength;
+      for (size_t t = c; t < str->PrivateGrids.size(); t += channels)
+        {
+        const PrivateGridType &privateGrid = str->PrivateGrids[t];
+        if ( lastBin < privateGrid.PlaneBegin || lastBin >= privateGrid.PlaneEnd )
+          {
+          continue;
+          }
+        const SizeValueType privatePlanes =
+          privateGrid.PlaneEnd - privateGrid.PlaneBegin;
+        const SizeValueType srcOffset =
+          (rangeBin*privatePlanes + lastBin - privateGrid.PlaneBegin)*planeLength;
+        const GridValueType *src = &privateGrid.Values[srcOffset];
+        for (SizeValueType j = 0; j < planeLength; ++j)
+          {
+          dst[j] += src[j];
+          }
+        }
       }
-    
-    intensityDelta = current - intensityMin;
-    
-    gridIndices[itkGetStaticConstMacro(ImageDimension)] =
-      intensityDelta / m_RangeSigma + padding;
-    
-    iterOutputImage.Set( static_cast<OutputPixelType>
-      (interpolator->EvaluateAtContinuousIndex(gridIndices))
-    );
-    
     }
-  }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSparseSplat(SplatThreadStruct *str, ThreadIdType threadId,
+                      ThreadIdType numberOfThreads)
+{
+  const unsigned int lastAxis  = itkGetStaticConstMacro(ImageDimension) - 1;
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const unsigned int channels  = str->NumberOfChannels;
+  SparseGridPointer *privateGrids = &str->PrivateSparseGrids[threadId*channels];
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    privateGrids[c] = SparseGridType::New();
+    privateGrids[c]->SetGridSize(str->SparseGrids[c]->GetGridSize());
+    }
+
+  // Slab of the inputs sorted by this thread
+  const InputImageType *input = str->Inputs[0];
+  typename InputImageType::RegionType slab = input->GetRequestedRegion();
+  SizeValueType begin, end;
+  SplitRange(slab.GetSize(lastAxis), threadId, numberOfThreads, begin, end);
+  if ( begin == end )
+    {
+    return;
+    }
+  slab.SetIndex(lastAxis, slab.GetIndex(lastAxis) + begin);
+  slab.SetSize(lastAxis, end - begin);
+
+  // For every pixel in the slab, place it into a bin in the private grid of
+  // every channel. Consecutive pixels mostly fall into the same brick, so
+  // the brick of the previous pixel is tried first.
+  typedef typename SparseGridType::KeyType KeyType;
+  std::vector<KeyType>         lastKeys(channels, NumericTraits<KeyType>::max());
+  std::vector<GridValueType *> bricks(channels,
+                                      static_cast<GridValueType *>(NULL));
+  std::vector<const InputPixelType *> inputBuffers(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    inputBuffers[c] = str->Inputs[c]->GetBufferPointer();
+    }
+  const float *guidePositions =
+    m_GuidePositions.empty() ? NULL : &m_GuidePositions[0];
+
+  // The pixels are visited along the lines of the first axis, stepping
+  // over those left out by the subsampling
+  const IndexValueType subsampling = str->Subsampling;
+  typename InputImageType::RegionType lines = slab;
+  const IndexValueType lineLength = slab.GetSize(0);
+  lines.SetSize(0, 1);
+  InputImageConstIteratorType iterLines(input, lines);
+  InputPixelType      current;
+  InputImageIndexType index;
+  typename SparseGridType::IndexType cell;
+  for ( iterLines.GoToBegin(); !iterLines.IsAtEnd(); ++iterLines )
+    {
+    index = iterLines.GetIndex();
+    const IndexValueType lineStart = index[0];
+    for (IndexValueType x = FirstSubsample(index, subsampling); x < lineLength;
+         x += subsampling)
+      {
+      index[0] = lineStart + x;
+      // Determine the position in the grid to place the pixel
+      for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+        {
+        cell[i] = static_cast<GridSizeValueType>
+          (index[i]/str->DomainSigmaInPixels[i]+0.5+str->GridShift[i]);
+        }
+      const OffsetValueType inputOffset = input->ComputeOffset(index);
+
+      for (unsigned int c = 0; c < channels; ++c)
+        {
+        current = inputBuffers[c][inputOffset];
+        if ( guidePositions )
+          {
+          cell[rangeAxis] = static_cast<GridSizeValueType>
+            (guidePositions[this->ComputeGuideOffset(index)]+0.5);
+          }
+        else
+          {
+          cell[rangeAxis] = static_cast<GridSizeValueType>
+            (str->RangeMaps[c].Map(current)+0.5+str->Padding);
+          }
+
+        const KeyType key = privateGrids[c]->ComputeKey(cell);
+        if ( key != lastKeys[c] )
+          {
+          lastKeys[c] = key;
+          bricks[c] = privateGrids[c]->InsertBrick(key);
+          }
+
+        // Update the bin and the weight
+        GridValueType *value = bricks[c] + SparseGridType::ComputeCellOffset(cell);
+        value[0] += current;
+        value[1] += 1.0;
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSparseSplatReduce(SplatThreadStruct *str, ThreadIdType threadId,
+                            ThreadIdType numberOfThreads)
+{
+  // Each thread owns a disjoint range of bricks of every grid
+  const unsigned int channels = str->NumberOfChannels;
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    SparseGridType *grid = str->SparseGrids[c];
+    SizeValueType begin, end;
+    SplitRange(grid->GetNumberOfBricks(), threadId, numberOfThreads,
+               begin, end);
+
+    for (SizeValueType slot = begin; slot < end; ++slot)
+      {
+      const typename SparseGridType::KeyType key = grid->GetKey(slot);
+      GridValueType *dst = grid->GetBrick(slot);
+      for (size_t t = c; t < str->PrivateSparseGrids.size(); t += channels)
+        {
+        const GridValueType *src = str->PrivateSparseGrids[t]->FindBrick(key);
+        if ( src == NULL )
+          {
+          continue;
+          }
+        for (unsigned int j = 0; j < SparseGridType::BrickValues; ++j)
+          {
+          dst[j] += src[j];
+          }
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedStreamSplat(SplatThreadStruct *str, ThreadIdType threadId,
+                      ThreadIdType numberOfThreads)
+{
+  const unsigned int rangeAxis = itkGetStaticConstMacro(ImageDimension);
+  const unsigned int channels  = str->NumberOfChannels;
+
+  // All the rows of the slab fall into the same plane. The threads own
+  // disjoint ranges of cells along the axis before the last one, so they
+  // write to the shared plane without locking. A 1-D image has a single
+  // spatial cell per plane and is splatted by the first thread.
+  typename InputImageType::RegionType slab = str->Slab;
+  if ( itkGetStaticConstMacro(ImageDimension) > 1 )
+    {
+    const unsigned int axis = itkGetStaticConstMacro(ImageDimension) - 2;
+    const double sigma = str->DomainSigmaInPixels[axis];
+    const double shift = 0.5 + str->GridShift[axis];
+    const IndexValueType first = slab.GetIndex(axis);
+    const IndexValueType last = first + slab.GetSize(axis);
+    const IndexValueType firstBin =
+      static_cast<IndexValueType>(first/sigma + shift);
+    const IndexValueType bins =
+      static_cast<IndexValueType>((last - 1)/sigma + shift) - firstBin + 1;
+    SizeValueType begin, end;
+    SplitRange(bins, threadId, numberOfThreads, begin, end);
+    IndexValueType rowBegin = first;
+    while ( rowBegin < last && static_cast<IndexValueType>
+            (rowBegin/sigma + shift) < firstBin + static_cast<IndexValueType>(begin) )
+      {
+      ++rowBegin;
+      }
+    IndexValueType rowEnd = rowBegin;
+    while ( rowEnd < last && static_cast<IndexValueType>
+            (rowEnd/sigma + shift) < firstBin + static_cast<IndexValueType>(end) )
+      {
+      ++rowEnd;
+      }
+    if ( rowBegin == rowEnd )
+      {
+      return;
+      }
+    slab.SetIndex(axis, rowBegin);
+    slab.SetSize(axis, rowEnd - rowBegin);
+    }
+  else if ( threadId > 0 )
+    {
+    return;
+    }
+
+  // Strides of the planes in grid values. The last spatial axis has a
+  // single plane and only the number of range bins differs between
+  // channels.
+  const OffsetValueType *planeStrides = str->Grids[0]->GetOffsetTable();
+  OffsetValueType strides[itkGetStaticConstMacro(ImageDimension)+1];
+  for (unsigned int i = 0; i <= rangeAxis; ++i)
+    {
+    strides[i] = GridComponents*planeStrides[i];
+    }
+
+  std::vector<GridValueType *>        grids(channels);
+  std::vector<const InputPixelType *> inputBuffers(channels);
+  for (unsigned int c = 0; c < channels; ++c)
+    {
+    grids[c] = str->Grids[c]->GetBufferPointer();
+    inputBuffers[c] = str->Inputs[c]->GetBufferPointer();
+    }
+  const InputImageType *input = str->Inputs[0];
+  const float *guidePositions =
+    m_GuidePositions.empty() ? NULL : &m_GuidePositions[0];
+
+  // Same binning and subsampling as ThreadedSplat, without the last
+  // spatial axis
+  const IndexValueType subsampling = str->Subsampling;
+  typename InputImageType::RegionType lines = slab;
+  const IndexValueType lineLength = slab.GetSize(0);
+  lines.SetSize(0, 1);
+  InputImageConstIteratorType iterLines(input, lines);
+  InputPixelType      current;
+  InputImageIndexType index;
+  OffsetValueType     offset;
+  IndexValueType      bin;
+  for ( iterLines.GoToBegin(); !iterLines.IsAtEnd(); ++iterLines )
+    {
+    index = iterLines.GetIndex();
+    const IndexValueType lineStart = index[0];
+    for (IndexValueType x = FirstSubsample(index, subsampling); x < lineLength;
+         x += subsampling)
+      {
+      index[0] = lineStart + x;
+      offset = 0;
+      for (unsigned int i = 0; i + 1 < itkGetStaticConstMacro(ImageDimension); ++i)
+        {
+        bin = static_cast<GridSizeValueType>
+          (index[i]/str->DomainSigmaInPixels[i]+0.5+str->GridShift[i]);
+        offset += bin*strides[i];
+        }
+      const OffsetValueType inputOffset = input->ComputeOffset(index);
+
+      for (unsigned int c = 0; c < channels; ++c)
+        {
+        current = inputBuffers[c][inputOffset];
+        if ( guidePositions )
+          {
+          bin = static_cast<GridSizeValueType>
+            (guidePositions[this->ComputeGuideOffset(index)]+0.5);
+          }
+        else
+          {
+          bin = static_cast<GridSizeValueType>
+            (str->RangeMaps[c].Map(current)+0.5+str->Padding);
+          }
+
+        GridValueType *cellValues = grids[c] + offset + bin*strides[rangeAxis];
+        cellValues[0] += current;
+        cellValues[1] += 1.0;
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::SplatThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  SplatThreadStruct *str = static_cast<SplatThreadStruct *>(info->UserData);
+
+  if ( !str->SparseGrids.empty() )
+    {
+    str->Filter->ThreadedSparseSplat(str, info->ThreadID,
+                                     info->NumberOfThreads);
+    }
+  else
+    {
+    str->Filter->ThreadedSplat(str, info->ThreadID, info->NumberOfThreads);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::StreamSplatThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  SplatThreadStruct *str = static_cast<SplatThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedStreamSplat(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::SplatReduceThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  SplatThreadStruct *str = static_cast<SplatThreadStruct *>(info->UserData);
+
+  if ( !str->SparseGrids.empty() )
+    {
+    str->Filter->ThreadedSparseSplatReduce(str, info->ThreadID,
+                                           info->NumberOfThreads);
+    }
+  else
+    {
+    str->Filter->ThreadedSplatReduce(str, info->ThreadID,
+                                     info->NumberOfThreads);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedBlur(BlurThreadStruct *str, ThreadIdType threadId,
+               ThreadIdType numberOfThreads)
+{
+  // View the grid as [outer][axis][inner] where inner holds the contiguous
+  // axes before the blurred one, including the interleaved cell values.
+  // Lines along the blurred axis are filtered in blocks of adjacent inner
+  // columns so that every row access is contiguous. The work items are
+  // (outer, block) pairs. Blocks always hold whole cells.
+  const unsigned int axis = str->Axis;
+
+  // The sparse grid blurs whole bricks out of place, split by slot
+  if ( str->SparseGrid )
+    {
+    SizeValueType begin, end;
+    SplitRange(str->SparseGrid->GetNumberOfBricks(), threadId,
+               numberOfThreads, begin, end);
+    str->SparseGrid->BlurBricks(axis, str->Kernel, str->Normalise, begin, end);
+    return;
+    }
+
+  SizeValueType inner = GridComponents;
+  SizeValueType outer = 1;
+  for (unsigned int i = 0; i <= itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    if ( i < axis )
+      {
+      inner *= str->Size[i];
+      }
+    else if ( i > axis )
+      {
+      outer *= str->Size[i];
+      }
+    }
+  const SizeValueType length = str->Size[axis];
+  const SizeValueType blockWidth = std::min<SizeValueType>(inner, 1024);
+  const SizeValueType blocksPerOuter = (inner + blockWidth - 1)/blockWidth;
+
+  SizeValueType begin, end;
+  SplitRange(outer*blocksPerOuter, threadId, numberOfThreads, begin, end);
+  if ( begin == end )
+    {
+    return;
+    }
+
+  // Zero flux Neumann boundary as in the DiscreteGaussianImageFilter.
+  // The blur is done in place, so the original values of the rows already
+  // overwritten are kept in a small ring of radius+1 rows.
+  const int radius = static_cast<int>(str->Kernel.size()/2);
+  const int ringRows = radius + 1;
+  const double *kernel = &str->Kernel[radius];
+  std::vector<GridValueType> ring(ringRows*blockWidth);
+  GridValueType *history = &ring[0];
+
+  for (SizeValueType item = begin; item < end; ++item)
+    {
+    const SizeValueType o = item / blocksPerOuter;
+    const SizeValueType firstColumn = (item % blocksPerOuter)*blockWidth;
+    const SizeValueType width = std::min(blockWidth, inner - firstColumn);
+    GridValueType *buffer = str->Buffer + o*length*inner + firstColumn;
+
+    for (IndexValueType k = 0; k < static_cast<IndexValueType>(length); ++k)
+      {
+      GridValueType *row = buffer + k*inner;
+      std::copy(row, row + width, history + (k % ringRows)*blockWidth);
+
+      for (SizeValueType j = 0; j < width; ++j)
+        {
+        row[j] = kernel[0]*row[j];
+        }
+      for (int t = 1; t <= radius; ++t)
+        {
+        // Rows behind are read from the ring, rows ahead from the grid
+        const IndexValueType behind = std::max<IndexValueType>(k - t, 0);
+        const IndexValueType ahead  =
+          std::min<IndexValueType>(k + t, length - 1);
+        const GridValueType *previous =
+          history + (behind % ringRows)*blockWidth;
+        const GridValueType *next = ( ahead == k )
+          ? history + (k % ringRows)*blockWidth : buffer + ahead*inner;
+        const double c = kernel[t];
+        for (SizeValueType j = 0; j < width; ++j)
+          {
+          row[j] += c*(previous[j] + next[j]);
+          }
+        }
+
+      // The row is final, divide the sums by the weights
+      if ( str->Normalise )
+        {
+        for (SizeValueType j = 0; j < width; j += GridComponents)
+          {
+          if ( row[j+1] != 0.0 )
+            {
+            row[j] /= row[j+1];
+            }
+          }
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::BlurThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  BlurThreadStruct *str = static_cast<BlurThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedBlur(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedStreamBlur(StreamBlurThreadStruct *str, ThreadIdType threadId,
+                     ThreadIdType numberOfThreads)
+{
+  // Planes and window are [range bin][rest of the plane]. The window holds
+  // both of its planes for each range bin, the first one then the second.
+  SizeValueType begin, end;
+  SplitRange(str->RangeBins, threadId, numberOfThreads, begin, end);
+  const SizeValueType length = str->PlaneLength;
+  const unsigned int taps = str->Kernel.size();
+
+  for (SizeValueType bin = begin; bin < end; ++bin)
+    {
+    GridValueType *first = str->Window + 2*bin*length;
+    GridValueType *second = first + length;
+    std::copy(second, second + length, first);
+
+    const GridValueType *plane = str->Planes[0] + bin*length;
+    const double k0 = str->Kernel[0];
+    for (SizeValueType j = 0; j < length; ++j)
+      {
+      second[j] = k0*plane[j];
+      }
+    for (unsigned int t = 1; t < taps; ++t)
+      {
+      plane = str->Planes[t] + bin*length;
+      const double c = str->Kernel[t];
+      for (SizeValueType j = 0; j < length; ++j)
+        {
+        second[j] += c*plane[j];
+        }
+      }
+
+    // The plane is final, divide the sums by the weights
+    for (SizeValueType j = 0; j < length; j += GridComponents)
+      {
+      if ( second[j+1] != 0.0 )
+        {
+        second[j] /= second[j+1];
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::StreamBlurThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  StreamBlurThreadStruct *str =
+    static_cast<StreamBlurThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedStreamBlur(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::StreamSliceThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  SliceThreadStruct *str = static_cast<SliceThreadStruct *>(info->UserData);
+
+  // Split the rows along the axis before the last one, or the only axis
+  const unsigned int axis = ( itkGetStaticConstMacro(ImageDimension) > 1 )
+    ? itkGetStaticConstMacro(ImageDimension) - 2 : 0;
+  OutputImageRegionType region = str->Region;
+  SizeValueType begin, end;
+  SplitRange(region.GetSize(axis), info->ThreadID, info->NumberOfThreads,
+             begin, end);
+  if ( begin < end )
+    {
+    region.SetIndex(axis, region.GetIndex(axis) + begin);
+    region.SetSize(axis, end - begin);
+    str->Filter->ThreadedDenseSlice(region);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::CreateBlurKernels(std::vector<double> &kernel,
+                    std::vector<double> &rangeKernel) const
+{
+  // Kernel of the blur.
+  // This variance approximately corresponds to a 1D filter of [1 2 1] which is
+  // used in Paris and Durands C++ implementation to blur their down-sampled
+  // data. With this variance a kernel width larger than 5 is not necessary.
+  // The coefficients are those the DiscreteGaussianImageFilter would use.
+  // Coarser range bins are RangeCoarsening sigmas wide, so the range axis
+  // is blurred with a variance smaller by its square to keep RangeSigma.
+  for (unsigned int k = 0; k < 2; ++k)
+    {
+    double      variance  = 1.59577;
+    int         maxWidth  = 5;
+    if ( k == 1 )
+      {
+      variance /= m_RangeCoarsening*m_RangeCoarsening;
+      }
+
+    GaussianOperator<double, 1> gaussianOperator;
+    gaussianOperator.SetVariance(variance);
+    gaussianOperator.SetMaximumError(0.01);
+    gaussianOperator.SetMaximumKernelWidth(maxWidth);
+    gaussianOperator.CreateDirectional();
+
+    std::vector<double> &axisKernel = ( k == 0 ) ? kernel : rangeKernel;
+    axisKernel.resize(gaussianOperator.Size());
+    for (unsigned int i = 0; i < gaussianOperator.Size(); ++i)
+      {
+      axisKernel[i] = gaussianOperator[i];
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+typename FastBilateralImageFilter<TInputImage, TOutputImage>::CostEstimateType
+FastBilateralImageFilter<TInputImage, TOutputImage>
+::EstimateCost(const InputImageSizeType &size,
+               const InputImageSpacingType &spacing,
+               double intensityRange) const
+{
+  const unsigned int gridDimension = itkGetStaticConstMacro(ImageDimension)+1;
+  const double channels = std::max(1u, this->GetNumberOfChannels());
+
+  // Same grid size as BeforeThreadedGenerateData
+  double pixels = 1.0;
+  double spatialCells = 1.0;
+  double lastAxisCells = 1.0;
+  double pixelsPerCell = 1.0;
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    const double sigmaInPixels = this->GetDomainSigma()[i] / spacing[i];
+    pixels *= size[i];
+    lastAxisCells = vcl_floor( (size[i] - 1) / sigmaInPixels )
+                    + 1 + 2*m_GridPadding;
+    spatialCells *= lastAxisCells;
+    pixelsPerCell *= std::max(1.0, sigmaInPixels);
+    }
+  const double rangeCells =
+    vcl_floor(intensityRange / this->GetRangeBinWidth()) + 1 + 2*m_GridPadding;
+  const double cellBytes = GridComponents*sizeof(GridValueType);
+
+  // Same kernels as the blur, whose widths set its cost and the depth of
+  // the ring of the streamed grid
+  std::vector<double> kernel;
+  std::vector<double> rangeKernel;
+  this->CreateBlurKernels(kernel, rangeKernel);
+  const double taps = itkGetStaticConstMacro(ImageDimension)*kernel.size()
+    + rangeKernel.size();
+
+  // The dense grid is doubled by the private grids of the splat. A sparse
+  // column along the range axis holds at most the bricks reached by the
+  // pixels of its spatial cell, each kept with its two neighbours.
+  CostEstimateType cost;
+  cost.Cells = channels*spatialCells*rangeCells;
+  cost.Memory = 2.0*cost.Cells*cellBytes;
+  double cellOperations = 1.0;
+  const double sparseCells = channels*spatialCells
+    *std::min(rangeCells, 3.0*SparseGridType::BrickEdge*pixelsPerCell);
+  const bool sparse = ( m_GridMode == SparseGrid )
+    || ( m_GridMode == AutomaticGrid
+         && cost.Cells*cellBytes > m_MaximumDenseGridMemory
+         && 4.0*sparseCells < cost.Cells );
+  // The streamed grid keeps the ring of planes of the blur and the 2 of the
+  // slicing window, and has no private grids
+  const double streamingMemory = (StreamingRingDepth(kernel) + 2.0)
+    *cost.Cells*cellBytes/lastAxisCells;
+  const bool streaming = !sparse
+    && ( m_GridMode == StreamingGrid
+         || ( m_GridMode == AutomaticGrid
+              && cost.Cells*cellBytes > m_MaximumDenseGridMemory
+              && 2.0*streamingMemory < cost.Cells*cellBytes ) );
+  if ( sparse )
+    {
+    // Brick headers and hashing make a sparse cell about twice as dear
+    cost.Cells = sparseCells;
+    cost.Memory = 2.0*cost.Cells*cellBytes;
+    cellOperations = 2.0;
+    }
+  else if ( streaming )
+    {
+    cost.Memory = streamingMemory;
+    }
+
+  // Splat: bin and accumulate every pixel. Blur: the taps of the kernel of
+  // each grid axis on both components. Slice: multilinear interpolation of
+  // both components over the 2^(D+1) corners, then the division.
+  const double corners = static_cast<double>(1u << gridDimension);
+  cost.Operations = channels*pixels*(gridDimension + 4.0)/m_SplatSubsampling
+    + cellOperations*cost.Cells*taps*GridComponents*2.0
+    + channels*pixels*(corners*GridComponents*2.0 + 4.0);
+  return cost;
 }
 
 template< class TInputImage, class TOutputImage >
@@ -309,8 +2029,14 @@ FastBilateralImageFilter<TInputImage, TOutputImage>
 {
   Superclass::PrintSelf(os,indent);
 
-  os << indent << "DomainSigma: " << m_DomainSigma << std::endl;
-  os << indent << "RangeSigma: " << m_RangeSigma << std::endl;
+  os << indent << "GridMode: " << m_GridMode << std::endl;
+  os << indent << "MaximumDenseGridMemory: " << m_MaximumDenseGridMemory
+     << std::endl;
+  os << indent << "SplatSubsampling: " << m_SplatSubsampling << std::endl;
+  os << indent << "RangeCoarsening: " << m_RangeCoarsening << std::endl;
+  os << indent << "RangeAxis: " << m_RangeAxis << std::endl;
+  os << indent << "MaximumRangeStretch: " << m_MaximumRangeStretch
+     << std::endl;
 
 }
 
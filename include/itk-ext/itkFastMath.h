@@ -0,0 +1,516 @@
+#ifndef __itkFastMath_h
+#define __itkFastMath_h
+
+#include "itkIntTypes.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if ( defined(__GNUC__) || defined(__clang__) ) \
+  && ( defined(__x86_64__) || defined(__i386__) ) \
+  && !defined(ITK_FASTMATH_NO_DISPATCH)
+#define ITK_FASTMATH_DISPATCH
+#endif
+
+#ifdef ITK_FASTMATH_DISPATCH
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace itk
+{
+/** \namespace FastMath
+* \brief Vectorised float exp, log, pow and sqrt over arrays, and their
+* conversion to and from 16 bit floats
+*
+* The array functions apply a branch free kernel to every element. On x86
+* with GCC or Clang the kernel is compiled for SSE4.1, AVX2 with FMA and
+* AVX-512 besides the default target, so that the compiler vectorises it
+* for each, and the widest set supported by the processor is picked at
+* run time. Elsewhere the default kernel is used, which the compiler may
+* still vectorise for its target. Define ITK_FASTMATH_NO_DISPATCH to build
+* the default kernel only. GCC vectorises Sqrt only with -fno-math-errno,
+* which the sHDR build sets for the HDR targets and itkFastMathTest alone.
+*
+* Exp and Log use the polynomials of the cephes library of Stephen L.
+* Moshier. Against double precision libm the errors are within the bounds
+* below on every instruction set, which itkFastMathTest checks (about 1 ulp
+* for Exp and 0.6 ulp for Log were measured):
+*   Exp(x)    2 ulp for x in [-87.3, 88.7], 0 below and +inf above
+*   Log(x)    2 ulp for x > 0, -inf at 0 and NaN below
+*   Pow(x, p) Exp(p Log(x)) for x >= 0, so 2 + 2|p log(x)| ulp, and 0 at
+*             x = 0 for p > 0
+*   Sqrt(x)   correctly rounded, also for double
+* Exp flushes subnormal results to zero. NaN inputs give unspecified
+* results.
+*
+* FloatToHalf and FloatToBFloat16 store floats in the 16 bits of IEEE 754
+* half precision (10 bit mantissa, up to 65504) and of bfloat16 (7 bit
+* mantissa, the float range), rounded to nearest even, with overflows to
+* infinity and quiet NaNs. Half precision keeps subnormals. HalfToFloat and
+* BFloat16ToFloat are exact, so every 16 bit value survives a round trip.
+* The half conversions use the F16C instructions with AVX2 and AVX-512 when
+* the processor reports them (CPUID leaf 1, ECX bit 29), and the same
+* rounding in integer arithmetic otherwise.
+*/
+namespace FastMath
+{
+/** Instruction sets of the array functions, from the narrowest */
+typedef enum { DefaultInstructionSet = 0, SSE4InstructionSet,
+               AVX2InstructionSet, AVX512InstructionSet } InstructionSetType;
+
+namespace Detail
+{
+#if defined(__GNUC__)
+#define itkFastMathInline inline __attribute__((always_inline))
+#else
+#define itkFastMathInline inline
+#endif
+
+// The kernels only select between values computed on every path, so their
+// floating point exceptions need not be preserved. GCC does not vectorise
+// the selections otherwise.
+#if defined(__GNUC__) && !defined(__clang__)
+#define itkFastMathKernel __attribute__((optimize("no-trapping-math")))
+#else
+#define itkFastMathKernel
+#endif
+
+itkFastMathInline float FromBits(int32_t bits)
+{
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+itkFastMathInline int32_t ToBits(float value)
+{
+  int32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+/** exp(x) = 2^n exp(r), with n the integer nearest to x/log(2) and r
+ *  reduced in two steps to keep it exact */
+struct ExpOperation
+{
+  itkFastMathKernel itkFastMathInline float operator()(float x) const
+  {
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float clamped = x < -87.33654f ? -87.33654f
+      : ( x > 88.72283f ? 88.72283f : x );
+    // Rounded by the shift 1.5 2^23, exact while |n| < 2^22
+    const float n = ( clamped*1.44269504088896341f + 12582912.0f ) - 12582912.0f;
+    const float r = ( clamped - n*0.693359375f ) + n*2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p*r + 1.3981999507e-3f;
+    p = p*r + 8.3334519073e-3f;
+    p = p*r + 4.1665795894e-2f;
+    p = p*r + 1.6666665459e-1f;
+    p = p*r + 5.0000001201e-1f;
+    p = p*r*r + r + 1.0f;
+    // 2^128 is split into 2^127 2 so that the exponent stays finite
+    const float twice = n > 127.5f ? 2.0f : 1.0f;
+    const int32_t exponent = static_cast<int32_t>(n) - ( n > 127.5f ? 1 : 0 );
+    const float value = p*twice*FromBits(( exponent + 127 ) << 23);
+    return x < -87.33654f ? 0.0f : ( x > 88.72283f ? infinity : value );
+  }
+};
+
+/** log(x) = e log(2) + log(1 + m), with 1 + m in [sqrt(1/2), sqrt(2)) */
+struct LogOperation
+{
+  itkFastMathKernel itkFastMathInline float operator()(float x) const
+  {
+    const float infinity = std::numeric_limits<float>::infinity();
+    // Subnormals are scaled by 2^25 to get a normal mantissa. Both sides
+    // of every selection are computed so that the loop has no branches.
+    const bool subnormal = x < 1.17549435e-38f;
+    const float scaled = x*33554432.0f;
+    const int32_t bits = ToBits(subnormal ? scaled : x);
+    const int32_t exponent = ( bits >> 23 ) - ( subnormal ? 151 : 126 );
+    const float mantissa = FromBits(( bits & 0x007fffff ) | 0x3f000000);
+    const bool low = mantissa < 0.707106781186547524f;
+    const float e = static_cast<float>(exponent - ( low ? 1 : 0 ));
+    const float m = ( low ? mantissa + mantissa : mantissa ) - 1.0f;
+    const float z = m*m;
+    float y = 7.0376836292e-2f;
+    y = y*m - 1.1514610310e-1f;
+    y = y*m + 1.1676998740e-1f;
+    y = y*m - 1.2420140846e-1f;
+    y = y*m + 1.4249322787e-1f;
+    y = y*m - 1.6668057665e-1f;
+    y = y*m + 2.0000714765e-1f;
+    y = y*m - 2.4999993993e-1f;
+    y = y*m + 3.3333331174e-1f;
+    y = y*m*z - e*2.12194440e-4f - 0.5f*z;
+    const float value = ( m + y ) + e*0.693359375f;
+    return ( x > 0.0f && x < infinity ) ? value
+      : ( x == 0.0f ? -infinity
+      : ( x == infinity ? infinity : std::numeric_limits<float>::quiet_NaN() ) );
+  }
+};
+
+/** x^p = exp(p log(x)) for x >= 0 */
+struct PowOperation
+{
+  explicit PowOperation(float exponent) : Exponent(exponent) {}
+  itkFastMathKernel itkFastMathInline float operator()(float x) const
+  {
+    const float value = ExpOperation()(Exponent*LogOperation()(x));
+    return Exponent == 0.0f ? 1.0f : value;
+  }
+  float Exponent;
+};
+
+/** Square root, which every instruction set computes exactly. GCC only
+ *  vectorises it when built with -fno-math-errno, its optimize attribute
+ *  does not do. */
+struct SqrtOperation
+{
+#if defined(__GNUC__)
+  itkFastMathInline float operator()(float x) const
+  {
+    return __builtin_sqrtf(x);
+  }
+  itkFastMathInline double operator()(double x) const
+  {
+    return __builtin_sqrt(x);
+  }
+#else
+  float operator()(float x) const
+  {
+    return std::sqrt(x);
+  }
+  double operator()(double x) const
+  {
+    return std::sqrt(x);
+  }
+#endif
+};
+
+/** float to half precision, rounded to nearest even. Normal halves get the
+ *  exponent rebiased and the mantissa rounded in integers, subnormal ones
+ *  are rounded by the float addition of 2^-1, which leaves their mantissa
+ *  in the low bits. */
+struct FloatToHalfOperation
+{
+  itkFastMathKernel itkFastMathInline uint16_t operator()(float x) const
+  {
+    const uint32_t bits = static_cast<uint32_t>(ToBits(x));
+    const uint32_t magnitude = bits & 0x7fffffff;
+    const uint32_t normal =
+      ( magnitude + 0xc8000fff + ( ( magnitude >> 13 ) & 1 ) ) >> 13;
+    const uint32_t subnormal = static_cast<uint32_t>(
+      ToBits(FromBits(magnitude) + 0.5f) ) - 0x3f000000;
+    // Below 2^-14 halves are subnormal, from 65520 on they overflow
+    uint32_t half = magnitude < 0x38800000 ? subnormal : normal;
+    half = magnitude >= 0x477ff000 ? 0x7c00 : half;
+    half = magnitude > 0x7f800000 ? 0x7e00 : half;
+    return static_cast<uint16_t>(( ( bits >> 16 ) & 0x8000 ) | half);
+  }
+};
+
+/** Half precision to float. Subnormal halves are renormalised by a float
+ *  subtraction of 2^-14. */
+struct HalfToFloatOperation
+{
+  itkFastMathKernel itkFastMathInline float operator()(uint16_t x) const
+  {
+    const int32_t magnitude = static_cast<int32_t>(x & 0x7fff) << 13;
+    const int32_t exponent = magnitude & 0x0f800000;
+    const float normal = FromBits(magnitude + 0x38000000);
+    const float subnormal = FromBits(magnitude + 0x38800000)
+      - 6.103515625e-05f;
+    const float special = FromBits(magnitude + 0x70000000);
+    const float value = exponent == 0 ? subnormal
+      : ( exponent == 0x0f800000 ? special : normal );
+    return FromBits(ToBits(value) | ( static_cast<int32_t>(x & 0x8000) << 16 ));
+  }
+};
+
+/** float to bfloat16, its upper half rounded to nearest even */
+struct FloatToBFloat16Operation
+{
+  itkFastMathKernel itkFastMathInline uint16_t operator()(float x) const
+  {
+    const uint32_t bits = static_cast<uint32_t>(ToBits(x));
+    const uint32_t rounded = ( bits + 0x7fff + ( ( bits >> 16 ) & 1 ) ) >> 16;
+    const uint32_t quiet = ( bits >> 16 ) | 0x0040;
+    return static_cast<uint16_t>(
+      ( bits & 0x7fffffff ) > 0x7f800000 ? quiet : rounded );
+  }
+};
+
+/** bfloat16 to float */
+struct BFloat16ToFloatOperation
+{
+  itkFastMathKernel itkFastMathInline float operator()(uint16_t x) const
+  {
+    return FromBits(static_cast<int32_t>(x) << 16);
+  }
+};
+
+/** The kernel of an operation for every instruction set */
+template <class TInput, class TOutput, class TOperation>
+itkFastMathKernel
+void TransformDefault(const TInput *x, TOutput *y, SizeValueType n,
+                      const TOperation &operation)
+{
+  for (SizeValueType i = 0; i < n; ++i)
+    {
+    y[i] = operation(x[i]);
+    }
+}
+
+#ifdef ITK_FASTMATH_DISPATCH
+template <class TInput, class TOutput, class TOperation>
+__attribute__((target("sse4.1")))
+itkFastMathKernel
+void TransformSSE4(const TInput *x, TOutput *y, SizeValueType n,
+                   const TOperation &operation)
+{
+  for (SizeValueType i = 0; i < n; ++i)
+    {
+    y[i] = operation(x[i]);
+    }
+}
+
+template <class TInput, class TOutput, class TOperation>
+__attribute__((target("avx2,fma")))
+itkFastMathKernel
+void TransformAVX2(const TInput *x, TOutput *y, SizeValueType n,
+                   const TOperation &operation)
+{
+  for (SizeValueType i = 0; i < n; ++i)
+    {
+    y[i] = operation(x[i]);
+    }
+}
+
+template <class TInput, class TOutput, class TOperation>
+__attribute__((target("avx512f")))
+itkFastMathKernel
+void TransformAVX512(const TInput *x, TOutput *y, SizeValueType n,
+                     const TOperation &operation)
+{
+  for (SizeValueType i = 0; i < n; ++i)
+    {
+    y[i] = operation(x[i]);
+    }
+}
+#endif
+
+#ifdef ITK_FASTMATH_DISPATCH
+/** Half precision conversions of eight floats at a time with F16C, the
+ *  remainder in integer arithmetic */
+__attribute__((target("avx2,fma,f16c")))
+inline void FloatToHalfF16C(const float *x, uint16_t *y, SizeValueType n)
+{
+  SizeValueType i = 0;
+  for (; i + 8 <= n; i += 8)
+    {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y + i),
+      _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+  for (; i < n; ++i)
+    {
+    y[i] = FloatToHalfOperation()(x[i]);
+    }
+}
+
+__attribute__((target("avx2,fma,f16c")))
+inline void HalfToFloatF16C(const uint16_t *x, float *y, SizeValueType n)
+{
+  SizeValueType i = 0;
+  for (; i + 8 <= n; i += 8)
+    {
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i))));
+    }
+  for (; i < n; ++i)
+    {
+    y[i] = HalfToFloatOperation()(x[i]);
+    }
+}
+#endif
+
+inline InstructionSetType DetectInstructionSet()
+{
+#ifdef ITK_FASTMATH_DISPATCH
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports("avx512f") )
+    {
+    return AVX512InstructionSet;
+    }
+  if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+    {
+    return AVX2InstructionSet;
+    }
+  if ( __builtin_cpu_supports("sse4.1") )
+    {
+    return SSE4InstructionSet;
+    }
+#endif
+  return DefaultInstructionSet;
+}
+
+/** Whether the processor has the F16C half conversions. Every processor
+ *  with AVX2 so far has them, but it is a separate CPUID bit, so a virtual
+ *  machine may mask it. */
+inline bool DetectF16C()
+{
+#ifdef ITK_FASTMATH_DISPATCH
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+  if ( __get_cpuid(1, &eax, &ebx, &ecx, &edx) )
+    {
+    return ( ecx & ( 1u << 29 ) ) != 0;
+    }
+#endif
+  return false;
+}
+
+/** The instruction set in use, initially the widest supported one */
+inline InstructionSetType & ActiveInstructionSet()
+{
+  static InstructionSetType active = DetectInstructionSet();
+  return active;
+}
+
+/** F16C is used with AVX2 and wider sets when the processor has it */
+inline bool UseF16C()
+{
+  static const bool supported = DetectF16C();
+  return supported && ActiveInstructionSet() >= AVX2InstructionSet;
+}
+
+template <class TInput, class TOutput, class TOperation>
+void Transform(const TInput *x, TOutput *y, SizeValueType n,
+               const TOperation &operation)
+{
+  switch ( ActiveInstructionSet() )
+    {
+#ifdef ITK_FASTMATH_DISPATCH
+    case AVX512InstructionSet:
+      TransformAVX512(x, y, n, operation);
+      return;
+    case AVX2InstructionSet:
+      TransformAVX2(x, y, n, operation);
+      return;
+    case SSE4InstructionSet:
+      TransformSSE4(x, y, n, operation);
+      return;
+#endif
+    default:
+      TransformDefault(x, y, n, operation);
+    }
+}
+} // end namespace Detail
+
+/** The widest instruction set supported by the processor and the build */
+inline InstructionSetType GetSupportedInstructionSet()
+{
+  static const InstructionSetType supported = Detail::DetectInstructionSet();
+  return supported;
+}
+
+/** Get/Set the instruction set of the array functions. It is limited to
+ *  the supported one, which is also the default. */
+inline InstructionSetType GetInstructionSet()
+{
+  return Detail::ActiveInstructionSet();
+}
+inline void SetInstructionSet(InstructionSetType set)
+{
+  Detail::ActiveInstructionSet() =
+    ( set < GetSupportedInstructionSet() ) ? set : GetSupportedInstructionSet();
+}
+
+/** Name of an instruction set, for logging */
+inline const char * GetInstructionSetName(InstructionSetType set)
+{
+  switch ( set )
+    {
+    case AVX512InstructionSet:
+      return "AVX-512";
+    case AVX2InstructionSet:
+      return "AVX2";
+    case SSE4InstructionSet:
+      return "SSE4.1";
+    default:
+      return "default";
+    }
+}
+
+/** y[i] = exp(x[i]) for i < n. x and y may be the same array. */
+inline void Exp(const float *x, float *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::ExpOperation());
+}
+
+/** y[i] = log(x[i]) for i < n. x and y may be the same array. */
+inline void Log(const float *x, float *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::LogOperation());
+}
+
+/** y[i] = x[i]^exponent for i < n and x[i] >= 0. x and y may be the same
+ *  array. */
+inline void Pow(const float *x, float exponent, float *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::PowOperation(exponent));
+}
+
+/** y[i] = sqrt(x[i]) for i < n. x and y may be the same array. */
+inline void Sqrt(const float *x, float *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::SqrtOperation());
+}
+inline void Sqrt(const double *x, double *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::SqrtOperation());
+}
+
+/** y[i] = x[i] in half precision for i < n, its bits stored in y[i]. */
+inline void FloatToHalf(const float *x, uint16_t *y, SizeValueType n)
+{
+#ifdef ITK_FASTMATH_DISPATCH
+  if ( Detail::UseF16C() )
+    {
+    Detail::FloatToHalfF16C(x, y, n);
+    return;
+    }
+#endif
+  Detail::Transform(x, y, n, Detail::FloatToHalfOperation());
+}
+
+/** y[i] = x[i] for the bits of half precision floats x[i], i < n. */
+inline void HalfToFloat(const uint16_t *x, float *y, SizeValueType n)
+{
+#ifdef ITK_FASTMATH_DISPATCH
+  if ( Detail::UseF16C() )
+    {
+    Detail::HalfToFloatF16C(x, y, n);
+    return;
+    }
+#endif
+  Detail::Transform(x, y, n, Detail::HalfToFloatOperation());
+}
+
+/** y[i] = x[i] in bfloat16 for i < n, its bits stored in y[i]. */
+inline void FloatToBFloat16(const float *x, uint16_t *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::FloatToBFloat16Operation());
+}
+
+/** y[i] = x[i] for the bits of bfloat16 floats x[i], i < n. */
+inline void BFloat16ToFloat(const uint16_t *x, float *y, SizeValueType n)
+{
+  Detail::Transform(x, y, n, Detail::BFloat16ToFloatOperation());
+}
+
+} // end namespace FastMath
+} // end namespace itk
+
+#endif // End #ifndef __itkFastMath_h
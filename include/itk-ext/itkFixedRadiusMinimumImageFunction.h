@@ -0,0 +1,99 @@
+#ifndef itkFixedRadiusMinimumImageFunction_h
+#define itkFixedRadiusMinimumImageFunction_h
+
+#include "itkMinimumImageFunction.h"
+
+namespace itk
+{
+/** Number of pixels of a box of width VWidth in VDimension dimensions */
+template< unsigned int VWidth, unsigned int VDimension >
+struct BoxPixelCount
+{
+  enum { Value = VWidth * BoxPixelCount< VWidth, VDimension - 1 >::Value };
+};
+
+template< unsigned int VWidth >
+struct BoxPixelCount< VWidth, 0 >
+{
+  enum { Value = 1 };
+};
+
+/**
+ * \class FixedRadiusMinimumImageFunction
+ * \brief MinimumImageFunction with the radius fixed at compile time
+ *
+ * The buffer offsets of the (2 VRadius + 1)^Dimension neighbours are
+ * tabulated in a fixed size array of the function when the input image is
+ * set. At an index whose box lies inside the buffer, EvaluateAtIndex() is
+ * then a loop of known length over that table, which the compiler can
+ * unroll, with no allocation and no bounds check per neighbour. Other
+ * indices fall back to MinimumImageFunction.
+ *
+ * The radius cannot be changed: SetNeighborhoodRadius() throws for any
+ * other value than VRadius.
+ *
+ * \sa MinimumImageFunction
+ *
+ * \ingroup ImageFunctions
+ */
+template< typename TInputImage, unsigned int VRadius, typename TCoordRep = float >
+class FixedRadiusMinimumImageFunction:
+  public MinimumImageFunction< TInputImage, TCoordRep >
+{
+public:
+  /** Standard class typedefs. */
+  typedef FixedRadiusMinimumImageFunction                Self;
+  typedef MinimumImageFunction< TInputImage, TCoordRep > Superclass;
+
+  typedef SmartPointer< Self >       Pointer;
+  typedef SmartPointer< const Self > ConstPointer;
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(FixedRadiusMinimumImageFunction, MinimumImageFunction);
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Typedefs of the superclass. */
+  typedef typename Superclass::InputImageType InputImageType;
+  typedef typename Superclass::InputPixelType InputPixelType;
+  typedef typename Superclass::OutputType     OutputType;
+  typedef typename Superclass::IndexType      IndexType;
+
+  /** Dimension of the underlying image. */
+  itkStaticConstMacro(ImageDimension, unsigned int,
+                      InputImageType::ImageDimension);
+
+  /** Radius and number of pixels of the box. */
+  itkStaticConstMacro(Radius, unsigned int, VRadius);
+  itkStaticConstMacro(NumberOfNeighbours, unsigned int,
+                      (BoxPixelCount< 2 * VRadius + 1, InputImageType::ImageDimension >::Value));
+
+  /** Set the input image and tabulate the offsets of the box in its
+   *  buffer. */
+  virtual void SetInputImage(const InputImageType *ptr) ITK_OVERRIDE;
+
+  /** Evalulate the function at specified index */
+  virtual OutputType EvaluateAtIndex(const IndexType & index) const ITK_OVERRIDE;
+
+  /** The radius is VRadius. */
+  virtual void SetNeighborhoodRadius(const unsigned int radius) ITK_OVERRIDE;
+
+protected:
+  FixedRadiusMinimumImageFunction();
+  ~FixedRadiusMinimumImageFunction(){}
+
+private:
+  FixedRadiusMinimumImageFunction(const Self &); //purposely not implemented
+  void operator=(const Self &);                  //purposely not implemented
+
+  OffsetValueType m_Offsets[NumberOfNeighbours];
+
+};
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkFixedRadiusMinimumImageFunction.hxx"
+#endif
+
+#endif
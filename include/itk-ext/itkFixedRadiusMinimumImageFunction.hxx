@@ -0,0 +1,87 @@
+#ifndef itkFixedRadiusMinimumImageFunction_hxx
+#define itkFixedRadiusMinimumImageFunction_hxx
+
+#include "itkFixedRadiusMinimumImageFunction.h"
+
+#include <algorithm>
+
+namespace itk
+{
+/**
+ * Constructor
+ */
+template< typename TInputImage, unsigned int VRadius, typename TCoordRep >
+FixedRadiusMinimumImageFunction< TInputImage, VRadius, TCoordRep >
+::FixedRadiusMinimumImageFunction()
+{
+  this->Superclass::SetNeighborhoodRadius(VRadius);
+  std::fill(m_Offsets, m_Offsets + NumberOfNeighbours, 0);
+}
+
+/**
+ *
+ */
+template< typename TInputImage, unsigned int VRadius, typename TCoordRep >
+void
+FixedRadiusMinimumImageFunction< TInputImage, VRadius, TCoordRep >
+::SetNeighborhoodRadius(const unsigned int radius)
+{
+  if ( radius != VRadius )
+    {
+    itkExceptionMacro(<< "The radius is fixed to " << VRadius << ", got " << radius);
+    }
+}
+
+/**
+ *
+ */
+template< typename TInputImage, unsigned int VRadius, typename TCoordRep >
+void
+FixedRadiusMinimumImageFunction< TInputImage, VRadius, TCoordRep >
+::SetInputImage(const InputImageType *ptr)
+{
+  this->Superclass::SetInputImage(ptr);
+  if ( ptr )
+    {
+    Superclass::ComputeBoxOffsets(ptr, VRadius, m_Offsets);
+    }
+}
+
+/**
+ *
+ */
+template< typename TInputImage, unsigned int VRadius, typename TCoordRep >
+typename FixedRadiusMinimumImageFunction< TInputImage, VRadius, TCoordRep >
+::OutputType
+FixedRadiusMinimumImageFunction< TInputImage, VRadius, TCoordRep >
+::EvaluateAtIndex(const IndexType & index) const
+{
+  const InputImageType *image = this->GetInputImage();
+  if ( !image )
+    {
+    return ( NumericTraits< OutputType >::max() );
+    }
+
+  // Boxes crossing the edge of the buffer are clipped by the superclass
+  const OffsetValueType radius = static_cast< OffsetValueType >( VRadius );
+  for ( unsigned int i = 0; i < ImageDimension; ++i )
+    {
+    if ( index[i] - radius < this->m_StartIndex[i]
+         || index[i] + radius > this->m_EndIndex[i] )
+      {
+      return this->Superclass::EvaluateAtIndex(index);
+      }
+    }
+
+  const InputPixelType *center = image->GetBufferPointer() + image->ComputeOffset(index);
+  InputPixelType minimumValue = center[m_Offsets[0]];
+  for ( unsigned int k = 1; k < NumberOfNeighbours; ++k )
+    {
+    minimumValue = std::min(minimumValue, center[m_Offsets[k]]);
+    }
+
+  return ( minimumValue );
+}
+} // namespace itk
+
+#endif
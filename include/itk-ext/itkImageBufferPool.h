@@ -0,0 +1,118 @@
+#ifndef __itkImageBufferPool_h
+#define __itkImageBufferPool_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkImageBase.h"
+
+#include <list>
+
+namespace itk
+{
+/**
+* \class ImageBufferPool
+* \brief A pool of image buffers that are leased and returned explicitly, so
+* that same sized intermediate images are recycled rather than allocated
+*
+* Filters that build many intermediate images of the same size, such as a
+* level per smoothing scale for every input, pay for each fresh buffer in
+* allocator calls, page faults and the zeroing of the new pages. Leasing
+* them from a pool instead hands back a buffer of the same region that was
+* returned earlier, and only allocates when none is free.
+*
+* Buffers are keyed by their buffered region, and by the pixel type through
+* the image type of the pool. Lease() gives an image of the region in the
+* space of a reference image, its pixels left as they were, and Return()
+* puts an image back for a later lease. The pool keeps every returned
+* buffer until Clear() or its destruction, so a pool owned by a filter
+* recycles them across updates as well.
+*
+* A returned image is only leased again once the pool holds the last
+* reference to it and to its pixel container. Images returned while they
+* are still shared, such as results a caller kept hold of, are therefore
+* never overwritten, they are simply not recycled until released.
+*
+* \ingroup DataRepresentation
+*/
+template <class TImage>
+class ITK_EXPORT ImageBufferPool : public Object
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef ImageBufferPool              Self;
+  typedef Object                       Superclass;
+  typedef SmartPointer<Self>           Pointer;
+  typedef SmartPointer<const Self>     ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(ImageBufferPool, Object);
+
+  /** Dimensionality of the pooled images. */
+  itkStaticConstMacro(ImageDimension, unsigned int, TImage::ImageDimension);
+
+  /** Image typedefs. */
+  typedef TImage                                          ImageType;
+  typedef typename TImage::Pointer                        ImagePointer;
+  typedef typename TImage::RegionType                     RegionType;
+  typedef ImageBase<itkGetStaticConstMacro(ImageDimension)> ReferenceImageType;
+
+  /** Lease an image buffered over the region with the spacing, origin and
+   *  direction of the reference. Its pixels are not initialised. */
+  ImagePointer Lease(const ReferenceImageType *reference,
+                     const RegionType &region);
+
+  /** Return an image to the pool for a later lease. NULL images, images
+   *  without a buffer and images already in the pool are ignored. */
+  void Return(ImageType *image);
+
+  /** Release every pooled buffer. */
+  void Clear();
+
+  /** Number of buffers held by the pool. */
+  SizeValueType GetNumberOfBuffers() const
+    {
+    return m_Buffers.size();
+    }
+
+  /** Number of leases that allocated a new buffer and that recycled one. */
+  itkGetConstMacro(NumberOfAllocations, SizeValueType);
+  itkGetConstMacro(NumberOfReuses, SizeValueType);
+
+protected:
+
+  ImageBufferPool()
+    {
+    m_NumberOfAllocations = 0;
+    m_NumberOfReuses = 0;
+    }
+
+  virtual ~ImageBufferPool() {}
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+private:
+
+  ImageBufferPool(const Self&);   // Not implemented on purpose
+
+  void operator=(const Self&);    // Not implemented on purpose
+
+  typedef std::list<ImagePointer> BufferListType;
+
+  BufferListType        m_Buffers;
+  SizeValueType         m_NumberOfAllocations;
+  SizeValueType         m_NumberOfReuses;
+
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkImageBufferPool.txx"
+#endif
+
+#endif // End #ifndef __itkImageBufferPool_h
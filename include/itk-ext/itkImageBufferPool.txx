@@ -0,0 +1,80 @@
+#ifndef __itkImageBufferPool_txx
+#define __itkImageBufferPool_txx
+
+#include "itkImageBufferPool.h"
+
+#include <algorithm>
+
+namespace itk
+{
+
+template <class TImage>
+typename ImageBufferPool<TImage>::ImagePointer
+ImageBufferPool<TImage>
+::Lease(const ReferenceImageType *reference, const RegionType &region)
+{
+  // Recycle a buffer of the region that nothing outside the pool refers to
+  for (typename BufferListType::iterator it = m_Buffers.begin();
+       it != m_Buffers.end(); ++it)
+    {
+    if ( (*it)->GetBufferedRegion() == region
+         && (*it)->GetReferenceCount() == 1
+         && (*it)->GetPixelContainer()->GetReferenceCount() == 1 )
+      {
+      ImagePointer image = *it;
+      m_Buffers.erase(it);
+      image->CopyInformation(reference);
+      image->SetRegions(region);
+      ++m_NumberOfReuses;
+      return image;
+      }
+    }
+
+  ImagePointer image = ImageType::New();
+  image->CopyInformation(reference);
+  image->SetRegions(region);
+  image->Allocate();
+  ++m_NumberOfAllocations;
+  return image;
+}
+
+template <class TImage>
+void
+ImageBufferPool<TImage>
+::Return(ImageType *image)
+{
+  if ( !image || !image->GetBufferPointer() )
+    {
+    return;
+    }
+  if ( std::find(m_Buffers.begin(), m_Buffers.end(), image) != m_Buffers.end() )
+    {
+    return;
+    }
+
+  m_Buffers.push_back(image);
+}
+
+template <class TImage>
+void
+ImageBufferPool<TImage>
+::Clear()
+{
+  m_Buffers.clear();
+}
+
+template <class TImage>
+void
+ImageBufferPool<TImage>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "NumberOfBuffers: " << m_Buffers.size() << std::endl;
+  os << indent << "NumberOfAllocations: " << m_NumberOfAllocations << std::endl;
+  os << indent << "NumberOfReuses: " << m_NumberOfReuses << std::endl;
+}
+
+} // end namespace itk
+
+#endif
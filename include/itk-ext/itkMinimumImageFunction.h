@@ -20,6 +20,7 @@
 
 #include "itkImageFunction.h"
 #include "itkNumericTraits.h"
+#include "itkMultiThreader.h"
 
 namespace itk
 {
@@ -33,6 +34,14 @@ namespace itk
  * If called with a ContinuousIndex or Point, the calculation is performed
  * at the nearest neighbor.
  *
+ * The neighborhood is walked directly in the buffer of the image, without
+ * any iterator or copy of the pixels. The edge pixels repeated by the
+ * boundary condition cannot lower the minimum, so the box is simply clipped
+ * to the buffered region. EvaluateOverRegion() evaluates a whole region at
+ * once: its interior is read through a table of buffer offsets, only the
+ * boundary faces are clipped, and the region is split between threads.
+ * FixedRadiusMinimumImageFunction fixes the radius at compile time.
+ *
  * This class is templated over the input image type and the
  * coordinate representation type (e.g. float or double ).
  *
@@ -83,6 +92,11 @@ public:
   itkStaticConstMacro(ImageDimension, unsigned int,
                       InputImageType::ImageDimension);
 
+  /** Region and image typedefs of the batch evaluation. The output holds
+   *  the minimum of every pixel. */
+  typedef typename InputImageType::RegionType RegionType;
+  typedef InputImageType                      OutputImageType;
+
   /** Evalulate the function at specified index */
   virtual OutputType EvaluateAtIndex(const IndexType & index) const ITK_OVERRIDE;
 
@@ -104,6 +118,12 @@ public:
     return this->EvaluateAtIndex(index);
   }
 
+  /** Evaluate the function at every index of region and write the minima
+   *  to the same region of output, which must be buffered over it. The
+   *  region must lie inside the buffer of the input image. */
+  virtual void EvaluateOverRegion(const RegionType & region,
+                                  OutputImageType *output) const;
+
   /** Get/Set the radius of the neighborhood over which the
       statistics are evaluated */
   itkSetMacro( NeighborhoodRadius, unsigned int );
@@ -114,6 +134,29 @@ protected:
   ~MinimumImageFunction(){}
   void PrintSelf(std::ostream & os, Indent indent) const ITK_OVERRIDE;
 
+  /** Write the buffer offsets of the box of the given radius in image,
+   *  first axis fastest, to offsets, which holds (2 radius + 1)^Dimension
+   *  values. */
+  static void ComputeBoxOffsets(const InputImageType *image,
+                                unsigned int radius, OffsetValueType *offsets);
+
+  /** Data shared by the threads of EvaluateOverRegion */
+  struct EvaluateThreadStruct
+    {
+    const Self            *Function;
+    RegionType            Region;
+    OutputImageType       *Output;
+    const OffsetValueType *Offsets;
+    SizeValueType         NumberOfOffsets;
+    };
+
+  /** Evaluate the part of a region handled by one thread */
+  void ThreadedEvaluateOverRegion(const RegionType & region,
+                                  const EvaluateThreadStruct *str) const;
+
+  /** Static function used to split EvaluateOverRegion between threads. */
+  static ITK_THREAD_RETURN_TYPE EvaluateThreaderCallback(void *arg);
+
 private:
   MinimumImageFunction(const Self &); //purposely not implemented
   void operator=(const Self &);      //purposely not implemented
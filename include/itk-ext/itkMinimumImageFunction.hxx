@@ -19,7 +19,10 @@
 #define itkMinimumImageFunction_hxx
 
 #include "itkMinimumImageFunction.h"
-#include "itkConstNeighborhoodIterator.h"
+#include "itkNeighborhoodAlgorithm.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
 
 #include <vector>
 #include <algorithm>
@@ -57,9 +60,8 @@ typename MinimumImageFunction< TInputImage, TCoordRep >
 MinimumImageFunction< TInputImage, TCoordRep >
 ::EvaluateAtIndex(const IndexType & index) const
 {
-  unsigned int i;
-
-  if ( !this->GetInputImage() )
+  const InputImageType *image = this->GetInputImage();
+  if ( !image )
     {
     return ( NumericTraits< OutputType >::max() );
     }
@@ -69,31 +71,208 @@ MinimumImageFunction< TInputImage, TCoordRep >
     return ( NumericTraits< OutputType >::max() );
     }
 
-  // Create an N-d neighborhood kernel, using a zeroflux boundary condition
-  typename InputImageType::SizeType kernelSize;
-  kernelSize.Fill( m_NeighborhoodRadius );
+  // The zero flux boundary repeats the edge pixels, which are already in
+  // the box, so the box is clipped to the buffer
+  const OffsetValueType radius = static_cast< OffsetValueType >( m_NeighborhoodRadius );
+  IndexType first;
+  IndexType last;
+  for ( unsigned int i = 0; i < ImageDimension; ++i )
+    {
+    first[i] = std::max(index[i] - radius, this->m_StartIndex[i]);
+    last[i] = std::min(index[i] + radius, this->m_EndIndex[i]);
+    }
 
-  ConstNeighborhoodIterator< InputImageType >
-  it( kernelSize, this->GetInputImage(), this->GetInputImage()->GetBufferedRegion() );
+  // Walk the lines of the box along the first axis
+  const OffsetValueType *offsetTable = image->GetOffsetTable();
+  const InputPixelType *buffer = image->GetBufferPointer();
+  const OffsetValueType lineLength = last[0] - first[0] + 1;
+  OffsetValueType offset = image->ComputeOffset(first);
+  IndexType position = first;
+  InputPixelType minimumValue = buffer[offset];
+  while ( true )
+    {
+    const InputPixelType *line = buffer + offset;
+    for ( OffsetValueType n = 0; n < lineLength; ++n )
+      {
+      minimumValue = std::min(minimumValue, line[n]);
+      }
 
-  // Set the iterator at the desired location
-  it.SetLocation(index);
+    unsigned int axis = 1;
+    for ( ; axis < ImageDimension; ++axis )
+      {
+      if ( position[axis] < last[axis] )
+        {
+        ++position[axis];
+        offset += offsetTable[axis];
+        break;
+        }
+      offset -= ( position[axis] - first[axis] ) * offsetTable[axis];
+      position[axis] = first[axis];
+      }
+    if ( axis == ImageDimension )
+      {
+      break;
+      }
+    }
 
-  // We have to copy the pixels so we can run std::min_element.
-  std::vector< InputPixelType > pixels;
+  return ( minimumValue );
+}
+
+/**
+ *
+ */
+template< typename TInputImage, typename TCoordRep >
+void
+MinimumImageFunction< TInputImage, TCoordRep >
+::ComputeBoxOffsets(const InputImageType *image, unsigned int radius,
+                    OffsetValueType *offsets)
+{
+  const OffsetValueType *offsetTable = image->GetOffsetTable();
+  const OffsetValueType width = 2 * static_cast< OffsetValueType >( radius ) + 1;
+
+  SizeValueType count = 1;
+  for ( unsigned int i = 0; i < ImageDimension; ++i )
+    {
+    count *= width;
+    }
 
-  // Walk the neighborhood
-  for ( i = 0; i < it.Size(); ++i )
+  // The digits of k in base width are the box coordinates, first axis
+  // fastest
+  for ( SizeValueType k = 0; k < count; ++k )
     {
-    pixels.push_back( it.GetPixel(i) );
-    //std::cout << it.GetPixel(i) << ", ";
+    SizeValueType digits = k;
+    OffsetValueType offset = 0;
+    for ( unsigned int i = 0; i < ImageDimension; ++i )
+      {
+      const OffsetValueType coordinate =
+        static_cast< OffsetValueType >( digits % width ) - static_cast< OffsetValueType >( radius );
+      digits /= width;
+      offset += coordinate * offsetTable[i];
+      }
+    offsets[k] = offset;
     }
-  //std::cout << std::endl;
+}
 
-  // Get the Minimum value
-  InputPixelType minimumValue = *std::min_element( pixels.begin(), pixels.end() );
+/**
+ *
+ */
+template< typename TInputImage, typename TCoordRep >
+void
+MinimumImageFunction< TInputImage, TCoordRep >
+::EvaluateOverRegion(const RegionType & region, OutputImageType *output) const
+{
+  const InputImageType *image = this->GetInputImage();
+  if ( !image )
+    {
+    itkExceptionMacro(<< "No input image");
+    }
+  if ( !image->GetBufferedRegion().IsInside(region) )
+    {
+    itkExceptionMacro(<< "The input must be buffered over the region");
+    }
+  if ( !output || !output->GetBufferedRegion().IsInside(region) )
+    {
+    itkExceptionMacro(<< "The output must be buffered over the region");
+    }
 
-  return ( minimumValue );
+  SizeValueType numberOfOffsets = 1;
+  for ( unsigned int i = 0; i < ImageDimension; ++i )
+    {
+    numberOfOffsets *= 2 * m_NeighborhoodRadius + 1;
+    }
+  std::vector< OffsetValueType > offsets(numberOfOffsets);
+  Self::ComputeBoxOffsets(image, m_NeighborhoodRadius, &offsets[0]);
+
+  EvaluateThreadStruct str;
+  str.Function = this;
+  str.Region = region;
+  str.Output = output;
+  str.Offsets = &offsets[0];
+  str.NumberOfOffsets = numberOfOffsets;
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetSingleMethod(this->EvaluateThreaderCallback, &str);
+  threader->SingleMethodExecute();
+}
+
+/**
+ *
+ */
+template< typename TInputImage, typename TCoordRep >
+void
+MinimumImageFunction< TInputImage, TCoordRep >
+::ThreadedEvaluateOverRegion(const RegionType & region,
+                             const EvaluateThreadStruct *str) const
+{
+  const InputImageType *image = this->GetInputImage();
+  typename InputImageType::SizeType radius;
+  radius.Fill(m_NeighborhoodRadius);
+
+  typedef NeighborhoodAlgorithm::ImageBoundaryFacesCalculator< InputImageType >
+    FacesCalculatorType;
+  FacesCalculatorType facesCalculator;
+  typename FacesCalculatorType::FaceListType faces =
+    facesCalculator(image, region, radius);
+
+  // The first face is the interior, whose boxes lie inside the buffer
+  typename FacesCalculatorType::FaceListType::const_iterator face = faces.begin();
+  if ( face != faces.end() && face->GetNumberOfPixels() > 0 )
+    {
+    ImageRegionConstIterator< InputImageType > inputIt(image, *face);
+    ImageRegionIterator< OutputImageType > outputIt(str->Output, *face);
+    for ( ; !outputIt.IsAtEnd(); ++inputIt, ++outputIt )
+      {
+      const InputPixelType *center = &inputIt.Value();
+      InputPixelType minimumValue = center[str->Offsets[0]];
+      for ( SizeValueType k = 1; k < str->NumberOfOffsets; ++k )
+        {
+        minimumValue = std::min(minimumValue, center[str->Offsets[k]]);
+        }
+      outputIt.Set(minimumValue);
+      }
+    }
+  if ( face != faces.end() )
+    {
+    ++face;
+    }
+
+  for ( ; face != faces.end(); ++face )
+    {
+    ImageRegionIteratorWithIndex< OutputImageType > outputIt(str->Output, *face);
+    for ( ; !outputIt.IsAtEnd(); ++outputIt )
+      {
+      outputIt.Set( this->EvaluateAtIndex( outputIt.GetIndex() ) );
+      }
+    }
+}
+
+/**
+ *
+ */
+template< typename TInputImage, typename TCoordRep >
+ITK_THREAD_RETURN_TYPE
+MinimumImageFunction< TInputImage, TCoordRep >
+::EvaluateThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast< MultiThreader::ThreadInfoStruct * >( arg );
+  const EvaluateThreadStruct *str =
+    static_cast< const EvaluateThreadStruct * >( info->UserData );
+
+  // Split the region along its last axis
+  const unsigned int axis = ImageDimension - 1;
+  const SizeValueType size = str->Region.GetSize(axis);
+  const SizeValueType begin = ( size * info->ThreadID ) / info->NumberOfThreads;
+  const SizeValueType end = ( size * ( info->ThreadID + 1 ) ) / info->NumberOfThreads;
+  if ( begin < end )
+    {
+    RegionType region = str->Region;
+    region.SetIndex(axis, region.GetIndex(axis) + static_cast< OffsetValueType >( begin ));
+    region.SetSize(axis, end - begin);
+    str->Function->ThreadedEvaluateOverRegion(region, str);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
 }
 } // namespace itk
 
@@ -0,0 +1,218 @@
+#ifndef __itkPermutohedralBilateralImageFilter_h
+#define __itkPermutohedralBilateralImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkImage.h"
+#include "itkMultiThreader.h"
+#include "itkPermutohedralLattice.h"
+
+#include <vector>
+
+namespace itk
+{
+/**
+* \class PermutohedralBilateralImageFilter
+* \brief A joint bilateral filter over several co-registered images
+*
+* This filter smooths several images at once, with a range term that uses
+* the intensities of all of them jointly. Two pixels are averaged only when
+* they are close in space and close in every channel, so edges are defined
+* consistently across the images.
+*
+* The channels are the components of all indexed inputs, in order. Inputs
+* may be scalar images or VectorImages and must share the same geometry.
+* There is one output per channel, holding that channel filtered with the
+* joint kernel.
+*
+* The filter uses the permutohedral lattice of Adams et al. [1] over the
+* feature space (position/DomainSigma, channels/RangeSigma). Unlike the
+* bilateral grid of the FastBilateralImageFilter, whose size grows
+* exponentially with the number of range channels, its cost is linear in
+* the number of points and quadratic in the feature dimension.
+*
+* Splatting is multithreaded over slabs of the input, each thread filling a
+* private lattice that is then summed into the shared one. The blur along
+* each lattice direction and the slicing are multithreaded as well.
+*
+* [1] Andrew Adams, Jongmin Baek and Myers Abraham Davis,
+*     Fast High-Dimensional Filtering Using the Permutohedral Lattice,
+*     Computer Graphics Forum (Eurographics 2010)
+*
+* \sa FastBilateralImageFilter
+* \sa PermutohedralLattice
+*
+* \ingroup ImageEnhancement
+* \ingroup ImageFeatureExtraction
+*/
+template <class TInputImage, class TOutputImage >
+class ITK_EXPORT PermutohedralBilateralImageFilter :
+    public ImageToImageFilter< TInputImage, TOutputImage >
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef PermutohedralBilateralImageFilter                 Self;
+  typedef ImageToImageFilter< TInputImage, TOutputImage >   Superclass;
+  typedef SmartPointer<Self>                                Pointer;
+  typedef SmartPointer<const Self>                          ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PermutohedralBilateralImageFilter, ImageToImageFilter);
+
+  /** Dimensionality of the input image. Dimensionality of the output image
+   *  is assumed to be the same. */
+  itkStaticConstMacro(
+    ImageDimension, unsigned int, TInputImage::ImageDimension);
+
+  /** Input image typedefs. */
+  typedef TInputImage                                   InputImageType;
+  typedef typename TInputImage::Pointer                 InputImagePointer;
+  typedef typename TInputImage::ConstPointer            InputImageConstPointer;
+  typedef typename TInputImage::SpacingType             InputImageSpacingType;
+  typedef typename TInputImage::IndexType               InputImageIndexType;
+  typedef typename TInputImage::RegionType              InputImageRegionType;
+  typedef typename TInputImage::InternalPixelType       InputInternalPixelType;
+
+  /** Output image typedefs. */
+  typedef TOutputImage                                  OutputImageType;
+  typedef typename TOutputImage::Pointer                OutputImagePointer;
+  typedef typename TOutputImage::RegionType             OutputImageRegionType;
+  typedef typename TOutputImage::PixelType              OutputPixelType;
+
+  typedef typename Superclass::DataObjectPointerArraySizeType
+    DataObjectPointerArraySizeType;
+
+  /** Typedef for an array of doubles that specifies the DomainSigma
+   *  in each spacial dimension. */
+  typedef FixedArray<double, itkGetStaticConstMacro(ImageDimension)>
+    DomainSigmaArrayType;
+
+  /** Standard get/set macros for filter parameters.
+   *  DomainSigma is specified in the same units as the Image spacing.
+   *  RangeSigma is specified in the units of intensity and is shared by
+   *  all channels. */
+  itkGetConstMacro(DomainSigma, const DomainSigmaArrayType);
+  itkSetMacro(DomainSigma, DomainSigmaArrayType);
+  itkGetConstMacro(RangeSigma, double);
+  itkSetMacro(RangeSigma, double);
+
+  /** Convenience set method for setting all domain standard deviations to the
+   *  same value. */
+  void SetDomainSigma(const double v)
+    {
+    m_DomainSigma.Fill(v);
+    }
+
+  /** Sets first NULL indexed input, appends to the end otherwise */
+  void AddInput(const InputImageType *input)
+    {
+    Superclass::AddInput(const_cast<InputImageType*>(input));
+    }
+
+  /** Number of channels, i.e. of outputs. Valid after the output
+   *  information has been generated. */
+  itkGetConstMacro(NumberOfChannels, unsigned int);
+
+protected:
+
+  /** Default Constructor. Default value for DomainSigma is 4. Default
+   *  value for RangeSigma is 50, as for the FastBilateralImageFilter. */
+  PermutohedralBilateralImageFilter();
+
+  virtual ~PermutohedralBilateralImageFilter() {}
+
+  /** Create one output per channel. */
+  virtual void GenerateOutputInformation();
+
+  /** The lattice is built from the whole of every input. */
+  virtual void GenerateInputRequestedRegion();
+
+  /** Build and blur the lattice from the inputs */
+  void BeforeThreadedGenerateData();
+
+  /** Slice the lattice to construct the output region of a thread */
+  void ThreadedGenerateData(const OutputImageRegionType& outputRegionForThread,
+                            ThreadIdType threadId);
+
+  /** Release the lattice */
+  void AfterThreadedGenerateData();
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+  /** Lattice types. Each vertex holds the channels and the weight. */
+  typedef float                                         LatticeValueType;
+  typedef PermutohedralLattice<LatticeValueType>        LatticeType;
+  typedef typename LatticeType::Pointer                 LatticePointer;
+  typedef typename LatticeType::SimplexType             SimplexType;
+
+  /** Gather the channels of a pixel and its position in the feature space,
+   *  in units of standard deviations. */
+  void ComputeFeatures(const InputImageIndexType &index,
+                       LatticeValueType *values,
+                       LatticeValueType *position) const;
+
+  /** Data shared by the threads of the splat, its reduction and the blur. */
+  struct LatticeThreadStruct
+    {
+    Self                         *Filter;
+    std::vector<LatticePointer>  PrivateLattices;
+    unsigned int                 Direction;
+    };
+
+  /** Sort the thread's slab of the input into its private lattice. */
+  void ThreadedSplat(LatticeThreadStruct *str, ThreadIdType threadId,
+                     ThreadIdType numberOfThreads);
+
+  /** Sum the private lattices into the shared one. Each thread owns a
+   *  disjoint range of vertices so no locking is required. */
+  void ThreadedSplatReduce(LatticeThreadStruct *str, ThreadIdType threadId,
+                           ThreadIdType numberOfThreads);
+
+  /** Blur a range of vertices along str->Direction. */
+  void ThreadedBlur(LatticeThreadStruct *str, ThreadIdType threadId,
+                    ThreadIdType numberOfThreads);
+
+  /** Static functions used to dispatch the passes to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE SplatThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE SplatReduceThreaderCallback(void *arg);
+  static ITK_THREAD_RETURN_TYPE BlurThreaderCallback(void *arg);
+
+  /** Split [0, length) into numberOfPieces nearly equal parts and return
+   *  the bounds of the given piece. */
+  static void SplitRange(SizeValueType length, ThreadIdType piece,
+                         ThreadIdType numberOfPieces,
+                         SizeValueType &begin, SizeValueType &end)
+    {
+    begin = (length*piece)/numberOfPieces;
+    end   = (length*(piece+1))/numberOfPieces;
+    }
+
+private:
+
+  PermutohedralBilateralImageFilter(const Self&);  // Not implemented on purpose
+
+  void operator=(const Self&);                     // Not implemented on purpose
+
+  double                m_RangeSigma;
+  DomainSigmaArrayType  m_DomainSigma;
+  unsigned int          m_NumberOfChannels;
+
+  /** State shared between lattice construction and the slicing threads */
+  LatticePointer                        m_Lattice;
+  DomainSigmaArrayType                  m_DomainSigmaInPixels;
+  std::vector<const InputInternalPixelType *>  m_InputBuffers;
+  std::vector<unsigned int>             m_InputComponents;
+
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkPermutohedralBilateralImageFilter.txx"
+#endif
+
+#endif // End #ifndef __itkPermutohedralBilateralImageFilter_h
@@ -0,0 +1,362 @@
+#ifndef __itkPermutohedralBilateralImageFilter_txx
+#define __itkPermutohedralBilateralImageFilter_txx
+
+#include "itkPermutohedralBilateralImageFilter.h"
+
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+namespace itk
+{
+
+template< class TInputImage, class TOutputImage >
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::PermutohedralBilateralImageFilter()
+{
+  m_DomainSigma.Fill(4.0);
+  m_RangeSigma = 50.0;
+  m_NumberOfChannels = 1;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::GenerateOutputInformation()
+{
+  // One output per channel of the inputs
+  m_NumberOfChannels = 0;
+  for (unsigned int k = 0; k < this->GetNumberOfIndexedInputs(); ++k)
+    {
+    const InputImageType *input = this->GetInput(k);
+    if ( input )
+      {
+      m_NumberOfChannels += input->GetNumberOfComponentsPerPixel();
+      }
+    }
+  if ( m_NumberOfChannels == 0 )
+    {
+    itkExceptionMacro(<< "At least one input is required.");
+    }
+
+  this->SetNumberOfIndexedOutputs(m_NumberOfChannels);
+  for (unsigned int c = 0; c < m_NumberOfChannels; ++c)
+    {
+    if ( !this->GetOutput(c) )
+      {
+      this->SetNthOutput(c, this->MakeOutput(c));
+      }
+    }
+
+  Superclass::GenerateOutputInformation();
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::GenerateInputRequestedRegion()
+{
+  Superclass::GenerateInputRequestedRegion();
+
+  // Every pixel of every input contributes to the lattice
+  for (unsigned int k = 0; k < this->GetNumberOfIndexedInputs(); ++k)
+    {
+    InputImagePointer input = const_cast<InputImageType *>(this->GetInput(k));
+    if ( input )
+      {
+      input->SetRequestedRegionToLargestPossibleRegion();
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::BeforeThreadedGenerateData()
+{
+  InputImageConstPointer input = this->GetInput();
+  const InputImageRegionType & region = input->GetBufferedRegion();
+
+  // All inputs are read through the offsets of the first one
+  m_InputBuffers.clear();
+  m_InputComponents.clear();
+  for (unsigned int k = 0; k < this->GetNumberOfIndexedInputs(); ++k)
+    {
+    const InputImageType *image = this->GetInput(k);
+    if ( !image )
+      {
+      continue;
+      }
+    if ( image->GetBufferedRegion() != region )
+      {
+      itkExceptionMacro(<< "Input " << k << " does not have the region of the first input.");
+      }
+    m_InputBuffers.push_back(image->GetBufferPointer());
+    m_InputComponents.push_back(image->GetNumberOfComponentsPerPixel());
+    }
+
+  // Convert domain sigmas from spacing units to pixel units
+  const InputImageSpacingType& spacing = input->GetSpacing();
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    m_DomainSigmaInPixels[i] = m_DomainSigma[i] / spacing[i];
+    }
+
+  m_Lattice = LatticeType::New();
+  m_Lattice->SetDimensions(itkGetStaticConstMacro(ImageDimension) + m_NumberOfChannels,
+                           m_NumberOfChannels + 1);
+
+  LatticeThreadStruct str;
+  str.Filter = this;
+  str.Direction = 0;
+
+  this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+  str.PrivateLattices.resize(this->GetMultiThreader()->GetNumberOfThreads());
+
+  // Splat. Every thread sorts a slab of the input into a private lattice,
+  // the shared lattice then holds the union of their vertices and sums them.
+  this->GetMultiThreader()->SetSingleMethod(this->SplatThreaderCallback, &str);
+  this->GetMultiThreader()->SingleMethodExecute();
+
+  for (size_t t = 0; t < str.PrivateLattices.size(); ++t)
+    {
+    const LatticeType *privateLattice = str.PrivateLattices[t];
+    for (SizeValueType v = 0; v < privateLattice->GetNumberOfVertices(); ++v)
+      {
+      m_Lattice->InsertVertex(privateLattice->GetKey(v));
+      }
+    }
+
+  this->GetMultiThreader()->SetSingleMethod(this->SplatReduceThreaderCallback,
+                                            &str);
+  this->GetMultiThreader()->SingleMethodExecute();
+  str.PrivateLattices.clear();
+
+  // Blur along each of the d+1 lattice directions
+  m_Lattice->AllocateBackBuffer();
+  this->GetMultiThreader()->SetSingleMethod(this->BlurThreaderCallback, &str);
+  for (str.Direction = 0;
+       str.Direction <= m_Lattice->GetFeatureDimension(); ++str.Direction)
+    {
+    this->GetMultiThreader()->SingleMethodExecute();
+    m_Lattice->SwapBuffers();
+    }
+  m_Lattice->ReleaseBackBuffer();
+
+  itkDebugMacro(<< "Lattice of " << m_Lattice->GetNumberOfVertices()
+                << " vertices, " << m_Lattice->GetMemorySize() << " bytes");
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::ComputeFeatures(const InputImageIndexType &index,
+                  LatticeValueType *values,
+                  LatticeValueType *position) const
+{
+  const OffsetValueType offset = this->GetInput()->ComputeOffset(index);
+  unsigned int channel = 0;
+  for (size_t k = 0; k < m_InputBuffers.size(); ++k)
+    {
+    const InputInternalPixelType *pixel =
+      m_InputBuffers[k] + offset*m_InputComponents[k];
+    for (unsigned int c = 0; c < m_InputComponents[k]; ++c, ++channel)
+      {
+      values[channel] = static_cast<LatticeValueType>(pixel[c]);
+      }
+    }
+
+  for (unsigned int i = 0; i < itkGetStaticConstMacro(ImageDimension); ++i)
+    {
+    position[i] = index[i] / m_DomainSigmaInPixels[i];
+    }
+  for (unsigned int c = 0; c < m_NumberOfChannels; ++c)
+    {
+    position[itkGetStaticConstMacro(ImageDimension) + c] =
+      values[c] / m_RangeSigma;
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedGenerateData(const OutputImageRegionType& outputRegionForThread,
+                       ThreadIdType itkNotUsed(threadId))
+{
+  // Every output pixel is interpolated from the d+1 vertices of the simplex
+  // enclosing its features
+  std::vector<OutputPixelType *> outputBuffers(m_NumberOfChannels);
+  for (unsigned int c = 0; c < m_NumberOfChannels; ++c)
+    {
+    outputBuffers[c] = this->GetOutput(c)->GetBufferPointer();
+    }
+  OutputImagePointer output = this->GetOutput();
+
+  SimplexType simplex;
+  m_Lattice->InitializeSimplex(simplex);
+  std::vector<LatticeValueType> values(m_NumberOfChannels);
+  std::vector<LatticeValueType> position(m_Lattice->GetFeatureDimension());
+
+  ImageRegionConstIteratorWithIndex<TInputImage>
+    iterInput(this->GetInput(), outputRegionForThread);
+  for ( iterInput.GoToBegin(); !iterInput.IsAtEnd(); ++iterInput )
+    {
+    const InputImageIndexType index = iterInput.GetIndex();
+    this->ComputeFeatures(index, &values[0], &position[0]);
+    m_Lattice->ComputeSimplex(&position[0], simplex);
+    m_Lattice->Slice(simplex, &values[0]);
+
+    const OffsetValueType offset = output->ComputeOffset(index);
+    for (unsigned int c = 0; c < m_NumberOfChannels; ++c)
+      {
+      outputBuffers[c][offset] = static_cast<OutputPixelType>(values[c]);
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::AfterThreadedGenerateData()
+{
+  // The lattice can be large, do not keep it around between updates
+  m_Lattice = NULL;
+  m_InputBuffers.clear();
+  m_InputComponents.clear();
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSplat(LatticeThreadStruct *str, ThreadIdType threadId,
+                ThreadIdType numberOfThreads)
+{
+  const unsigned int lastAxis = itkGetStaticConstMacro(ImageDimension) - 1;
+  LatticePointer privateLattice = LatticeType::New();
+  privateLattice->SetDimensions(m_Lattice->GetFeatureDimension(),
+                                m_Lattice->GetValueDimension());
+  str->PrivateLattices[threadId] = privateLattice;
+
+  // Slab of the input sorted by this thread
+  InputImageRegionType slab = this->GetInput()->GetBufferedRegion();
+  SizeValueType begin, end;
+  SplitRange(slab.GetSize(lastAxis), threadId, numberOfThreads, begin, end);
+  if ( begin == end )
+    {
+    return;
+    }
+  slab.SetIndex(lastAxis, slab.GetIndex(lastAxis) + begin);
+  slab.SetSize(lastAxis, end - begin);
+
+  SimplexType simplex;
+  privateLattice->InitializeSimplex(simplex);
+  std::vector<LatticeValueType> values(m_NumberOfChannels);
+  std::vector<LatticeValueType> position(privateLattice->GetFeatureDimension());
+
+  ImageRegionConstIteratorWithIndex<TInputImage>
+    iterInput(this->GetInput(), slab);
+  for ( iterInput.GoToBegin(); !iterInput.IsAtEnd(); ++iterInput )
+    {
+    this->ComputeFeatures(iterInput.GetIndex(), &values[0], &position[0]);
+    privateLattice->ComputeSimplex(&position[0], simplex);
+    privateLattice->Splat(simplex, &values[0]);
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedSplatReduce(LatticeThreadStruct *str, ThreadIdType threadId,
+                      ThreadIdType numberOfThreads)
+{
+  SizeValueType begin, end;
+  SplitRange(m_Lattice->GetNumberOfVertices(), threadId, numberOfThreads,
+             begin, end);
+
+  const unsigned int valueDimension = m_Lattice->GetValueDimension();
+  for (SizeValueType v = begin; v < end; ++v)
+    {
+    const typename LatticeType::KeyValueType *key = m_Lattice->GetKey(v);
+    LatticeValueType *dst = m_Lattice->GetValues(v);
+    for (size_t t = 0; t < str->PrivateLattices.size(); ++t)
+      {
+      const LatticeValueType *src = str->PrivateLattices[t]->FindVertex(key);
+      if ( src == NULL )
+        {
+        continue;
+        }
+      for (unsigned int c = 0; c < valueDimension; ++c)
+        {
+        dst[c] += src[c];
+        }
+      }
+    }
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::ThreadedBlur(LatticeThreadStruct *str, ThreadIdType threadId,
+               ThreadIdType numberOfThreads)
+{
+  SizeValueType begin, end;
+  SplitRange(m_Lattice->GetNumberOfVertices(), threadId, numberOfThreads,
+             begin, end);
+  m_Lattice->BlurVertices(str->Direction, begin, end);
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::SplatThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  LatticeThreadStruct *str = static_cast<LatticeThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedSplat(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::SplatReduceThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  LatticeThreadStruct *str = static_cast<LatticeThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedSplatReduce(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+ITK_THREAD_RETURN_TYPE
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::BlurThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info =
+    static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  LatticeThreadStruct *str = static_cast<LatticeThreadStruct *>(info->UserData);
+
+  str->Filter->ThreadedBlur(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< class TInputImage, class TOutputImage >
+void
+PermutohedralBilateralImageFilter<TInputImage, TOutputImage>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "DomainSigma: " << m_DomainSigma << std::endl;
+  os << indent << "RangeSigma: " << m_RangeSigma << std::endl;
+  os << indent << "NumberOfChannels: " << m_NumberOfChannels << std::endl;
+}
+
+} // end namespace itk
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef __itkPermutohedralLattice_h
+#define __itkPermutohedralLattice_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIntTypes.h"
+
+#include <vector>
+
+namespace itk
+{
+/**
+* \class PermutohedralLattice
+* \brief Sparse permutohedral lattice for high dimensional Gaussian filtering
+*
+* The permutohedral lattice of Adams et al. [1] tessellates a feature space
+* of dimension d with simplices. A point is splatted onto the d+1 vertices
+* of the simplex enclosing it, the vertices are blurred with a [1 2 1]
+* kernel along each of the d+1 lattice directions, and the point is sliced
+* back from the same vertices. Every step costs O(d^2) per point instead of
+* the O(2^d) of a bilateral grid, so several range channels can be used
+* jointly.
+*
+* Only the vertices reached by the input are stored, in an open addressing
+* hash table keyed on their d integer coordinates. Every vertex holds
+* ValueDimension values, the last of which is the homogeneous weight.
+*
+* [1] Andrew Adams, Jongmin Baek and Myers Abraham Davis,
+*     Fast High-Dimensional Filtering Using the Permutohedral Lattice,
+*     Computer Graphics Forum (Eurographics 2010)
+*
+* \sa PermutohedralBilateralImageFilter
+* \sa SparseBilateralGrid
+*
+* \ingroup ImageEnhancement
+*/
+template< class TValue = float >
+class ITK_EXPORT PermutohedralLattice : public Object
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef PermutohedralLattice         Self;
+  typedef Object                       Superclass;
+  typedef SmartPointer<Self>           Pointer;
+  typedef SmartPointer<const Self>     ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(PermutohedralLattice, Object);
+
+  typedef TValue                       ValueType;
+  typedef int                          KeyValueType;
+
+  /** Enclosing simplex of a point: the keys of its d+1 vertices and their
+   *  barycentric weights, plus the workspace used to find them. Each thread
+   *  should use its own. */
+  struct SimplexType
+    {
+    std::vector<KeyValueType>  Keys;
+    std::vector<ValueType>     Weights;
+    std::vector<ValueType>     Elevated;
+    std::vector<ValueType>     Barycentric;
+    std::vector<KeyValueType>  Greedy;
+    std::vector<KeyValueType>  Rank;
+    };
+
+  /** Set the dimension of the feature space and the number of values per
+   *  vertex, including the homogeneous weight. This removes all vertices. */
+  void SetDimensions(unsigned int featureDimension, unsigned int valueDimension);
+  unsigned int GetFeatureDimension() const
+    {
+    return m_FeatureDimension;
+    }
+  unsigned int GetValueDimension() const
+    {
+    return m_ValueDimension;
+    }
+
+  /** Remove all vertices. */
+  void Clear();
+
+  /** Number of stored vertices, numbered [0, GetNumberOfVertices()). */
+  SizeValueType GetNumberOfVertices() const
+    {
+    return m_NumberOfVertices;
+    }
+
+  /** Access by vertex number. */
+  const KeyValueType * GetKey(SizeValueType vertex) const
+    {
+    return &m_Keys[vertex*m_FeatureDimension];
+    }
+  ValueType * GetValues(SizeValueType vertex)
+    {
+    return &m_Values[vertex*m_ValueDimension];
+    }
+
+  /** Size the workspace of a simplex for this lattice. */
+  void InitializeSimplex(SimplexType &simplex) const;
+
+  /** Find the simplex enclosing a point of the feature space. The position
+   *  is expected in units of standard deviations. Thread safe. */
+  void ComputeSimplex(const ValueType *position, SimplexType &simplex) const;
+
+  /** Return the values of the vertex with the given key, or NULL when it
+   *  is not stored. */
+  ValueType * FindVertex(const KeyValueType *key) const;
+
+  /** Return the values of the vertex with the given key, creating it zero
+   *  filled when it is not stored yet. Not thread safe. */
+  ValueType * InsertVertex(const KeyValueType *key);
+
+  /** Add ValueDimension-1 values and a unit weight to the vertices of a
+   *  simplex. Not thread safe. */
+  void Splat(const SimplexType &simplex, const ValueType *values);
+
+  /** Interpolate the vertices of a simplex and divide by the weight,
+   *  writing ValueDimension-1 values. Thread safe. */
+  void Slice(const SimplexType &simplex, ValueType *values) const;
+
+  /** Blur the vertices [beginVertex, endVertex) along one of the d+1
+   *  lattice directions with a [1 2 1]/4 kernel, reading the current values
+   *  and writing the back buffer. Call AllocateBackBuffer() before the
+   *  first pass and SwapBuffers() once all vertices of a pass are done.
+   *  Different vertex ranges may be processed by different threads. */
+  void BlurVertices(unsigned int direction,
+                    SizeValueType beginVertex, SizeValueType endVertex);
+  void AllocateBackBuffer();
+  void SwapBuffers();
+  void ReleaseBackBuffer();
+
+  /** Memory used by the vertices and the hash table, in bytes. */
+  SizeValueType GetMemorySize() const;
+
+protected:
+  PermutohedralLattice();
+  virtual ~PermutohedralLattice() {}
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+  /** Slot of a key in the hash table. */
+  SizeValueType HashSlot(const KeyValueType *key) const
+    {
+    uint64_t h = 0;
+    for (unsigned int i = 0; i < m_FeatureDimension; ++i)
+      {
+      h = (h + static_cast<uint32_t>(key[i]))*2531011ULL;
+      }
+    return static_cast<SizeValueType>
+      ((h*0x9E3779B97F4A7C15ULL) >> (64 - m_TableBits));
+    }
+
+  /** Grow the hash table and reinsert all vertices. */
+  void Rehash(unsigned int tableBits);
+
+private:
+  PermutohedralLattice(const Self&);  // Not implemented on purpose
+  void operator=(const Self&);        // Not implemented on purpose
+
+  unsigned int                m_FeatureDimension;
+  unsigned int                m_ValueDimension;
+  SizeValueType               m_NumberOfVertices;
+
+  /** Scale of each feature axis before elevation onto the lattice plane */
+  std::vector<ValueType>      m_ScaleFactors;
+
+  std::vector<KeyValueType>   m_Keys;
+  std::vector<ValueType>      m_Values;
+  std::vector<ValueType>      m_BackValues;
+
+  /** Hash table of vertex numbers plus one, zero marks an empty slot */
+  unsigned int                m_TableBits;
+  std::vector<SizeValueType>  m_Table;
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkPermutohedralLattice.txx"
+#endif
+
+#endif // End #ifndef __itkPermutohedralLattice_h
@@ -0,0 +1,396 @@
+#ifndef __itkPermutohedralLattice_txx
+#define __itkPermutohedralLattice_txx
+
+#include "itkPermutohedralLattice.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace itk
+{
+
+template< class TValue >
+PermutohedralLattice<TValue>
+::PermutohedralLattice()
+{
+  this->SetDimensions(1, 2);
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::SetDimensions(unsigned int featureDimension, unsigned int valueDimension)
+{
+  m_FeatureDimension = featureDimension;
+  m_ValueDimension = valueDimension;
+
+  // Features in units of standard deviations are scaled so that the
+  // d+1 [1 2 1] passes of the blur amount to a unit Gaussian
+  const double d = m_FeatureDimension;
+  const double invStdDev = (d + 1)*vcl_sqrt(2.0/3.0);
+  m_ScaleFactors.resize(m_FeatureDimension);
+  for (unsigned int i = 0; i < m_FeatureDimension; ++i)
+    {
+    m_ScaleFactors[i] = static_cast<ValueType>
+      (invStdDev/vcl_sqrt(static_cast<double>((i + 1)*(i + 2))));
+    }
+  this->Clear();
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::Clear()
+{
+  m_NumberOfVertices = 0;
+  std::vector<KeyValueType>().swap(m_Keys);
+  std::vector<ValueType>().swap(m_Values);
+  std::vector<ValueType>().swap(m_BackValues);
+  m_TableBits = 0;
+  this->Rehash(10);
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::Rehash(unsigned int tableBits)
+{
+  m_TableBits = tableBits;
+  m_Table.assign(SizeValueType(1) << m_TableBits, 0);
+
+  const SizeValueType mask = (SizeValueType(1) << m_TableBits) - 1;
+  for (SizeValueType vertex = 0; vertex < m_NumberOfVertices; ++vertex)
+    {
+    SizeValueType h = this->HashSlot(this->GetKey(vertex));
+    while ( m_Table[h] != 0 )
+      {
+      h = (h + 1) & mask;
+      }
+    m_Table[h] = vertex + 1;
+    }
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::InitializeSimplex(SimplexType &simplex) const
+{
+  const unsigned int d = m_FeatureDimension;
+  simplex.Keys.resize((d + 1)*d);
+  simplex.Weights.resize(d + 1);
+  simplex.Elevated.resize(d + 1);
+  simplex.Barycentric.resize(d + 2);
+  simplex.Greedy.resize(d + 1);
+  simplex.Rank.resize(d + 1);
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::ComputeSimplex(const ValueType *position, SimplexType &simplex) const
+{
+  const int d = static_cast<int>(m_FeatureDimension);
+  const int d1 = d + 1;
+  ValueType    *elevated    = &simplex.Elevated[0];
+  ValueType    *barycentric = &simplex.Barycentric[0];
+  KeyValueType *greedy      = &simplex.Greedy[0];
+  KeyValueType *rank        = &simplex.Rank[0];
+
+  // Elevate the point onto the plane of the lattice, x.(1,...,1) = 0
+  ValueType sum = 0;
+  for (int i = d; i > 0; --i)
+    {
+    const ValueType cf = position[i-1]*m_ScaleFactors[i-1];
+    elevated[i] = sum - i*cf;
+    sum += cf;
+    }
+  elevated[0] = sum;
+
+  // Closest remainder-0 point, i.e. coordinates that are multiples of d+1
+  KeyValueType coordinateSum = 0;
+  for (int i = 0; i <= d; ++i)
+    {
+    const ValueType v = elevated[i]/d1;
+    const KeyValueType up = static_cast<KeyValueType>(vcl_ceil(v))*d1;
+    const KeyValueType down = static_cast<KeyValueType>(vcl_floor(v))*d1;
+    greedy[i] = ( up - elevated[i] < elevated[i] - down ) ? up : down;
+    coordinateSum += greedy[i];
+    }
+  coordinateSum /= d1;
+
+  // Rank the differential to find the permutation of the simplex
+  std::fill(rank, rank + d1, 0);
+  for (int i = 0; i < d; ++i)
+    {
+    for (int j = i + 1; j <= d; ++j)
+      {
+      if ( elevated[i] - greedy[i] < elevated[j] - greedy[j] )
+        {
+        ++rank[i];
+        }
+      else
+        {
+        ++rank[j];
+        }
+      }
+    }
+
+  // Wrap the point back onto the plane if the coordinates do not sum to 0
+  if ( coordinateSum > 0 )
+    {
+    for (int i = 0; i <= d; ++i)
+      {
+      if ( rank[i] >= d1 - coordinateSum )
+        {
+        greedy[i] -= d1;
+        rank[i] += coordinateSum - d1;
+        }
+      else
+        {
+        rank[i] += coordinateSum;
+        }
+      }
+    }
+  else if ( coordinateSum < 0 )
+    {
+    for (int i = 0; i <= d; ++i)
+      {
+      if ( rank[i] < -coordinateSum )
+        {
+        greedy[i] += d1;
+        rank[i] += d1 + coordinateSum;
+        }
+      else
+        {
+        rank[i] += coordinateSum;
+        }
+      }
+    }
+
+  // Barycentric coordinates
+  std::fill(barycentric, barycentric + d + 2, 0);
+  for (int i = 0; i <= d; ++i)
+    {
+    const ValueType delta = (elevated[i] - greedy[i])/d1;
+    barycentric[d - rank[i]] += delta;
+    barycentric[d + 1 - rank[i]] -= delta;
+    }
+  barycentric[0] += 1 + barycentric[d + 1];
+
+  // Vertices of the simplex. The canonical simplex of remainder r has
+  // coordinates r, or r-(d+1) for the last r of them in rank order. The
+  // last coordinate is implied since the coordinates sum to zero.
+  for (int remainder = 0; remainder <= d; ++remainder)
+    {
+    KeyValueType *key = &simplex.Keys[remainder*d];
+    for (int i = 0; i < d; ++i)
+      {
+      key[i] = greedy[i]
+        + ( rank[i] <= d - remainder ? remainder : remainder - d1 );
+      }
+    simplex.Weights[remainder] = barycentric[remainder];
+    }
+}
+
+template< class TValue >
+typename PermutohedralLattice<TValue>::ValueType *
+PermutohedralLattice<TValue>
+::FindVertex(const KeyValueType *key) const
+{
+  const SizeValueType mask = (SizeValueType(1) << m_TableBits) - 1;
+  SizeValueType h = this->HashSlot(key);
+  while ( m_Table[h] != 0 )
+    {
+    const SizeValueType vertex = m_Table[h] - 1;
+    if ( std::equal(key, key + m_FeatureDimension,
+                    &m_Keys[vertex*m_FeatureDimension]) )
+      {
+      return const_cast<ValueType *>(&m_Values[vertex*m_ValueDimension]);
+      }
+    h = (h + 1) & mask;
+    }
+  return NULL;
+}
+
+template< class TValue >
+typename PermutohedralLattice<TValue>::ValueType *
+PermutohedralLattice<TValue>
+::InsertVertex(const KeyValueType *key)
+{
+  const SizeValueType mask = (SizeValueType(1) << m_TableBits) - 1;
+  SizeValueType h = this->HashSlot(key);
+  while ( m_Table[h] != 0 )
+    {
+    const SizeValueType vertex = m_Table[h] - 1;
+    if ( std::equal(key, key + m_FeatureDimension,
+                    &m_Keys[vertex*m_FeatureDimension]) )
+      {
+      return &m_Values[vertex*m_ValueDimension];
+      }
+    h = (h + 1) & mask;
+    }
+
+  // Not stored yet, keep the table at most half full
+  const SizeValueType vertex = m_NumberOfVertices++;
+  m_Keys.insert(m_Keys.end(), key, key + m_FeatureDimension);
+  m_Values.resize(m_Values.size() + m_ValueDimension,
+                  NumericTraits<ValueType>::Zero);
+  if ( 2*m_NumberOfVertices > (SizeValueType(1) << m_TableBits) )
+    {
+    this->Rehash(m_TableBits + 1);
+    }
+  else
+    {
+    m_Table[h] = vertex + 1;
+    }
+  return &m_Values[vertex*m_ValueDimension];
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::Splat(const SimplexType &simplex, const ValueType *values)
+{
+  const unsigned int channels = m_ValueDimension - 1;
+  for (unsigned int r = 0; r <= m_FeatureDimension; ++r)
+    {
+    ValueType *vertex = this->InsertVertex(&simplex.Keys[r*m_FeatureDimension]);
+    const ValueType weight = simplex.Weights[r];
+    for (unsigned int c = 0; c < channels; ++c)
+      {
+      vertex[c] += weight*values[c];
+      }
+    vertex[channels] += weight;
+    }
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::Slice(const SimplexType &simplex, ValueType *values) const
+{
+  const unsigned int channels = m_ValueDimension - 1;
+  std::fill(values, values + channels, NumericTraits<ValueType>::Zero);
+  ValueType weightSum = 0;
+  for (unsigned int r = 0; r <= m_FeatureDimension; ++r)
+    {
+    const ValueType *vertex =
+      this->FindVertex(&simplex.Keys[r*m_FeatureDimension]);
+    if ( vertex == NULL )
+      {
+      continue;
+      }
+    const ValueType weight = simplex.Weights[r];
+    for (unsigned int c = 0; c < channels; ++c)
+      {
+      values[c] += weight*vertex[c];
+      }
+    weightSum += weight*vertex[channels];
+    }
+  if ( weightSum > 0 )
+    {
+    for (unsigned int c = 0; c < channels; ++c)
+      {
+      values[c] /= weightSum;
+      }
+    }
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::AllocateBackBuffer()
+{
+  m_BackValues.resize(m_Values.size());
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::SwapBuffers()
+{
+  m_Values.swap(m_BackValues);
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::ReleaseBackBuffer()
+{
+  std::vector<ValueType>().swap(m_BackValues);
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::BlurVertices(unsigned int direction,
+               SizeValueType beginVertex, SizeValueType endVertex)
+{
+  // The neighbours along direction j differ by +-(1,...,1,-d,1,...,1),
+  // with -d at coordinate j. The last coordinate is not stored, so along
+  // direction d only the ones change.
+  const unsigned int d = m_FeatureDimension;
+  std::vector<KeyValueType> before(d);
+  std::vector<KeyValueType> after(d);
+
+  for (SizeValueType vertex = beginVertex; vertex < endVertex; ++vertex)
+    {
+    const KeyValueType *key = this->GetKey(vertex);
+    for (unsigned int i = 0; i < d; ++i)
+      {
+      before[i] = key[i] - 1;
+      after[i] = key[i] + 1;
+      }
+    if ( direction < d )
+      {
+      before[direction] = key[direction] + d;
+      after[direction] = key[direction] - d;
+      }
+
+    const ValueType *center = &m_Values[vertex*m_ValueDimension];
+    const ValueType *previous = this->FindVertex(&before[0]);
+    const ValueType *next = this->FindVertex(&after[0]);
+    ValueType *output = &m_BackValues[vertex*m_ValueDimension];
+    for (unsigned int c = 0; c < m_ValueDimension; ++c)
+      {
+      ValueType value = 0.5*center[c];
+      if ( previous )
+        {
+        value += 0.25*previous[c];
+        }
+      if ( next )
+        {
+        value += 0.25*next[c];
+        }
+      output[c] = value;
+      }
+    }
+}
+
+template< class TValue >
+SizeValueType
+PermutohedralLattice<TValue>
+::GetMemorySize() const
+{
+  return m_Keys.size()*sizeof(KeyValueType)
+    + (m_Values.size() + m_BackValues.size())*sizeof(ValueType)
+    + m_Table.size()*sizeof(SizeValueType);
+}
+
+template< class TValue >
+void
+PermutohedralLattice<TValue>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "FeatureDimension: " << m_FeatureDimension << std::endl;
+  os << indent << "ValueDimension: " << m_ValueDimension << std::endl;
+  os << indent << "NumberOfVertices: " << m_NumberOfVertices << std::endl;
+  os << indent << "MemorySize: " << this->GetMemorySize() << std::endl;
+}
+
+} // end namespace itk
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef __itkSparseBilateralGrid_h
+#define __itkSparseBilateralGrid_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "itkIndex.h"
+#include "itkSize.h"
+#include "itkIntTypes.h"
+
+#include <deque>
+#include <vector>
+
+namespace itk
+{
+/**
+* \class SparseBilateralGrid
+* \brief Sparse storage for the homogeneous grid of the fast bilateral filter
+*
+* The grid is cut into bricks of BrickEdge cells along every axis and only
+* the bricks that receive data are stored. Bricks are found through an
+* open addressing hash table keyed on their linear brick index. Every cell
+* holds the interleaved pair (sum, weight), as in the dense grid of the
+* FastBilateralImageFilter.
+*
+* The grid supports the operations of the filter: inserting bricks while
+* splatting, dilating the set of bricks so that the blur has room to spread,
+* an out of place separable blur along one axis, and cell lookup for
+* slicing. Missing bricks read as zero.
+*
+* The blur radius must not exceed BrickEdge, so that a cell only depends on
+* its own brick and the two neighbouring bricks along the blurred axis.
+*
+* \sa FastBilateralImageFilter
+*
+* \ingroup ImageEnhancement
+*/
+template< unsigned int VDimension, class TValue = float >
+class ITK_EXPORT SparseBilateralGrid : public Object
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef SparseBilateralGrid          Self;
+  typedef Object                       Superclass;
+  typedef SmartPointer<Self>           Pointer;
+  typedef SmartPointer<const Self>     ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(SparseBilateralGrid, Object);
+
+  /** Dimension of the grid, including the range axis. */
+  itkStaticConstMacro(Dimension, unsigned int, VDimension);
+
+  /** Values per cell, (sum, weight). */
+  itkStaticConstMacro(Components, unsigned int, 2);
+
+  /** Cells per brick along each axis. */
+  itkStaticConstMacro(BrickEdge, unsigned int, 4);
+  itkStaticConstMacro(BrickEdgeShift, unsigned int, 2);
+
+  /** Cells and values per brick. */
+  itkStaticConstMacro(BrickCells, unsigned int, 1u << (2*VDimension));
+  itkStaticConstMacro(BrickValues, unsigned int, 2u << (2*VDimension));
+
+  typedef TValue                      ValueType;
+  typedef Size<VDimension>            SizeType;
+  typedef Index<VDimension>           IndexType;
+  typedef uint64_t                    KeyType;
+
+  /** Storage of one brick. Cells are ordered with the first axis fastest. */
+  struct BrickType
+    {
+    ValueType Values[2u << (2*VDimension)];
+    };
+
+  /** Set the size of the grid in cells. This removes all bricks. */
+  void SetGridSize(const SizeType &size);
+  const SizeType & GetGridSize() const
+    {
+    return m_GridSize;
+    }
+
+  /** Remove all bricks. */
+  void Clear();
+
+  /** Number of stored bricks. Slots are numbered [0, GetNumberOfBricks()). */
+  SizeValueType GetNumberOfBricks() const
+    {
+    return static_cast<SizeValueType>(m_Keys.size());
+    }
+
+  /** Key of the brick holding a cell. */
+  KeyType ComputeKey(const IndexType &cell) const
+    {
+    KeyType key = 0;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      {
+      key += static_cast<KeyType>(cell[i] >> BrickEdgeShift)*m_BrickStrides[i];
+      }
+    return key;
+    }
+
+  /** Offset of the first value of a cell inside its brick. */
+  static OffsetValueType ComputeCellOffset(const IndexType &cell)
+    {
+    OffsetValueType offset = 0;
+    for (unsigned int i = 0; i < VDimension; ++i)
+      {
+      offset += static_cast<OffsetValueType>(cell[i] & (BrickEdge-1))
+        << (BrickEdgeShift*i);
+      }
+    return Components*offset;
+    }
+
+  /** Return the brick with the given key, or NULL when it is not stored. */
+  ValueType * FindBrick(KeyType key) const;
+
+  /** Return the brick with the given key, creating it zero filled when it
+   *  is not stored yet. Not thread safe. */
+  ValueType * InsertBrick(KeyType key);
+
+  /** Access by slot. */
+  KeyType GetKey(SizeValueType slot) const
+    {
+    return m_Keys[slot];
+    }
+  ValueType * GetBrick(SizeValueType slot)
+    {
+    return m_Bricks[slot].Values;
+    }
+  const ValueType * GetBrick(SizeValueType slot) const
+    {
+    return m_Bricks[slot].Values;
+    }
+
+  /** Add the 3^Dimension neighbours of every stored brick, so that a blur
+   *  of radius up to BrickEdge along each axis stays inside stored bricks. */
+  void Dilate();
+
+  /** Blur the bricks in slots [beginSlot, endSlot) along one axis with a
+   *  symmetric kernel of odd length, reading the current values and
+   *  writing the result to the back buffer. Zero flux Neumann boundary
+   *  conditions are used at the edges of the grid. When normalise is set
+   *  the sums are divided by the weights. Call AllocateBackBuffer() before
+   *  the first pass and SwapBuffers() once all slots of a pass are done.
+   *  Different slot ranges may be processed by different threads. */
+  void BlurBricks(unsigned int axis, const std::vector<double> &kernel,
+                  bool normalise,
+                  SizeValueType beginSlot, SizeValueType endSlot);
+  void AllocateBackBuffer();
+  void SwapBuffers();
+  void ReleaseBackBuffer();
+
+  /** Memory used by the bricks and the hash table, in bytes. */
+  SizeValueType GetMemorySize() const;
+
+protected:
+  SparseBilateralGrid();
+  virtual ~SparseBilateralGrid() {}
+
+  /** Method to print member variables to an output stream */
+  void PrintSelf(std::ostream& os, Indent indent) const;
+
+  /** Slot of a key in the hash table. */
+  SizeValueType HashSlot(KeyType key) const
+    {
+    return static_cast<SizeValueType>
+      ((key*0x9E3779B97F4A7C15ULL) >> (64 - m_TableBits));
+    }
+
+  /** Grow the hash table and reinsert all keys. */
+  void Rehash(unsigned int tableBits);
+
+private:
+  SparseBilateralGrid(const Self&);  // Not implemented on purpose
+  void operator=(const Self&);       // Not implemented on purpose
+
+  SizeType                    m_GridSize;
+  SizeValueType               m_BrickGridSize[VDimension];
+  KeyType                     m_BrickStrides[VDimension];
+
+  std::vector<KeyType>        m_Keys;
+  std::deque<BrickType>       m_Bricks;
+  std::deque<BrickType>       m_BackBricks;
+
+  unsigned int                m_TableBits;
+  std::vector<KeyType>        m_TableKeys;
+  std::vector<SizeValueType>  m_TableSlots;
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkSparseBilateralGrid.txx"
+#endif
+
+#endif // End #ifndef __itkSparseBilateralGrid_h
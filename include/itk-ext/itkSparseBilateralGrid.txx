@@ -0,0 +1,298 @@
+#ifndef __itkSparseBilateralGrid_txx
+#define __itkSparseBilateralGrid_txx
+
+#include "itkSparseBilateralGrid.h"
+#include "itkNumericTraits.h"
+
+#include <algorithm>
+
+namespace itk
+{
+
+template< unsigned int VDimension, class TValue >
+SparseBilateralGrid<VDimension, TValue>
+::SparseBilateralGrid()
+{
+  SizeType size;
+  size.Fill(0);
+  this->SetGridSize(size);
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::SetGridSize(const SizeType &size)
+{
+  m_GridSize = size;
+  KeyType stride = 1;
+  for (unsigned int i = 0; i < VDimension; ++i)
+    {
+    m_BrickGridSize[i] = (size[i] + BrickEdge - 1) >> BrickEdgeShift;
+    m_BrickStrides[i] = stride;
+    stride *= m_BrickGridSize[i];
+    }
+  this->Clear();
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::Clear()
+{
+  std::vector<KeyType>().swap(m_Keys);
+  std::deque<BrickType>().swap(m_Bricks);
+  std::deque<BrickType>().swap(m_BackBricks);
+  m_TableBits = 0;
+  this->Rehash(10);
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::Rehash(unsigned int tableBits)
+{
+  m_TableBits = tableBits;
+  m_TableKeys.assign(SizeValueType(1) << m_TableBits,
+                     NumericTraits<KeyType>::max());
+  m_TableSlots.assign(SizeValueType(1) << m_TableBits, 0);
+
+  const SizeValueType mask = (SizeValueType(1) << m_TableBits) - 1;
+  for (SizeValueType slot = 0; slot < m_Keys.size(); ++slot)
+    {
+    SizeValueType h = this->HashSlot(m_Keys[slot]);
+    while ( m_TableKeys[h] != NumericTraits<KeyType>::max() )
+      {
+      h = (h + 1) & mask;
+      }
+    m_TableKeys[h] = m_Keys[slot];
+    m_TableSlots[h] = slot;
+    }
+}
+
+template< unsigned int VDimension, class TValue >
+typename SparseBilateralGrid<VDimension, TValue>::ValueType *
+SparseBilateralGrid<VDimension, TValue>
+::FindBrick(KeyType key) const
+{
+  const SizeValueType mask = (SizeValueType(1) << m_TableBits) - 1;
+  SizeValueType h = this->HashSlot(key);
+  while ( m_TableKeys[h] != NumericTraits<KeyType>::max() )
+    {
+    if ( m_TableKeys[h] == key )
+      {
+      return const_cast<ValueType *>(m_Bricks[m_TableSlots[h]].Values);
+      }
+    h = (h + 1) & mask;
+    }
+  return NULL;
+}
+
+template< unsigned int VDimension, class TValue >
+typename SparseBilateralGrid<VDimension, TValue>::ValueType *
+SparseBilateralGrid<VDimension, TValue>
+::InsertBrick(KeyType key)
+{
+  const SizeValueType mask = (SizeValueType(1) << m_TableBits) - 1;
+  SizeValueType h = this->HashSlot(key);
+  while ( m_TableKeys[h] != NumericTraits<KeyType>::max() )
+    {
+    if ( m_TableKeys[h] == key )
+      {
+      return m_Bricks[m_TableSlots[h]].Values;
+      }
+    h = (h + 1) & mask;
+    }
+
+  // Not stored yet, keep the table at most half full
+  const SizeValueType slot = m_Keys.size();
+  m_Keys.push_back(key);
+  m_Bricks.push_back(BrickType());
+  std::fill(m_Bricks.back().Values, m_Bricks.back().Values + BrickValues,
+            NumericTraits<ValueType>::Zero);
+  if ( 2*m_Keys.size() > (SizeValueType(1) << m_TableBits) )
+    {
+    this->Rehash(m_TableBits + 1);
+    }
+  else
+    {
+    m_TableKeys[h] = key;
+    m_TableSlots[h] = slot;
+    }
+  return m_Bricks.back().Values;
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::Dilate()
+{
+  // Visit the 3^Dimension neighbourhood of every brick stored before the
+  // dilation, skipping neighbours outside the grid
+  unsigned int neighbours = 1;
+  for (unsigned int i = 0; i < VDimension; ++i)
+    {
+    neighbours *= 3;
+    }
+
+  const SizeValueType storedBricks = m_Keys.size();
+  for (SizeValueType slot = 0; slot < storedBricks; ++slot)
+    {
+    KeyType remainder = m_Keys[slot];
+    IndexValueType brick[VDimension];
+    for (int i = VDimension - 1; i >= 0; --i)
+      {
+      brick[i] = static_cast<IndexValueType>(remainder / m_BrickStrides[i]);
+      remainder %= m_BrickStrides[i];
+      }
+
+    for (unsigned int n = 0; n < neighbours; ++n)
+      {
+      unsigned int code = n;
+      KeyType key = 0;
+      bool inside = true;
+      for (unsigned int i = 0; i < VDimension; ++i)
+        {
+        const IndexValueType b = brick[i] + static_cast<IndexValueType>(code % 3) - 1;
+        code /= 3;
+        if ( b < 0 || b >= static_cast<IndexValueType>(m_BrickGridSize[i]) )
+          {
+          inside = false;
+          break;
+          }
+        key += static_cast<KeyType>(b)*m_BrickStrides[i];
+        }
+      if ( inside )
+        {
+        this->InsertBrick(key);
+        }
+      }
+    }
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::AllocateBackBuffer()
+{
+  m_BackBricks.resize(m_Bricks.size());
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::SwapBuffers()
+{
+  m_Bricks.swap(m_BackBricks);
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::ReleaseBackBuffer()
+{
+  std::deque<BrickType>().swap(m_BackBricks);
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::BlurBricks(unsigned int axis, const std::vector<double> &kernel,
+             bool normalise, SizeValueType beginSlot, SizeValueType endSlot)
+{
+  const int radius = static_cast<int>(kernel.size()/2);
+  const double *center = &kernel[radius];
+  const IndexValueType edge = BrickEdge;
+  const IndexValueType gridLength = m_GridSize[axis];
+  const OffsetValueType cellStride = OffsetValueType(1) << (BrickEdgeShift*axis);
+
+  // Values along one line of a brick, plus radius cells on either side
+  std::vector<ValueType> line(BrickEdge + 2*radius);
+
+  for (SizeValueType slot = beginSlot; slot < endSlot; ++slot)
+    {
+    const KeyType key = m_Keys[slot];
+    const IndexValueType brickPosition = static_cast<IndexValueType>
+      ((key / m_BrickStrides[axis]) % m_BrickGridSize[axis]);
+    const IndexValueType firstCell = brickPosition*edge;
+
+    // Bricks before and after along the blurred axis
+    const ValueType *bricks[3];
+    bricks[0] = ( brickPosition > 0 )
+      ? this->FindBrick(key - m_BrickStrides[axis]) : NULL;
+    bricks[1] = m_Bricks[slot].Values;
+    bricks[2] = ( brickPosition + 1 < static_cast<IndexValueType>(m_BrickGridSize[axis]) )
+      ? this->FindBrick(key + m_BrickStrides[axis]) : NULL;
+    ValueType *output = m_BackBricks[slot].Values;
+
+    // Every cell with a zero coordinate along the axis starts a line
+    for (OffsetValueType cell = 0; cell < static_cast<OffsetValueType>(BrickCells); ++cell)
+      {
+      if ( (cell >> (BrickEdgeShift*axis)) & (BrickEdge-1) )
+        {
+        continue;
+        }
+      for (unsigned int c = 0; c < Components; ++c)
+        {
+        // Gather the line, clamping at the edges of the grid
+        for (IndexValueType k = -radius; k < edge + radius; ++k)
+          {
+          IndexValueType g = firstCell + k;
+          g = std::max<IndexValueType>(0, std::min(g, gridLength - 1));
+          const IndexValueType local = g - firstCell;
+          const int b = ( local < 0 ) ? 0 : ( local >= edge ? 2 : 1 );
+          const ValueType *brick = bricks[b];
+          line[k + radius] = ( brick == NULL ) ? NumericTraits<ValueType>::Zero
+            : brick[Components*(cell + ((local + edge) % edge)*cellStride) + c];
+          }
+        for (IndexValueType k = 0; k < edge; ++k)
+          {
+          const ValueType *l = &line[k + radius];
+          double value = center[0]*l[0];
+          for (int t = 1; t <= radius; ++t)
+            {
+            value += center[t]*(l[-t] + l[t]);
+            }
+          output[Components*(cell + k*cellStride) + c] =
+            static_cast<ValueType>(value);
+          }
+        }
+      if ( normalise )
+        {
+        for (IndexValueType k = 0; k < edge; ++k)
+          {
+          ValueType *value = output + Components*(cell + k*cellStride);
+          if ( value[1] != 0.0 )
+            {
+            value[0] /= value[1];
+            }
+          }
+        }
+      }
+    }
+}
+
+template< unsigned int VDimension, class TValue >
+SizeValueType
+SparseBilateralGrid<VDimension, TValue>
+::GetMemorySize() const
+{
+  return (m_Bricks.size() + m_BackBricks.size())*sizeof(BrickType)
+    + m_Keys.size()*sizeof(KeyType)
+    + m_TableKeys.size()*(sizeof(KeyType) + sizeof(SizeValueType));
+}
+
+template< unsigned int VDimension, class TValue >
+void
+SparseBilateralGrid<VDimension, TValue>
+::PrintSelf(std::ostream& os, Indent indent) const
+{
+  Superclass::PrintSelf(os,indent);
+
+  os << indent << "GridSize: " << m_GridSize << std::endl;
+  os << indent << "NumberOfBricks: " << m_Keys.size() << std::endl;
+  os << indent << "MemorySize: " << this->GetMemorySize() << std::endl;
+}
+
+} // end namespace itk
+
+#endif
@@ -21,6 +21,7 @@
 #include "itkImageFileWriter.h"
 #include "itkMinimumImageFunction.h"
 #include "itkHighDynamicRangeImageFilter.h"
+#include "itkFastMath.h"
 //SMILI
 #include "milxGlobal.h"
 #include "milxFile.h"
@@ -59,6 +60,9 @@ int main(int argc, char* argv[])
   ValueArg<float> betaArg("b", "beta", "Beta value to operation (such as MSDE).", false, 0.8, "Beta");
   ValueArg<float> lambdaArg("", "lambda", "Lambda value to operation (such as MSDE).", false, 0.8, "Lambda");
   ValueArg<float> weightArg("w", "weight", "Weight value per image for operation (such as MSDE).", false, 0.8, "Weight");
+  ValueArg<float> memoryArg("", "memory", "Memory budget in MB of the smoother picked per level by the cost model with --automatic (such as MSDE).", false, 1024, "Memory");
+  ValueArg<float> qualityArg("q", "quality", "Quality (0-1] of the fast bilateral smoother. Below 1 the grid is built from a subsample of the voxels with coarser intensity bins, which is faster but less accurate.", false, 1, "Quality");
+  ValueArg<float> detailSigmaArg("", "detailsigma", "Sigma of the Gaussian smoothing the detail weights of each level (such as MSDE). Fattal et al. suggest 8, its runtime does not depend on it.", false, 1, "Detail Sigma");
   ValueArg<float> contrastArg("c", "contrast", "Contrast value per image for operation (such as Tone Map).", false, 5, "Contrast");
   ///Switches
   SwitchArg verboseMode("v", "verbose", "Verbose Output, i.e. output all intermediate results of the pipeline.", false);
@@ -66,6 +70,17 @@ int main(int argc, char* argv[])
   SwitchArg msdeArg("m", "msde", "Apply MSDE HDR mode to images. Multiple channels/inputs required.", true);
   SwitchArg sosArg("", "sos", "Output sums of squares image. MSDE mode only.", false);
   SwitchArg aveArg("", "average", "Output average image. MSDE mode only.", false);
+  SwitchArg jointArg("j", "joint", "Smooth all images jointly with the permutohedral bilateral filter, so that edges are shared across images. MSDE mode only.", false);
+  SwitchArg bilateralArg("", "bilateral", "Smooth each image with the fast bilateral filter, the default. MSDE mode only.", false);
+  SwitchArg exactArg("", "exact", "Smooth each image with the exact (brute force) bilateral filter. Slow, MSDE mode only.", false);
+  SwitchArg automaticArg("", "automatic", "Smooth each image with the cheaper of the fast and exact bilateral filters at each level, as predicted by the cost model within the --memory budget. MSDE mode only.", false);
+  SwitchArg transformArg("", "transform", "Smooth each image with the domain transform filter, whose runtime is linear in the image size and independent of the sigmas. MSDE mode only.", false);
+  SwitchArg adaptiveArg("", "adaptive", "Lay out the intensity bins of the fast bilateral smoother from the histogram of each image, fewer bins for skewed histograms such as MR. MSDE mode only.", false);
+  SwitchArg streamingArg("", "streaming", "Add the layers of each image to the HDR image as soon as they are computed and release them, so that memory does not grow with the number of images. Ignored with verbose output, which saves the layers. MSDE mode only.", false);
+  SwitchArg lazyDetailArg("", "lazydetail", "Compute the detail layers of each level from the adjacent levels when needed instead of storing them, which saves a volume per level. Ignored with verbose output, which saves the layers. MSDE mode only.", false);
+  SwitchArg halfArg("", "half", "Store the levels and detail layers of each image in half precision floats, which halves their memory. MSDE mode only.", false);
+  SwitchArg bfloatArg("", "bfloat16", "Store the levels and detail layers of each image in bfloat16, which halves their memory with fewer significant bits than --half. MSDE mode only.", false);
+  SwitchArg unbatchedArg("", "unbatched", "Smooth each image in its own fast bilateral pass instead of all images in one pass per level. MSDE mode only.", false);
 
   ///Add argumnets
   cmd.add(multinames);
@@ -79,11 +94,25 @@ int main(int argc, char* argv[])
   cmd.add(lambdaArg);
   cmd.add(weightArg);
   cmd.add(contrastArg);
+  cmd.add(memoryArg);
+  cmd.add(qualityArg);
+  cmd.add(detailSigmaArg);
   cmd.add(verboseMode);
   cmd.add(toneMapArg);
   cmd.add(msdeArg);
   cmd.add(sosArg);
   cmd.add(aveArg);
+  cmd.add(jointArg);
+  cmd.add(unbatchedArg);
+  cmd.add(halfArg);
+  cmd.add(bfloatArg);
+  cmd.add(streamingArg);
+  cmd.add(lazyDetailArg);
+  cmd.add(adaptiveArg);
+  cmd.add(transformArg);
+  cmd.add(bilateralArg);
+  cmd.add(exactArg);
+  cmd.add(automaticArg);
 
   ///Parse the argv array.
   cmd.parse(argc, argv);
@@ -102,6 +131,26 @@ int main(int argc, char* argv[])
   float weight = weightArg.getValue();
   float contrast = contrastArg.getValue();
 
+  //At most one smoother may be chosen
+  const int smoothers = jointArg.isSet() + transformArg.isSet() + bilateralArg.isSet() + exactArg.isSet() + automaticArg.isSet();
+  if(smoothers > 1)
+    {
+    std::cerr << "Error: only one of --joint, --transform, --bilateral, --exact and --automatic may be given." << std::endl;
+    return EXIT_FAILURE;
+    }
+  //The layers are stored in one precision only
+  if(halfArg.isSet() && bfloatArg.isSet())
+    {
+    std::cerr << "Error: only one of --half and --bfloat16 may be given." << std::endl;
+    return EXIT_FAILURE;
+    }
+  //The memory budget is only used by the cost model
+  if(memoryArg.isSet() && !automaticArg.isSet())
+    {
+    std::cerr << "Error: --memory is only used with --automatic." << std::endl;
+    return EXIT_FAILURE;
+    }
+
   std::cout << "Using levels: " << levels << std::endl;
   std::cout << "Using range and domain sigma as: " << range << ", " << domain << std::endl;
   std::cout << "Using beta and lambda values as: " << beta << ", " << lambda << std::endl;
@@ -109,6 +158,8 @@ int main(int argc, char* argv[])
   ///Setup ITK Threads
   itk::MultiThreader::SetGlobalDefaultNumberOfThreads(threads);
   std::cout << "Threads to use: " << threads << std::endl;
+  if(verboseMode.isSet())
+    std::cout << "Vector math on " << itk::FastMath::GetInstructionSetName(itk::FastMath::GetInstructionSet()) << std::endl;
 
   itk::HighDynamicRangeImageFilter<InputImageType, OutputImageType>::Pointer hdrImage = itk::HighDynamicRangeImageFilter<InputImageType, OutputImageType>::New();
     hdrImage->SetLevels(levels);
@@ -126,8 +177,40 @@ int main(int argc, char* argv[])
     hdrImage->ToneModeModeOn();
   if(msdeArg.isSet())
     hdrImage->MultiLightModeOn();
-    hdrImage->SetNumberOfThreads(threads);
-    //hdrImage->SetNumberOfIndexedInputs(filenames.size());
+  if(jointArg.isSet())
+    hdrImage->SetSmoother(itk::PermutohedralSmoother);
+  if(unbatchedArg.isSet())
+    hdrImage->BatchedSmoothingOff();
+  if(streamingArg.isSet() && !verboseMode.isSet())
+    hdrImage->StreamingSynthesisOn();
+  if(lazyDetailArg.isSet() && !verboseMode.isSet())
+    hdrImage->StoreDetailLayersOff();
+  if(halfArg.isSet())
+    hdrImage->SetLayerPrecision(itk::HalfPrecision);
+  if(bfloatArg.isSet())
+    hdrImage->SetLayerPrecision(itk::BFloat16Precision);
+  //Only verbose output saves the per image layers and MLIC, the base and detail layers are always saved
+  if(verboseMode.isSet())
+    hdrImage->SetRetention(itk::RetainAll);
+  else
+    hdrImage->SetRetention(itk::RetainFinalLayers);
+  if(adaptiveArg.isSet())
+    hdrImage->AdaptiveRangeAxisOn();
+  if(transformArg.isSet())
+    hdrImage->SetSmoother(itk::DomainTransformSmoother);
+  if(bilateralArg.isSet())
+    hdrImage->SetSmoother(itk::FastBilateralSmoother);
+  if(exactArg.isSet())
+    hdrImage->SetSmoother(itk::ExactBilateralSmoother);
+  if(automaticArg.isSet())
+    {
+    hdrImage->SetSmoother(itk::AutomaticSmoother);
+    hdrImage->SetMaximumSmootherMemory(memoryArg.getValue()*1024.0*1024.0);
+    }
+  hdrImage->SetQuality(qualityArg.getValue());
+  hdrImage->SetDetailSigma(detailSigmaArg.getValue());
+  hdrImage->SetNumberOfThreads(threads);
+  //hdrImage->SetNumberOfIndexedInputs(filenames.size());
 
   //std::vector< itk::SmartPointer<InputImageType> > images;
   for (size_t j = 0; j < filenames.size(); j ++)
@@ -19,11 +19,20 @@
 #define itkHighDynamicRangeImageFilter_h
 
 #include <itkImageToImageFilter.h>
+#include <itkImage.h>
+#include "itkEdgePreservingSmoothingImageFilter.h"
+#include "itkImageBufferPool.h"
 
 namespace itk
 {
 //HDR Mode
 enum HDRMode { ToneMap = 0, MultiLight };
+//Edge preserving smoother used to build the MLIC
+enum HDRSmoother { FastBilateralSmoother = 0, PermutohedralSmoother, DomainTransformSmoother, ExactBilateralSmoother, AutomaticSmoother };
+//Intermediate results kept after an update, each level keeps those of the levels before it
+enum HDRRetention { RetainNothing = 0, RetainFinalLayers, RetainInputLayers, RetainAll };
+//Storage of the MLIC levels and detail layers
+enum HDRPrecision { SinglePrecision = 0, HalfPrecision, BFloat16Precision };
 
 /** \class HighDynamicRangeImageFilter
  * \brief Combine N images into an HDR image using various HDR techniques
@@ -114,15 +123,111 @@ public:
   void MultiLightModeOn()
   {   m_Mode = MultiLight;   }  
 
+  /** Set/Get the smoother of the MLIC. The fast bilateral smoother, the
+   *  default, filters each input on its own, the permutohedral one filters
+   *  all inputs at once with a joint range over their intensities. The
+   *  domain transform smoother filters each input on its own in a time
+   *  linear in the number of pixels that does not depend on the sigmas, the
+   *  exact bilateral one by brute force. The automatic smoother picks the
+   *  cheaper of the fast and exact bilateral smoothers at every level from
+   *  their predicted costs, see SelectSmoother(). The permutohedral and
+   *  domain transform smoothers change the layers rather than only their
+   *  cost, so they are only used when set. */
+  itkSetMacro(Smoother, HDRSmoother);
+  itkGetConstMacro(Smoother, HDRSmoother);
+  /** Set/Get batched smoothing. When on, the fast bilateral smoother filters
+   *  all inputs of a level in one pass instead of one pass per input. */
+  itkSetMacro(BatchedSmoothing, bool);
+  itkGetConstMacro(BatchedSmoothing, bool);
+  itkBooleanMacro(BatchedSmoothing);
+  /** Set/Get the memory in bytes the automatic smoother may use. Smoothers
+   *  predicted to need more are only picked if all of them do. Default is 1 GB. */
+  itkSetMacro(MaximumSmootherMemory, double);
+  itkGetConstMacro(MaximumSmootherMemory, double);
+  /** Set/Get the quality of the fast bilateral smoother, in (0, 1]. Below 1
+   *  the grid is built from a subsample of the pixels with coarser range
+   *  bins, see FastBilateralImageFilter::SetQuality(). Default is 1. */
+  itkSetClampMacro(Quality, float, 1e-3, 1.0);
+  itkGetConstMacro(Quality, float);
+  /** Set/Get the adaptive range axis of the fast bilateral smoother. When on,
+   *  the range bins follow the histogram of each image, see
+   *  FastBilateralImageFilter::SetRangeAxis(). Default is off. */
+  itkSetMacro(AdaptiveRangeAxis, bool);
+  itkGetConstMacro(AdaptiveRangeAxis, bool);
+  itkBooleanMacro(AdaptiveRangeAxis);
+  /** Set/Get the sigma, in physical units, of the Gaussian smoothing the MSDE detail weights. Fattal et al.
+   *  2007 suggest 8. The smoothing is recursive, so its cost does not depend on the sigma. Default is 1. */
+  itkSetMacro(DetailSigma, float);
+  itkGetConstMacro(DetailSigma, float);
+  /** Set/Get streaming synthesis. When on, the MSDE layers of each input are added to the sums of the synthesis as
+   *  soon as they are computed and then released with its MLIC, so that the memory used does not grow with the
+   *  number of inputs. The per input layers and MLIC are then not kept, and batched smoothing is left out since
+   *  it holds the MLIC of all inputs. The joint smoother still does. Default is off. */
+  itkSetMacro(StreamingSynthesis, bool);
+  itkGetConstMacro(StreamingSynthesis, bool);
+  itkBooleanMacro(StreamingSynthesis);
+  /** Set/Get storing the detail layers of the MLIC. Each is the difference of the image a level smoothed and the
+   *  level, so when off it is not stored but computed where the MSDE needs it from the adjacent levels, which saves
+   *  a subtraction and a volume per level. GetMultiLightDetails() is then empty. Default is on. */
+  itkSetMacro(StoreDetailLayers, bool);
+  itkGetConstMacro(StoreDetailLayers, bool);
+  itkBooleanMacro(StoreDetailLayers);
+  /** Set/Get the intermediate results kept after an update. With RetainNothing only the HDR image and the enabled
+   *  sums of squares, average and bias field images are kept. RetainFinalLayers also keeps the base and detail
+   *  layers, RetainInputLayers the MSDE layers of every input and RetainAll the MLIC as well. Results that are not
+   *  retained are released as soon as the outputs no longer need them, and their getters throw. Below RetainAll
+   *  the buffer pool is also cleared after the update, see SetBufferPool(). Default is RetainAll. */
+  itkSetMacro(Retention, HDRRetention);
+  itkGetConstMacro(Retention, HDRRetention);
+  /** Set/Get the storage of the MLIC levels and detail layers. With HalfPrecision or BFloat16Precision they are
+   *  stored in 16 bits, which halves their memory and the bandwidth of the MSDE. A level is converted once the
+   *  next one has been smoothed from it, the detail layers as they are computed, and the MSDE decodes them row by
+   *  row, so all arithmetic stays in float. The last level, the base of the MSDE, stays in float. Half precision
+   *  keeps 11 significant bits up to 65504, bfloat16 8 bits over the float range. Stored detail layers keep
+   *  more of the detail than those computed from two rounded levels, see SetStoreDetailLayers(). The MLIC getters
+   *  decode the layers into new images. Default is SinglePrecision. */
+  itkSetMacro(LayerPrecision, HDRPrecision);
+  itkGetConstMacro(LayerPrecision, HDRPrecision);
+
+  /** Pool the intermediate images are leased from and returned to, so that their buffers are recycled across
+   *  levels and inputs instead of allocated afresh. With RetainAll the pool keeps them across updates as well,
+   *  until GetBufferPool()->Clear(). With any other retention it is cleared at the end of every update, along
+   *  with the pool of the 16 bit layers, so a pool shared by several filters of the same image type loses the
+   *  buffers of the others too. NULL allocates every intermediate image. */
+  typedef ImageBufferPool<TOutputImage> BufferPoolType;
+  itkSetObjectMacro(BufferPool, BufferPoolType);
+  itkGetObjectMacro(BufferPool, BufferPoolType);
+
+  /** Images of the layers stored in 16 bits, see SetLayerPrecision() */
+  typedef unsigned short CompactPixelType;
+  typedef Image<CompactPixelType, TOutputImage::ImageDimension> CompactImageType;
+  typedef typename CompactImageType::Pointer CompactImagePointer;
+  typedef ImageBufferPool<CompactImageType> CompactBufferPoolType;
+
+  /** Edge preserving smoother of the per input MLIC */
+  typedef EdgePreservingSmoothingImageFilter<TInputImage, TOutputImage> SmoothingFilterType;
+
+  /** Create a per input smoother (fast bilateral, domain transform or exact bilateral)*/
+  typename SmoothingFilterType::Pointer CreateSmoothingFilter(HDRSmoother smoother) const;
+  /** Predict the cost of smoothing the images with the fast and the exact bilateral smoothers and return the
+      cheaper one within MaximumSmootherMemory. The predictions and the choice are logged.*/
+  HDRSmoother SelectSmoother(const std::vector< itk::SmartPointer<TOutputImage> > &images, float range, float domain) const;
+  /** The Smoother setting, or the one picked by SelectSmoother() in automatic mode*/
+  HDRSmoother ResolveSmoother(const std::vector< itk::SmartPointer<TOutputImage> > &images, float range, float domain) const;
+
   /** Get the MLIC result*/
   itk::SmartPointer<OutputImageType> GetBaseImage()
   {
+    if(!m_BaseImage)
+      this->VerifyRetained(RetainFinalLayers, "base image");
     return m_BaseImage;
   }
   /** Get the MLIC result*/
   itk::SmartPointer<OutputImageType> GetDetailImage()
   {
-      return m_DetailImage;
+    if(!m_DetailImage)
+      this->VerifyRetained(RetainFinalLayers, "detail image");
+    return m_DetailImage;
   }
   /** Get the sums of squares result*/
   itk::SmartPointer<OutputImageType> GetSumsOfSquaresImage()
@@ -166,32 +271,83 @@ public:
     m_BaseWeights.clear();
   }
 
-  /** Get the MSDE base result for a given level*/
+  /** Get the MSDE base result for a given input, not kept with streaming synthesis*/
   inline itk::SmartPointer<OutputImageType> GetLevelBaseImage(int level)
   {
+    if(level < 0 || static_cast<size_t>(level) >= m_LevelBaseImages.size())
+    {
+      this->VerifyRetained(RetainInputLayers, "MSDE base of each input");
+      itkExceptionMacro(<< "No MSDE base for input " << level << ", see SetStreamingSynthesis()");
+    }
     return m_LevelBaseImages[level];
   }
-  /** Get the MSDE detail result for a given level*/
+  /** Get the MSDE detail result for a given input, not kept with streaming synthesis*/
   inline itk::SmartPointer<OutputImageType> GetLevelDetailImage(int level)
   {
+    if(level < 0 || static_cast<size_t>(level) >= m_LevelDetailImages.size())
+    {
+      this->VerifyRetained(RetainInputLayers, "MSDE detail of each input");
+      itkExceptionMacro(<< "No MSDE detail for input " << level << ", see SetStreamingSynthesis()");
+    }
     return m_LevelDetailImages[level];
   }
 
   /** Get the MLIC base result*/
   inline std::vector< itk::SmartPointer<OutputImageType> > GetMultiLightResults()
   {
-    return m_LevelResults;
+    if(m_LevelResults.empty() && m_CompactLevelResults.empty())
+      this->VerifyRetained(RetainAll, "MLIC");
+    return this->DecodeLayers(m_LevelResults, m_CompactLevelResults);
   }
   /** Get the MLIC detail details*/
   inline std::vector< itk::SmartPointer<OutputImageType> > GetMultiLightDetails()
   {
-    return m_DiffResults;
+    if(m_DiffResults.empty() && m_CompactDiffResults.empty())
+      this->VerifyRetained(RetainAll, "MLIC");
+    return this->DecodeLayers(m_DiffResults, m_CompactDiffResults);
+  }
+
+  /** Get the MLIC results of the joint or batched smoothing for a given input, empty if it was smoothed on its own*/
+  inline std::vector< itk::SmartPointer<OutputImageType> > GetInputMultiLightResults(int idx)
+  {
+    if(idx < 0 || static_cast<size_t>(idx) >= this->GetNumberOfInputs())
+      itkExceptionMacro(<< "No input " << idx << ", the filter has " << this->GetNumberOfInputs() << " inputs");
+    if(static_cast<size_t>(idx) >= m_InputLevelResults.size()
+       || (m_InputLevelResults[idx].empty() && m_InputCompactLevelResults[idx].empty()))
+    {
+      this->VerifyRetained(RetainAll, "MLIC of each input");
+      return std::vector< itk::SmartPointer<OutputImageType> >();
+    }
+    return this->DecodeLayers(m_InputLevelResults[idx], m_InputCompactLevelResults[idx]);
+  }
+  /** Get the MLIC details of the joint or batched smoothing for a given input, empty if it was smoothed on its own*/
+  inline std::vector< itk::SmartPointer<OutputImageType> > GetInputMultiLightDetails(int idx)
+  {
+    if(idx < 0 || static_cast<size_t>(idx) >= this->GetNumberOfInputs())
+      itkExceptionMacro(<< "No input " << idx << ", the filter has " << this->GetNumberOfInputs() << " inputs");
+    if(static_cast<size_t>(idx) >= m_InputDiffResults.size()
+       || (m_InputDiffResults[idx].empty() && m_InputCompactDiffResults[idx].empty()))
+    {
+      this->VerifyRetained(RetainAll, "MLIC of each input");
+      return std::vector< itk::SmartPointer<OutputImageType> >();
+    }
+    return this->DecodeLayers(m_InputDiffResults[idx], m_InputCompactDiffResults[idx]);
   }
 
-  /**Create Multi-light Image Collection (MLIC) using the fast bilateral filter.
+  /**Create Multi-light Image Collection (MLIC) using the smoother of each level given by ResolveSmoother().
      Issues on Windows: optimisation flag /O2 and maybe the flag /Ob2 causes crash. Using /O1 and /Ob1 worked OK.*/
   void CreateMultiLightImageCollection(itk::SmartPointer<TInputImage> image, float range, float domain, int levels);
+  /**Create the MLIC of all inputs at once using the permutohedral bilateral filter, so that edges are shared across inputs.
+     Results are kept per input, see GetInputMultiLightResults().*/
+  void CreateJointMultiLightImageCollections(float range, float domain, int levels);
+  /**Create the MLIC of all inputs with one fast bilateral pass per level. Each input keeps its own range, but
+     the spatial binning is done once for all of them. Levels for which ResolveSmoother() gives another smoother
+     filter the inputs one by one. Results are kept per input, see GetInputMultiLightResults().*/
+  void CreateBatchedMultiLightImageCollections(float range, float domain, int levels);
   void ComputeMultiscaleShapeDetailEnhancement(std::vector< itk::SmartPointer<TOutputImage> > results, std::vector< itk::SmartPointer<TOutputImage> > diffs, RegionType region, int levels, float lambdaValue = 0.8);
+  /**MSDE of an MLIC built without its detail layers, see SetStoreDetailLayers(). The detail of each level is the
+     image it smoothed minus its result, the image given for the first level.*/
+  void ComputeMultiscaleShapeDetailEnhancement(itk::SmartPointer<TInputImage> image, std::vector< itk::SmartPointer<TOutputImage> > results, RegionType region, int levels, float lambdaValue = 0.8);
   //Tone mapping of Durand et al.
   void ComputeToneMapEnhancement(itk::SmartPointer<TInputImage> image, float range, float domain, float contrast = 5);
 
@@ -221,6 +377,163 @@ protected:
 //                                    outputRegionForThread, ThreadIdType threadId) ITK_OVERRIDE;
   virtual void GenerateData() ITK_OVERRIDE;
 
+  /** Throw if results kept from the retention given were released by the retention of the filter. */
+  void VerifyRetained(HDRRetention retention, const char *name) const
+  {
+    if(m_Retention < retention)
+      itkExceptionMacro(<< "The " << name << " was not retained, the retention is " << m_Retention
+                        << " and needs to be at least " << retention << ", see SetRetention()");
+  }
+
+  /** Lease an output sized image over the region in the space of the reference from the buffer pool, or
+   *  allocate it without a pool. Its pixels are not initialised. */
+  OutputImagePointer LeaseImage(const typename BufferPoolType::ReferenceImageType *reference, const RegionType &region);
+  /** Lease an image of 16 bit pixels over the region in the space of the reference, as LeaseImage(). */
+  CompactImagePointer LeaseCompactImage(const typename BufferPoolType::ReferenceImageType *reference, const RegionType &region);
+  /** Return an image to the buffer pool and release it. */
+  void ReturnImage(OutputImagePointer &image);
+  void ReturnImage(CompactImagePointer &image);
+  /** Return the images to the buffer pool and clear them. */
+  void ReturnImages(std::vector< itk::SmartPointer<TOutputImage> > &images);
+  void ReturnImages(std::vector<CompactImagePointer> &images);
+
+  /** A layer of the MLIC in float, in 16 bits or absent. Full is used when set, else Compact when set. */
+  struct LayerPointer
+    {
+    PixelType *Full;
+    CompactPixelType *Compact;
+    HDRPrecision Precision; //!< Format of Compact
+    };
+
+  /** Layer of a level, in float when its image is set and in 16 bits otherwise, absent beyond both. */
+  LayerPointer MakeLayer(const std::vector< itk::SmartPointer<TOutputImage> > &images, const std::vector<CompactImagePointer> &compactImages, size_t level) const;
+  /** Pixels [offset, offset + n) of a layer, decoded into the scratch when in 16 bits. NULL for an absent layer. */
+  static const PixelType *ReadLayer(const LayerPointer &layer, SizeValueType offset, SizeValueType n, PixelType *scratch);
+  /** Set the pixels [offset, offset + n) of a layer to the values, encoded when in 16 bits. */
+  static void WriteLayer(const LayerPointer &layer, SizeValueType offset, SizeValueType n, const PixelType *values);
+  /** Float images of the layers, new ones decoded from those in 16 bits. */
+  std::vector< itk::SmartPointer<TOutputImage> > DecodeLayers(const std::vector< itk::SmartPointer<TOutputImage> > &images, const std::vector<CompactImagePointer> &compactImages);
+  /** Store a level in 16 bits and return its float image to the buffer pool, unless in SinglePrecision. */
+  void CompactLayer(std::vector< itk::SmartPointer<TOutputImage> > &images, std::vector<CompactImagePointer> &compactImages, size_t level);
+  /** Append the detail layer of a level, the image it smoothed minus its result, in the LayerPrecision. */
+  void AppendDetailLayer(const TOutputImage *image, const TOutputImage *result, std::vector< itk::SmartPointer<TOutputImage> > &diffs, std::vector<CompactImagePointer> &compactDiffs);
+  /** Return the layers, MLIC and extra outputs of the previous update to the buffer pool. */
+  void ReturnIntermediateImages();
+
+  /** Data shared by the threads of the difference of two images buffered over the same region, or of the copy of
+   *  the minuend when Subtrahend is NULL, into a layer in float or 16 bits. */
+  struct DifferenceThreadStruct
+    {
+    const PixelType *Minuend;
+    const PixelType *Subtrahend;
+    LayerPointer Difference;
+    SizeValueType NumberOfPixels;
+    };
+
+  /** Subtract the pixels of a contiguous range of the thread, a chunk at a time when encoded. */
+  static void ThreadedDifference(const DifferenceThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads);
+
+  /** Static function used to dispatch the difference to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE DifferenceThreaderCallback(void *arg);
+
+  /** Run the difference into the layer over the pixels of the minuend. */
+  void ComputeDifference(const TOutputImage *minuend, const TOutputImage *subtrahend, const LayerPointer &difference);
+  /** Detail layer of a level, the image it smoothed minus its result, into an image leased from the buffer pool. */
+  OutputImagePointer ComputeDifferenceImage(const TOutputImage *minuend, const TOutputImage *subtrahend);
+  /** Difference of the images, or the minuend alone when the subtrahend is NULL, in the 16 bits of the LayerPrecision. */
+  CompactImagePointer ComputeCompactImage(const TOutputImage *minuend, const TOutputImage *subtrahend);
+
+  /** Data shared by the threads of the synthesis of the MSDE layers. All buffers cover the same region of
+   *  NumberOfPixels pixels, the extra outputs are NULL when not enabled. The layers given are added to the sums,
+   *  which are zeroed first on Initialize, and the sums are turned into the outputs on Finalize. */
+  struct SynthesisThreadStruct
+    {
+    std::vector<const PixelType *> Inputs; //!< Input images of the layers to add
+    std::vector<const PixelType *> Bases; //!< MSDE bases to add
+    std::vector<const PixelType *> Details; //!< MSDE details to add
+    PixelType *Base; //!< Root sums of squares of the bases
+    PixelType *Detail; //!< Sum of the details
+    PixelType *Output; //!< HDR image, base + beta detail
+    PixelType *SumsOfSquares; //!< Root sums of squares of the inputs
+    PixelType *Average; //!< Average of the inputs
+    PixelType *BiasField; //!< Sum of the inputs over the HDR image
+    SizeValueType NumberOfPixels;
+    unsigned int NumberOfInputs; //!< Number of inputs of the average, all of them
+    float Beta;
+    bool Initialize;
+    bool Finalize;
+    };
+
+  /** Add the layers to the sums and, on Finalize, form the base and detail layers, the HDR image and the enabled
+      extra outputs over the pixels of a thread. Every input and its layers are read once per pixel, instead of
+      once per output.*/
+  static void ThreadedSynthesis(const SynthesisThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads);
+
+  /** Run the synthesis on the MultiThreader of the filter. */
+  void SynthesizeLayers(const SynthesisThreadStruct *str);
+
+  /** Static function used to dispatch the synthesis to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE SynthesisThreaderCallback(void *arg);
+
+  /** MSDE of the levels, with their details stored or, when diffs are empty, computed from the image and the
+      levels as Previous - Base. Levels and details are read in float, or in 16 bits where the float image is
+      NULL, see MakeLayer(). The last level must be in float.*/
+  void EnhanceShapeDetail(const std::vector< itk::SmartPointer<TOutputImage> > &results, const std::vector<CompactImagePointer> &compactResults,
+                          const std::vector< itk::SmartPointer<TOutputImage> > &diffs, const std::vector<CompactImagePointer> &compactDiffs,
+                          const PixelType *image, RegionType region, int levels, float lambdaValue);
+
+  /** Data shared by the threads of the MSDE weight kernel of a level. The
+   *  buffers cover the same region of Size pixels. */
+  struct ShapeDetailThreadStruct
+    {
+    LayerPointer Base; //!< Smoothed image of the level
+    LayerPointer Detail; //!< Detail of the level, compressed in place, or absent to compute it from Previous
+    LayerPointer Previous; //!< Image the level smoothed, the detail is Previous - Base when not stored
+    PixelType *Weights; //!< Detail weights of the level
+    typename OutputImageType::SizeType Size;
+    typename OutputImageType::SpacingType Spacing;
+    float Lambda;
+    };
+
+  /** Compute the detail weights exp(|d| - C), with C the gradient magnitude of the base over its 3x3x3
+      minimum, and compress the detail to sign(d) |d|^lambda when it is stored for the rows of a thread. Each row is swept
+      once with its neighbouring rows, clamped at the edges, so no gradient or minimum image is stored.*/
+  static void ThreadedShapeDetailWeights(const ShapeDetailThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads);
+
+  /** Static function used to dispatch the MSDE weight kernel to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE ShapeDetailThreaderCallback(void *arg);
+
+  /** Data shared by the threads of one pass of the recursive Gaussian over the MSDE weights of a level, laid out
+   *  as in DomainTransformImageFilter: lines of Length pixels separated by Stride, in Outer groups of Stride lines. */
+  struct WeightSmoothingThreadStruct
+    {
+    PixelType *Weights; //!< Detail weights of the level, smoothed in place
+    LayerPointer Detail; //!< Compressed detail of the level, or absent to compress Previous - Base on the last pass
+    LayerPointer Base; //!< Smoothed image of the level
+    LayerPointer Previous; //!< Image the level smoothed
+    float Lambda;
+    PixelType *Accumulator; //!< Detail image the weighted detail is added to by the last pass, NULL for the others
+    bool Initialize; //!< Store the weighted detail in the Accumulator instead of adding it, for the first level
+    SizeValueType Length;
+    SizeValueType Stride;
+    SizeValueType Outer;
+    double Causal[4]; //!< Coefficients of x[n], ..., x[n-3] in the causal half
+    double AntiCausal[4]; //!< Coefficients of x[n+1], ..., x[n+4] in the anticausal half
+    double Feedback[4]; //!< Coefficients of the previous four outputs in both halves
+    };
+
+  /** Coefficients of the fourth order recursive Gaussian of Deriche for a sigma in pixels, normalised to unit gain
+      as in RecursiveGaussianImageFilter.*/
+  static void ComputeRecursiveGaussianCoefficients(double sigma, WeightSmoothingThreadStruct *str);
+
+  /** Smooth the lines of a thread along one axis with the recursive Gaussian, its causal and anticausal halves
+      started from a constant extension past either end. With an Accumulator the smoothed weights are not stored,
+      each is multiplied by its detail and added to the Accumulator instead.*/
+  static void ThreadedSmoothWeights(const WeightSmoothingThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads);
+
+  /** Static function used to dispatch a pass of the weight smoothing to the MultiThreader. */
+  static ITK_THREAD_RETURN_TYPE WeightSmoothingThreaderCallback(void *arg);
+
   int m_Levels; //!< Number of levels in algorithm
   bool m_SumsOfSquares; //!< Compute SoS Image?
   bool m_Average; //!< Compute Average Image?
@@ -231,6 +544,18 @@ protected:
   float m_SigmaDomain; //!< Domain parameter of Features
   float m_Contrast; //!< Contrast enhancement
   HDRMode m_Mode; //!< HDR Mode to use
+  HDRSmoother m_Smoother; //!< Smoother of the MLIC
+  bool m_BatchedSmoothing; //!< Smooth all inputs of a level in one pass?
+  double m_MaximumSmootherMemory; //!< Memory budget of the automatic smoother
+  float m_Quality; //!< Speed/accuracy trade-off of the fast bilateral smoother
+  bool m_AdaptiveRangeAxis; //!< Range bins of the fast bilateral smoother follow the histogram?
+  float m_DetailSigma; //!< Sigma of the smoothing of the MSDE detail weights
+  bool m_StreamingSynthesis; //!< Add the layers of each input to the synthesis as soon as they are computed?
+  bool m_StoreDetailLayers; //!< Store the detail layers of the MLIC?
+  HDRRetention m_Retention; //!< Intermediate results kept after an update
+  typename BufferPoolType::Pointer m_BufferPool; //!< Recycled buffers of the intermediate images
+  HDRPrecision m_LayerPrecision; //!< Storage of the MLIC levels and detail layers
+  typename CompactBufferPoolType::Pointer m_CompactBufferPool; //!< Recycled buffers of the layers in 16 bits
 
   itk::SmartPointer<OutputImageType> m_BaseImage;
   itk::SmartPointer<OutputImageType> m_DetailImage;
@@ -243,6 +568,12 @@ protected:
   std::vector< itk::SmartPointer<OutputImageType> > m_LevelDetailImages;
   std::vector< itk::SmartPointer<OutputImageType> > m_LevelResults;
   std::vector< itk::SmartPointer<OutputImageType> > m_DiffResults;
+  std::vector< std::vector< itk::SmartPointer<OutputImageType> > > m_InputLevelResults; //!< Per input MLIC of the joint or batched smoothing
+  std::vector< std::vector< itk::SmartPointer<OutputImageType> > > m_InputDiffResults; //!< Per input MLIC details of the joint or batched smoothing
+  std::vector<CompactImagePointer> m_CompactLevelResults; //!< MLIC levels in 16 bits, NULL in m_LevelResults
+  std::vector<CompactImagePointer> m_CompactDiffResults; //!< MLIC details in 16 bits, m_DiffResults is then empty
+  std::vector< std::vector<CompactImagePointer> > m_InputCompactLevelResults;
+  std::vector< std::vector<CompactImagePointer> > m_InputCompactDiffResults;
 
 private:
   HighDynamicRangeImageFilter(const Self &); //purposely not implemented
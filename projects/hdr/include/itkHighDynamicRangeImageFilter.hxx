@@ -20,12 +20,18 @@
 
 #include "itkHighDynamicRangeImageFilter.h"
 #include "itkFastBilateralImageFilter.h"
-#include "itkSubtractImageFilter.h"
+#include "itkPermutohedralBilateralImageFilter.h"
+#include "itkDomainTransformImageFilter.h"
+#include "itkExactBilateralImageFilter.h"
+#include "itkMinimumMaximumImageCalculator.h"
 #include "itkLogImageFilter.h"
 #include "itkProgressReporter.h"
 #include "itkImageAlgorithm.h"
+#include "itkFastMath.h"
+
+#include <complex>
+#include <algorithm>
 
-#include "itkMinimumImageFunction.h"
 
 #include "milxImage.h"
 #include "milxFile.h"
@@ -47,6 +53,18 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
   m_SigmaDomain = 20;
   m_Contrast = 5;
   m_Mode = ToneMap;
+  m_Smoother = FastBilateralSmoother;
+  m_BatchedSmoothing = true;
+  m_MaximumSmootherMemory = 1024.0*1024.0*1024.0;
+  m_Quality = 1.0;
+  m_AdaptiveRangeAxis = false;
+  m_DetailSigma = 1.0;
+  m_StreamingSynthesis = false;
+  m_StoreDetailLayers = true;
+  m_Retention = RetainAll;
+  m_BufferPool = BufferPoolType::New();
+  m_LayerPrecision = SinglePrecision;
+  m_CompactBufferPool = CompactBufferPoolType::New();
 }
 
 template< typename TInputImage, typename TOutputImage >
@@ -56,6 +74,10 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
 {
   Superclass::PrintSelf(os, indent);
 
+  os << indent << "DetailSigma: " << m_DetailSigma << std::endl;
+  os << indent << "Retention: " << m_Retention << std::endl;
+  os << indent << "BufferPool: " << m_BufferPool.GetPointer() << std::endl;
+  os << indent << "LayerPrecision: " << m_LayerPrecision << std::endl;
 //  os << indent << "Spacing: " << m_Spacing << std::endl;
 //  os << indent << "Origin: " << m_Origin << std::endl;
 }
@@ -65,8 +87,54 @@ void
 HighDynamicRangeImageFilter< TInputImage, TOutputImage >
 ::GenerateData()
 {
+  itkDebugMacro(<< "Vector math on " << itk::FastMath::GetInstructionSetName(itk::FastMath::GetInstructionSet()));
+  //Intermediates of the previous update are recycled unless the caller kept hold of them
+  this->ReturnIntermediateImages();
   if(m_Mode == MultiLight)
   {
+    ///run joint or batched MLIC of all inputs, batching is left out when streaming so that one MLIC is held at a time
+    const bool batched = ((m_Smoother == FastBilateralSmoother || m_Smoother == AutomaticSmoother) && m_BatchedSmoothing && !m_StreamingSynthesis);
+    const bool perInputResults = (m_Smoother == PermutohedralSmoother || batched);
+    if(m_Smoother == PermutohedralSmoother)
+      CreateJointMultiLightImageCollections(m_SigmaRange, m_SigmaDomain, m_Levels);
+    else if(batched)
+      CreateBatchedMultiLightImageCollections(m_SigmaRange, m_SigmaDomain, m_Levels);
+
+    typename InputImageType::Pointer imageFirst = const_cast<InputImageType *>(this->GetInput(0));
+    typename InputImageType::RegionType firstRegion = imageFirst->GetLargestPossibleRegion();
+
+    //Outputs of the synthesis, accumulated input by input when streaming
+    typename TOutputImage::Pointer base = this->LeaseImage(imageFirst, firstRegion);
+    typename TOutputImage::Pointer detail = this->LeaseImage(imageFirst, firstRegion);
+    if(m_SumsOfSquares)
+      m_SoSImage = this->LeaseImage(imageFirst, firstRegion);
+    if(m_Average)
+      m_AverageImage = this->LeaseImage(imageFirst, firstRegion);
+    if(m_BiasField)
+      m_BiasFieldImage = this->LeaseImage(imageFirst, firstRegion);
+
+    typename TOutputImage::Pointer output = this->GetOutput();
+    output->SetRegions(firstRegion);
+    output->Allocate();
+
+    SynthesisThreadStruct str;
+    str.Base = base->GetBufferPointer();
+    str.Detail = detail->GetBufferPointer();
+    str.Output = output->GetBufferPointer();
+    str.SumsOfSquares = m_SumsOfSquares ? m_SoSImage->GetBufferPointer() : NULL;
+    str.Average = m_Average ? m_AverageImage->GetBufferPointer() : NULL;
+    str.BiasField = m_BiasField ? m_BiasFieldImage->GetBufferPointer() : NULL;
+    str.NumberOfPixels = firstRegion.GetNumberOfPixels();
+    str.NumberOfInputs = this->GetNumberOfInputs();
+    str.Beta = m_Beta;
+    str.Initialize = true;
+    str.Finalize = false;
+    this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+
+    //Unless retained, the layers of each input are folded into the sums as soon as they are computed,
+    //and its MLIC is returned to the buffer pool once its MSDE is done.
+    const bool fold = (m_StreamingSynthesis || m_Retention < RetainInputLayers);
+    const bool releaseMultiLight = (m_StreamingSynthesis || m_Retention < RetainAll);
     for(IndexValueType idx = 0; idx < this->GetNumberOfInputs(); ++idx)
     {
       this->InvokeEvent( ProgressEvent() );
@@ -80,7 +148,15 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
       std::cout << "Size of image " << idx << ": " << region.GetSize()[0] << ", " << region.GetSize()[1] << ", " << region.GetSize()[2] << std::endl;
 
       ///run MLIC
-      CreateMultiLightImageCollection(image, m_SigmaRange, m_SigmaDomain, m_Levels);
+      if(perInputResults)
+      {
+        m_LevelResults = m_InputLevelResults[idx];
+        m_DiffResults = m_InputDiffResults[idx];
+        m_CompactLevelResults = m_InputCompactLevelResults[idx];
+        m_CompactDiffResults = m_InputCompactDiffResults[idx];
+      }
+      else
+        CreateMultiLightImageCollection(image, m_SigmaRange, m_SigmaDomain, m_Levels);
 
       //Debug, check MLIC output
       //      for(size_t level = 0; level < m_Levels; level ++)
@@ -91,148 +167,75 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
       //          milx::File::SaveImage<OutputImageType>(filenameDiff, m_DiffResults[level]);
       //        }
 
-      ComputeMultiscaleShapeDetailEnhancement(m_LevelResults, m_DiffResults, region, m_Levels, m_Lambda);
+      if(m_LevelResults.empty() || (m_StoreDetailLayers && m_DiffResults.empty() && m_CompactDiffResults.empty()))
+        itkExceptionMacro(<< "No MLIC for input " << idx);
+      if(image->GetBufferedRegion().GetSize() != region.GetSize())
+        itkExceptionMacro(<< "Input " << idx << " must be buffered over its region");
+      if(m_StoreDetailLayers)
+        EnhanceShapeDetail(m_LevelResults, m_CompactLevelResults, m_DiffResults, m_CompactDiffResults, NULL, region, m_Levels, m_Lambda);
+      else
+        EnhanceShapeDetail(m_LevelResults, m_CompactLevelResults, std::vector<OutputImagePointer>(), std::vector<CompactImagePointer>(),
+                           image->GetBufferPointer(), region, m_Levels, m_Lambda);
 
       //      std::string filename = outputPrefix + "_image_" + milx::NumberToString(idx) + "_base.nii.gz";
       //      milx::File::SaveImage<OutputImageType>(filename, m_LevelBaseImage);
       //      std::string filenameDiff = outputPrefix + "_image_" + milx::NumberToString(idx) + "_details.nii.gz";
       //      milx::File::SaveImage<OutputImageType>(filenameDiff, m_LevelDetailImage);
 
-      m_LevelBaseImages.push_back(m_BaseImage);
-      m_LevelDetailImages.push_back(m_DetailImage);
-    }
-
-    typename InputImageType::Pointer imageFirst = const_cast<InputImageType *>(this->GetInput(0));
-    typename InputImageType::RegionType region = imageFirst->GetLargestPossibleRegion();
-    typename TOutputImage::Pointer baseBlank = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-    typename TOutputImage::Pointer base = milx::Image<TOutputImage>::MatchInformation(baseBlank, imageFirst); //ensure images in same space
-    typename TOutputImage::Pointer detailBlank = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-    typename TOutputImage::Pointer detail = milx::Image<TOutputImage>::MatchInformation(detailBlank, imageFirst); //ensure images in same space
-    std::cout << "Synthesize layers ... " << std::endl;
-    for(IndexValueType idx = 0; idx < this->GetNumberOfInputs(); ++idx)
-    {
-      //Synthesize base and detail layers
-      itk::ImageRegionConstIterator<TOutputImage> inputIterator(m_LevelBaseImages[idx], region);
-      itk::ImageRegionConstIterator<TOutputImage> detailIterator(m_LevelDetailImages[idx], region);
-      itk::ImageRegionIterator<TOutputImage> outputIterator(base, region);
-      itk::ImageRegionIterator<TOutputImage> outputDetailIterator(detail, region);
-      while(!inputIterator.IsAtEnd())
-      {
-        //outputIterator.Set(m_BaseWeights[idx]*inputIterator.Get()+outputIterator.Get());
-        outputIterator.Set(inputIterator.Get()*inputIterator.Get() + outputIterator.Get()); //sums of squares
-        outputDetailIterator.Set(detailIterator.Get() + outputDetailIterator.Get());
-        //outputDetailIterator.Set(detailIterator.Get()*detailIterator.Get() + outputDetailIterator.Get()); //sums of squares
-        ++inputIterator;
-        ++detailIterator;
-        ++outputIterator;
-        ++outputDetailIterator;
-      }
-
-      this->InvokeEvent( ProgressEvent() );
-    }
-    itk::ImageRegionIterator<TOutputImage> outputIteratorFinal(base, region);
-    //itk::ImageRegionIterator<TOutputImage> outputDetailIteratorFinal(detail, region);
-    while(!outputIteratorFinal.IsAtEnd())
-    {
-      outputIteratorFinal.Set(sqrt(outputIteratorFinal.Get())); //sqrt
-      //outputDetailIteratorFinal.Set(sqrt(outputDetailIteratorFinal.Get())); //sqrt
-      ++outputIteratorFinal;
-      //++outputDetailIteratorFinal;
-    }
-
-    m_BaseImage = base;
-    m_DetailImage = detail;
-    std::cout << "Done" << std::endl;
-
-    //Create HDR image
-    std::cout << "Creating HDR image ... " << std::endl;
-    typename TOutputImage::Pointer output = this->GetOutput();
-    output->SetRegions(region);
-    output->Allocate();
-
-    itk::ImageRegionConstIterator<TOutputImage> inputIterator(m_BaseImage, region);
-    itk::ImageRegionConstIterator<TOutputImage> detailIterator(m_DetailImage, region);
-    itk::ImageRegionIterator<TOutputImage> outputIterator(this->GetOutput(), region);
-    while(!inputIterator.IsAtEnd())
-    {
-      outputIterator.Set(inputIterator.Get() + m_Beta*detailIterator.Get());
-      ++inputIterator;
-      ++detailIterator;
-      ++outputIterator;
-    }
-    std::cout << "Done" << std::endl;
-
-    if(m_SumsOfSquares)
-    {
-      std::cout << "Sums of Squares Image ... " << std::endl;
-      typename TOutputImage::Pointer sosImage = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-      m_SoSImage = milx::Image<TOutputImage>::MatchInformation(sosImage, imageFirst); //ensure images in same space
-      for(IndexValueType idx = 0; idx < this->GetNumberOfInputs(); ++idx)
+      if(image->GetBufferedRegion().GetSize() != base->GetBufferedRegion().GetSize() || m_BaseImage->GetBufferedRegion().GetSize() != base->GetBufferedRegion().GetSize())
+        itkExceptionMacro(<< "Input " << idx << " and its MSDE layers must be buffered over the region of the first input");
+      str.Inputs.push_back(image->GetBufferPointer());
+      str.Bases.push_back(m_BaseImage->GetBufferPointer());
+      str.Details.push_back(m_DetailImage->GetBufferPointer());
+      if(fold)
       {
-        typename InputImageType::Pointer image = const_cast<InputImageType *>(this->GetInput(idx));
+        //Fold the layers of the input into the sums, then release them
+        this->SynthesizeLayers(&str);
+        str.Inputs.clear();
+        str.Bases.clear();
+        str.Details.clear();
+        str.Initialize = false;
 
-        //Synthesize image
-        itk::ImageRegionConstIterator<TOutputImage> imageIterator(image, region);
-        itk::ImageRegionIterator<TOutputImage> sosIterator(m_SoSImage, region);
-        while(!imageIterator.IsAtEnd())
-        {
-          sosIterator.Set(imageIterator.Get()*imageIterator.Get() + sosIterator.Get()); //sums of squares
-          ++imageIterator;
-          ++sosIterator;
-        }
+        this->ReturnImage(m_BaseImage);
+        this->ReturnImage(m_DetailImage);
       }
-      itk::ImageRegionIterator<TOutputImage> sosIteratorFinal(m_SoSImage, region);
-      while(!sosIteratorFinal.IsAtEnd())
+      else
       {
-        sosIteratorFinal.Set(sqrt(sosIteratorFinal.Get())); //sqrt
-        ++sosIteratorFinal;
+        m_LevelBaseImages.push_back(m_BaseImage);
+        m_LevelDetailImages.push_back(m_DetailImage);
       }
-      std::cout << "Done" << std::endl;
-    }
-    if(m_Average)
-    {
-      std::cout << "Average Image ... " << std::endl;
-      typename TOutputImage::Pointer aveImage = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-      m_AverageImage = milx::Image<TOutputImage>::MatchInformation(aveImage, imageFirst); //ensure images in same space
-      for(IndexValueType idx = 0; idx < this->GetNumberOfInputs(); ++idx)
+      if(releaseMultiLight)
       {
-        typename InputImageType::Pointer image = const_cast<InputImageType *>(this->GetInput(idx));
-
-        //Synthesize image
-        itk::ImageRegionConstIterator<TOutputImage> imageIterator(image, region);
-        itk::ImageRegionIterator<TOutputImage> aveIterator(m_AverageImage, region);
-        while(!imageIterator.IsAtEnd())
+        this->ReturnImages(m_LevelResults);
+        this->ReturnImages(m_DiffResults);
+        this->ReturnImages(m_CompactLevelResults);
+        this->ReturnImages(m_CompactDiffResults);
+        if(perInputResults)
         {
-          aveIterator.Set(imageIterator.Get() / this->GetNumberOfInputs() + aveIterator.Get()); //average
-          ++imageIterator;
-          ++aveIterator;
+          this->ReturnImages(m_InputLevelResults[idx]);
+          this->ReturnImages(m_InputDiffResults[idx]);
+          this->ReturnImages(m_InputCompactLevelResults[idx]);
+          this->ReturnImages(m_InputCompactDiffResults[idx]);
         }
       }
-      std::cout << "Done" << std::endl;
     }
-    if(m_BiasField)
-    {
-      std::cout << "Bias Field Image ... " << std::endl;
-      typename TOutputImage::Pointer biasImage = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-      m_BiasFieldImage = milx::Image<TOutputImage>::MatchInformation(biasImage, imageFirst); //ensure images in same space
-      for(IndexValueType idx = 0; idx < this->GetNumberOfInputs(); ++idx)
-      {
-        typename InputImageType::Pointer image = const_cast<InputImageType *>(this->GetInput(idx));
 
-        //Synthesize image
-        itk::ImageRegionConstIterator<TOutputImage> imageIterator(image, region);
-        itk::ImageRegionConstIterator<TOutputImage> hdrIterator(this->GetOutput(), region);
-        itk::ImageRegionIterator<TOutputImage> biasFieldIterator(m_BiasFieldImage, region);
-        while(!imageIterator.IsAtEnd())
-        {
-          biasFieldIterator.Set(biasFieldIterator.Get() + imageIterator.Get() / hdrIterator.Get()); //scale
-          ++imageIterator;
-          ++hdrIterator;
-          ++biasFieldIterator;
-        }
-      }
-      std::cout << "Done" << std::endl;
+    //Synthesize base and detail layers, the HDR image and the enabled extra outputs in one threaded pass,
+    //over the layers of all inputs or, when streaming, over the sums alone
+    std::cout << "Synthesize layers and HDR image ... " << std::endl;
+    str.Finalize = true;
+    this->SynthesizeLayers(&str);
+    m_BaseImage = base;
+    m_DetailImage = detail;
+
+    if(m_Retention < RetainInputLayers)
+    {
+      this->ReturnImages(m_LevelBaseImages);
+      this->ReturnImages(m_LevelDetailImages);
     }
+
+    this->InvokeEvent( ProgressEvent() );
+    std::cout << "Done" << std::endl;
   }
   else //tone map
   {
@@ -247,9 +250,506 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
       typename InputImageType::RegionType region = image->GetLargestPossibleRegion();
       std::cout << "Size of image " << idx << ": " << region.GetSize()[0] << ", " << region.GetSize()[1] << ", " << region.GetSize()[2] << std::endl;
 
+      this->ReturnImage(m_BaseImage);
+      this->ReturnImage(m_DetailImage);
       ComputeToneMapEnhancement(image, m_SigmaRange, m_SigmaDomain, m_Contrast);
     }
   }
+
+  if(m_Retention < RetainFinalLayers)
+  {
+    this->ReturnImage(m_BaseImage);
+    this->ReturnImage(m_DetailImage);
+  }
+
+  //Below RetainAll the buffers recycled during the update are released with it, so that only the retained
+  //results stay in memory between updates
+  if(m_Retention < RetainAll)
+  {
+    if(m_BufferPool)
+      m_BufferPool->Clear();
+    if(m_CompactBufferPool)
+      m_CompactBufferPool->Clear();
+  }
+}
+
+template< typename TInputImage, typename TOutputImage >
+typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::OutputImagePointer
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::LeaseImage(const typename BufferPoolType::ReferenceImageType *reference, const RegionType &region)
+{
+  if(m_BufferPool)
+    return m_BufferPool->Lease(reference, region); //ensure images in same space
+
+  OutputImagePointer image = TOutputImage::New();
+  image->CopyInformation(reference); //ensure images in same space
+  image->SetRegions(region);
+  image->Allocate();
+  return image;
+}
+
+template< typename TInputImage, typename TOutputImage >
+typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::CompactImagePointer
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::LeaseCompactImage(const typename BufferPoolType::ReferenceImageType *reference, const RegionType &region)
+{
+  if(m_BufferPool && m_CompactBufferPool) //pooled along with the float images
+    return m_CompactBufferPool->Lease(reference, region);
+
+  CompactImagePointer image = CompactImageType::New();
+  image->CopyInformation(reference);
+  image->SetRegions(region);
+  image->Allocate();
+  return image;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ReturnImage(OutputImagePointer &image)
+{
+  if(m_BufferPool)
+    m_BufferPool->Return(image);
+  image = NULL;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ReturnImage(CompactImagePointer &image)
+{
+  if(m_BufferPool && m_CompactBufferPool)
+    m_CompactBufferPool->Return(image);
+  image = NULL;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ReturnImages(std::vector< itk::SmartPointer<TOutputImage> > &images)
+{
+  for(size_t j = 0; j < images.size(); j ++)
+    this->ReturnImage(images[j]);
+  images.clear();
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ReturnImages(std::vector<CompactImagePointer> &images)
+{
+  for(size_t j = 0; j < images.size(); j ++)
+    this->ReturnImage(images[j]);
+  images.clear();
+}
+
+template< typename TInputImage, typename TOutputImage >
+typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::LayerPointer
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::MakeLayer(const std::vector< itk::SmartPointer<TOutputImage> > &images, const std::vector<CompactImagePointer> &compactImages, size_t level) const
+{
+  LayerPointer layer;
+  layer.Full = NULL;
+  layer.Compact = NULL;
+  layer.Precision = m_LayerPrecision;
+  if(level < images.size() && images[level])
+    layer.Full = images[level]->GetBufferPointer();
+  else if(level < compactImages.size() && compactImages[level])
+    layer.Compact = compactImages[level]->GetBufferPointer();
+  return layer;
+}
+
+template< typename TInputImage, typename TOutputImage >
+const typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::PixelType *
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ReadLayer(const LayerPointer &layer, SizeValueType offset, SizeValueType n, PixelType *scratch)
+{
+  if(layer.Full)
+    return layer.Full + offset;
+  if(!layer.Compact)
+    return NULL;
+
+  if(layer.Precision == BFloat16Precision)
+    FastMath::BFloat16ToFloat(layer.Compact + offset, scratch, n);
+  else
+    FastMath::HalfToFloat(layer.Compact + offset, scratch, n);
+  return scratch;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::WriteLayer(const LayerPointer &layer, SizeValueType offset, SizeValueType n, const PixelType *values)
+{
+  if(layer.Full)
+  {
+    if(layer.Full + offset != values) //already in place
+      std::copy(values, values + n, layer.Full + offset);
+  }
+  else if(layer.Precision == BFloat16Precision)
+    FastMath::FloatToBFloat16(values, layer.Compact + offset, n);
+  else
+    FastMath::FloatToHalf(values, layer.Compact + offset, n);
+}
+
+template< typename TInputImage, typename TOutputImage >
+std::vector< itk::SmartPointer<TOutputImage> >
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::DecodeLayers(const std::vector< itk::SmartPointer<TOutputImage> > &images, const std::vector<CompactImagePointer> &compactImages)
+{
+  std::vector< itk::SmartPointer<TOutputImage> > decoded(std::max(images.size(), compactImages.size()));
+  for(size_t level = 0; level < decoded.size(); level ++)
+  {
+    if(level < images.size() && images[level])
+    {
+      decoded[level] = images[level];
+      continue;
+    }
+
+    //Results handed out are the caller's, so they are not leased from the pool
+    const CompactImageType *compact = compactImages[level];
+    const RegionType region = compact->GetBufferedRegion();
+    decoded[level] = TOutputImage::New();
+    decoded[level]->CopyInformation(compact);
+    decoded[level]->SetRegions(region);
+    decoded[level]->Allocate();
+    ReadLayer(MakeLayer(images, compactImages, level), 0, region.GetNumberOfPixels(), decoded[level]->GetBufferPointer());
+  }
+  return decoded;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::CompactLayer(std::vector< itk::SmartPointer<TOutputImage> > &images, std::vector<CompactImagePointer> &compactImages, size_t level)
+{
+  if(m_LayerPrecision == SinglePrecision || level >= images.size() || !images[level])
+    return;
+
+  if(compactImages.size() < images.size())
+    compactImages.resize(images.size());
+  compactImages[level] = this->ComputeCompactImage(images[level], NULL);
+  this->ReturnImage(images[level]);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::AppendDetailLayer(const TOutputImage *image, const TOutputImage *result, std::vector< itk::SmartPointer<TOutputImage> > &diffs, std::vector<CompactImagePointer> &compactDiffs)
+{
+  if(m_LayerPrecision == SinglePrecision)
+    diffs.push_back(this->ComputeDifferenceImage(image, result));
+  else
+    compactDiffs.push_back(this->ComputeCompactImage(image, result));
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ReturnIntermediateImages()
+{
+  this->ReturnImage(m_BaseImage);
+  this->ReturnImage(m_DetailImage);
+  this->ReturnImage(m_SoSImage);
+  this->ReturnImage(m_AverageImage);
+  this->ReturnImage(m_BiasFieldImage);
+  this->ReturnImages(m_LevelBaseImages);
+  this->ReturnImages(m_LevelDetailImages);
+  this->ReturnImages(m_LevelResults);
+  this->ReturnImages(m_DiffResults);
+  for(size_t idx = 0; idx < m_InputLevelResults.size(); idx ++)
+    this->ReturnImages(m_InputLevelResults[idx]);
+  for(size_t idx = 0; idx < m_InputDiffResults.size(); idx ++)
+    this->ReturnImages(m_InputDiffResults[idx]);
+  m_InputLevelResults.clear();
+  m_InputDiffResults.clear();
+  this->ReturnImages(m_CompactLevelResults);
+  this->ReturnImages(m_CompactDiffResults);
+  for(size_t idx = 0; idx < m_InputCompactLevelResults.size(); idx ++)
+    this->ReturnImages(m_InputCompactLevelResults[idx]);
+  for(size_t idx = 0; idx < m_InputCompactDiffResults.size(); idx ++)
+    this->ReturnImages(m_InputCompactDiffResults[idx]);
+  m_InputCompactLevelResults.clear();
+  m_InputCompactDiffResults.clear();
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ThreadedDifference(const DifferenceThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+  const SizeValueType begin = (str->NumberOfPixels*threadId)/numberOfThreads;
+  const SizeValueType end = (str->NumberOfPixels*(threadId+1))/numberOfThreads;
+  if(str->Difference.Full)
+  {
+    PixelType *difference = str->Difference.Full;
+    if(str->Subtrahend)
+      for(SizeValueType k = begin; k < end; k ++)
+        difference[k] = str->Minuend[k] - str->Subtrahend[k];
+    else
+      std::copy(str->Minuend + begin, str->Minuend + end, difference + begin);
+    return;
+  }
+
+  //Encoded a chunk at a time from a buffer that stays in cache, so the float difference is never stored
+  const SizeValueType chunkLength = 4096;
+  std::vector<PixelType> chunk(std::min(chunkLength, end - begin));
+  for(SizeValueType first = begin; first < end; first += chunkLength)
+  {
+    const SizeValueType n = std::min(chunkLength, end - first);
+    const PixelType *values = str->Minuend + first;
+    if(str->Subtrahend)
+    {
+      for(SizeValueType k = 0; k < n; k ++)
+        chunk[k] = values[k] - str->Subtrahend[first + k];
+      values = &chunk[0];
+    }
+    WriteLayer(str->Difference, first, n, values);
+  }
+}
+
+template< typename TInputImage, typename TOutputImage >
+ITK_THREAD_RETURN_TYPE
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::DifferenceThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  const DifferenceThreadStruct *str = static_cast<const DifferenceThreadStruct *>(info->UserData);
+
+  ThreadedDifference(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ComputeDifference(const TOutputImage *minuend, const TOutputImage *subtrahend, const LayerPointer &difference)
+{
+  if(subtrahend && minuend->GetBufferedRegion() != subtrahend->GetBufferedRegion())
+    itkExceptionMacro(<< "Images of a detail layer must be buffered over the same region");
+
+  DifferenceThreadStruct str;
+  str.Minuend = minuend->GetBufferPointer();
+  str.Subtrahend = (subtrahend) ? subtrahend->GetBufferPointer() : NULL;
+  str.Difference = difference;
+  str.NumberOfPixels = minuend->GetBufferedRegion().GetNumberOfPixels();
+  this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
+  this->GetMultiThreader()->SetSingleMethod(this->DifferenceThreaderCallback, &str);
+  this->GetMultiThreader()->SingleMethodExecute();
+}
+
+template< typename TInputImage, typename TOutputImage >
+typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::OutputImagePointer
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ComputeDifferenceImage(const TOutputImage *minuend, const TOutputImage *subtrahend)
+{
+  OutputImagePointer difference = this->LeaseImage(subtrahend, subtrahend->GetBufferedRegion());
+
+  LayerPointer layer;
+  layer.Full = difference->GetBufferPointer();
+  layer.Compact = NULL;
+  layer.Precision = SinglePrecision;
+  this->ComputeDifference(minuend, subtrahend, layer);
+
+  return difference;
+}
+
+template< typename TInputImage, typename TOutputImage >
+typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::CompactImagePointer
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ComputeCompactImage(const TOutputImage *minuend, const TOutputImage *subtrahend)
+{
+  CompactImagePointer compact = this->LeaseCompactImage(minuend, minuend->GetBufferedRegion());
+
+  LayerPointer layer;
+  layer.Full = NULL;
+  layer.Compact = compact->GetBufferPointer();
+  layer.Precision = m_LayerPrecision;
+  this->ComputeDifference(minuend, subtrahend, layer);
+
+  return compact;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ThreadedSynthesis(const SynthesisThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+  //Each thread synthesizes a contiguous range of pixels, a chunk at a time so that the sums stay in cache
+  //while the layers of every input are added to them
+  const SizeValueType chunkLength = 4096;
+  const SizeValueType beginPixel = (str->NumberOfPixels*threadId)/numberOfThreads;
+  const SizeValueType endPixel = (str->NumberOfPixels*(threadId+1))/numberOfThreads;
+  const size_t numberOfLayers = str->Bases.size();
+  const unsigned int numberOfInputs = str->NumberOfInputs;
+
+  for(SizeValueType begin = beginPixel; begin < endPixel; begin += chunkLength)
+    {
+      const SizeValueType length = std::min(chunkLength, endPixel - begin);
+      PixelType *base = str->Base + begin;
+      PixelType *detail = str->Detail + begin;
+      PixelType *output = str->Output + begin;
+      PixelType *sos = (str->SumsOfSquares) ? str->SumsOfSquares + begin : NULL;
+      PixelType *average = (str->Average) ? str->Average + begin : NULL;
+      PixelType *biasField = (str->BiasField) ? str->BiasField + begin : NULL;
+
+      if(str->Initialize)
+        {
+          std::fill(base, base + length, static_cast<PixelType>(0));
+          std::fill(detail, detail + length, static_cast<PixelType>(0));
+          if(sos)
+            std::fill(sos, sos + length, static_cast<PixelType>(0));
+          if(average)
+            std::fill(average, average + length, static_cast<PixelType>(0));
+          if(biasField)
+            std::fill(biasField, biasField + length, static_cast<PixelType>(0));
+        }
+
+      //Base is the sums of squares of the input bases, detail the sum of their details
+      for(size_t idx = 0; idx < numberOfLayers; idx ++)
+        {
+          const PixelType *levelBase = str->Bases[idx] + begin;
+          const PixelType *levelDetail = str->Details[idx] + begin;
+          const PixelType *image = str->Inputs[idx] + begin;
+          for(SizeValueType x = 0; x < length; x ++)
+            {
+              //base[x] += m_BaseWeights[idx]*levelBase[x];
+              base[x] += levelBase[x]*levelBase[x]; //sums of squares
+              detail[x] += levelDetail[x];
+              //detail[x] += levelDetail[x]*levelDetail[x]; //sums of squares
+            }
+          if(sos)
+            for(SizeValueType x = 0; x < length; x ++)
+              sos[x] += image[x]*image[x]; //sums of squares
+          if(average)
+            for(SizeValueType x = 0; x < length; x ++)
+              average[x] += image[x] / numberOfInputs; //average
+          if(biasField)
+            for(SizeValueType x = 0; x < length; x ++)
+              biasField[x] += image[x]; //scaled by the HDR image below
+        }
+
+      if(!str->Finalize)
+        continue;
+
+      itk::FastMath::Sqrt(base, base, length); //sqrt
+
+      //HDR image
+      for(SizeValueType x = 0; x < length; x ++)
+        output[x] = base[x] + str->Beta*detail[x];
+
+      if(sos)
+        itk::FastMath::Sqrt(sos, sos, length); //sqrt
+      if(biasField)
+        for(SizeValueType x = 0; x < length; x ++)
+          biasField[x] /= output[x]; //scale
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::SynthesizeLayers(const SynthesisThreadStruct *str)
+{
+  this->GetMultiThreader()->SetSingleMethod(this->SynthesisThreaderCallback, const_cast<SynthesisThreadStruct *>(str));
+  this->GetMultiThreader()->SingleMethodExecute();
+}
+
+template< typename TInputImage, typename TOutputImage >
+ITK_THREAD_RETURN_TYPE
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::SynthesisThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  const SynthesisThreadStruct *str = static_cast<const SynthesisThreadStruct *>(info->UserData);
+
+  ThreadedSynthesis(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TInputImage, typename TOutputImage >
+typename HighDynamicRangeImageFilter< TInputImage, TOutputImage >::SmoothingFilterType::Pointer
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::CreateSmoothingFilter(HDRSmoother smoother) const
+{
+  if(smoother == DomainTransformSmoother)
+    return itk::DomainTransformImageFilter<TInputImage, TOutputImage>::New().GetPointer();
+  if(smoother == ExactBilateralSmoother)
+    return itk::ExactBilateralImageFilter<TInputImage, TOutputImage>::New().GetPointer();
+
+  typedef itk::FastBilateralImageFilter<TInputImage, TOutputImage> FastFilterType;
+  typename FastFilterType::Pointer filter = FastFilterType::New();
+  filter->SetQuality(m_Quality);
+  filter->SetRangeAxis(m_AdaptiveRangeAxis ? FastFilterType::AdaptiveRangeAxis : FastFilterType::UniformRangeAxis);
+  return filter.GetPointer();
+}
+
+template< typename TInputImage, typename TOutputImage >
+HDRSmoother
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::SelectSmoother(const std::vector< itk::SmartPointer<TOutputImage> > &images, float range, float domain) const
+{
+  //widest intensity range of the images, it sets the range axis of the bilateral grid
+  double intensityRange = 0.0;
+  for(size_t idx = 0; idx < images.size(); idx ++)
+  {
+    typedef itk::MinimumMaximumImageCalculator<TOutputImage> ImageCalculatorFilterType;
+    typename ImageCalculatorFilterType::Pointer imageCalculatorFilter = ImageCalculatorFilterType::New();
+    imageCalculatorFilter->SetImage(images[idx]);
+    imageCalculatorFilter->Compute();
+    intensityRange = std::max(intensityRange, static_cast<double>(imageCalculatorFilter->GetMaximum() - imageCalculatorFilter->GetMinimum()));
+  }
+
+  //only smoothers of the same bilateral kernel are candidates, so that the choice changes the cost and not the layers
+  const int numberOfCandidates = 2;
+  const HDRSmoother candidates[numberOfCandidates] = { FastBilateralSmoother, ExactBilateralSmoother };
+  const char *names[numberOfCandidates] = { "fast bilateral", "exact bilateral" };
+  const typename TOutputImage::SizeType size = images[0]->GetLargestPossibleRegion().GetSize();
+  const typename TOutputImage::SpacingType spacing = images[0]->GetSpacing();
+
+  //cheapest within the memory budget, or the least memory hungry if none fits
+  int best = -1;
+  int leanest = 0;
+  double bestOperations = 0.0;
+  double leanestMemory = 0.0;
+  for(int c = 0; c < numberOfCandidates; c ++)
+  {
+    typename SmoothingFilterType::Pointer filter = CreateSmoothingFilter(candidates[c]);
+    filter->SetRangeSigma(range);
+    filter->SetDomainSigma(domain);
+    const typename SmoothingFilterType::CostEstimateType cost = filter->EstimateCost(size, spacing, intensityRange);
+    const double operations = images.size()*cost.Operations;
+    std::cout << "	  Cost of " << names[c] << ": " << cost.Cells << " cells, " << cost.Memory/(1024.0*1024.0) << " MB, " << operations << " flops" << std::endl;
+
+    if(cost.Memory <= m_MaximumSmootherMemory && (best < 0 || operations < bestOperations))
+    {
+      best = c;
+      bestOperations = operations;
+    }
+    if(c == 0 || cost.Memory < leanestMemory)
+    {
+      leanest = c;
+      leanestMemory = cost.Memory;
+    }
+  }
+  if(best < 0)
+    best = leanest;
+  std::cout << "	Selected smoother: " << names[best] << std::endl;
+
+  return candidates[best];
+}
+
+template< typename TInputImage, typename TOutputImage >
+HDRSmoother
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ResolveSmoother(const std::vector< itk::SmartPointer<TOutputImage> > &images, float range, float domain) const
+{
+  if(m_Smoother != AutomaticSmoother)
+    return m_Smoother;
+
+  return SelectSmoother(images, range, domain);
 }
 
 template< typename TInputImage, typename TOutputImage >
@@ -257,8 +757,11 @@ void
 HighDynamicRangeImageFilter< TInputImage, TOutputImage >
 ::CreateMultiLightImageCollection(itk::SmartPointer<TInputImage> image, float range, float domain, int levels)
 {
-  m_LevelResults.clear();
-  m_DiffResults.clear();
+  //MLIC of the previous input is recycled unless it was retained
+  this->ReturnImages(m_LevelResults);
+  this->ReturnImages(m_DiffResults);
+  this->ReturnImages(m_CompactLevelResults);
+  this->ReturnImages(m_CompactDiffResults);
 
   //run MLIC
   itk::SmartPointer<TOutputImage> prevResult = NULL;
@@ -279,9 +782,9 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
       if(level == 0)
           currentImage = image;
 
-      // create the filter
-      typedef itk::FastBilateralImageFilter<TInputImage, TOutputImage> FilterType;
-      typename FilterType::Pointer filter1 = FilterType::New();
+      // create the filter, the cheapest for the sigmas of the level in automatic mode
+      const HDRSmoother smoother = ResolveSmoother(std::vector< itk::SmartPointer<TOutputImage> >(1, currentImage), range/factor, spatialFactor*domain);
+      typename SmoothingFilterType::Pointer filter1 = CreateSmoothingFilter(smoother);
         filter1->SetInput(currentImage);
         filter1->SetRangeSigma(range/factor);
         filter1->SetDomainSigma(spatialFactor*domain);
@@ -298,25 +801,174 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
         }
       itk::SmartPointer<TOutputImage> result = filter1->GetOutput();
 
-      //Diff with previous
-      typedef itk::SubtractImageFilter<TOutputImage, TOutputImage> SubtractImageType;
-      typename SubtractImageType::Pointer subtractFilter = SubtractImageType::New();
-        subtractFilter->SetInput1(currentImage);
-        subtractFilter->SetInput2(result);
-        try
+      m_LevelResults.push_back(result);
+      prevResult = result;
+
+      //Diff with previous, unless computed from the adjacent levels by the MSDE
+      if(m_StoreDetailLayers)
+        this->AppendDetailLayer(currentImage, result, m_DiffResults, m_CompactDiffResults);
+
+      //The image the level smoothed is no longer needed in float
+      if(level > 0)
+        this->CompactLayer(m_LevelResults, m_CompactLevelResults, level - 1);
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::CreateJointMultiLightImageCollections(float range, float domain, int levels)
+{
+  const size_t numberOfInputs = this->GetNumberOfInputs();
+  m_InputLevelResults.assign(numberOfInputs, std::vector< itk::SmartPointer<OutputImageType> >());
+  m_InputDiffResults.assign(numberOfInputs, std::vector< itk::SmartPointer<OutputImageType> >());
+  m_InputCompactLevelResults.assign(numberOfInputs, std::vector<CompactImagePointer>());
+  m_InputCompactDiffResults.assign(numberOfInputs, std::vector<CompactImagePointer>());
+
+  //run MLIC, one joint pass per level over all inputs
+  std::vector< itk::SmartPointer<TOutputImage> > currentImages(numberOfInputs);
+  for(size_t idx = 0; idx < numberOfInputs; idx ++)
+    currentImages[idx] = const_cast<InputImageType *>(this->GetInput(idx));
+
+  for(size_t level = 0; level < levels; level ++)
+    {
+      size_t factor = 1 << level;
+      std::cout << "\tProcess Joint Level " << level << " with Factor " << factor << std::endl;
+
+      //spatial factor as per Fattal et al. 2007, sec. 4.1
+      size_t spatialFactor = 1;
+      if(level > 1)
+        spatialFactor = 1 << (level-1);
+      else if(level == 1)
+        spatialFactor = sqrt(3);
+
+      // create the filter
+      typedef itk::PermutohedralBilateralImageFilter<TOutputImage, TOutputImage> FilterType;
+      typename FilterType::Pointer filter1 = FilterType::New();
+        for(size_t idx = 0; idx < numberOfInputs; idx ++)
+          filter1->SetInput(idx, currentImages[idx]);
+        filter1->SetRangeSigma(range/factor);
+        filter1->SetDomainSigma(spatialFactor*domain);
+        filter1->SetNumberOfThreads(this->GetNumberOfThreads());
+      try
         {
-          subtractFilter->Update();
+          std::cout << "Applying Joint Level " << level << " ..." << std::endl;
+          filter1->Update();
         }
-        catch (itk::ExceptionObject & ex )
+      catch (itk::ExceptionObject& e)
         {
-          std::cerr << "Failed Subtraction" << std::endl;
-          std::cerr << ex.GetDescription() << std::endl;
+          std::cerr << "Exception detected: "  << e.GetDescription();
+          return;
         }
-      itk::SmartPointer<TOutputImage> diffResult = subtractFilter->GetOutput();
 
-      m_LevelResults.push_back(result);
-      m_DiffResults.push_back(diffResult);
-      prevResult = result;
+      for(size_t idx = 0; idx < numberOfInputs; idx ++)
+        {
+          itk::SmartPointer<TOutputImage> result = filter1->GetOutput(idx);
+
+          //Diff with previous, unless computed from the adjacent levels by the MSDE
+          if(m_StoreDetailLayers)
+            this->AppendDetailLayer(currentImages[idx], result, m_InputDiffResults[idx], m_InputCompactDiffResults[idx]);
+
+          m_InputLevelResults[idx].push_back(result);
+          currentImages[idx] = result;
+          if(level > 0)
+            this->CompactLayer(m_InputLevelResults[idx], m_InputCompactLevelResults[idx], level - 1);
+        }
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::CreateBatchedMultiLightImageCollections(float range, float domain, int levels)
+{
+  const size_t numberOfInputs = this->GetNumberOfInputs();
+  m_InputLevelResults.assign(numberOfInputs, std::vector< itk::SmartPointer<OutputImageType> >());
+  m_InputDiffResults.assign(numberOfInputs, std::vector< itk::SmartPointer<OutputImageType> >());
+  m_InputCompactLevelResults.assign(numberOfInputs, std::vector<CompactImagePointer>());
+  m_InputCompactDiffResults.assign(numberOfInputs, std::vector<CompactImagePointer>());
+
+  //run MLIC, one batched pass per level over all inputs
+  std::vector< itk::SmartPointer<TOutputImage> > currentImages(numberOfInputs);
+  for(size_t idx = 0; idx < numberOfInputs; idx ++)
+    currentImages[idx] = const_cast<InputImageType *>(this->GetInput(idx));
+
+  for(size_t level = 0; level < levels; level ++)
+    {
+      size_t factor = 1 << level;
+      std::cout << "\tProcess Batched Level " << level << " with Factor " << factor << std::endl;
+
+      //spatial factor as per Fattal et al. 2007, sec. 4.1
+      size_t spatialFactor = 1;
+      if(level > 1)
+        spatialFactor = 1 << (level-1);
+      else if(level == 1)
+        spatialFactor = sqrt(3);
+
+      // create the filter, each input is filtered into the output of the same index.
+      // Other smoothers than the fast bilateral filter the inputs one by one.
+      const HDRSmoother smoother = ResolveSmoother(currentImages, range/factor, spatialFactor*domain);
+      std::vector< itk::SmartPointer<TOutputImage> > results(numberOfInputs);
+      if(smoother == FastBilateralSmoother)
+        {
+          typedef itk::FastBilateralImageFilter<TOutputImage, TOutputImage> FilterType;
+          typename FilterType::Pointer filter1 = FilterType::New();
+            for(size_t idx = 0; idx < numberOfInputs; idx ++)
+              filter1->SetInput(idx, currentImages[idx]);
+            filter1->SetRangeSigma(range/factor);
+            filter1->SetDomainSigma(spatialFactor*domain);
+            filter1->SetQuality(m_Quality);
+            filter1->SetRangeAxis(m_AdaptiveRangeAxis ? FilterType::AdaptiveRangeAxis : FilterType::UniformRangeAxis);
+            filter1->SetNumberOfThreads(this->GetNumberOfThreads());
+          try
+            {
+              std::cout << "Applying Batched Level " << level << " ..." << std::endl;
+              filter1->Update();
+            }
+          catch (itk::ExceptionObject& e)
+            {
+              std::cerr << "Exception detected: "  << e.GetDescription();
+              return;
+            }
+          for(size_t idx = 0; idx < numberOfInputs; idx ++)
+            results[idx] = filter1->GetOutput(idx);
+        }
+      else
+        {
+          for(size_t idx = 0; idx < numberOfInputs; idx ++)
+            {
+              typename SmoothingFilterType::Pointer filter1 = CreateSmoothingFilter(smoother);
+                filter1->SetInput(currentImages[idx]);
+                filter1->SetRangeSigma(range/factor);
+                filter1->SetDomainSigma(spatialFactor*domain);
+                filter1->SetNumberOfThreads(this->GetNumberOfThreads());
+              try
+                {
+                  std::cout << "Applying Level " << level << " to input " << idx << " ..." << std::endl;
+                  filter1->Update();
+                }
+              catch (itk::ExceptionObject& e)
+                {
+                  std::cerr << "Exception detected: "  << e.GetDescription();
+                  return;
+                }
+              results[idx] = filter1->GetOutput();
+            }
+        }
+
+      for(size_t idx = 0; idx < numberOfInputs; idx ++)
+        {
+          itk::SmartPointer<TOutputImage> result = results[idx];
+
+          //Diff with previous, unless computed from the adjacent levels by the MSDE
+          if(m_StoreDetailLayers)
+            this->AppendDetailLayer(currentImages[idx], result, m_InputDiffResults[idx], m_InputCompactDiffResults[idx]);
+
+          m_InputLevelResults[idx].push_back(result);
+          currentImages[idx] = result;
+          if(level > 0)
+            this->CompactLayer(m_InputLevelResults[idx], m_InputCompactLevelResults[idx], level - 1);
+        }
     }
 }
 
@@ -331,10 +983,48 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
         return;
     }
 
-    float epsilon = 1e-8; //avoid divide by zero
+    EnhanceShapeDetail(results, std::vector<CompactImagePointer>(), diffs, std::vector<CompactImagePointer>(), NULL, region, levels, lambdaValue);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ComputeMultiscaleShapeDetailEnhancement(itk::SmartPointer<TInputImage> image, std::vector< itk::SmartPointer<TOutputImage> > results, RegionType region, int levels, float lambdaValue)
+{
+    if(!image || results.empty())
+    {
+        std::cout << "Inputs to MSDE cannot be empty. Returning.";
+        return;
+    }
+    if(image->GetBufferedRegion().GetSize() != region.GetSize())
+      itkExceptionMacro(<< "MSDE input image must be buffered over the region");
+
+    EnhanceShapeDetail(results, std::vector<CompactImagePointer>(), std::vector< itk::SmartPointer<TOutputImage> >(), std::vector<CompactImagePointer>(),
+                       image->GetBufferPointer(), region, levels, lambdaValue);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::EnhanceShapeDetail(const std::vector< itk::SmartPointer<TOutputImage> > &results, const std::vector<CompactImagePointer> &compactResults,
+                     const std::vector< itk::SmartPointer<TOutputImage> > &diffs, const std::vector<CompactImagePointer> &compactDiffs,
+                     const PixelType *image, RegionType region, int levels, float lambdaValue)
+{
+    //Without diffs the detail of a level is computed where needed from the image it smoothed, the previous level
+    const bool storedDetails = !diffs.empty() || !compactDiffs.empty();
+    typedef typename BufferPoolType::ReferenceImageType ReferenceImageType;
+    //The last level becomes the base image, so it is never compacted
+    if(results.empty() || !results.back())
+      itkExceptionMacro(<< "The last MSDE level must be in float");
+
+    const unsigned int dimension = TOutputImage::ImageDimension;
     float lambdaValues[3] = { lambdaValue, lambdaValue + 0.05, lambdaValue + 0.15 };
-    typename InputImageType::Pointer levelDetailBlank = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-    m_DetailImage = milx::Image<TOutputImage>::MatchInformation(levelDetailBlank, results[0]); //ensure images in same space
+    //Detail image, written by the first level and added to by the others, and detail weights,
+    //computed and smoothed in place at every level
+    m_DetailImage = this->LeaseImage(results.back(), region);
+    OutputImagePointer weights = this->LeaseImage(results.back(), region);
+
+    this->GetMultiThreader()->SetNumberOfThreads(this->GetNumberOfThreads());
     for(size_t level = 0; level < levels; level ++)
       {
         float lambda = lambdaValue;
@@ -342,58 +1032,449 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
           lambda = lambdaValues[level];
 
         std::cout << "\tProcessing image in level " << level << " with lambda of " << lambda << std::endl;
-        typename TOutputImage::Pointer weightsBlank = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-        typename TOutputImage::Pointer weights = milx::Image<TOutputImage>::MatchInformation(weightsBlank, results[0]); //ensure images in same space
-
-        typename TOutputImage::Pointer gradMagResult = milx::Image<TOutputImage>::GradientMagnitude(results[level]);
-
-        typedef itk::MinimumImageFunction<TOutputImage> FilterType;
-        typename FilterType::Pointer minImageFunction = FilterType::New();
-        minImageFunction->SetInputImage(results[level]);
+        //Levels and details are in float or in 16 bits, see MakeLayer()
+        const ReferenceImageType *levelImage = (level < results.size() && results[level])
+            ? static_cast<const ReferenceImageType *>(results[level]) : static_cast<const ReferenceImageType *>(compactResults[level]);
+        const ReferenceImageType *detailImage = NULL;
+        if(storedDetails)
+          detailImage = (diffs.empty()) ? static_cast<const ReferenceImageType *>(compactDiffs[level]) : static_cast<const ReferenceImageType *>(diffs[level]);
+        if(levelImage->GetBufferedRegion() != region || (detailImage && detailImage->GetBufferedRegion() != region))
+          itkExceptionMacro(<< "MSDE level " << level << " must be buffered over the region");
+        LayerPointer previous; //image the level smoothed
+        if(level == 0)
+        {
+          previous.Full = const_cast<PixelType *>(image);
+          previous.Compact = NULL;
+          previous.Precision = m_LayerPrecision;
+        }
+        else
+          previous = MakeLayer(results, compactResults, level - 1);
 
+        //Weights and compressed detail in one threaded sweep over the level
         //std::cout << "Computing Weights ... " << std::endl;
-        itk::ImageRegionIteratorWithIndex<TOutputImage> resultIterator(results[level], region);
-        itk::ImageRegionIteratorWithIndex<TOutputImage> diffIterator(diffs[level], region);
-        itk::ImageRegionIteratorWithIndex<TOutputImage> gradIterator(gradMagResult, region);
-        itk::ImageRegionIteratorWithIndex<TOutputImage> weightsIterator(weights, region);
-        while(!diffIterator.IsAtEnd())
-            {
-              PixelType minValue = static_cast<PixelType>(minImageFunction->EvaluateAtIndex(resultIterator.GetIndex()));
-              PixelType C = gradIterator.Get()/(minValue+epsilon); //penalise strong edges which the ideal bilateral would not have picked up
-              // Set the current detail pixel
-              PixelType U = exp( abs(diffIterator.Get())-C );
-              weightsIterator.Set(U);
-
-              //reduce ratio between min max values
-              diffIterator.Set(copysign(pow(fabs(diffIterator.Get()), lambda), diffIterator.Get())); //copysign - Return x with the sign of y
-
-              ++resultIterator;
-              ++diffIterator;
-              ++gradIterator;
-              ++weightsIterator;
-            }
+        ShapeDetailThreadStruct str;
+        str.Base = MakeLayer(results, compactResults, level);
+        str.Detail = MakeLayer(diffs, compactDiffs, level); //absent without diffs
+        str.Previous = previous;
+        str.Weights = weights->GetBufferPointer();
+        str.Size = region.GetSize();
+        str.Spacing = m_DetailImage->GetSpacing();
+        str.Lambda = lambda;
+        this->GetMultiThreader()->SetSingleMethod(this->ShapeDetailThreaderCallback, &str);
+        this->GetMultiThreader()->SingleMethodExecute();
         //std::cout << "Done" << std::endl;
 
-        //Smooth weights
-        typename TOutputImage::Pointer weightsFinal = milx::Image<TOutputImage>::GaussianSmooth(weights, 1); //smooth, 8 parameter from Fattal et al. 2007
-
-        //Muliply, Add and Deep Copy detail
-        //std::cout << "Form level layers ... " << std::endl;
-        itk::ImageRegionConstIterator<TOutputImage> inputIterator(diffs[level], region);
-        itk::ImageRegionConstIterator<TOutputImage> weightIterator(weightsFinal, region);
-        itk::ImageRegionIterator<TOutputImage> outputIterator(m_DetailImage, region);
-        while(!inputIterator.IsAtEnd())
+        //Smooth weights in place axis by axis, 8 parameter from Fattal et al. 2007 see SetDetailSigma()
+        //The pass along the last axis multiplies them by the detail and adds them to the detail image
+        //std::cout << "Smooth weights and form level layers ... " << std::endl;
+        WeightSmoothingThreadStruct smoothing;
+        smoothing.Weights = weights->GetBufferPointer();
+        smoothing.Detail = str.Detail;
+        smoothing.Base = str.Base;
+        smoothing.Previous = str.Previous;
+        smoothing.Lambda = lambda;
+        this->GetMultiThreader()->SetSingleMethod(this->WeightSmoothingThreaderCallback, &smoothing);
+        SizeValueType stride = 1;
+        for(unsigned int i = 0; i < dimension; i ++)
           {
-              outputIterator.Set(inputIterator.Get()*weightIterator.Get()+outputIterator.Get());
-              ++inputIterator;
-              ++weightIterator;
-              ++outputIterator;
+            smoothing.Length = region.GetSize(i);
+            smoothing.Stride = stride;
+            smoothing.Outer = region.GetNumberOfPixels()/(smoothing.Length*stride);
+            stride *= smoothing.Length;
+            smoothing.Accumulator = (i == dimension - 1) ? m_DetailImage->GetBufferPointer() : NULL;
+            smoothing.Initialize = (level == 0);
+            ComputeRecursiveGaussianCoefficients(m_DetailSigma/str.Spacing[i], &smoothing);
+            this->GetMultiThreader()->SingleMethodExecute();
           }
 
         if (level == results.size() - 1) //last one
           m_BaseImage = results[level];
         //std::cout << "Done" << std::endl;
       }
+
+    this->ReturnImage(weights);
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ThreadedShapeDetailWeights(const ShapeDetailThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+  const unsigned int dimension = TOutputImage::ImageDimension;
+  const float epsilon = 1e-8; //avoid divide by zero
+  const SizeValueType length = str->Size[0];
+
+  //Rows along the first axis are split between the threads
+  SizeValueType rows = 1;
+  SizeValueType strides[TOutputImage::ImageDimension];
+  strides[0] = 1;
+  for(unsigned int i = 1; i < dimension; i ++)
+    {
+      strides[i] = strides[i-1]*str->Size[i-1];
+      rows *= str->Size[i];
+    }
+  const SizeValueType beginRow = (rows*threadId)/numberOfThreads;
+  const SizeValueType endRow = (rows*(threadId+1))/numberOfThreads;
+
+  //Central differences are halved and divided by the spacing, as in GradientMagnitudeImageFilter
+  float scales[TOutputImage::ImageDimension];
+  for(unsigned int i = 0; i < dimension; i ++)
+    scales[i] = 0.5/str->Spacing[i];
+
+  //The 3^(D-1) rows around the current one, and their minimum along the row
+  SizeValueType numberOfNeighbours = 1;
+  for(unsigned int i = 1; i < dimension; i ++)
+    numberOfNeighbours *= 3;
+  std::vector<const PixelType *> neighbours(numberOfNeighbours);
+  std::vector<PixelType> columnMinima(length);
+  //Rows of a base in 16 bits are decoded into a cache of twice the neighbours, tagged by their offset and the row
+  //they were last used for, so that the rows shared by consecutive rows are decoded once
+  const bool compactBase = !str->Base.Full;
+  const SizeValueType numberOfSlots = (compactBase) ? 2*numberOfNeighbours : 0;
+  std::vector<PixelType> cachedRows(numberOfSlots*length);
+  std::vector<SizeValueType> cachedOffsets(numberOfSlots, NumericTraits<SizeValueType>::max());
+  std::vector<SizeValueType> cachedUses(numberOfSlots, 0);
+  std::vector<SizeValueType> neighbourOffsets(numberOfNeighbours);
+  //Detail and the image the level smoothed of the row, decoded when in 16 bits
+  std::vector<PixelType> detailRow(length);
+  std::vector<PixelType> originalRow(length);
+  //Exponents of the weights and detail magnitudes of the row, for the vectorised exp and pow
+  std::vector<float> exponents(length);
+  std::vector<float> magnitudes(length);
+
+  SizeValueType coordinates[TOutputImage::ImageDimension];
+  for(SizeValueType row = beginRow; row < endRow; row ++)
+    {
+      SizeValueType remainder = row;
+      for(unsigned int i = 1; i < dimension; i ++)
+        {
+          coordinates[i] = remainder%str->Size[i];
+          remainder /= str->Size[i];
+        }
+
+      //Neighbouring rows, clamped at the edges as the zero flux boundary
+      for(SizeValueType k = 0; k < numberOfNeighbours; k ++)
+        {
+          SizeValueType digits = k;
+          SizeValueType offset = 0;
+          for(unsigned int i = 1; i < dimension; i ++)
+            {
+              SizeValueType coordinate = coordinates[i];
+              const SizeValueType step = digits%3;
+              digits /= 3;
+              if(step == 0 && coordinate > 0)
+                coordinate --;
+              else if(step == 2 && coordinate + 1 < str->Size[i])
+                coordinate ++;
+              offset += coordinate*strides[i];
+            }
+          neighbourOffsets[k] = offset;
+          if(!compactBase)
+            neighbours[k] = str->Base.Full + offset;
+        }
+      if(compactBase)
+        {
+          //Rows already decoded are kept for this row first, so a row to decode never evicts one still needed
+          std::fill(neighbours.begin(), neighbours.end(), static_cast<const PixelType *>(NULL));
+          for(SizeValueType k = 0; k < numberOfNeighbours; k ++)
+            for(SizeValueType slot = 0; slot < numberOfSlots; slot ++)
+              if(cachedOffsets[slot] == neighbourOffsets[k])
+                {
+                  cachedUses[slot] = row + 1;
+                  neighbours[k] = &cachedRows[slot*length];
+                  break;
+                }
+          for(SizeValueType k = 0; k < numberOfNeighbours; k ++)
+            {
+              if(neighbours[k])
+                continue;
+              SizeValueType slot = 0;
+              for(SizeValueType j = 0; j < numberOfSlots; j ++)
+                if(cachedOffsets[j] == neighbourOffsets[k]) //clamped duplicate decoded just now
+                  {
+                    slot = j;
+                    break;
+                  }
+                else if(cachedUses[j] < cachedUses[slot])
+                  slot = j;
+              if(cachedOffsets[slot] != neighbourOffsets[k])
+                {
+                  cachedOffsets[slot] = neighbourOffsets[k];
+                  ReadLayer(str->Base, neighbourOffsets[k], length, &cachedRows[slot*length]);
+                }
+              cachedUses[slot] = row + 1;
+              neighbours[k] = &cachedRows[slot*length];
+            }
+        }
+
+      for(SizeValueType x = 0; x < length; x ++)
+        {
+          PixelType minValue = neighbours[0][x];
+          for(SizeValueType k = 1; k < numberOfNeighbours; k ++)
+            minValue = std::min(minValue, neighbours[k][x]);
+          columnMinima[x] = minValue;
+        }
+
+      //The previous and next rows along axis i are the neighbours with digit i-1 at 0 and 2, the others at 1
+      const SizeValueType rowOffset = row*length;
+      const SizeValueType centre = (numberOfNeighbours - 1)/2;
+      const PixelType *base = neighbours[centre];
+      const PixelType *detail = ReadLayer(str->Detail, rowOffset, length, &detailRow[0]);
+      const PixelType *original = (detail) ? NULL : ReadLayer(str->Previous, rowOffset, length, &originalRow[0]); //image the level smoothed
+      PixelType *weights = str->Weights + rowOffset;
+      for(SizeValueType x = 0; x < length; x ++)
+        {
+          const SizeValueType previous = (x > 0) ? x - 1 : x;
+          const SizeValueType next = (x + 1 < length) ? x + 1 : x;
+
+          const float derivative = (base[next] - base[previous])*scales[0];
+          float gradient = derivative*derivative;
+          SizeValueType digitWeight = 1;
+          for(unsigned int i = 1; i < dimension; i ++)
+            {
+              const float difference = (neighbours[centre + digitWeight][x] - neighbours[centre - digitWeight][x])*scales[i];
+              gradient += difference*difference;
+              digitWeight *= 3;
+            }
+          exponents[x] = gradient;
+        }
+      itk::FastMath::Sqrt(&exponents[0], &exponents[0], length);
+
+      for(SizeValueType x = 0; x < length; x ++)
+        {
+          const SizeValueType previous = (x > 0) ? x - 1 : x;
+          const SizeValueType next = (x + 1 < length) ? x + 1 : x;
+          const PixelType minValue = std::min(std::min(columnMinima[previous], columnMinima[x]), columnMinima[next]);
+          const float C = exponents[x]/(minValue+epsilon); //penalise strong edges which the ideal bilateral would not have picked up
+          const float difference = (detail) ? detail[x] : original[x] - base[x];
+          magnitudes[x] = fabs(difference);
+          exponents[x] = magnitudes[x]-C;
+        }
+      itk::FastMath::Exp(&exponents[0], &exponents[0], length);
+      std::copy(exponents.begin(), exponents.end(), weights);
+      if(!detail) //compressed by the weight smoothing instead
+        continue;
+
+      itk::FastMath::Pow(&magnitudes[0], str->Lambda, &magnitudes[0], length); //reduce ratio between min max values
+      for(SizeValueType x = 0; x < length; x ++)
+        {
+          // Set the current detail pixel
+          magnitudes[x] = copysign(magnitudes[x], static_cast<float>(detail[x])); //copysign - Return x with the sign of y
+        }
+      WriteLayer(str->Detail, rowOffset, length, &magnitudes[0]);
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+ITK_THREAD_RETURN_TYPE
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ShapeDetailThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  const ShapeDetailThreadStruct *str = static_cast<const ShapeDetailThreadStruct *>(info->UserData);
+
+  ThreadedShapeDetailWeights(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ComputeRecursiveGaussianCoefficients(double sigma, WeightSmoothingThreadStruct *str)
+{
+  //Deriche, INRIA RR-1893, 1993: the causal half of the impulse response is
+  //sum_k (a_k cos(w_k n/sigma) + b_k sin(w_k n/sigma)) exp(-l_k n/sigma), with the constants of RecursiveGaussianImageFilter
+  const double a[2] = { 1.3530, -0.3531 };
+  const double b[2] = { 1.8151, 0.0902 };
+  const double w[2] = { 0.6681, 2.0787 };
+  const double l[2] = { 1.3932, 1.3732 };
+
+  //Its four poles are the two pairs exp((-l_k +- i w_k)/sigma), with residues (a_k -+ i b_k)/2
+  std::complex<double> poles[4], residues[4];
+  for(unsigned int k = 0; k < 2; k ++)
+    {
+      poles[2*k] = std::exp(std::complex<double>(-l[k], w[k])/sigma);
+      poles[2*k+1] = std::conj(poles[2*k]);
+      residues[2*k] = std::complex<double>(a[k], -b[k])/2.0;
+      residues[2*k+1] = std::conj(residues[2*k]);
+    }
+
+  //Denominator prod_k (1 - p_k z^-1) and numerator sum_k r_k prod_{j != k} (1 - p_j z^-1) of the causal half
+  std::complex<double> denominator[5] = { 1.0, 0.0, 0.0, 0.0, 0.0 };
+  std::complex<double> numerator[4] = { 0.0, 0.0, 0.0, 0.0 };
+  for(unsigned int k = 0; k < 4; k ++)
+    {
+      for(unsigned int i = k+1; i > 0; i --)
+        denominator[i] -= poles[k]*denominator[i-1];
+
+      std::complex<double> product[4] = { 1.0, 0.0, 0.0, 0.0 };
+      unsigned int degree = 0;
+      for(unsigned int j = 0; j < 4; j ++)
+        {
+          if(j == k)
+            continue;
+          degree ++;
+          for(unsigned int i = degree; i > 0; i --)
+            product[i] -= poles[j]*product[i-1];
+        }
+      for(unsigned int i = 0; i < 4; i ++)
+        numerator[i] += residues[k]*product[i];
+    }
+
+  //The anticausal half mirrors the causal one without its centre sample
+  double causalSum = 0.0, antiCausalSum = 0.0, feedbackSum = 1.0;
+  for(unsigned int i = 0; i < 4; i ++)
+    {
+      str->Feedback[i] = denominator[i+1].real();
+      str->Causal[i] = numerator[i].real();
+      feedbackSum += str->Feedback[i];
+    }
+  for(unsigned int i = 0; i < 4; i ++)
+    {
+      str->AntiCausal[i] = ((i < 3) ? str->Causal[i+1] : 0.0) - str->Feedback[i]*str->Causal[0];
+      causalSum += str->Causal[i];
+      antiCausalSum += str->AntiCausal[i];
+    }
+
+  //Unit gain, so that constant weights stay constant
+  const double gain = (causalSum + antiCausalSum)/feedbackSum;
+  for(unsigned int i = 0; i < 4; i ++)
+    {
+      str->Causal[i] /= gain;
+      str->AntiCausal[i] /= gain;
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+void
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::ThreadedSmoothWeights(const WeightSmoothingThreadStruct *str, ThreadIdType threadId, ThreadIdType numberOfThreads)
+{
+  //Work is split into blocks of up to blockLength neighbouring lines, whose pixels at the same position along the
+  //axis are contiguous, so the recursions advance the whole block one position at a time
+  const SizeValueType blockLength = 64;
+  const SizeValueType blocksPerGroup = (str->Stride + blockLength - 1)/blockLength;
+  const SizeValueType numberOfBlocks = str->Outer*blocksPerGroup;
+  const SizeValueType beginBlock = (numberOfBlocks*threadId)/numberOfThreads;
+  const SizeValueType endBlock = (numberOfBlocks*(threadId+1))/numberOfThreads;
+
+  const SizeValueType length = str->Length;
+  const SizeValueType stride = str->Stride;
+  const double *n = str->Causal;
+  const double *m = str->AntiCausal;
+  const double *d = str->Feedback;
+
+  //Outputs of a constant line of ones, which start the recursions as if the line went on past its ends
+  const double feedbackSum = 1.0 + d[0] + d[1] + d[2] + d[3];
+  const double causalGain = (n[0] + n[1] + n[2] + n[3])/feedbackSum;
+  const double antiCausalGain = (m[0] + m[1] + m[2] + m[3])/feedbackSum;
+
+  //Causal half of the block, then the last four inputs and outputs of each line as the recursions advance
+  const SizeValueType maxWidth = std::min(blockLength, stride);
+  std::vector<double> causal(length*maxWidth);
+  std::vector<double> state(8*maxWidth);
+  //Compressed detail of the positions of the block, when it is not stored, and the layers of the positions
+  //decoded when in 16 bits
+  const bool storedDetail = str->Detail.Full || str->Detail.Compact;
+  std::vector<float> compressed((str->Accumulator && !storedDetail) ? maxWidth : 0);
+  std::vector<PixelType> layerScratch((str->Accumulator) ? 3*maxWidth : 0);
+
+  for(SizeValueType block = beginBlock; block < endBlock; block ++)
+    {
+      const SizeValueType group = block/blocksPerGroup;
+      const SizeValueType first = (block%blocksPerGroup)*blockLength;
+      const SizeValueType width = std::min(blockLength, stride - first);
+      const SizeValueType base = group*length*stride + first;
+      double *x1 = &state[0], *x2 = x1 + width, *x3 = x2 + width, *x4 = x3 + width;
+      double *y1 = x4 + width, *y2 = y1 + width, *y3 = y2 + width, *y4 = y3 + width;
+
+      //Causal: y[n] = n0 x[n] + ... + n3 x[n-3] - d1 y[n-1] - ... - d4 y[n-4]
+      const PixelType *start = str->Weights + base;
+      for(SizeValueType j = 0; j < width; j ++)
+        {
+          x1[j] = x2[j] = x3[j] = start[j];
+          y1[j] = y2[j] = y3[j] = y4[j] = causalGain*start[j];
+        }
+      for(SizeValueType p = 0; p < length; p ++)
+        {
+          const PixelType *values = str->Weights + base + p*stride;
+          double *current = &causal[p*width];
+          for(SizeValueType j = 0; j < width; j ++)
+            {
+              const double value = values[j];
+              const double y = n[0]*value + n[1]*x1[j] + n[2]*x2[j] + n[3]*x3[j]
+                             - d[0]*y1[j] - d[1]*y2[j] - d[2]*y3[j] - d[3]*y4[j];
+              current[j] = y;
+              x3[j] = x2[j]; x2[j] = x1[j]; x1[j] = value;
+              y4[j] = y3[j]; y3[j] = y2[j]; y2[j] = y1[j]; y1[j] = y;
+            }
+        }
+
+      //Anticausal: y[n] = m1 x[n+1] + ... + m4 x[n+4] - d1 y[n+1] - ... - d4 y[n+4], added to the causal half.
+      //The weights are overwritten behind the recursion, so their inputs are kept in the state.
+      const PixelType *end = str->Weights + base + (length - 1)*stride;
+      for(SizeValueType j = 0; j < width; j ++)
+        {
+          x1[j] = x2[j] = x3[j] = x4[j] = end[j];
+          y1[j] = y2[j] = y3[j] = y4[j] = antiCausalGain*end[j];
+        }
+      for(SizeValueType p = length; p > 0; p --)
+        {
+          const SizeValueType offset = base + (p - 1)*stride;
+          PixelType *values = str->Weights + offset;
+          const double *current = &causal[(p - 1)*width];
+          if(str->Accumulator)
+            {
+              const PixelType *detail = ReadLayer(str->Detail, offset, width, &layerScratch[0]);
+              if(!detail)
+                {
+                  const PixelType *base = ReadLayer(str->Base, offset, width, &layerScratch[maxWidth]);
+                  const PixelType *previous = ReadLayer(str->Previous, offset, width, &layerScratch[2*maxWidth]);
+                  for(SizeValueType j = 0; j < width; j ++)
+                    compressed[j] = fabs(previous[j] - base[j]);
+                  itk::FastMath::Pow(&compressed[0], str->Lambda, &compressed[0], width); //reduce ratio between min max values
+                  for(SizeValueType j = 0; j < width; j ++)
+                    compressed[j] = copysign(compressed[j], static_cast<float>(previous[j] - base[j]));
+                }
+              PixelType *accumulator = str->Accumulator + offset;
+              for(SizeValueType j = 0; j < width; j ++)
+                {
+                  const double y = m[0]*x1[j] + m[1]*x2[j] + m[2]*x3[j] + m[3]*x4[j]
+                                 - d[0]*y1[j] - d[1]*y2[j] - d[2]*y3[j] - d[3]*y4[j];
+                  x4[j] = x3[j]; x3[j] = x2[j]; x2[j] = x1[j]; x1[j] = values[j];
+                  y4[j] = y3[j]; y3[j] = y2[j]; y2[j] = y1[j]; y1[j] = y;
+                  const PixelType value = (detail) ? detail[j] : static_cast<PixelType>(compressed[j]);
+                  const PixelType weighted = value*static_cast<PixelType>(current[j] + y);
+                  accumulator[j] = (str->Initialize) ? weighted : accumulator[j] + weighted;
+                }
+            }
+          else
+            {
+              for(SizeValueType j = 0; j < width; j ++)
+                {
+                  const double y = m[0]*x1[j] + m[1]*x2[j] + m[2]*x3[j] + m[3]*x4[j]
+                                 - d[0]*y1[j] - d[1]*y2[j] - d[2]*y3[j] - d[3]*y4[j];
+                  x4[j] = x3[j]; x3[j] = x2[j]; x2[j] = x1[j]; x1[j] = values[j];
+                  y4[j] = y3[j]; y3[j] = y2[j]; y2[j] = y1[j]; y1[j] = y;
+                  values[j] = static_cast<PixelType>(current[j] + y);
+                }
+            }
+        }
+    }
+}
+
+template< typename TInputImage, typename TOutputImage >
+ITK_THREAD_RETURN_TYPE
+HighDynamicRangeImageFilter< TInputImage, TOutputImage >
+::WeightSmoothingThreaderCallback(void *arg)
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>(arg);
+  const WeightSmoothingThreadStruct *str = static_cast<const WeightSmoothingThreadStruct *>(info->UserData);
+
+  ThreadedSmoothWeights(str, info->ThreadID, info->NumberOfThreads);
+
+  return ITK_THREAD_RETURN_VALUE;
 }
 
 template< typename TInputImage, typename TOutputImage >
@@ -426,6 +1507,8 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
   filter1->SetInput(logImage);
   filter1->SetRangeSigma(range);
   filter1->SetDomainSigma(domain);
+  filter1->SetQuality(m_Quality);
+  filter1->SetRangeAxis(m_AdaptiveRangeAxis ? FilterType::AdaptiveRangeAxis : FilterType::UniformRangeAxis);
   filter1->SetNumberOfThreads(this->GetNumberOfThreads());
   try
   {
@@ -449,31 +1532,40 @@ HighDynamicRangeImageFilter< TInputImage, TOutputImage >
   std::cout << "Min/Max in log image: " << minValue << "/" << maxValue << std::endl;
 
   double scale = contrast / static_cast<double>(maxValue - minValue);
-  const double normFactor = 1.0/exp(maxValue*scale);
+  const double normExponent = -maxValue*scale; //rescale to 0-1 range in the exponent
   std::cout << "Applying Scaling in Log Domain of " << scale << std::endl;
 
   //Apply scaling in log domain
-  typename TOutputImage::Pointer scaledImage = milx::Image<TOutputImage>::BlankImage(0.0, region.GetSize());
-  m_DetailImage = milx::Image<TOutputImage>::MatchInformation(scaledImage, image); //ensure images in same space
+  m_DetailImage = this->LeaseImage(image, region); //ensure images in same space
   itk::ImageRegionConstIterator<TOutputImage> logIterator(logImage, region);
   itk::ImageRegionConstIterator<TOutputImage> baseIterator(m_BaseImage, region);
   itk::ImageRegionIterator<TOutputImage> detailIterator(m_DetailImage, region);
   itk::ImageRegionIterator<TOutputImage> outputIterator(this->GetOutput(), region);
+  //Exponentials are taken a block of pixels at a time with the vectorised exp
+  const SizeValueType blockSize = 4096;
+  std::vector<float> exponents(blockSize);
   while(!logIterator.IsAtEnd())
-  { 
-    //Create detail layer
-    double detailValue = logIterator.Get() - baseIterator.Get(); //division in real space
-    detailIterator.Set(detailValue);
-    //compose HDR tone mapped image
-    double expValue = exp(baseIterator.Get()*scale + detailValue); //multiply in real space
-    //rescale to 0-1 range
-    double toneMapValue = expValue*normFactor;
-    outputIterator.Set(toneMapValue);
-
-    ++logIterator;
-    ++baseIterator;
-    ++detailIterator;
-    ++outputIterator;
+  {
+    SizeValueType count = 0;
+    for(; count < blockSize && !logIterator.IsAtEnd(); count ++)
+    {
+      //Create detail layer
+      double detailValue = logIterator.Get() - baseIterator.Get(); //division in real space
+      detailIterator.Set(detailValue);
+      //compose HDR tone mapped image, multiply in real space
+      exponents[count] = baseIterator.Get()*scale + detailValue + normExponent;
+
+      ++logIterator;
+      ++baseIterator;
+      ++detailIterator;
+    }
+    itk::FastMath::Exp(&exponents[0], &exponents[0], count);
+
+    for(SizeValueType k = 0; k < count; k ++)
+    {
+      outputIterator.Set(exponents[k]);
+      ++outputIterator;
+    }
   }
 }
 
@@ -43,6 +43,7 @@ protected:
     QLineEdit *txtSigmaSpatial;
     QLineEdit *txtBeta;
     QLineEdit *txtLambda;
+    QLineEdit *txtQuality;
     QLineEdit *txtThreads;
     QCheckBox *chkVerbose;
     QCheckBox *chkAdvanced;
@@ -83,6 +83,7 @@ void milxQtHDRMain::showAdvancedOptions(int state)
       txtSigmaRange->setDisabled(true);
       txtSigmaSpatial->setDisabled(true);
       txtLambda->setDisabled(true);
+      txtQuality->setDisabled(true);
       txtThreads->setDisabled(true);
   }
   else
@@ -91,6 +92,7 @@ void milxQtHDRMain::showAdvancedOptions(int state)
       txtSigmaRange->setDisabled(false);
       txtSigmaSpatial->setDisabled(false);
       txtLambda->setDisabled(false);
+      txtQuality->setDisabled(false);
       txtThreads->setDisabled(false);
   }
 }
@@ -145,11 +147,13 @@ void milxQtHDRMain::hdr()
     const float domain = txtSigmaSpatial->text().toFloat();
     const float beta = txtBeta->text().toFloat();
     const float lambda = txtLambda->text().toFloat();
+    const float quality = txtQuality->text().toFloat();
     const float weight = 1.0;
 
     printInfo("Using levels: " + QString::number(levels));
     printInfo("Using range and domain sigma as: " + QString::number(range) + ", " + QString::number(domain));
     printInfo("Using beta and lambda values as: " + QString::number(beta) + ", " + QString::number(lambda));
+    printInfo("Using smoothing quality: " + QString::number(quality));
 
     ///Setup ITK Threads
     itk::MultiThreader::SetGlobalDefaultNumberOfThreads(threads);
@@ -161,10 +165,12 @@ void milxQtHDRMain::hdr()
         hdrImage->SetLambda(lambda);
         hdrImage->SetSigmaRange(range);
         hdrImage->SetSigmaDomain(domain);
+        hdrImage->SetQuality(quality);
         hdrImage->SumsOfSquaresOn();
         hdrImage->AverageOn();
         //hdrImage->BiasFieldOn();
         hdrImage->MultiLightModeOn();
+        hdrImage->SetRetention(itk::RetainFinalLayers); //only the base and detail layers are displayed
         hdrImage->SetNumberOfThreads(threads);
         hdrImage->AddObserver(itk::ProgressEvent(), milx::ProgressUpdates);
 
@@ -309,6 +315,9 @@ void milxQtHDRMain::createWizard()
   txtLambda = new QLineEdit;
   txtLambda->setText("0.8");
   txtLambda->setValidator( new QDoubleValidator(0, 1.0, 3, this) );
+  txtQuality = new QLineEdit;
+  txtQuality->setText("1.0");
+  txtQuality->setValidator( new QDoubleValidator(0.001, 1.0, 3, this) );
   txtThreads = new QLineEdit;
   txtThreads->setText(QString::number(milx::NumberOfProcessors()/2));
   txtThreads->setValidator( new QIntValidator(1, milx::NumberOfProcessors(), this) );
@@ -319,6 +328,7 @@ void milxQtHDRMain::createWizard()
   paraAdvFormLayout->addRow(tr("&Sigma Range/Color:"), txtSigmaRange);
   paraAdvFormLayout->addRow(tr("&Sigma Spatial:"), txtSigmaSpatial);
   paraAdvFormLayout->addRow(tr("&Lambda:"), txtLambda);
+  paraAdvFormLayout->addRow(tr("&Quality (0.0-1.0):"), txtQuality);
   paraAdvFormLayout->addRow(tr("&Threads:"), txtThreads);
   paraFormLayout->addRow(tr("&Beta:"), txtBeta);
   paraFormLayout->addRow(tr("HDR Image Only"), chkVerbose);
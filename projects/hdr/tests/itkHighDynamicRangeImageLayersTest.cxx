@@ -0,0 +1,347 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkHighDynamicRangeImageFilter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+typedef float                          PixelType;
+typedef itk::Image< PixelType, 3 >     ImageType;
+typedef itk::HighDynamicRangeImageFilter<ImageType, ImageType> HDRFilterType;
+
+/** The same scene, smooth shading with a bright half along the first axis, lit from a different side in each
+ *  image, plus normal noise, all scaled by the given factor */
+std::vector<ImageType::Pointer> CreateInputs(unsigned int size, unsigned int count, double scale = 1.0)
+{
+  ImageType::SizeType imageSize;
+  imageSize.Fill(size);
+  ImageType::RegionType region(imageSize);
+
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->Initialize(76);
+
+  std::vector<ImageType::Pointer> images;
+  for(unsigned int j = 0; j < count; j ++)
+    {
+    ImageType::Pointer image = ImageType::New();
+    image->SetRegions(region);
+    image->Allocate();
+
+    itk::ImageRegionIteratorWithIndex<ImageType> iter(image, region);
+    for (iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+      {
+      const ImageType::IndexType index = iter.GetIndex();
+      double value = 100.0 + 40.0*std::sin(0.3*index[1])*std::cos(0.2*index[2]);
+      if (index[0] >= static_cast<long>(size/2))
+        value += 150.0;
+      const double light = 0.5 + static_cast<double>(index[j%3])/size;
+      value = value*light + 5.0*generator->GetNormalVariate();
+      iter.Set(static_cast<PixelType>(scale*value));
+      }
+    images.push_back(image);
+    }
+
+  return images;
+}
+
+/** Options of an update of the filter, the defaults of the filter unless changed */
+struct Configuration
+{
+  Configuration() : StreamingSynthesis(false), BatchedSmoothing(true), StoreDetailLayers(true), Retention(itk::RetainAll),
+                    LayerPrecision(itk::SinglePrecision) {}
+
+  bool StreamingSynthesis;
+  bool BatchedSmoothing;
+  bool StoreDetailLayers;
+  itk::HDRRetention Retention;
+  itk::HDRPrecision LayerPrecision;
+};
+
+/** MSDE of the inputs with the options */
+HDRFilterType::Pointer Enhance(const std::vector<ImageType::Pointer> &inputs, const Configuration &configuration, float range = 20.0)
+{
+  HDRFilterType::Pointer hdrImage = HDRFilterType::New();
+    hdrImage->MultiLightModeOn();
+    hdrImage->SetSigmaRange(range);
+    hdrImage->SetSigmaDomain(2.0);
+    hdrImage->SetLevels(3);
+    hdrImage->SumsOfSquaresOn();
+    hdrImage->SetStreamingSynthesis(configuration.StreamingSynthesis);
+    hdrImage->SetBatchedSmoothing(configuration.BatchedSmoothing);
+    hdrImage->SetStoreDetailLayers(configuration.StoreDetailLayers);
+    hdrImage->SetRetention(configuration.Retention);
+    hdrImage->SetLayerPrecision(configuration.LayerPrecision);
+  for(size_t j = 0; j < inputs.size(); j ++)
+    hdrImage->AddInput(inputs[j]);
+  hdrImage->Update();
+  return hdrImage;
+}
+
+/** Maximum absolute and root mean square difference of two images */
+void Difference(const ImageType *a, const ImageType *b, double &maxAbs, double &rms)
+{
+  const ImageType::RegionType region = a->GetLargestPossibleRegion();
+  itk::ImageRegionConstIterator<ImageType> iterA(a, region);
+  itk::ImageRegionConstIterator<ImageType> iterB(b, region);
+  double squares = 0.0;
+  maxAbs = 0.0;
+  for (; !iterA.IsAtEnd(); ++iterA, ++iterB)
+    {
+    const double difference = static_cast<double>(iterA.Get()) - iterB.Get();
+    squares += difference*difference;
+    maxAbs = std::max(maxAbs, std::fabs(difference));
+    }
+  rms = std::sqrt(squares/region.GetNumberOfPixels());
+}
+
+/** Largest absolute value of an image */
+double Peak(const ImageType *image)
+{
+  itk::ImageRegionConstIterator<ImageType> iter(image, image->GetLargestPossibleRegion());
+  double peak = 0.0;
+  for (; !iter.IsAtEnd(); ++iter)
+    peak = std::max(peak, std::fabs(static_cast<double>(iter.Get())));
+  return peak;
+}
+
+/** Compare an image to the reference, their maximum and rms differences may reach the tolerances at most */
+bool Compare(const std::string &name, const ImageType *image, const ImageType *reference, double tolerance, double rmsTolerance)
+{
+  double maxAbs = 0.0, rms = 0.0;
+  Difference(image, reference, maxAbs, rms);
+  std::cout << name << ": max difference " << maxAbs << ", rms " << rms << " (tolerances " << tolerance << ", " << rmsTolerance << ")" << std::endl;
+  if(!(maxAbs <= tolerance && rms <= rmsTolerance)) //NaN fails too
+    {
+    std::cerr << name << " differs from the default configuration" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+/** Compare an image to the reference, they may differ by the tolerance at most */
+bool Compare(const std::string &name, const ImageType *image, const ImageType *reference, double tolerance)
+{
+  return Compare(name, image, reference, tolerance, tolerance);
+}
+
+/** Compare the HDR image, its base and detail layers and the sums of squares of an update to the reference */
+bool CompareLayers(const std::string &name, HDRFilterType *hdrImage, HDRFilterType *reference, double tolerance)
+{
+  bool passed = Compare(name + " HDR image", hdrImage->GetOutput(), reference->GetOutput(), tolerance*Peak(reference->GetOutput()));
+  passed &= Compare(name + " base", hdrImage->GetBaseImage(), reference->GetBaseImage(), tolerance*Peak(reference->GetBaseImage()));
+  passed &= Compare(name + " detail", hdrImage->GetDetailImage(), reference->GetDetailImage(), tolerance*Peak(reference->GetDetailImage()));
+  passed &= Compare(name + " sums of squares", hdrImage->GetSumsOfSquaresImage(), reference->GetSumsOfSquaresImage(),
+                    tolerance*Peak(reference->GetSumsOfSquaresImage()));
+  return passed;
+}
+
+/** Intermediates handed out by the getters and the retention they need */
+struct Intermediate
+{
+  const char *Name;
+  itk::HDRRetention Retention;
+  bool PerInput;
+};
+const Intermediate intermediates[] = {
+  { "base image", itk::RetainFinalLayers, false },
+  { "detail image", itk::RetainFinalLayers, false },
+  { "MSDE base of an input", itk::RetainInputLayers, true },
+  { "MSDE detail of an input", itk::RetainInputLayers, true },
+  { "MLIC", itk::RetainAll, false },
+  { "MLIC details", itk::RetainAll, false },
+  { "MLIC of an input", itk::RetainAll, true },
+  { "MLIC details of an input", itk::RetainAll, true }
+};
+const size_t numberOfIntermediates = sizeof(intermediates)/sizeof(Intermediate);
+
+/** Get the intermediate of the given index of intermediates[], of the input of the given index for those
+ *  kept per input, false if the getter throws */
+bool GetIntermediate(HDRFilterType *hdrImage, size_t intermediate, int input = 0)
+{
+  try
+    {
+    switch(intermediate)
+      {
+      case 0:
+        hdrImage->GetBaseImage();
+        break;
+      case 1:
+        hdrImage->GetDetailImage();
+        break;
+      case 2:
+        hdrImage->GetLevelBaseImage(input);
+        break;
+      case 3:
+        hdrImage->GetLevelDetailImage(input);
+        break;
+      case 4:
+        hdrImage->GetMultiLightResults();
+        break;
+      case 5:
+        hdrImage->GetMultiLightDetails();
+        break;
+      case 6:
+        hdrImage->GetInputMultiLightResults(input);
+        break;
+      default:
+        hdrImage->GetInputMultiLightDetails(input);
+      }
+    }
+  catch (itk::ExceptionObject&)
+    {
+    return false;
+    }
+  return true;
+}
+
+/**
+ * The options that trade memory for time must not change the HDR image.
+ * Streaming synthesis adds the same layers to the sums in the same order as
+ * the synthesis of all inputs at once, so it must match the unbatched
+ * default bit for bit. It smooths each input on its own, so it may differ
+ * from the batched default by float rounding only. Detail layers computed
+ * on demand are the same float differences of the same levels, compressed
+ * by the same functions, so they must match the default bit for bit.
+ * Every retention synthesizes the same sums in the same order, so the HDR
+ * image and the layers it keeps must match the default bit for bit, and
+ * the getters of the intermediates it released must throw, as must those
+ * kept per input for an input that does not exist. The MLIC of an input
+ * smoothed on its own is empty. Below RetainAll
+ * the buffer pool must be empty after the update. Layers stored in 16 bits
+ * are rounded, and the exponential weights of the MSDE amplify the rounding,
+ * so the HDR image may differ from the float default within tolerances of
+ * its peak, looser for bfloat16 and for details computed from two rounded
+ * levels. They are checked on the scene at a tenth of its intensities, where
+ * the weights stay moderate.
+ */
+int main(int argc, char* argv[])
+{
+  bool passed = true;
+  try
+    {
+    const std::vector<ImageType::Pointer> inputs = CreateInputs(24, 3);
+
+    const Configuration defaults;
+    HDRFilterType::Pointer reference = Enhance(inputs, defaults);
+    Configuration unbatched;
+    unbatched.BatchedSmoothing = false;
+    HDRFilterType::Pointer unbatchedReference = Enhance(inputs, unbatched);
+    //An input smoothed on its own has no MLIC of the joint or batched smoothing
+    if(!unbatchedReference->GetInputMultiLightResults(0).empty() || !unbatchedReference->GetInputMultiLightDetails(0).empty())
+      {
+      std::cerr << "Unbatched: the MLIC of an input smoothed on its own is not empty" << std::endl;
+      passed = false;
+      }
+
+    Configuration streaming;
+    streaming.StreamingSynthesis = true;
+    HDRFilterType::Pointer streamed = Enhance(inputs, streaming);
+    passed &= CompareLayers("Streaming", streamed, reference, 1e-5);
+    passed &= CompareLayers("Streaming unbatched", streamed, unbatchedReference, 0.0);
+
+    Configuration lazy;
+    lazy.StoreDetailLayers = false;
+    passed &= CompareLayers("Lazy details", Enhance(inputs, lazy), reference, 0.0);
+
+    const itk::HDRRetention retentions[4] = { itk::RetainNothing, itk::RetainFinalLayers, itk::RetainInputLayers, itk::RetainAll };
+    const char *retentionNames[4] = { "RetainNothing", "RetainFinalLayers", "RetainInputLayers", "RetainAll" };
+    for(int r = 0; r < 4; r ++)
+      {
+      Configuration retained;
+      retained.Retention = retentions[r];
+      HDRFilterType::Pointer hdrImage = Enhance(inputs, retained);
+      const std::string name = retentionNames[r];
+
+      passed &= Compare(name + " HDR image", hdrImage->GetOutput(), reference->GetOutput(), 0.0);
+      passed &= Compare(name + " sums of squares", hdrImage->GetSumsOfSquaresImage(), reference->GetSumsOfSquaresImage(), 0.0);
+      if(retentions[r] >= itk::RetainFinalLayers)
+        {
+        passed &= Compare(name + " base", hdrImage->GetBaseImage(), reference->GetBaseImage(), 0.0);
+        passed &= Compare(name + " detail", hdrImage->GetDetailImage(), reference->GetDetailImage(), 0.0);
+        }
+      if(retentions[r] >= itk::RetainInputLayers)
+        for(int j = 0; j < static_cast<int>(inputs.size()); j ++)
+          {
+          passed &= Compare(name + " MSDE base of input", hdrImage->GetLevelBaseImage(j), reference->GetLevelBaseImage(j), 0.0);
+          passed &= Compare(name + " MSDE detail of input", hdrImage->GetLevelDetailImage(j), reference->GetLevelDetailImage(j), 0.0);
+          }
+
+      for(size_t k = 0; k < numberOfIntermediates; k ++)
+        {
+        const bool expected = (retentions[r] >= intermediates[k].Retention);
+        if(GetIntermediate(hdrImage, k) != expected)
+          {
+          std::cerr << name << ": the getter of the " << intermediates[k].Name << (expected ? " throws" : " does not throw") << std::endl;
+          passed = false;
+          }
+        const int missingInputs[2] = { -1, static_cast<int>(inputs.size()) };
+        for(int m = 0; m < 2 && intermediates[k].PerInput; m ++)
+          if(GetIntermediate(hdrImage, k, missingInputs[m]))
+            {
+            std::cerr << name << ": the getter of the " << intermediates[k].Name << " does not throw for input " << missingInputs[m] << std::endl;
+            passed = false;
+            }
+        }
+
+      const itk::SizeValueType pooled = hdrImage->GetBufferPool()->GetNumberOfBuffers();
+      std::cout << name << ": " << pooled << " buffers pooled after the update" << std::endl;
+      if(retentions[r] < itk::RetainAll && pooled > 0)
+        {
+        std::cerr << name << ": the buffer pool still holds " << pooled << " buffers after the update" << std::endl;
+        passed = false;
+        }
+      }
+
+    //Tolerances relative to the peak of the HDR image, of the maximum then the rms difference, with the
+    //detail layers stored then computed on demand
+    const std::vector<ImageType::Pointer> scaledInputs = CreateInputs(24, 3, 0.1);
+    HDRFilterType::Pointer singleReference = Enhance(scaledInputs, defaults, 2.0);
+    const double peak = Peak(singleReference->GetOutput());
+    const itk::HDRPrecision precisions[2] = { itk::HalfPrecision, itk::BFloat16Precision };
+    const char *precisionNames[2] = { "HalfPrecision", "BFloat16Precision" };
+    const double maxTolerances[2][2] = { { 3e-4, 3e-3 }, { 2e-3, 2e-2 } };
+    const double rmsTolerances[2][2] = { { 3e-5, 3e-4 }, { 2e-4, 2e-3 } };
+    for(int p = 0; p < 2; p ++)
+      for(int lazyDetails = 0; lazyDetails < 2; lazyDetails ++)
+        {
+        Configuration compact;
+        compact.LayerPrecision = precisions[p];
+        compact.StoreDetailLayers = (lazyDetails == 0);
+        const std::string name = std::string(precisionNames[p]) + (lazyDetails ? " lazy details" : "");
+        passed &= Compare(name + " HDR image", Enhance(scaledInputs, compact, 2.0)->GetOutput(), singleReference->GetOutput(),
+                          maxTolerances[p][lazyDetails]*peak, rmsTolerances[p][lazyDetails]*peak);
+        }
+    }
+  catch (itk::ExceptionObject& e)
+    {
+    std::cerr << "Exception detected: "  << e.GetDescription();
+    return EXIT_FAILURE;
+    }
+
+  std::cout << "Complete" << std::endl;
+  if(!passed)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
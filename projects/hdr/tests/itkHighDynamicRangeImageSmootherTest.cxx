@@ -0,0 +1,219 @@
+/*=========================================================================
+ *
+ *  Copyright Insight Software Consortium
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0.txt
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *=========================================================================*/
+
+#include "itkFastBilateralImageFilter.h"
+#include "itkHighDynamicRangeImageFilter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+typedef float                          PixelType;
+typedef itk::Image< PixelType, 3 >     ImageType;
+typedef itk::HighDynamicRangeImageFilter<ImageType, ImageType> HDRFilterType;
+
+/** Smooth shading with a bright half along the first axis plus normal noise */
+ImageType::Pointer CreateImage(unsigned int size)
+{
+  ImageType::SizeType imageSize;
+  imageSize.Fill(size);
+  ImageType::RegionType region(imageSize);
+
+  ImageType::Pointer image = ImageType::New();
+  image->SetRegions(region);
+  image->Allocate();
+
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->Initialize(76);
+
+  itk::ImageRegionIteratorWithIndex<ImageType> iter(image, region);
+  for (iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    const ImageType::IndexType index = iter.GetIndex();
+    double value = 100.0 + 40.0*std::sin(0.3*index[1])*std::cos(0.2*index[2]);
+    if (index[0] >= static_cast<long>(size/2))
+      value += 150.0;
+    value += 5.0*generator->GetNormalVariate();
+    iter.Set(static_cast<PixelType>(value));
+    }
+
+  return image;
+}
+
+/** Maximum absolute difference of two images */
+double MaximumDifference(const ImageType *a, const ImageType *b)
+{
+  const ImageType::RegionType region = a->GetLargestPossibleRegion();
+  itk::ImageRegionConstIterator<ImageType> iterA(a, region);
+  itk::ImageRegionConstIterator<ImageType> iterB(b, region);
+  double maxAbs = 0.0;
+  for (; !iterA.IsAtEnd(); ++iterA, ++iterB)
+    maxAbs = std::max(maxAbs, std::fabs(static_cast<double>(iterA.Get()) - iterB.Get()));
+  return maxAbs;
+}
+
+/** MLIC as computed before the smoother could be chosen, one fast bilateral filter per level */
+void CreateReferenceCollection(ImageType::Pointer image, float range, float domain, int levels,
+                               std::vector<ImageType::Pointer> &results, std::vector<ImageType::Pointer> &diffs)
+{
+  ImageType::Pointer currentImage = image;
+  for(size_t level = 0; level < levels; level ++)
+    {
+    size_t factor = 1 << level;
+
+    size_t spatialFactor = 1;
+    if(level > 1)
+      spatialFactor = 1 << (level-1);
+    else if(level == 1)
+      spatialFactor = sqrt(3);
+
+    typedef itk::FastBilateralImageFilter<ImageType, ImageType> FilterType;
+    FilterType::Pointer filter = FilterType::New();
+      filter->SetInput(currentImage);
+      filter->SetRangeSigma(range/factor);
+      filter->SetDomainSigma(spatialFactor*domain);
+      filter->Update();
+    ImageType::Pointer result = filter->GetOutput();
+
+    ImageType::Pointer diff = ImageType::New();
+      diff->CopyInformation(result);
+      diff->SetRegions(result->GetBufferedRegion());
+      diff->Allocate();
+    const PixelType *current = currentImage->GetBufferPointer();
+    const PixelType *smoothed = result->GetBufferPointer();
+    PixelType *difference = diff->GetBufferPointer();
+    for(size_t k = 0; k < result->GetBufferedRegion().GetNumberOfPixels(); k ++)
+      difference[k] = current[k] - smoothed[k];
+
+    results.push_back(result);
+    diffs.push_back(diff);
+    currentImage = result;
+    }
+}
+
+/** Details of a MLIC after the MSDE of an update, which compresses them in place to sign(d)|d|^lambda */
+std::vector<ImageType::Pointer> CompressDetails(const std::vector<ImageType::Pointer> &diffs, float lambdaValue)
+{
+  const float lambdaValues[3] = { lambdaValue, lambdaValue + 0.05f, lambdaValue + 0.15f };
+  std::vector<ImageType::Pointer> compressed;
+  for(size_t level = 0; level < diffs.size(); level ++)
+    {
+    const float lambda = (diffs.size() == 3) ? lambdaValues[level] : lambdaValue;
+
+    ImageType::Pointer detail = ImageType::New();
+      detail->CopyInformation(diffs[level]);
+      detail->SetRegions(diffs[level]->GetBufferedRegion());
+      detail->Allocate();
+    const PixelType *diff = diffs[level]->GetBufferPointer();
+    PixelType *values = detail->GetBufferPointer();
+    for(size_t k = 0; k < detail->GetBufferedRegion().GetNumberOfPixels(); k ++)
+      values[k] = copysign(std::pow(std::fabs(diff[k]), lambda), diff[k]);
+
+    compressed.push_back(detail);
+    }
+  return compressed;
+}
+
+/**
+ * Compare the levels and details of a MLIC to the reference, the levels must
+ * be identical and the details within the tolerance
+ */
+bool CompareCollections(const char *name, const std::vector<ImageType::Pointer> &results, const std::vector<ImageType::Pointer> &diffs,
+                        const std::vector<ImageType::Pointer> &referenceResults, const std::vector<ImageType::Pointer> &referenceDiffs,
+                        double detailTolerance = 0.0)
+{
+  if(results.size() != referenceResults.size() || diffs.size() != referenceDiffs.size())
+    {
+    std::cerr << name << ": " << results.size() << " levels and " << diffs.size() << " details instead of " << referenceResults.size() << std::endl;
+    return false;
+    }
+
+  bool passed = true;
+  for(size_t level = 0; level < results.size(); level ++)
+    {
+    const double resultError = MaximumDifference(results[level], referenceResults[level]);
+    const double diffError = MaximumDifference(diffs[level], referenceDiffs[level]);
+    std::cout << name << " level " << level << ": max difference " << resultError << ", of detail " << diffError << std::endl;
+    if(resultError > 0.0 || diffError > detailTolerance)
+      {
+      std::cerr << name << " level " << level << " differs from the fast bilateral MLIC" << std::endl;
+      passed = false;
+      }
+    }
+  return passed;
+}
+
+/**
+ * The default smoother of the HDR filter must be the fast bilateral filter,
+ * so that the MLIC of a default filter is that of one fast bilateral filter
+ * per level, bit for bit, whether created directly or by an update. The
+ * details of an update are those of the filters compressed by its MSDE.
+ */
+int main(int argc, char* argv[])
+{
+  const float range = 20.0;
+  const float domain = 2.0;
+  const int levels = 3;
+
+  bool passed = true;
+  try
+    {
+    ImageType::Pointer image = CreateImage(24);
+
+    std::vector<ImageType::Pointer> referenceResults, referenceDiffs;
+    CreateReferenceCollection(image, range, domain, levels, referenceResults, referenceDiffs);
+
+    HDRFilterType::Pointer hdrImage = HDRFilterType::New();
+    if(hdrImage->GetSmoother() != itk::FastBilateralSmoother)
+      {
+      std::cerr << "Default smoother is " << hdrImage->GetSmoother() << " instead of the fast bilateral smoother" << std::endl;
+      passed = false;
+      }
+
+    hdrImage->CreateMultiLightImageCollection(image, range, domain, levels);
+    passed &= CompareCollections("Collection", hdrImage->GetMultiLightResults(), hdrImage->GetMultiLightDetails(),
+                                 referenceResults, referenceDiffs);
+
+    HDRFilterType::Pointer hdrUpdate = HDRFilterType::New();
+      hdrUpdate->MultiLightModeOn();
+      hdrUpdate->SetSigmaRange(range);
+      hdrUpdate->SetSigmaDomain(domain);
+      hdrUpdate->SetLevels(levels);
+      hdrUpdate->AddInput(image);
+      hdrUpdate->Update();
+    //The MSDE of the update compresses the details with the fast power, a few ulp from std::pow
+    passed &= CompareCollections("Update", hdrUpdate->GetInputMultiLightResults(0), hdrUpdate->GetInputMultiLightDetails(0),
+                                 referenceResults, CompressDetails(referenceDiffs, hdrUpdate->GetLambda()), 1e-3);
+    }
+  catch (itk::ExceptionObject& e)
+    {
+    std::cerr << "Exception detected: "  << e.GetDescription();
+    return EXIT_FAILURE;
+    }
+
+  std::cout << "Complete" << std::endl;
+  if(!passed)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+#include <fstream>
+#include "itkBoxMinimumImageFilter.h"
+#include "itkMinimumImageFunction.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+
+/**
+ * Box minimum of an image by the running minimum filter, checked voxel by
+ * voxel against the MinimumImageFunction it replaces.
+ */
+int main(int ac, char* av[] )
+{
+  if(ac < 3)
+    {
+    std::cerr << "Usage: " << av[0] << " InputImage OutputImage [Radius]\n";
+    return EXIT_FAILURE;
+    }
+
+  unsigned int radius = 1;
+  if(ac > 3)
+    radius = atoi(av[3]);
+
+  typedef float PixelType;
+  typedef itk::Image<PixelType, 3> myImage;
+  itk::ImageFileReader<myImage>::Pointer input 
+    = itk::ImageFileReader<myImage>::New();
+  input->SetFileName(av[1]);
+
+  // Create a filter
+  typedef itk::BoxMinimumImageFilter<myImage,myImage> FilterType;
+
+  FilterType::Pointer filter1 = FilterType::New();
+    filter1->SetInput(input->GetOutput());
+    filter1->SetRadius(radius);
+  try
+    {
+    input->Update();
+    myImage::RegionType region = input->GetOutput()->GetLargestPossibleRegion();
+    std::cout << "Size of image read: " << region.GetSize()[0] << ", " << region.GetSize()[1] << ", " << region.GetSize()[2] << std::endl;
+
+    std::cout << "Computing minimum with radius " << radius << " ..." << std::endl;
+    filter1->Update();
+    }
+  catch (itk::ExceptionObject& e)
+    {
+    std::cerr << "Exception detected: "  << e.GetDescription();
+    return EXIT_FAILURE;
+    }
+
+  // Compare with the image function
+  typedef itk::MinimumImageFunction<myImage> FunctionType;
+  FunctionType::Pointer minImageFunction = FunctionType::New();
+    minImageFunction->SetInputImage(input->GetOutput());
+    minImageFunction->SetNeighborhoodRadius(radius);
+
+  size_t mismatches = 0;
+  itk::ImageRegionConstIteratorWithIndex<myImage> iter(filter1->GetOutput(), filter1->GetOutput()->GetLargestPossibleRegion());
+  for(iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    if(iter.Get() != static_cast<PixelType>(minImageFunction->EvaluateAtIndex(iter.GetIndex())))
+      mismatches ++;
+    }
+  std::cout << "Voxels differing from MinimumImageFunction: " << mismatches << std::endl;
+
+  // Generate test image
+  itk::ImageFileWriter<myImage>::Pointer writer;
+    writer = itk::ImageFileWriter<myImage>::New();
+    writer->SetInput( filter1->GetOutput() );
+    writer->SetFileName( av[2] );
+    writer->Update();
+  std::cout << "Complete" << std::endl;
+
+  if(mismatches > 0)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+#include <fstream>
+#include <algorithm>
+#include "itkDomainTransformImageFilter.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+
+typedef float PixelType;
+typedef itk::Image<PixelType, 3> myImage;
+typedef itk::DomainTransformImageFilter<myImage,myImage> FilterType;
+
+/** Cube of the size at a level with a step of the given height along the
+ *  first axis at its middle. */
+myImage::Pointer CreateStepImage(unsigned int size, double level, double step)
+{
+  myImage::SizeType imageSize;
+  imageSize.Fill(size);
+  myImage::RegionType region(imageSize);
+
+  myImage::Pointer image = myImage::New();
+  image->SetRegions(region);
+  image->Allocate();
+
+  itk::ImageRegionIteratorWithIndex<myImage> iter(image, region);
+  for (iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    const bool upper = iter.GetIndex()[0] >= static_cast<long>(size/2);
+    iter.Set(static_cast<PixelType>(upper ? level + step : level));
+    }
+
+  return image;
+}
+
+myImage::Pointer Filter(myImage *input, double range, double domain)
+{
+  FilterType::Pointer filter = FilterType::New();
+  filter->SetInput(input);
+  filter->SetRangeSigma(range);
+  filter->SetDomainSigma(domain);
+  filter->Update();
+  return filter->GetOutput();
+}
+
+/** Maximum absolute difference of two images */
+double MaximumDifference(myImage *a, myImage *b)
+{
+  const myImage::RegionType region = a->GetLargestPossibleRegion();
+  itk::ImageRegionConstIterator<myImage> iterA(a, region);
+  itk::ImageRegionConstIterator<myImage> iterB(b, region);
+  double maxAbs = 0.0;
+  for (; !iterA.IsAtEnd(); ++iterA, ++iterB)
+    maxAbs = std::max(maxAbs, vcl_abs(static_cast<double>(iterA.Get()) - iterB.Get()));
+  return maxAbs;
+}
+
+/**
+ * Edge preserving smoothing with the domain transform recursive filter,
+ * in the style of the itkFastBilateralImageFilterTest.
+ * A constant image must be preserved, a step must not be blurred across
+ * when the range sigma is small, and with a huge range sigma an impulse
+ * must spread into a Gaussian like blob of the domain sigma: its mass kept,
+ * its variance along each axis near sigma^2 and its profile decreasing.
+ * With an image given the filtered image is written.
+ */
+int main(int ac, char* av[] )
+{
+  if(ac != 1 && ac < 5)
+    {
+    std::cerr << "Usage: " << av[0] << " [InputImage sigmaRange sigmaDomain OutputImage [Iterations]]\n";
+    return -1;
+    }
+
+  bool passed = true;
+  try
+    {
+    // Every distance is 1 and the recursive filters have unit gain
+    myImage::Pointer constant = CreateStepImage(24, 100.0, 0.0);
+    const double constantError = MaximumDifference(Filter(constant, 10.0, 3.0), constant);
+    std::cout << "Constant: max difference " << constantError << std::endl;
+    if (constantError > 1e-3*100.0)
+      {
+      std::cerr << "Constant image not preserved" << std::endl;
+      passed = false;
+      }
+
+    // The distance across a step of 20 range sigmas is 61 times the domain
+    // sigma, so a^dt vanishes there
+    myImage::Pointer step = CreateStepImage(24, 100.0, 200.0);
+    const double stepError = MaximumDifference(Filter(step, 10.0, 3.0), step);
+    std::cout << "Step: max difference " << stepError << std::endl;
+    if (stepError > 0.01*200.0)
+      {
+      std::cerr << "Step edge blurred" << std::endl;
+      passed = false;
+      }
+
+    // Without edges the iterations add up to a variance of sigma^2, the
+    // discrete recursive filters fall a little short of it
+    const unsigned int size = 41;
+    const double sigma = 3.0;
+    const double mass = 1000.0;
+    myImage::Pointer impulse = CreateStepImage(size, 0.0, 0.0);
+    myImage::IndexType centre;
+    centre.Fill(size/2);
+    impulse->SetPixel(centre, mass);
+    myImage::Pointer blob = Filter(impulse, 1e9, sigma);
+
+    double total = 0.0;
+    double moments[3] = { 0.0, 0.0, 0.0 };
+    itk::ImageRegionConstIteratorWithIndex<myImage> iter(blob, blob->GetLargestPossibleRegion());
+    for (iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+      {
+      total += iter.Get();
+      for (unsigned int i = 0; i < 3; ++i)
+        {
+        const double offset = iter.GetIndex()[i] - centre[i];
+        moments[i] += offset*offset*iter.Get();
+        }
+      }
+    std::cout << "Impulse: mass " << total << ", variances " << moments[0]/total << ", "
+              << moments[1]/total << ", " << moments[2]/total << " for " << sigma*sigma << std::endl;
+    if (vcl_abs(total - mass) > 0.01*mass)
+      {
+      std::cerr << "Mass of the impulse not kept" << std::endl;
+      passed = false;
+      }
+    for (unsigned int i = 0; i < 3; ++i)
+      {
+      const double variance = moments[i]/total;
+      if (variance < 0.8*sigma*sigma || variance > 1.2*sigma*sigma)
+        {
+        std::cerr << "Variance along axis " << i << " is not that of a Gaussian of the domain sigma" << std::endl;
+        passed = false;
+        }
+      }
+    myImage::IndexType index = centre;
+    for (unsigned int x = size/2 + 1; x < size; ++x)
+      {
+      index[0] = x;
+      myImage::IndexType previous = index;
+      previous[0] = x - 1;
+      if (blob->GetPixel(index) > blob->GetPixel(previous))
+        {
+        std::cerr << "Profile of the impulse increases at " << x << std::endl;
+        passed = false;
+        break;
+        }
+      }
+    }
+  catch (itk::ExceptionObject& e)
+    {
+    std::cerr << "Exception detected: "  << e.GetDescription();
+    return EXIT_FAILURE;
+    }
+
+  if(ac >= 5)
+    {
+    float range = atof(av[2]);
+    float domain = atof(av[3]);
+
+    itk::ImageFileReader<myImage>::Pointer input
+      = itk::ImageFileReader<myImage>::New();
+    input->SetFileName(av[1]);
+
+    // Create a filter
+    FilterType::Pointer filter1 = FilterType::New();
+      filter1->SetInput(input->GetOutput());
+      filter1->SetRangeSigma(range);
+      filter1->SetDomainSigma(domain);
+    if(ac > 5)
+      filter1->SetNumberOfIterations(atoi(av[5]));
+    try
+      {
+      input->Update();
+      std::cout << "Using range and domain sigma as: " << range << ", " << domain << std::endl;
+      myImage::RegionType region = input->GetOutput()->GetLargestPossibleRegion();
+      std::cout << "Size of image read: " << region.GetSize()[0] << ", " << region.GetSize()[1] << ", " << region.GetSize()[2] << std::endl;
+
+      std::cout << "Applying " << filter1->GetNumberOfIterations() << " iterations ..." << std::endl;
+      filter1->Update();
+      }
+    catch (itk::ExceptionObject& e)
+      {
+      std::cerr << "Exception detected: "  << e.GetDescription();
+      return -1;
+      }
+
+    // Generate test image
+    itk::ImageFileWriter<myImage>::Pointer writer;
+      writer = itk::ImageFileWriter<myImage>::New();
+      writer->SetInput( filter1->GetOutput() );
+      writer->SetFileName( av[4] );
+      writer->Update();
+    }
+  std::cout << "Complete" << std::endl;
+
+  if(!passed)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
@@ -2,66 +2,330 @@
 #pragma warning ( disable : 4786 )
 #endif
 #include <fstream>
+#include <algorithm>
+#include <vector>
 #include "itkFastBilateralImageFilter.h"
 #include "itkImageFileReader.h"
 #include "itkImageFileWriter.h"
 #include "itkPNGImageIO.h"
 #include "itkPNGImageIOFactory.h"
 #include "itkImageRegionIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
 
+typedef float PixelType;
+typedef itk::Image<PixelType, 3> myImage;
+typedef itk::FastBilateralImageFilter<myImage,myImage> FilterType;
+
+/** Cube of the size with a step of the given height along the first axis
+ *  at its middle, on a level, plus normal noise of the given deviation. */
+myImage::Pointer CreateStepImage(unsigned int size, double level, double step, double noise)
+{
+  myImage::SizeType imageSize;
+  imageSize.Fill(size);
+  myImage::RegionType region(imageSize);
+
+  myImage::Pointer image = myImage::New();
+  image->SetRegions(region);
+  image->Allocate();
+
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->Initialize(76);
+
+  itk::ImageRegionIteratorWithIndex<myImage> iter(image, region);
+  for (iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    const bool upper = iter.GetIndex()[0] >= static_cast<long>(size/2);
+    double value = upper ? level + step : level;
+    if (noise > 0.0)
+      value += noise*generator->GetNormalVariate();
+    iter.Set(static_cast<PixelType>(value));
+    }
+
+  return image;
+}
+
+/** Copy of an image with its region moved to start at the index */
+myImage::Pointer Move(myImage *image, const myImage::IndexType &index)
+{
+  const myImage::RegionType region = image->GetLargestPossibleRegion();
+  myImage::Pointer moved = myImage::New();
+  moved->SetRegions(myImage::RegionType(index, region.GetSize()));
+  moved->Allocate();
+  std::copy(image->GetBufferPointer(),
+            image->GetBufferPointer() + region.GetNumberOfPixels(),
+            moved->GetBufferPointer());
+  return moved;
+}
+
+/** Filters the input with the grid mode forced, over the requested region
+ *  when one is given and over the whole image otherwise. A number of
+ *  threads of 0 keeps the default, and the range is taken from the edge
+ *  image when one is given. */
+myImage::Pointer Filter(myImage *input, double range, double domain,
+                        FilterType::GridModeType mode,
+                        const myImage::RegionType *requested = 0,
+                        unsigned int threads = 0, myImage *edge = 0)
+{
+  FilterType::Pointer filter = FilterType::New();
+  filter->SetInput(input);
+  filter->SetRangeSigma(range);
+  filter->SetDomainSigma(domain);
+  filter->SetGridMode(mode);
+  if (edge)
+    filter->SetEdgeImage(edge);
+  if (threads > 0)
+    filter->SetNumberOfThreads(threads);
+  if (requested)
+    filter->GetOutput()->SetRequestedRegion(*requested);
+  filter->Update();
+  return filter->GetOutput();
+}
+
+/** Maximum absolute and root mean square difference of two images over
+ *  a region */
+void Difference(myImage *a, myImage *b, const myImage::RegionType &region,
+                double &maxAbs, double &rms)
+{
+  itk::ImageRegionConstIterator<myImage> iterA(a, region);
+  itk::ImageRegionConstIterator<myImage> iterB(b, region);
+  double squares = 0.0;
+  maxAbs = 0.0;
+  for (; !iterA.IsAtEnd(); ++iterA, ++iterB)
+    {
+    const double difference = static_cast<double>(iterA.Get()) - iterB.Get();
+    squares += difference*difference;
+    maxAbs = std::max(maxAbs, vcl_abs(difference));
+    }
+  rms = vcl_sqrt(squares/region.GetNumberOfPixels());
+}
 
 /**
  * This test was originally taken from the tests for the itkBilateralImageFilter
  * and modified for the itkFastBilateralImageFilter. Modified by Shakes Chandra for parameters.
  * Note that I found that Crash on Windows if O2 optimization is enabled
+ *
+ * Without arguments, only the checks on a synthetic noisy step are run:
+ * the streamed grid must give the dense grid's output, over the whole image
+ * and over a cropped requested region, an image starting at a negative
+ * index must be filtered as at index 0, the dense grid must give the same
+ * output with one thread as with several, and the sparse grid that of the
+ * dense one. Differences of 1e-5 of the intensity range are allowed for
+ * the order of the float sums. The range must follow the edge image: the
+ * input itself as edge image gives the plain output, and a flat one blurs
+ * a step the plain filter keeps. Inputs filtered together must come out as
+ * when filtered one by one.
  */
 int main(int ac, char* av[] )
 {
-  if(ac < 5)
+  if(ac != 1 && ac < 5)
     {
-    std::cerr << "Usage: " << av[0] << " InputImage sigmaRange sigmaDomain OutputImage\n";
+    std::cerr << "Usage: " << av[0] << " [InputImage sigmaRange sigmaDomain OutputImage [EdgeImage]]\n";
     return -1;
     }
 
-  float range = atof(av[2]);
-  float domain = atof(av[3]);
-
-  typedef float PixelType;
-  typedef itk::Image<PixelType, 3> myImage;
-  itk::ImageFileReader<myImage>::Pointer input 
-    = itk::ImageFileReader<myImage>::New();
-  input->SetFileName(av[1]);
-  
-  // Create a filter
-  typedef itk::FastBilateralImageFilter<myImage,myImage> FilterType;
-
-  FilterType::Pointer filter1 = FilterType::New();
-    filter1->SetInput(input->GetOutput());
-    filter1->SetRangeSigma(range);
-    filter1->SetDomainSigma(domain);
+  bool passed = true;
   try
     {
-    input->Update();
-    std::cout << "Using range and domain sigma as: " << range << ", " << domain << std::endl;
-    myImage::RegionType region = input->GetOutput()->GetLargestPossibleRegion();
-    std::cout << "Size of image read: " << region.GetSize()[0] << ", " << region.GetSize()[1] << ", " << region.GetSize()[2] << std::endl;
+    const double range = 20.0, domain = 2.0;
+    const double tolerance = 1e-5*300.0;
+    myImage::Pointer noisy = CreateStepImage(24, 100.0, 200.0, 10.0);
+    const myImage::RegionType whole = noisy->GetLargestPossibleRegion();
+    double maxAbs = 0.0, rms = 0.0;
+
+    // The streamed grid is swept plane by plane along the last axis and
+    // blurred in the same order as the dense one
+    myImage::Pointer dense = Filter(noisy, range, domain, FilterType::DenseGrid);
+    myImage::Pointer streamed = Filter(noisy, range, domain, FilterType::StreamingGrid);
+    Difference(streamed, dense, whole, maxAbs, rms);
+    std::cout << "Streamed: max difference " << maxAbs << ", rms " << rms << std::endl;
+    if (maxAbs > tolerance)
+      {
+      std::cerr << "Streamed grid differs from the dense grid" << std::endl;
+      passed = false;
+      }
+
+    // A cropped requested region only sweeps the planes it needs, and the
+    // cells stay aligned with those of the whole image
+    myImage::IndexType cropIndex;
+    cropIndex[0] = 5; cropIndex[1] = 3; cropIndex[2] = 7;
+    myImage::SizeType cropSize;
+    cropSize[0] = 12; cropSize[1] = 14; cropSize[2] = 10;
+    const myImage::RegionType crop(cropIndex, cropSize);
+    myImage::Pointer denseCrop = Filter(noisy, range, domain, FilterType::DenseGrid, &crop);
+    myImage::Pointer streamedCrop = Filter(noisy, range, domain, FilterType::StreamingGrid, &crop);
+    Difference(streamedCrop, dense, crop, maxAbs, rms);
+    double denseMaxAbs = 0.0, denseRms = 0.0;
+    Difference(denseCrop, dense, crop, denseMaxAbs, denseRms);
+    std::cout << "Cropped: max difference streamed " << maxAbs << ", dense " << denseMaxAbs << std::endl;
+    if (maxAbs > tolerance || denseMaxAbs > tolerance)
+      {
+      std::cerr << "Cropped requested region differs from the whole image" << std::endl;
+      passed = false;
+      }
+
+    // Cells are aligned on multiples of the sigmas from index 0, so an image
+    // moved by whole cells towards negative indices keeps its output
+    myImage::IndexType negative;
+    negative[0] = -4; negative[1] = -6; negative[2] = -2;
+    myImage::IndexType zero;
+    zero.Fill(0);
+    for (int mode = FilterType::DenseGrid; mode <= FilterType::StreamingGrid; ++mode)
+      {
+      myImage::Pointer moved = Filter(Move(noisy, negative), range, domain,
+                                      static_cast<FilterType::GridModeType>(mode));
+      Difference(Move(moved, zero), dense, whole, maxAbs, rms);
+      std::cout << "Negative index, grid mode " << mode << ": max difference " << maxAbs << std::endl;
+      if (maxAbs > tolerance)
+        {
+        std::cerr << "Image at a negative index filtered differently" << std::endl;
+        passed = false;
+        }
+      }
+
+    // Each thread splats a slab of planes into a private grid and the planes
+    // shared by neighbouring slabs are summed in the reduction. The slice is
+    // split between the threads too.
+    myImage::Pointer single = Filter(noisy, range, domain, FilterType::DenseGrid, 0, 1);
+    const unsigned int threadCounts[] = { 2, 3, 8 };
+    for (unsigned int t = 0; t < 3; ++t)
+      {
+      myImage::Pointer threaded =
+        Filter(noisy, range, domain, FilterType::DenseGrid, 0, threadCounts[t]);
+      Difference(threaded, single, whole, maxAbs, rms);
+      std::cout << "Threads " << threadCounts[t] << ": max difference " << maxAbs << std::endl;
+      if (maxAbs > tolerance)
+        {
+        std::cerr << threadCounts[t] << " threads differ from one thread" << std::endl;
+        passed = false;
+        }
+      }
+
+    // The sparse grid only stores the bricks holding splatted cells, and
+    // the blur and slice treat missing bricks as empty
+    myImage::Pointer sparse = Filter(noisy, range, domain, FilterType::SparseGrid);
+    Difference(sparse, dense, whole, maxAbs, rms);
+    std::cout << "Sparse: max difference " << maxAbs << ", rms " << rms << std::endl;
+    if (maxAbs > tolerance)
+      {
+      std::cerr << "Sparse grid differs from the dense grid" << std::endl;
+      passed = false;
+      }
+
+    // The input as its own edge image is binned as without one
+    myImage::Pointer cross = Filter(noisy, range, domain, FilterType::DenseGrid, 0, 0, noisy);
+    Difference(cross, dense, whole, maxAbs, rms);
+    std::cout << "Input as edge image: max difference " << maxAbs << std::endl;
+    if (maxAbs > tolerance)
+      {
+      std::cerr << "Input as edge image differs from the plain filter" << std::endl;
+      passed = false;
+      }
+
+    // A flat edge image puts every pixel in the same range bin, so a step
+    // of 10 range sigmas is blurred as by a Gaussian
+    myImage::Pointer step = CreateStepImage(24, 100.0, 200.0, 0.0);
+    myImage::Pointer flat = CreateStepImage(24, 100.0, 0.0, 0.0);
+    myImage::Pointer kept = Filter(step, range, domain, FilterType::DenseGrid);
+    myImage::Pointer blurred = Filter(step, range, domain, FilterType::DenseGrid, 0, 0, flat);
+    myImage::IndexType below, above;
+    below.Fill(12);
+    below[0] = 11;
+    above.Fill(12);
+    const double keptJump = kept->GetPixel(above) - kept->GetPixel(below);
+    const double blurredJump = blurred->GetPixel(above) - blurred->GetPixel(below);
+    std::cout << "Flat edge image: step " << blurredJump << " (plain " << keptJump << ")" << std::endl;
+    if (keptJump < 0.9*200.0 || blurredJump > 0.5*200.0)
+      {
+      std::cerr << "Range not taken from the edge image" << std::endl;
+      passed = false;
+      }
 
-    std::cout << "Applying ..." << std::endl;
-    filter1->Update();
+    // Every input of a batch has its own range axis and grid, and only the
+    // spatial binning is shared
+    const double levels[] = { 100.0, 50.0, 1000.0 };
+    const double steps[] = { 200.0, -40.0, 500.0 };
+    const double noises[] = { 10.0, 5.0, 30.0 };
+    std::vector<myImage::Pointer> inputs;
+    FilterType::Pointer batch = FilterType::New();
+    batch->SetRangeSigma(range);
+    batch->SetDomainSigma(domain);
+    batch->SetGridMode(FilterType::DenseGrid);
+    for (unsigned int c = 0; c < 3; ++c)
+      {
+      inputs.push_back(CreateStepImage(24, levels[c], steps[c], noises[c]));
+      batch->AddInput(inputs[c]);
+      }
+    batch->Update();
+    for (unsigned int c = 0; c < 3; ++c)
+      {
+      myImage::Pointer single = Filter(inputs[c], range, domain, FilterType::DenseGrid);
+      Difference(batch->GetOutput(c), single, whole, maxAbs, rms);
+      std::cout << "Batched input " << c << ": max difference " << maxAbs << std::endl;
+      const double intensities = vcl_abs(steps[c]) + 6.0*noises[c];
+      if (maxAbs > 1e-5*intensities)
+        {
+        std::cerr << "Batched input " << c << " differs from a separate pass" << std::endl;
+        passed = false;
+        }
+      }
     }
   catch (itk::ExceptionObject& e)
     {
     std::cerr << "Exception detected: "  << e.GetDescription();
-    return -1;
+    return EXIT_FAILURE;
     }
 
-  // Generate test image
-  itk::ImageFileWriter<myImage>::Pointer writer;
-    writer = itk::ImageFileWriter<myImage>::New();
-    writer->SetInput( filter1->GetOutput() );
-    writer->SetFileName( av[4] );
-    writer->Update();
+  if(ac >= 5)
+    {
+    float range = atof(av[2]);
+    float domain = atof(av[3]);
+
+    itk::ImageFileReader<myImage>::Pointer input
+      = itk::ImageFileReader<myImage>::New();
+    input->SetFileName(av[1]);
+
+    // Create a filter
+    FilterType::Pointer filter1 = FilterType::New();
+      filter1->SetInput(input->GetOutput());
+      filter1->SetRangeSigma(range);
+      filter1->SetDomainSigma(domain);
+    itk::ImageFileReader<myImage>::Pointer edge;
+    if(ac > 5)
+      {
+      // Cross bilateral filter, range taken from the edge image
+      edge = itk::ImageFileReader<myImage>::New();
+      edge->SetFileName(av[5]);
+      filter1->SetEdgeImage(edge->GetOutput());
+      }
+    try
+      {
+      input->Update();
+      std::cout << "Using range and domain sigma as: " << range << ", " << domain << std::endl;
+      myImage::RegionType region = input->GetOutput()->GetLargestPossibleRegion();
+      std::cout << "Size of image read: " << region.GetSize()[0] << ", " << region.GetSize()[1] << ", " << region.GetSize()[2] << std::endl;
+
+      std::cout << "Applying ..." << std::endl;
+      filter1->Update();
+      }
+    catch (itk::ExceptionObject& e)
+      {
+      std::cerr << "Exception detected: "  << e.GetDescription();
+      return -1;
+      }
+
+    // Generate test image
+    itk::ImageFileWriter<myImage>::Pointer writer;
+      writer = itk::ImageFileWriter<myImage>::New();
+      writer->SetInput( filter1->GetOutput() );
+      writer->SetFileName( av[4] );
+      writer->Update();
+    }
   std::cout << "Complete" << std::endl;
 
+  if(!passed)
+    return EXIT_FAILURE;
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,194 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include "itkFastMath.h"
+#include "itkTimeProbe.h"
+
+/**
+ * Accuracy and throughput of the FastMath array functions on every
+ * instruction set the processor supports. The errors are measured in ulp
+ * against double precision libm and checked against the documented bounds,
+ * the times are compared with the scalar float libm loop. The 16 bit
+ * conversions are checked exhaustively for round trips and ties.
+ */
+
+/** Error of value in ulp of the float nearest to reference */
+double UlpError(float value, double reference)
+{
+  if(reference == 0.0 || std::fabs(reference) > std::numeric_limits<float>::max())
+    return (value == static_cast<float>(reference)) ? 0.0 : 1e9;
+  // A float in [2^(e-1), 2^e) has an ulp of 2^(e-24)
+  int exponent;
+  std::frexp(static_cast<float>(reference), &exponent);
+  return std::fabs(value - reference)/std::ldexp(1.0, exponent - 24);
+}
+
+/** Time of repetitions of a function over samples */
+template <class TFunction>
+double Time(TFunction function, const std::vector<float> &x, std::vector<float> &y, unsigned int repetitions)
+{
+  itk::TimeProbe probe;
+  probe.Start();
+  for(unsigned int k = 0; k < repetitions; k ++)
+    function(&x[0], &y[0], x.size());
+  probe.Stop();
+  return probe.GetTotal();
+}
+
+void LibmExp(const float *x, float *y, itk::SizeValueType n)
+{
+  for(itk::SizeValueType i = 0; i < n; i ++)
+    y[i] = std::exp(x[i]);
+}
+
+void LibmLog(const float *x, float *y, itk::SizeValueType n)
+{
+  for(itk::SizeValueType i = 0; i < n; i ++)
+    y[i] = std::log(x[i]);
+}
+
+void LibmPow(const float *x, float *y, itk::SizeValueType n)
+{
+  for(itk::SizeValueType i = 0; i < n; i ++)
+    y[i] = std::pow(x[i], 0.8f);
+}
+
+/** Number of 16 bit floats that do not survive a round trip through float,
+ *  or whose tie with the next one does not round to the even one. Values
+ *  of exponent field maximum and below are finite, NaNs only stay NaN. */
+template <class TDecode, class TEncode>
+itk::SizeValueType ConversionErrors(TDecode decode, TEncode encode, itk::uint16_t maximum, int mantissaBits)
+{
+  const itk::SizeValueType count = 65536;
+  std::vector<itk::uint16_t> bits(count), converted(count), ties(count);
+  std::vector<float> values(count), midpoints(count, 0.0f);
+  for(itk::SizeValueType i = 0; i < count; i ++)
+    bits[i] = static_cast<itk::uint16_t>(i);
+  decode(&bits[0], &values[0], count);
+  encode(&values[0], &converted[0], count);
+  for(itk::SizeValueType i = 0; i < count; i ++)
+    if((i & 0x7fff) < maximum)
+      midpoints[i] = static_cast<float>(0.5*(static_cast<double>(values[i]) + values[i + 1]));
+  encode(&midpoints[0], &ties[0], count);
+
+  const itk::uint16_t infinity = static_cast<itk::uint16_t>(maximum + 1);
+  const itk::uint16_t mantissa = static_cast<itk::uint16_t>((1 << mantissaBits) - 1);
+  itk::SizeValueType errors = 0;
+  for(itk::SizeValueType i = 0; i < count; i ++)
+    {
+    const bool nan = (i & 0x7fff) > infinity;
+    if(nan ? ((converted[i] & 0x7fff) <= infinity || (converted[i] & mantissa) == 0) : converted[i] != i)
+      errors ++;
+    if((i & 0x7fff) < maximum && ties[i] != ((i % 2 == 0) ? i : i + 1))
+      errors ++;
+    }
+  return errors;
+}
+
+void FastExp(const float *x, float *y, itk::SizeValueType n)
+{
+  itk::FastMath::Exp(x, y, n);
+}
+
+void FastLog(const float *x, float *y, itk::SizeValueType n)
+{
+  itk::FastMath::Log(x, y, n);
+}
+
+void FastPow(const float *x, float *y, itk::SizeValueType n)
+{
+  itk::FastMath::Pow(x, 0.8f, y, n);
+}
+
+int main(int ac, char* av[] )
+{
+  itk::SizeValueType samples = 1 << 22;
+  if(ac > 1)
+    samples = atoi(av[1]);
+  const unsigned int repetitions = 10;
+
+  // Exp over its whole finite range, Log over all binades, Pow over the detail range of MSDE
+  std::vector<float> expSamples(samples), logSamples(samples), powSamples(samples), results(samples);
+  for(itk::SizeValueType i = 0; i < samples; i ++)
+    {
+    expSamples[i] = -87.3f + 176.0f*(i/static_cast<float>(samples));
+    logSamples[i] = std::ldexp(1.0f + (i%1000)/1000.0f, static_cast<int>(i%250) - 125);
+    powSamples[i] = (i%100000)/1000.0f;
+    }
+
+  bool passed = true;
+  const itk::FastMath::InstructionSetType supported = itk::FastMath::GetSupportedInstructionSet();
+  for(int set = itk::FastMath::DefaultInstructionSet; set <= supported; set ++)
+    {
+    itk::FastMath::SetInstructionSet(static_cast<itk::FastMath::InstructionSetType>(set));
+
+    double expError = 0.0, logError = 0.0, powError = 0.0;
+    itk::FastMath::Exp(&expSamples[0], &results[0], samples);
+    for(itk::SizeValueType i = 0; i < samples; i ++)
+      expError = std::max(expError, UlpError(results[i], std::exp(static_cast<double>(expSamples[i]))));
+    itk::FastMath::Log(&logSamples[0], &results[0], samples);
+    for(itk::SizeValueType i = 0; i < samples; i ++)
+      logError = std::max(logError, UlpError(results[i], std::log(static_cast<double>(logSamples[i]))));
+    // Pow relative to its bound 2 + 2|p log(x)|
+    itk::FastMath::Pow(&powSamples[0], 0.8f, &results[0], samples);
+    for(itk::SizeValueType i = 0; i < samples; i ++)
+      {
+      const double x = powSamples[i];
+      const double bound = (x > 0.0) ? 2.0 + 2.0*std::fabs(0.8*std::log(x)) : 1.0;
+      powError = std::max(powError, UlpError(results[i], std::pow(x, 0.8))/bound);
+      }
+
+    const double expTime = Time(FastExp, expSamples, results, repetitions);
+    const double expLibm = Time(LibmExp, expSamples, results, repetitions);
+    const double logTime = Time(FastLog, logSamples, results, repetitions);
+    const double logLibm = Time(LibmLog, logSamples, results, repetitions);
+    const double powTime = Time(FastPow, powSamples, results, repetitions);
+    const double powLibm = Time(LibmPow, powSamples, results, repetitions);
+
+    std::cout << std::setw(8) << itk::FastMath::GetInstructionSetName(itk::FastMath::GetInstructionSet())
+              << ": exp " << expError << " ulp, " << expLibm/expTime << "x libm"
+              << "; log " << logError << " ulp, " << logLibm/logTime << "x libm"
+              << "; pow " << powError << " of bound, " << powLibm/powTime << "x libm" << std::endl;
+
+    if(expError > 2.0 || logError > 2.0 || powError > 1.0)
+      {
+      std::cerr << "Error above the documented bound" << std::endl;
+      passed = false;
+      }
+
+    const itk::SizeValueType halfErrors = ConversionErrors(itk::FastMath::HalfToFloat, itk::FastMath::FloatToHalf, 0x7bff, 10);
+    const itk::SizeValueType bfloatErrors = ConversionErrors(itk::FastMath::BFloat16ToFloat, itk::FastMath::FloatToBFloat16, 0x7f7f, 7);
+    std::cout << "          half " << halfErrors << " errors, bfloat16 " << bfloatErrors << " errors" << std::endl;
+    if(halfErrors > 0 || bfloatErrors > 0)
+      {
+      std::cerr << "16 bit conversions differ" << std::endl;
+      passed = false;
+      }
+    }
+
+  // Special values
+  const float specials[] = { 0.0f, -1.0f, 1e-40f, 100.0f, -100.0f };
+  float exps[5], logs[5];
+  itk::FastMath::Exp(specials, exps, 5);
+  itk::FastMath::Log(specials, logs, 5);
+  if(exps[0] != 1.0f || logs[0] != -std::numeric_limits<float>::infinity() || !(logs[1] != logs[1])
+     || UlpError(logs[2], std::log(static_cast<double>(specials[2]))) > 2.0 || exps[3] != std::numeric_limits<float>::infinity() || exps[4] != 0.0f)
+    {
+    std::cerr << "Special values differ" << std::endl;
+    passed = false;
+    }
+
+  std::cout << "Complete" << std::endl;
+
+  if(!passed)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
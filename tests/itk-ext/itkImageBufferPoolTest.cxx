@@ -0,0 +1,90 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+#include <iostream>
+#include <cstdlib>
+#include "itkImageBufferPool.h"
+#include "itkImage.h"
+
+/**
+ * Leases and returns of an image buffer pool: returned buffers of the same
+ * region are recycled in the space of the reference, buffers still referred
+ * to elsewhere or of another region are not.
+ */
+int main(int ac, char* av[] )
+{
+  typedef itk::Image<float, 3> myImage;
+  typedef itk::ImageBufferPool<myImage> PoolType;
+
+  myImage::SizeType size;
+    size[0] = 64;
+    size[1] = 48;
+    size[2] = 32;
+  myImage::RegionType region(size);
+  myImage::SpacingType spacing;
+    spacing[0] = 0.5;
+    spacing[1] = 1.0;
+    spacing[2] = 2.0;
+
+  myImage::Pointer reference = myImage::New();
+    reference->SetRegions(region);
+    reference->SetSpacing(spacing);
+
+  bool passed = true;
+  PoolType::Pointer pool = PoolType::New();
+
+  // A returned buffer is leased again in the space of the new reference
+  myImage::Pointer first = pool->Lease(reference, region);
+  first->FillBuffer(1.0);
+  const float *firstBuffer = first->GetBufferPointer();
+  pool->Return(first);
+  first = NULL;
+  myImage::Pointer second = pool->Lease(reference, region);
+  if(second->GetBufferPointer() != firstBuffer || second->GetSpacing() != spacing || second->GetBufferedRegion() != region)
+    {
+    std::cerr << "Returned buffer not recycled" << std::endl;
+    passed = false;
+    }
+
+  // A buffer still held outside the pool is left alone
+  pool->Return(second);
+  myImage::Pointer third = pool->Lease(reference, region);
+  if(third->GetBufferPointer() == second->GetBufferPointer())
+    {
+    std::cerr << "Buffer in use was recycled" << std::endl;
+    passed = false;
+    }
+
+  // Buffers of another region are not recycled
+  myImage::SizeType halfSize = size;
+    halfSize[2] = size[2]/2;
+  myImage::RegionType halfRegion(halfSize);
+  pool->Return(third);
+  third = NULL;
+  myImage::Pointer half = pool->Lease(reference, halfRegion);
+  if(half->GetBufferedRegion() != halfRegion || half->GetPixelContainer()->Size() != halfRegion.GetNumberOfPixels())
+    {
+    std::cerr << "Buffer of another region leased" << std::endl;
+    passed = false;
+    }
+
+  pool->Print(std::cout);
+  if(pool->GetNumberOfAllocations() != 3 || pool->GetNumberOfReuses() != 1 || pool->GetNumberOfBuffers() != 2)
+    {
+    std::cerr << "Unexpected number of allocations" << std::endl;
+    passed = false;
+    }
+
+  pool->Clear();
+  if(pool->GetNumberOfBuffers() != 0)
+    {
+    std::cerr << "Buffers left after clearing" << std::endl;
+    passed = false;
+    }
+  std::cout << "Complete" << std::endl;
+
+  if(!passed)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
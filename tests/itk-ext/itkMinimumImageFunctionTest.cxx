@@ -2,29 +2,161 @@
 #pragma warning ( disable : 4786 )
 #endif
 #include <fstream>
+#include <algorithm>
 #include "itkMinimumImageFunction.h"
+#include "itkFixedRadiusMinimumImageFunction.h"
 #include "itkImageFileReader.h"
 #include "itkImageRegionIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
 
+typedef float PixelType;
+typedef itk::Image<PixelType, 3> myImage;
+
+/** Minimum over the box of the radius around the index, clipped to the
+ *  buffered region as the zero flux Neumann boundary condition implies. */
+PixelType BruteForceMinimum(const myImage *image, const myImage::IndexType &index, int radius)
+{
+  const myImage::RegionType region = image->GetBufferedRegion();
+  myImage::IndexType first, last;
+  for(unsigned int i = 0; i < 3; ++i)
+    {
+    first[i] = std::max<itk::IndexValueType>(index[i] - radius, region.GetIndex()[i]);
+    last[i] = std::min<itk::IndexValueType>(index[i] + radius, region.GetIndex()[i] + region.GetSize()[i] - 1);
+    }
+
+  PixelType minimum = image->GetPixel(index);
+  myImage::IndexType neighbour;
+  for(neighbour[2] = first[2]; neighbour[2] <= last[2]; ++neighbour[2])
+    for(neighbour[1] = first[1]; neighbour[1] <= last[1]; ++neighbour[1])
+      for(neighbour[0] = first[0]; neighbour[0] <= last[0]; ++neighbour[0])
+        minimum = std::min(minimum, image->GetPixel(neighbour));
+  return minimum;
+}
+
+/** Count the pixels of region where the function differs from the brute
+ *  force minimum, evaluated at each index and over the region at once. */
+template <class TFunction>
+size_t CountMismatches(TFunction *function, const myImage *image, const myImage::RegionType &region, int radius)
+{
+  myImage::Pointer minima = myImage::New();
+    minima->CopyInformation(image);
+    minima->SetRegions(region);
+    minima->Allocate();
+  function->SetInputImage(image);
+  function->EvaluateOverRegion(region, minima);
+
+  size_t mismatches = 0;
+  itk::ImageRegionConstIteratorWithIndex<myImage> iter(minima, region);
+  for(iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    const PixelType expected = BruteForceMinimum(image, iter.GetIndex(), radius);
+    if(iter.Get() != expected || static_cast<PixelType>(function->EvaluateAtIndex(iter.GetIndex())) != expected)
+      mismatches ++;
+    }
+  return mismatches;
+}
+
+/** Compare every variant of the minimum against the brute force minimum on
+ *  a small random image, where most pixels lie near a face, edge or corner,
+ *  over the whole image and over a region sharing a corner with it. */
+size_t CompareToBruteForce()
+{
+  myImage::SizeType size;
+  size[0] = 9;
+  size[1] = 7;
+  size[2] = 5;
+  myImage::IndexType start;
+  start[0] = -2;
+  start[1] = 0;
+  start[2] = 3;
+  myImage::RegionType region(start, size);
+
+  myImage::Pointer image = myImage::New();
+  image->SetRegions(region);
+  image->Allocate();
+
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->Initialize(76);
+  itk::ImageRegionIteratorWithIndex<myImage> iter(image, region);
+  for(iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    iter.Set(static_cast<PixelType>(generator->GetIntegerVariate(1000)));
+
+  myImage::SizeType cornerSize;
+  cornerSize[0] = 4;
+  cornerSize[1] = 3;
+  cornerSize[2] = 2;
+  myImage::IndexType cornerStart;
+  for(unsigned int i = 0; i < 3; ++i)
+    cornerStart[i] = start[i] + size[i] - cornerSize[i];
+  const myImage::RegionType corner(cornerStart, cornerSize);
+
+  size_t mismatches = 0;
+  typedef itk::MinimumImageFunction<myImage> FunctionType;
+  for(int radius = 1; radius <= 3; ++radius)
+    {
+    FunctionType::Pointer function = FunctionType::New();
+      function->SetNeighborhoodRadius(radius);
+    const size_t whole = CountMismatches(function.GetPointer(), image, region, radius);
+    const size_t partial = CountMismatches(function.GetPointer(), image, corner, radius);
+    std::cout << "Radius " << radius << ": " << whole << " and " << partial << " voxels differing from the brute force minimum" << std::endl;
+    mismatches += whole + partial;
+    }
+
+  typedef itk::FixedRadiusMinimumImageFunction<myImage, 1> FixedFunctionType;
+  FixedFunctionType::Pointer fixedFunction = FixedFunctionType::New();
+  const size_t fixedWhole = CountMismatches(fixedFunction.GetPointer(), image, region, 1);
+  const size_t fixedPartial = CountMismatches(fixedFunction.GetPointer(), image, corner, 1);
+  std::cout << "Fixed radius 1: " << fixedWhole << " and " << fixedPartial << " voxels differing from the brute force minimum" << std::endl;
+  mismatches += fixedWhole + fixedPartial;
+
+  typedef itk::FixedRadiusMinimumImageFunction<myImage, 2> FixedFunction2Type;
+  FixedFunction2Type::Pointer fixedFunction2 = FixedFunction2Type::New();
+  const size_t fixed2Whole = CountMismatches(fixedFunction2.GetPointer(), image, region, 2);
+  const size_t fixed2Partial = CountMismatches(fixedFunction2.GetPointer(), image, corner, 2);
+  std::cout << "Fixed radius 2: " << fixed2Whole << " and " << fixed2Partial << " voxels differing from the brute force minimum" << std::endl;
+  mismatches += fixed2Whole + fixed2Partial;
+
+  return mismatches;
+}
 
 /**
  * This test was originally taken from the tests for the itkBilateralImageFilter
  * and modified for the itkFastBilateralImageFilter. Modified by Shakes Chandra for parameters.
  * Note that I found that Crash on Windows if O2 optimization is enabled
+ * The batch, index and fixed radius evaluations are compared to a brute
+ * force minimum, borders included. With an image given the minimum of the
+ * index provided is printed and the evaluations compared over the image.
  */
 int main(int ac, char* av[] )
 {
-  if(ac < 3)
+  if(ac != 1 && ac < 3)
     {
     std::cerr << "Print the minimum of index provided\n";
-    std::cerr << "Usage: " << av[0] << " InputImage Index\n";
+    std::cerr << "Usage: " << av[0] << " [InputImage Index]\n";
     return EXIT_FAILURE;
     }
 
+  size_t bruteForceMismatches = 0;
+  try
+    {
+    bruteForceMismatches = CompareToBruteForce();
+    }
+  catch (itk::ExceptionObject& e)
+    {
+    std::cerr << "Exception detected: "  << e.GetDescription();
+    return EXIT_FAILURE;
+    }
+  if(ac == 1)
+    {
+    std::cout << "Complete" << std::endl;
+    return (bruteForceMismatches > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
   int indexValue = atoi(av[2]);
 
-  typedef float PixelType;
-  typedef itk::Image<PixelType, 3> myImage;
   itk::ImageFileReader<myImage>::Pointer input 
     = itk::ImageFileReader<myImage>::New();
   input->SetFileName(av[1]);
@@ -51,7 +183,32 @@ int main(int ac, char* av[] )
     index.Fill(indexValue);
   std::cout << "Minimum at " << index << " is " << static_cast<PixelType>(medianImageFunction->EvaluateAtIndex(index)) << std::endl;
 
+  // Batch evaluation and compile time radius against the index evaluation
+  myImage::RegionType region = input->GetOutput()->GetLargestPossibleRegion();
+  myImage::Pointer minima = myImage::New();
+    minima->CopyInformation(input->GetOutput());
+    minima->SetRegions(region);
+    minima->Allocate();
+  medianImageFunction->EvaluateOverRegion(region, minima);
+
+  typedef itk::FixedRadiusMinimumImageFunction<myImage, 1> FixedFunctionType;
+  FixedFunctionType::Pointer fixedImageFunction = FixedFunctionType::New();
+    fixedImageFunction->SetInputImage(input->GetOutput());
+
+  size_t mismatches = 0;
+  itk::ImageRegionConstIteratorWithIndex<myImage> iter(minima, region);
+  for(iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    const PixelType value = static_cast<PixelType>(medianImageFunction->EvaluateAtIndex(iter.GetIndex()));
+    if(iter.Get() != value || static_cast<PixelType>(fixedImageFunction->EvaluateAtIndex(iter.GetIndex())) != value)
+      mismatches ++;
+    }
+  std::cout << "Voxels differing between evaluations: " << mismatches << std::endl;
+
   std::cout << "Complete" << std::endl;
 
+  if(mismatches > 0 || bruteForceMismatches > 0)
+    return EXIT_FAILURE;
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,187 @@
+#if defined(_MSC_VER)
+#pragma warning ( disable : 4786 )
+#endif
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "itkPermutohedralBilateralImageFilter.h"
+#include "itkExactBilateralImageFilter.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+
+typedef float PixelType;
+typedef itk::Image<PixelType, 3> myImage;
+typedef itk::PermutohedralBilateralImageFilter<myImage,myImage> FilterType;
+
+/** Cube of the size with a step of the given height along the first axis
+ *  at its middle, on a level, plus normal noise of the given deviation. */
+myImage::Pointer CreateStepImage(unsigned int size, double level, double step, double noise)
+{
+  myImage::SizeType imageSize;
+  imageSize.Fill(size);
+  myImage::RegionType region(imageSize);
+
+  myImage::Pointer image = myImage::New();
+  image->SetRegions(region);
+  image->Allocate();
+
+  typedef itk::Statistics::MersenneTwisterRandomVariateGenerator GeneratorType;
+  GeneratorType::Pointer generator = GeneratorType::New();
+  generator->Initialize(76);
+
+  itk::ImageRegionIteratorWithIndex<myImage> iter(image, region);
+  for (iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+    {
+    const bool upper = iter.GetIndex()[0] >= static_cast<long>(size/2);
+    double value = upper ? level + step : level;
+    if (noise > 0.0)
+      value += noise*generator->GetNormalVariate();
+    iter.Set(static_cast<PixelType>(value));
+    }
+
+  return image;
+}
+
+myImage::Pointer Filter(myImage *input, double range, double domain)
+{
+  FilterType::Pointer filter = FilterType::New();
+  filter->SetInput(input);
+  filter->SetRangeSigma(range);
+  filter->SetDomainSigma(domain);
+  filter->Update();
+  return filter->GetOutput();
+}
+
+/** Maximum absolute and root mean square difference of two images */
+void Difference(myImage *a, myImage *b, double &maxAbs, double &rms)
+{
+  const myImage::RegionType region = a->GetLargestPossibleRegion();
+  itk::ImageRegionConstIterator<myImage> iterA(a, region);
+  itk::ImageRegionConstIterator<myImage> iterB(b, region);
+  double squares = 0.0;
+  maxAbs = 0.0;
+  for (; !iterA.IsAtEnd(); ++iterA, ++iterB)
+    {
+    const double difference = static_cast<double>(iterA.Get()) - iterB.Get();
+    squares += difference*difference;
+    maxAbs = std::max(maxAbs, vcl_abs(difference));
+    }
+  rms = vcl_sqrt(squares/region.GetNumberOfPixels());
+}
+
+/**
+ * Joint bilateral filtering of co-registered images with the permutohedral
+ * lattice, in the style of the itkFastBilateralImageFilterTest.
+ * A constant image must be preserved, a step of 20 range sigmas must not be
+ * blurred across, and a noisy step must come out much closer to the
+ * ExactBilateralImageFilter than the input was. With images given, every
+ * output is written as OutputPrefix_<n>.nii.gz
+ */
+int main(int ac, char* av[] )
+{
+  if(ac != 1 && ac < 5)
+    {
+    std::cerr << "Usage: " << av[0] << " [sigmaRange sigmaDomain OutputPrefix InputImage [InputImage ...]]\n";
+    return -1;
+    }
+
+  bool passed = true;
+  try
+    {
+    double maxAbs = 0.0, rms = 0.0;
+
+    // Normalisation by the splatted weights gives back a constant
+    myImage::Pointer constant = CreateStepImage(24, 100.0, 0.0, 0.0);
+    Difference(Filter(constant, 10.0, 2.0), constant, maxAbs, rms);
+    std::cout << "Constant: max difference " << maxAbs << std::endl;
+    if (maxAbs > 1e-3*100.0)
+      {
+      std::cerr << "Constant image not preserved" << std::endl;
+      passed = false;
+      }
+
+    // Both sides of a step of 20 range sigmas stay apart
+    myImage::Pointer step = CreateStepImage(24, 100.0, 200.0, 0.0);
+    Difference(Filter(step, 10.0, 2.0), step, maxAbs, rms);
+    std::cout << "Step: max difference " << maxAbs << std::endl;
+    if (maxAbs > 0.01*200.0)
+      {
+      std::cerr << "Step edge blurred" << std::endl;
+      passed = false;
+      }
+
+    // The noise of a step of 6 range sigmas is smoothed as by the exact filter
+    typedef itk::ExactBilateralImageFilter<myImage,myImage> ExactFilterType;
+    myImage::Pointer noisy = CreateStepImage(24, 100.0, 250.0, 10.0);
+    ExactFilterType::Pointer exact = ExactFilterType::New();
+    exact->SetInput(noisy);
+    exact->SetRangeSigma(40.0);
+    exact->SetDomainSigma(2.0);
+    exact->Update();
+    double inputMaxAbs = 0.0, inputRms = 0.0;
+    Difference(noisy, exact->GetOutput(), inputMaxAbs, inputRms);
+    Difference(Filter(noisy, 40.0, 2.0), exact->GetOutput(), maxAbs, rms);
+    std::cout << "Exact: rms difference " << rms << " (input " << inputRms << "), max " << maxAbs << std::endl;
+    if (rms > 0.5*inputRms || maxAbs > 0.1*250.0)
+      {
+      std::cerr << "Too far from the exact bilateral filter" << std::endl;
+      passed = false;
+      }
+    }
+  catch (itk::ExceptionObject& e)
+    {
+    std::cerr << "Exception detected: "  << e.GetDescription();
+    return EXIT_FAILURE;
+    }
+
+  if(ac >= 5)
+    {
+    float range = atof(av[1]);
+    float domain = atof(av[2]);
+    std::string outputPrefix = av[3];
+
+    // Create a filter
+    FilterType::Pointer filter1 = FilterType::New();
+      filter1->SetRangeSigma(range);
+      filter1->SetDomainSigma(domain);
+    for (int j = 4; j < ac; ++j)
+      {
+      itk::ImageFileReader<myImage>::Pointer input
+        = itk::ImageFileReader<myImage>::New();
+      input->SetFileName(av[j]);
+      filter1->SetInput(j - 4, input->GetOutput());
+      }
+    try
+      {
+      std::cout << "Using range and domain sigma as: " << range << ", " << domain << std::endl;
+      std::cout << "Applying to " << ac - 4 << " images ..." << std::endl;
+      filter1->Update();
+      }
+    catch (itk::ExceptionObject& e)
+      {
+      std::cerr << "Exception detected: "  << e.GetDescription();
+      return -1;
+      }
+
+    // Generate test images
+    for (unsigned int c = 0; c < filter1->GetNumberOfChannels(); ++c)
+      {
+      std::ostringstream filename;
+      filename << outputPrefix << "_" << c << ".nii.gz";
+      itk::ImageFileWriter<myImage>::Pointer writer;
+        writer = itk::ImageFileWriter<myImage>::New();
+        writer->SetInput( filter1->GetOutput(c) );
+        writer->SetFileName( filename.str() );
+        writer->Update();
+      }
+    }
+  std::cout << "Complete" << std::endl;
+
+  if(!passed)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}